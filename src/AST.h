@@ -1,468 +1,708 @@
 #pragma once
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <vector>
 #include <iostream>
-#include <deque>
 #include <unordered_map>
 #include "assert.h"
 #include "utils.h"
+#include "koopa_builder.h"
+#include "ast_arena.h"
 using namespace std;
 
-extern string koopa_str;
-extern int reg_cnt;
-extern int if_cnt;
+// 并行前端的每个线程各自解析、生成一部分函数，所以除了驻留表之外的状态都是线程局部的
+extern thread_local KoopaBuilder builder;
+extern thread_local int reg_cnt;
+extern thread_local int if_cnt;
 
 // 警惕使用全局变量
-static int logical;
+inline thread_local int logical;
 // lv7 while
-static int loop_cnt;
-static int loop_dep;
-static unordered_map<int, int> find_loop;
+inline thread_local int loop_cnt;
+inline thread_local int loop_dep;
+inline thread_local unordered_map<int, int> find_loop;
 
-static bool if_end = true;
+inline thread_local bool if_end = true;
 
 // lv8 function
-static bool param_block = false;
-static vector<pair<string, int>> function_params; // 记录函数的形参，用于在函数体内部延迟加入符号表
-                                                  // lv9 update: 由于新加入了数组参数，加入一个标识，0=int;size=ptr
-// lv8 global var
-static bool is_global = true;
+inline thread_local vector<pair<int, int>> function_params; // 记录函数的形参，用于在函数体内部延迟加入符号表
+                                                            // lv9 update: 由于新加入了数组参数，加入一个标识，0=int;size=ptr
+
+// 当前编译的驻留表，同一次编译的所有线程共用
+extern thread_local Interner *interner;
+extern thread_local SymbolList symbol_list;
+extern thread_local BlockHandler block_handler;
+// 语义分析时的基本块编号，与生成 IR 时的 block_handler 分开
+// 变量按所在基本块命名，编号只在语义分析中分配一次，保存在声明节点上
+inline thread_local BlockHandler scope_handler;
+
+// 把 Koopa() 的返回值转换为指令的操作数
+// 能直接求值的表达式使用整数，否则使用保存在 %reg 中的结果
+static koopa_raw_value_t get_operand(const pair<bool, int> &res, int reg)
+{
+    if (res.first)
+    {
+        return builder.integer(res.second);
+    }
+    return builder.reg(reg);
+}
+
+static koopa_raw_binary_op_t get_binary_op(string_view op)
+{
+    if (op == "+")
+        return KOOPA_RBO_ADD;
+    if (op == "-")
+        return KOOPA_RBO_SUB;
+    if (op == "*")
+        return KOOPA_RBO_MUL;
+    if (op == "/")
+        return KOOPA_RBO_DIV;
+    if (op == "%")
+        return KOOPA_RBO_MOD;
+    if (op == "<")
+        return KOOPA_RBO_LT;
+    if (op == ">")
+        return KOOPA_RBO_GT;
+    if (op == "<=")
+        return KOOPA_RBO_LE;
+    if (op == ">=")
+        return KOOPA_RBO_GE;
+    if (op == "==")
+        return KOOPA_RBO_EQ;
+    return KOOPA_RBO_NOT_EQ;
+}
+
+// 数组的初始值，只记录值不是常量 0 的元素：展开成一维后的下标和值，按下标递增
+using ArrayInit = vector<pair<int, koopa_raw_value_t>>;
 
-extern SymbolList symbol_list;
-extern BlockHandler block_handler;
+// 需要清零的元素不超过这个数时逐个 store，否则先用循环清零
+static constexpr int ZERO_FILL_MIN = 16;
+// 清零循环每次迭代清零的元素个数
+static constexpr int ZERO_FILL_UNROLL = 8;
 
-static void initArray(std::string name_, std::string *ptr, const std::vector<int> &len)
+// 全局数组的初始值，全为 0 时用 zeroinit
+static koopa_raw_value_t arrayInitializer(koopa_raw_type_t ty, const vector<int> &len, int tot_len, const ArrayInit &init)
 {
-    int n = len[0];
-    if (len.size() == 1)
+    if (init.empty())
     {
-        for (int i = 0; i < n; ++i)
-        {
-            string tmp = "%" + to_string(reg_cnt);
-            reg_cnt++;
-            koopa_str += "  " + tmp + " = getelemptr " + name_ + ", " + to_string(i) + "\n";
-            koopa_str += "  store " + ptr[i] + ", " + tmp + "\n";
-        }
+        return builder.zero_init(ty);
     }
-    else
+    vector<koopa_raw_value_t> flat(tot_len, builder.integer(0));
+    for (auto &elem : init)
     {
-        vector<int> sublen(len.begin() + 1, len.end());
-        int width = 1;
-        for (auto l : sublen)
-            width *= l;
-        for (int i = 0; i < n; ++i)
-        {
-            string tmp = "%" + to_string(reg_cnt);
-            reg_cnt++;
-            koopa_str += "  " + tmp + " = getelemptr " + name_ + ", " + to_string(i) + "\n";
-            initArray(tmp, ptr + i * width, sublen);
-        }
+        flat[elem.first] = elem.second;
+    }
+    return builder.aggregate(flat.data(), len);
+}
+
+// 逐个元素 store，沿各维 getelemptr
+static void storeArray(koopa_raw_value_t array, const koopa_raw_value_t *ptr, const vector<int> &len, size_t dim)
+{
+    int width = 1;
+    for (size_t d = dim + 1; d < len.size(); ++d)
+        width *= len[d];
+    for (int i = 0; i < len[dim]; ++i)
+    {
+        koopa_raw_value_t tmp = builder.get_elem_ptr(array, builder.integer(i));
+        reg_cnt++;
+        if (dim + 1 == len.size())
+            builder.store(ptr[i], tmp);
+        else
+            storeArray(tmp, ptr + i * width, len, dim + 1);
+    }
+}
+
+// 把 base 开始的 tot_len 个 i32 清零，循环体展开 ZERO_FILL_UNROLL 次，剩余的元素逐个 store
+// name 是数组的名字，用来生成计数器和基本块的名字
+static void zeroFill(koopa_raw_value_t base, int tot_len, const string &name)
+{
+    int loop_len = tot_len / ZERO_FILL_UNROLL * ZERO_FILL_UNROLL;
+    string cond_tag = "%" + name.substr(1) + "_zero_cond";
+    string body_tag = "%" + name.substr(1) + "_zero_body";
+    string end_tag = "%" + name.substr(1) + "_zero_end";
+
+    koopa_raw_value_t counter = builder.alloc(name + "_zi", builder.int_type());
+    builder.store(builder.integer(0), counter);
+    builder.jump(builder.block(cond_tag));
+
+    builder.set_block(builder.block(cond_tag));
+    koopa_raw_value_t i = builder.load(counter);
+    reg_cnt++;
+    koopa_raw_value_t cond = builder.binary(KOOPA_RBO_LT, i, builder.integer(loop_len));
+    reg_cnt++;
+    builder.branch(cond, builder.block(body_tag), builder.block(end_tag));
+
+    builder.set_block(builder.block(body_tag));
+    i = builder.load(counter);
+    reg_cnt++;
+    koopa_raw_value_t ptr = builder.get_ptr(base, i);
+    reg_cnt++;
+    builder.store(builder.integer(0), ptr);
+    for (int k = 1; k < ZERO_FILL_UNROLL; ++k)
+    {
+        koopa_raw_value_t tmp = builder.get_ptr(ptr, builder.integer(k));
+        reg_cnt++;
+        builder.store(builder.integer(0), tmp);
+    }
+    koopa_raw_value_t next = builder.binary(KOOPA_RBO_ADD, i, builder.integer(ZERO_FILL_UNROLL));
+    reg_cnt++;
+    builder.store(next, counter);
+    builder.jump(builder.block(cond_tag));
+
+    builder.set_block(builder.block(end_tag));
+    for (int k = loop_len; k < tot_len; ++k)
+    {
+        koopa_raw_value_t tmp = builder.get_ptr(base, builder.integer(k));
+        reg_cnt++;
+        builder.store(builder.integer(0), tmp);
     }
 }
 
-static string getInitList(std::string *ptr, const std::vector<int> &len)
+// 局部数组的初始化
+// 需要清零的元素很少时逐个元素 store，否则先整体清零，再只 store 非零的元素
+static void initArray(koopa_raw_value_t array, const string &name, const vector<int> &len, int tot_len, const ArrayInit &init)
 {
-    std::string ret = "{";
-    if (len.size() == 1)
+    if (tot_len - (int)init.size() <= ZERO_FILL_MIN)
     {
-        int n = len[0];
-        ret += ptr[0];
-        for (int i = 1; i < n; ++i)
+        vector<koopa_raw_value_t> flat(tot_len, builder.integer(0));
+        for (auto &elem : init)
         {
-            ret += ", " + ptr[i];
+            flat[elem.first] = elem.second;
         }
+        storeArray(array, flat.data(), len, 0);
+        return;
+    }
+
+    // 指向第一个元素的 *i32，之后按一维下标 getptr
+    koopa_raw_value_t base = array;
+    for (size_t d = 0; d < len.size(); ++d)
+    {
+        base = builder.get_elem_ptr(base, builder.integer(0));
+        reg_cnt++;
     }
+    zeroFill(base, tot_len, name);
+    for (auto &elem : init)
+    {
+        koopa_raw_value_t tmp = builder.get_ptr(base, builder.integer(elem.first));
+        reg_cnt++;
+        builder.store(elem.second, tmp);
+    }
+}
+
+// 常量折叠二元运算，除数为0等无法在编译期求值的情况返回 false
+static bool fold_binary(string_view op, int l, int r, int &res)
+{
+    if (op == "+")
+        res = l + r;
+    else if (op == "-")
+        res = l - r;
+    else if (op == "*")
+        res = l * r;
+    else if (op == "/" || op == "%")
+    {
+        if (r == 0 || (l == INT32_MIN && r == -1))
+            return false;
+        res = op == "/" ? l / r : l % r;
+    }
+    else if (op == "<")
+        res = l < r;
+    else if (op == ">")
+        res = l > r;
+    else if (op == "<=")
+        res = l <= r;
+    else if (op == ">=")
+        res = l >= r;
+    else if (op == "==")
+        res = l == r;
     else
+        res = l != r;
+    return true;
+}
+
+// 数组类型的各维长度，例：[[i32, 3], 2] -> {2, 3}
+static vector<int> getArrayLen(koopa_raw_type_t ty)
+{
+    vector<int> len;
+    while (ty->tag == KOOPA_RTT_ARRAY)
     {
-        int n = len[0], width = 1;
-        std::vector<int> sublen(len.begin() + 1, len.end());
-        for (auto iter = len.end() - 1; iter != len.begin(); --iter)
-            width *= *iter;
-        ret += getInitList(ptr, sublen);
-        for (int i = 1; i < n; ++i)
-        {
-            ret += ", " + getInitList(ptr + width * i, sublen);
-        }
+        len.push_back(ty->data.array.len);
+        ty = ty->data.array.base;
     }
-    ret += "}";
-    return ret;
+    return len;
 }
 
+// 所有 AST 节点的种类，节点的类名为 种类名 + AST
+#define AST_KINDS(X)                                                                              \
+    X(CompUnit) X(FuncDef) X(FuncDefWithParams) X(FuncFParams) X(FuncFParam) X(FuncRParams)        \
+    X(Block) X(Stmt) X(IfStmt) X(If) X(While) X(LoopJump)                                          \
+    X(Exp) X(PrimaryExp) X(UnaryExp) X(UnaryExpWithFunc) X(MulExp) X(AddExp) X(RelExp) X(EqExp)   \
+    X(LAndExp) X(LOrExp)                                                                           \
+    X(Decl) X(ConstDecl) X(ConstDef) X(InitValWithList) X(ConstDefArray) X(ConstInitVal) X(ConstExp) \
+    X(BlockItem) X(LVal) X(LValArray) X(LeVal) X(LeValArray) X(VarDecl) X(VarDef) X(VarDefArray)   \
+    X(InitVal)
+
+enum class AstKind : uint8_t
+{
+#define AST_KIND_ENUM(K) K,
+    AST_KINDS(AST_KIND_ENUM)
+#undef AST_KIND_ENUM
+};
+
+class BaseAST;
+
+// 非递归生成 IR 时的栈帧，见 BaseAST::Koopa()
+struct AstFrame
+{
+    const BaseAST *node;
+    // 下一个要处理的子节点
+    int next;
+    // 节点自己使用的状态，例如短路求值和 if/while 的编号
+    int tag;
+    // 节点自己使用的 IR 值，例如数组元素的指针；左值的地址也通过它交给父节点
+    koopa_raw_value_t value;
+    // 子节点的结果在结果栈中的起始位置
+    size_t base;
+};
+
+// 子节点的结果：Koopa() 的返回值，不能直接求值时结果所在的寄存器，以及左值的地址
+struct AstResult
+{
+    pair<bool, int> res;
+    int reg;
+    koopa_raw_value_t value;
+};
+
 // lv4+
 // 所有 AST 的基类
+// 节点没有虚函数，按 kind 分派到具体的类（见文件末尾的 visit_ast）
+// 编译分两遍，都用显式栈访问节点，不会因为表达式或语句嵌套太深而耗尽栈空间：
+// 1. analyze()：语义分析，解析符号，计算类型和常量值并保存在节点上
+// 2. Koopa()：生成 IR，直接使用保存的结果，常量表达式不再访问子节点
+// 每一遍对 i = 0, 1, ... 先调用 enter(i)，再处理 child(i)，直到 enter 返回 false 或 child(i) 为空，最后调用 leave()
+// 派生类通过定义同名函数覆盖下面的默认实现
 class BaseAST
 {
 public:
-    virtual ~BaseAST() = default;
+    // 节点由 AstArena 统一分配和释放，不会单独析构
+    AstKind kind;
+    // 语义分析的结果：表达式能否在编译期求值，以及它的值
+    // 不能求值的表达式 val 也尽量求出（变量取其初值，函数调用为 0），只用于全局变量的初始化
+    bool is_const = false;
+    int val = 0;
 
+    explicit BaseAST(AstKind kind_) : kind(kind_) {}
+
+    // 语义分析，每个全局定义在生成 IR 之前调用一次
+    void analyze();
     // 用于优化，对于能直接计算出值的表达式，直接返回值，减少寄存器浪费
     // bool: true-能计算 false-不能
     // int: 能计算出的值；对于不能计算出的值，返回-1
-    virtual pair<bool, int> Koopa() const { return make_pair(false, -1); }
-    virtual string name() const { return "oops"; }
-    // 用于计算初始化的值
-    // 必定能计算出来，否则是程序的问题
-    virtual int calc() const { return 0; }
-    virtual bool is_list() const { return false; }
+    pair<bool, int> Koopa() const;
+
+    bool is_list() const { return kind == AstKind::InitValWithList; }
+    bool is_func() const { return kind == AstKind::FuncDef || kind == AstKind::FuncDefWithParams; }
+
+    // 转换为具体的节点类型，类型由语法保证，只做检查
+    template <typename T>
+    T *as()
+    {
+        assert(kind == T::KIND);
+        return static_cast<T *>(this);
+    }
+
+    // 第 i 个子节点，没有则返回空
+    Ref<BaseAST> child(int i) const { return Ref<BaseAST>{0}; }
+
+    // 语义分析：处理第 i 个子节点之前 / 所有子节点之后调用
+    bool analyze_enter(int i) { return true; }
+    void analyze_leave() {}
+
+    // 生成 IR：处理第 i 个子节点之前调用，done 是已处理的子节点的结果
+    // 返回 false 则不再处理后面的子节点（基本块已经结束，或者子节点在 leave 中自行处理）
+    // 自行处理了第 i 个子节点时可以增加 f.next 跳过它，例如 if/while 的条件
+    bool enter(int i, AstFrame &f, const AstResult *done) const { return true; }
+    // 子节点都处理完之后调用，生成本节点的 IR，返回值即 Koopa() 的返回值
+    pair<bool, int> leave(AstFrame &f, const AstResult *done) const { return make_pair(false, -1); }
+
+protected:
+    // 与唯一的子节点相同：能否求值以及值
+    void same_as(Ref<BaseAST> c)
+    {
+        is_const = c->is_const;
+        val = c->val;
+    }
 };
 
-// lv4+
-// CompUnit 是 BaseAST
-class CompUnitAST : public BaseAST
+// 具体节点类型的基类，记录节点的种类
+template <AstKind K>
+class AstNode : public BaseAST
 {
 public:
-    // 用智能指针管理对象
-    unique_ptr<deque<unique_ptr<BaseAST>>> DefList;
-    int func_num;
+    static constexpr AstKind KIND = K;
+    AstNode() : BaseAST(K) {}
+};
 
-    pair<bool, int> Koopa() const override
+// 数组的类型，例：int a[2][3] -> [[i32, 3], 2]
+// 各维的长度在语义分析中已经求出
+static koopa_raw_type_t getArrayType(const List &array_size_list)
+{
+    vector<int> len;
+    for (auto &i : array_size_list)
     {
-        // 全局符号表
-        symbol_list.newMap();
+        len.push_back(i->val);
+    }
+    return builder.array_type(len);
+}
 
-        // block_end.push_back(false);
-        // 库函数声明
-        koopa_str += "decl @getint(): i32\ndecl @getch() : i32\ndecl @getarray(*i32) : i32\n";
-        koopa_str += "decl @putint(i32)\ndecl @putch(i32)\ndecl @putarray(i32, *i32)\n";
-        koopa_str += "decl @starttime()\ndecl @stoptime()\n\n\n";
+// 变量在 IR 中的名字：@标识符_所在基本块编号
+static string var_name(int ident, int index)
+{
+    return "@" + interner->name(ident) + "_" + to_string(index);
+}
 
-        // 库函数加入符号表
-        symbol_list.addSymbol("getint", Value(FUNC, 1, 0));
-        symbol_list.addSymbol("getch", Value(FUNC, 1, 0));
-        symbol_list.addSymbol("getarray", Value(FUNC, 1, 0));
-        symbol_list.addSymbol("putint", Value(FUNC, 0, 0));
-        symbol_list.addSymbol("putch", Value(FUNC, 0, 0));
-        symbol_list.addSymbol("putarray", Value(FUNC, 0, 0));
-        symbol_list.addSymbol("starttime", Value(FUNC, 0, 0));
-        symbol_list.addSymbol("stoptime", Value(FUNC, 0, 0));
+// lv4+
+// CompUnit 是 BaseAST
+class CompUnitAST : public AstNode<AstKind::CompUnit>
+{
+public:
+    // 按源码顺序排列的全局定义（变量/常量声明和函数）
+    List DefList;
 
-        int n = (*DefList).size();
+    // 全局定义逐个分析并生成 IR，见 leave()
+    bool enter(int, AstFrame &, const AstResult *) const { return false; }
+
+    pair<bool, int> leave(AstFrame &, const AstResult *) const
+    {
+        begin_unit();
 
         // 全局变量
-        for (int i = 0; i < n - func_num; i++)
+        for (auto &def : DefList)
         {
-            if (n == func_num)
-                break;
-            ((*DefList)[i])->Koopa();
+            if (!def->is_func())
+                lower_def(def);
         }
 
-        koopa_str += "\n";
-
-        // 函数: in inverted order
-        for (int i = n - 1; i >= n - func_num; i--)
+        // 函数
+        for (auto &def : DefList)
         {
-            ((*DefList)[i])->Koopa();
+            if (def->is_func())
+                lower_def(def);
         }
 
-        symbol_list.deleteMap();
+        end_unit();
 
         return make_pair(false, -1);
     }
+
+    // 处理一个全局定义：先做语义分析，再生成 IR
+    static void lower_def(Ref<BaseAST> def)
+    {
+        def->analyze();
+        def->Koopa();
+    }
+
+    // 进入编译单元：创建全局符号表，声明库函数
+    // 流式处理时全局定义不经过 CompUnit，由调用者在解析前后分别调用 begin_unit / end_unit
+    static void begin_unit()
+    {
+        // 全局符号表
+        symbol_list.newMap();
+
+        // block_end.push_back(false);
+        // 库函数声明
+        koopa_raw_type_t i32 = builder.int_type();
+        koopa_raw_type_t unit = builder.unit_type();
+        koopa_raw_type_t i32_ptr = builder.pointer_type(i32);
+        builder.declare_function("@getint", {}, i32);
+        builder.declare_function("@getch", {}, i32);
+        builder.declare_function("@getarray", {i32_ptr}, i32);
+        builder.declare_function("@putint", {i32}, unit);
+        builder.declare_function("@putch", {i32}, unit);
+        builder.declare_function("@putarray", {i32, i32_ptr}, unit);
+        builder.declare_function("@starttime", {}, unit);
+        builder.declare_function("@stoptime", {}, unit);
+
+        // 库函数加入符号表
+        symbol_list.addSymbol(interner->intern("getint"), Value(FUNC, 1, 0));
+        symbol_list.addSymbol(interner->intern("getch"), Value(FUNC, 1, 0));
+        symbol_list.addSymbol(interner->intern("getarray"), Value(FUNC, 1, 0));
+        symbol_list.addSymbol(interner->intern("putint"), Value(FUNC, 0, 0));
+        symbol_list.addSymbol(interner->intern("putch"), Value(FUNC, 0, 0));
+        symbol_list.addSymbol(interner->intern("putarray"), Value(FUNC, 0, 0));
+        symbol_list.addSymbol(interner->intern("starttime"), Value(FUNC, 0, 0));
+        symbol_list.addSymbol(interner->intern("stoptime"), Value(FUNC, 0, 0));
+    }
+
+    static void end_unit()
+    {
+        symbol_list.deleteMap();
+    }
 };
 
 // lv4+
 // FuncDef 也是 BaseAST
-class FuncDefAST : public BaseAST
+class FuncDefAST : public AstNode<AstKind::FuncDef>
 {
 public:
-    string type;
-    string ident;
-    unique_ptr<BaseAST> block;
+    string_view type;
+    int ident;
+    Ref<BaseAST> block;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
     {
-        is_global = false;
-        int val_func = 0;
-        if (type == "int")
-        {
-            val_func = 1;
-        }
-        Value global_func = Value(FUNC, val_func, 0);
-        symbol_list.addSymbol(ident, global_func);
-
-        koopa_str += "fun ";
-        koopa_str += "@";
-        koopa_str += ident;
-        koopa_str += "()";
+        return i == 0 ? block : Ref<BaseAST>{0};
+    }
 
-        if (type == "int")
-        {
-            koopa_str += ": i32 ";
-        }
-        else if (type == "void")
+    bool analyze_enter(int i)
+    {
+        // 先加入符号表，函数体内可以递归调用
+        if (i == 0)
         {
-            koopa_str += " ";
+            symbol_list.addSymbol(ident, Value(FUNC, type == "int" ? 1 : 0, 0));
         }
+        return true;
+    }
+
+    bool enter(int, AstFrame &, const AstResult *) const { return false; }
 
+    pair<bool, int> leave(AstFrame &, const AstResult *) const
+    {
         // func_type->Koopa();
 
         reg_cnt = 0;
 
-        koopa_str += "{\n";
-        koopa_str += "\%entry:\n";
+        builder.begin_function("@" + interner->name(ident), {}, type == "int" ? builder.int_type() : builder.unit_type());
+        builder.set_block(builder.block("%entry"));
 
         block->Koopa();
 
         if (!block_handler.is_end())
         {
             if (type == "int")
-                koopa_str += "  ret 0\n";
+                builder.ret(builder.integer(0));
             else
             {
-                koopa_str += "  ret\n";
+                builder.ret();
             }
         }
 
-        koopa_str += "}\n\n";
+        builder.end_function();
         return make_pair(false, -1);
     }
 };
 
-// lv8
-// FuncDef with Params
-// FuncDef ::= FuncType IDENT '(' FuncFParams ')' Block
-// @
-class FuncDefWithParamsAST : public BaseAST
+// lv9 update
+// FuncFParam
+// INT IDENT
+class FuncFParamAST : public AstNode<AstKind::FuncFParam>
 {
 public:
-    string type;
-    string ident;
-    unique_ptr<BaseAST> funcfparams;
-    unique_ptr<BaseAST> block;
-
-    pair<bool, int> Koopa() const override
+    string_view type;
+    int name_;
+    List array_size_list;
+    // 语义分析的结果：参数的类型，以及函数体的基本块编号（用于命名）
+    koopa_raw_type_t ty;
+    int index;
+
+    Ref<BaseAST> child(int i) const
     {
-        is_global = false;
-        int val_func = 0;
-        if (type == "int")
-        {
-            val_func = 1;
-        }
-        Value global_func = Value(FUNC, val_func, 0);
-        symbol_list.addSymbol(ident, global_func);
-
-        koopa_str += "fun ";
-        koopa_str += "@";
-        koopa_str += ident;
-
-        koopa_str += "(";
-
-        // 不在函数体内，声明参数
-        param_block = false;
-        funcfparams->Koopa();
-
-        koopa_str += ")";
+        return i < (int)array_size_list.size() ? array_size_list[i] : Ref<BaseAST>{0};
+    }
 
+    void analyze_leave()
+    {
+        // 函数体是下一个编号的基本块
+        index = scope_handler.block_cnt + 1;
         if (type == "int")
         {
-            koopa_str += ": i32 ";
+            ty = builder.int_type();
+            function_params.emplace_back(make_pair(name_, 0));
         }
-        else if (type == "void")
+        else
         {
-            koopa_str += " ";
+            ty = builder.pointer_type(getArrayType(array_size_list));
+            int pointer_size = array_size_list.size() + 1;
+            function_params.emplace_back(make_pair(name_, pointer_size));
         }
+    }
 
-        reg_cnt = 0;
-        koopa_str += "{\n";
-        koopa_str += "\%entry:\n";
-
-        // 在函数体内，把参数加载出来
-        param_block = true;
-        funcfparams->Koopa();
-
-        block->Koopa();
+    string param_name() const
+    {
+        return var_name(name_, index) + "_param";
+    }
 
-        if (!block_handler.is_end())
-        {
-            if (type == "int")
-                koopa_str += "  ret 0\n";
-            else
-            {
-                koopa_str += "  ret\n";
-            }
-        }
+    bool enter(int, AstFrame &, const AstResult *) const { return false; }
 
-        koopa_str += "}\n\n";
+    // 函数体内 为参数分配内存空间
+    pair<bool, int> leave(AstFrame &, const AstResult *) const
+    {
+        koopa_raw_value_t use = builder.alloc(var_name(name_, index), ty);
+        builder.store(builder.value(param_name()), use);
         return make_pair(false, -1);
     }
 };
 
 // lv8
 // FuncFParams
-class FuncFParamsAST : public BaseAST
+class FuncFParamsAST : public AstNode<AstKind::FuncFParams>
 {
 public:
-    vector<unique_ptr<BaseAST>> ParamList;
+    List ParamList;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
     {
-        bool params = false;
-        for (auto &i : ParamList)
-        {
-            if (params && !param_block)
-            {
-                koopa_str += ", ";
-            }
-            i->Koopa();
-            params = true;
-        }
-        return make_pair(false, -1);
+        return i < (int)ParamList.size() ? ParamList[i] : Ref<BaseAST>{0};
     }
 };
 
-// lv9 update
-// FuncFParam
-// INT IDENT
-class FuncFParamAST : public BaseAST
+// lv8
+// FuncDef with Params
+// FuncDef ::= FuncType IDENT '(' FuncFParams ')' Block
+// @
+class FuncDefWithParamsAST : public AstNode<AstKind::FuncDefWithParams>
 {
 public:
-    string type;
-    string name_;
-    vector<unique_ptr<BaseAST>> array_size_list;
+    string_view type;
+    int ident;
+    Ref<FuncFParamsAST> funcfparams;
+    Ref<BaseAST> block;
+
+    Ref<BaseAST> child(int i) const
+    {
+        if (i == 0)
+            return funcfparams;
+        if (i == 1)
+            return block;
+        return Ref<BaseAST>{0};
+    }
+
+    bool analyze_enter(int i)
+    {
+        if (i == 0)
+        {
+            symbol_list.addSymbol(ident, Value(FUNC, type == "int" ? 1 : 0, 0));
+        }
+        return true;
+    }
 
-    pair<bool, int> Koopa() const override
+    bool enter(int, AstFrame &, const AstResult *) const { return false; }
+
+    pair<bool, int> leave(AstFrame &, const AstResult *) const
     {
         // 声明参数
-        if (!param_block)
+        vector<pair<string, koopa_raw_type_t>> param_types;
+        for (auto &p : funcfparams->ParamList)
         {
-            if (type == "int")
-            {
-                string param_tag = "@" + name_ + "_" + to_string(block_handler.block_cnt + 1) + "_param";
-                koopa_str += param_tag + ": i32";
-            }
-            else if (type == "array")
-            {
-                string param_tag = "@" + name_ + "_" + to_string(block_handler.block_cnt + 1) + "_param";
-                koopa_str += param_tag + ": ";
+            FuncFParamAST *param = p->as<FuncFParamAST>();
+            param_types.emplace_back(param->param_name(), param->ty);
+        }
 
-                string type_tag = "i32";
-                int len = array_size_list.size();
-                for (int i = len - 1; i >= 0; i--)
-                {
-                    type_tag = "[" + type_tag + ", " + to_string(array_size_list[i]->calc()) + "]";
-                }
-                koopa_str += "*" + type_tag;
-            }
+        reg_cnt = 0;
+        builder.begin_function("@" + interner->name(ident), param_types, type == "int" ? builder.int_type() : builder.unit_type());
+        builder.set_block(builder.block("%entry"));
+
+        // 在函数体内，把参数加载出来
+        for (auto &p : funcfparams->ParamList)
+        {
+            p->Koopa();
         }
-        // 函数体内 为参数分配内存空间
-        else
+
+        block->Koopa();
+
+        if (!block_handler.is_end())
         {
             if (type == "int")
+                builder.ret(builder.integer(0));
+            else
             {
-                string param_tag = "@" + name_ + "_" + to_string(block_handler.block_cnt + 1) + "_param";
-                string use_tag = "@" + name_ + "_" + to_string(block_handler.block_cnt + 1);
-                koopa_str += "  " + use_tag + " = alloc i32\n";
-                koopa_str += "  store " + param_tag + ", " + use_tag + "\n";
-                function_params.emplace_back(make_pair(name_, 0));
-            }
-            else if (type == "array")
-            {
-                string type_tag = "i32";
-                int len = array_size_list.size();
-                for (int i = len - 1; i >= 0; i--)
-                {
-                    type_tag = "[" + type_tag + ", " + to_string(array_size_list[i]->calc()) + "]";
-                }
-                string param_tag = "@" + name_ + "_" + to_string(block_handler.block_cnt + 1) + "_param";
-                string use_tag = "@" + name_ + "_" + to_string(block_handler.block_cnt + 1);
-
-                koopa_str += "  " + use_tag + " = alloc *" + type_tag + "\n";
-                koopa_str += "  store " + param_tag + ", " + use_tag + "\n";
-
-                int pointer_size = len + 1;
-                function_params.emplace_back(make_pair(name_, pointer_size));
+                builder.ret();
             }
         }
-        return make_pair(false, -1);
-    }
 
-    string name() const override
-    {
-        return name_;
+        builder.end_function();
+        return make_pair(false, -1);
     }
 };
 
 // lv9 ?
 // lv8
 // FuncRParams
-class FuncRParamsAST : public BaseAST
+class FuncRParamsAST : public AstNode<AstKind::FuncRParams>
 {
 public:
-    vector<unique_ptr<BaseAST>> ParamList;
-
-    pair<bool, int> Koopa() const override
-    {
-        return make_pair(false, -1);
-    }
-    vector<pair<bool, int>> get_params()
-    {
-        vector<pair<bool, int>> rparams;
-        for (auto &i : ParamList)
-        {
-            auto res = i->Koopa();
-            if (res.first)
-            {
-                rparams.push_back(res);
-            }
-            else
-            {
-                rparams.push_back(make_pair(false, reg_cnt - 1));
-            }
-        }
-        return rparams;
-    }
+    // 实参作为函数调用 UnaryExpWithFuncAST 的子节点处理
+    List ParamList;
 };
 
 // lv9 update
 // lv4+
 // Block lv4
-class BlockAST : public BaseAST
+class BlockAST : public AstNode<AstKind::Block>
 {
 public:
-    vector<unique_ptr<BaseAST>> blockItemList;
+    List blockItemList;
+
+    Ref<BaseAST> child(int i) const
+    {
+        return i < (int)blockItemList.size() ? blockItemList[i] : Ref<BaseAST>{0};
+    }
 
-    pair<bool, int> Koopa() const override
+    bool analyze_enter(int i)
     {
+        if (i > 0)
+        {
+            return true;
+        }
+
         symbol_list.newMap();
 
-        block_handler.addBlock();
+        scope_handler.addBlock();
+        int index = scope_handler.block_now.index;
 
         // 参数加入符号表
         // lv9 update: 数组指针
-        for (int i = 0; i < function_params.size(); i++)
+        for (int j = 0; j < (int)function_params.size(); j++)
         {
-            if (function_params[i].second == 0)
+            if (function_params[j].second == 0)
             {
-                Value param = Value(VAR, 0, block_handler.block_now.index);
-                symbol_list.addSymbol(function_params[i].first, param);
+                Value param = Value(VAR, 0, index);
+                symbol_list.addSymbol(function_params[j].first, param);
             }
             else
             {
                 // 指针的val是[]的数量，例：如果参数是a[]，则val记为1
-                Value param = Value(POINTER, function_params[i].second, block_handler.block_now.index);
-                symbol_list.addSymbol(function_params[i].first, param);
+                Value param = Value(POINTER, function_params[j].second, index);
+                symbol_list.addSymbol(function_params[j].first, param);
             }
         }
 
         function_params.clear();
+        return true;
+    }
 
-        for (int i = 0; i < blockItemList.size(); i++)
-        {
-            if (block_handler.is_end())
-            {
-                break;
-            }
+    void analyze_leave()
+    {
+        scope_handler.leaveBlock();
+        symbol_list.deleteMap();
+    }
 
-            blockItemList[i]->Koopa();
+    bool enter(int i, AstFrame &, const AstResult *) const
+    {
+        if (i == 0)
+        {
+            block_handler.addBlock();
         }
+        // 基本块已经结束，后面的语句不再生成
+        return !block_handler.is_end();
+    }
 
+    pair<bool, int> leave(AstFrame &, const AstResult *) const
+    {
         // 子块完成后，归位block_last
         block_handler.leaveBlock();
 
-        symbol_list.deleteMap();
-
         // 返回当前基本块的序号
         return make_pair(true, block_handler.block_cnt);
     }
@@ -470,28 +710,33 @@ public:
 
 // lv4+
 // Stmt 语句 赋值|返回|无效表达式|if语句 LeVal "=" Exp ";" | "return" [Exp] ";" | [Exp] ";" | Block | If [Else]
-class StmtAST : public BaseAST
+class StmtAST : public AstNode<AstKind::Stmt>
 {
 public:
     int rule;
-    unique_ptr<BaseAST> exp;
-    unique_ptr<BaseAST> leval;
-    unique_ptr<BaseAST> block;
+    Ref<BaseAST> exp;
+    Ref<BaseAST> leval;
+    Ref<BaseAST> block;
+
+    Ref<BaseAST> child(int i) const
+    {
+        // 赋值：先计算左值的地址，再计算右侧的表达式
+        if (rule == 0)
+        {
+            if (i == 0)
+                return leval;
+            return i == 1 ? exp : Ref<BaseAST>{0};
+        }
+        if (i > 0)
+            return Ref<BaseAST>{0};
+        return rule == 3 ? block : exp;
+    }
 
-    pair<bool, int> Koopa() const override
+    pair<bool, int> leave(AstFrame &, const AstResult *done) const
     {
         if (rule == 0) // 赋值
         {
-            string val_name = leval->name();
-            pair<bool, int> res = exp->Koopa();
-            if (res.first)
-            {
-                koopa_str += "  store " + to_string(res.second) + ", " + val_name + "\n";
-            }
-            else
-            {
-                koopa_str += "  store %" + to_string(reg_cnt - 1) + ", " + val_name + "\n";
-            }
+            builder.store(get_operand(done[1].res, done[1].reg), done[0].value);
 
             block_handler.set_not_end();
         }
@@ -499,86 +744,91 @@ public:
         {
             if (exp != nullptr)
             {
-                pair<bool, int> res = exp->Koopa();
-                if (res.first)
-                {
-                    koopa_str += "  ret " + to_string(res.second) + "\n";
-                }
-                else
-                {
-                    koopa_str += "  ret %" + to_string(reg_cnt - 1) + "\n";
-                }
+                builder.ret(get_operand(done[0].res, done[0].reg));
             }
             else
             {
-                koopa_str += "  ret\n";
+                builder.ret();
             }
 
             block_handler.set_end();
         }
         else if (rule == 2)
         {
-            if (exp != nullptr)
-                exp->Koopa();
-
             block_handler.set_not_end();
         }
         else if (rule == 3)
         {
-            return block->Koopa();
+            return done[0].res;
         }
         return make_pair(false, -1);
     }
 };
 
+// 条件跳转：exp 非零时跳转到 true_bb，否则跳转到 false_bb，定义在表达式之后
+static void lower_cond(Ref<BaseAST> exp, koopa_raw_basic_block_t true_bb, koopa_raw_basic_block_t false_bb);
+
 // lv6
 // if_stmt ::= If ELSE else_stmt | If
-class IfStmtAST : public BaseAST
+class IfStmtAST : public AstNode<AstKind::IfStmt>
 {
 public:
-    unique_ptr<BaseAST> if_stmt;
-    unique_ptr<BaseAST> else_stmt;
+    Ref<BaseAST> if_stmt;
+    Ref<BaseAST> else_stmt;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
     {
-        if_cnt++;
-        int now_if_cnt = if_cnt;
-        // If
-        if (else_stmt == nullptr)
-        {
-            if_end = true;
-            if_stmt->Koopa();
-            string end_tag = "%end_" + to_string(now_if_cnt);
-            koopa_str += end_tag + ":\n";
+        if (i == 0)
+            return if_stmt;
+        if (i == 1)
+            return else_stmt;
+        return Ref<BaseAST>{0};
+    }
 
-            block_handler.set_not_end();
+    bool enter(int i, AstFrame &f, const AstResult *) const
+    {
+        if (i == 0)
+        {
+            if_cnt++;
+            f.tag = if_cnt;
+            // 告诉 If 是否有 else
+            if_end = else_stmt == nullptr;
         }
-        // If ELSE Stmt
-        else
+        else if (i == 1 && else_stmt != nullptr)
         {
-            if_end = false;
+            string else_tag = "%else_" + to_string(f.tag);
 
-            pair<bool, int> res_if = if_stmt->Koopa();
+            // else tag:
+            builder.set_block(builder.block(else_tag));
 
-            bool if_stmt_end = res_if.second == 1 ? true : false;
+            block_handler.set_not_end();
+        }
+        return true;
+    }
 
+    pair<bool, int> leave(AstFrame &f, const AstResult *done) const
+    {
+        int now_if_cnt = f.tag;
+        // If
+        if (else_stmt == nullptr)
+        {
             string end_tag = "%end_" + to_string(now_if_cnt);
-            string else_tag = "%else_" + to_string(now_if_cnt);
-
-            // else tag:
-            koopa_str += else_tag + ":\n";
+            builder.set_block(builder.block(end_tag));
 
             block_handler.set_not_end();
-
-            else_stmt->Koopa();
+        }
+        // If ELSE Stmt
+        else
+        {
+            bool if_stmt_end = done[0].res.second == 1 ? true : false;
 
             bool else_stmt_end = block_handler.is_end();
 
-            end_tag = "%end_" + to_string(now_if_cnt);
+            string end_tag = "%end_" + to_string(now_if_cnt);
 
             if (!else_stmt_end)
             {
-                koopa_str += "  jump " + end_tag + "\n\n";
+                builder.jump(builder.block(end_tag));
             }
 
             if (if_stmt_end && else_stmt_end)
@@ -588,7 +838,7 @@ public:
             else
             {
                 block_handler.set_not_end();
-                koopa_str += end_tag + ":\n";
+                builder.set_block(builder.block(end_tag));
             }
         }
 
@@ -599,45 +849,46 @@ public:
 // lv6
 // If ::= IF (Exp) Stmt
 // 不含else的if
-class IfAST : public BaseAST
+class IfAST : public AstNode<AstKind::If>
 {
 public:
-    unique_ptr<BaseAST> exp;
-    unique_ptr<BaseAST> stmt;
+    Ref<BaseAST> exp;
+    Ref<BaseAST> stmt;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
     {
-        pair<bool, int> res = exp->Koopa();
+        if (i == 0)
+            return exp;
+        if (i == 1)
+            return stmt;
+        return Ref<BaseAST>{0};
+    }
+
+    // 条件直接生成跳转，然后处理 stmt
+    bool enter(int i, AstFrame &f, const AstResult *) const
+    {
+        if (i != 0)
+        {
+            return true;
+        }
         int now_if_cnt = if_cnt;
         bool now_if_end = if_end;
+        f.tag = now_if_cnt;
 
         string then_tag = "%then_" + to_string(now_if_cnt);
         string else_tag = "%else_" + to_string(now_if_cnt);
         string end_tag = "%end_" + to_string(now_if_cnt);
-        // 是否返回具体值
-        if (res.first)
-        {
-            koopa_str += "  br " + to_string(res.second) + ", " + then_tag;
-        }
-        else
-        {
-            koopa_str += "  br %" + to_string(reg_cnt - 1) + ", " + then_tag;
-        }
-        // 没有else的情况
-        if (now_if_end)
-        {
-            koopa_str += ", " + end_tag + "\n";
-        }
-        // else
-        else
-        {
-            koopa_str += ", " + else_tag + "\n";
-        }
+        // 没有else的情况，条件为假时跳到end
+        lower_cond(exp, builder.block(then_tag), builder.block(now_if_end ? end_tag : else_tag));
 
-        koopa_str += "\n";
-        koopa_str += then_tag + ":\n";
+        builder.set_block(builder.block(then_tag));
+        f.next = 1;
+        return true;
+    }
 
-        stmt->Koopa();
+    pair<bool, int> leave(AstFrame &f, const AstResult *) const
+    {
+        string end_tag = "%end_" + to_string(f.tag);
 
         bool end_now = block_handler.is_end();
 
@@ -645,10 +896,9 @@ public:
         if (!end_now)
         {
             is_end = -1;
-            koopa_str += "  jump " + end_tag + "\n\n";
+            builder.jump(builder.block(end_tag));
         }
         // end of if branch
-        // koopa_str += end_tag + ":\n";
 
         return make_pair(false, is_end);
     }
@@ -657,45 +907,56 @@ public:
 // lv7
 // While ::= WHILE (Exp) Stmt
 // While循环
-class WhileAST : public BaseAST
+class WhileAST : public AstNode<AstKind::While>
 {
 public:
-    unique_ptr<BaseAST> exp;
-    unique_ptr<BaseAST> stmt;
+    Ref<BaseAST> exp;
+    Ref<BaseAST> stmt;
+
+    Ref<BaseAST> child(int i) const
+    {
+        if (i == 0)
+            return exp;
+        if (i == 1)
+            return stmt;
+        return Ref<BaseAST>{0};
+    }
 
-    pair<bool, int> Koopa() const override
+    bool enter(int i, AstFrame &f, const AstResult *) const
     {
-        loop_cnt++;
-        loop_dep++;
-        find_loop[loop_dep] = loop_cnt;
+        if (i == 0)
+        {
+            loop_cnt++;
+            loop_dep++;
+            find_loop[loop_dep] = loop_cnt;
+            f.tag = loop_cnt;
 
-        string entry_name = "%while_entry_" + to_string(loop_cnt);
-        string body_name = "%while_body_" + to_string(loop_cnt);
-        string end_name = "%while_end_" + to_string(loop_cnt);
+            string entry_name = "%while_entry_" + to_string(loop_cnt);
+            string body_name = "%while_body_" + to_string(loop_cnt);
+            string end_name = "%while_end_" + to_string(loop_cnt);
+            builder.jump(builder.block(entry_name));
+            builder.set_block(builder.block(entry_name));
 
-        koopa_str += "  jump " + entry_name + "\n\n";
-        koopa_str += entry_name + ":\n";
+            // 条件直接生成跳转，然后处理循环体
+            lower_cond(exp, builder.block(body_name), builder.block(end_name));
 
-        pair<bool, int> res = exp->Koopa();
-        if (res.first)
-        {
-            koopa_str += "  br " + to_string(res.second) + ", " + body_name + ", " + end_name + "\n\n";
-        }
-        else
-        {
-            koopa_str += "  br %" + to_string(reg_cnt - 1) + ", " + body_name + ", " + end_name + "\n\n";
+            builder.set_block(builder.block(body_name));
+            f.next = 1;
         }
+        return true;
+    }
 
-        koopa_str += body_name + ":\n";
-
-        stmt->Koopa();
+    pair<bool, int> leave(AstFrame &f, const AstResult *) const
+    {
+        string entry_name = "%while_entry_" + to_string(f.tag);
+        string end_name = "%while_end_" + to_string(f.tag);
 
         if (!block_handler.is_end())
         {
-            koopa_str += "  jump " + entry_name + "\n\n";
+            builder.jump(builder.block(entry_name));
         }
 
-        koopa_str += end_name + ":\n";
+        builder.set_block(builder.block(end_name));
 
         loop_dep--;
 
@@ -709,12 +970,12 @@ public:
 // BREAK/CONTINUE
 // break: rule -> 0
 // continue: rule -> 1
-class LoopJumpAST : public BaseAST
+class LoopJumpAST : public AstNode<AstKind::LoopJump>
 {
 public:
     int rule;
 
-    pair<bool, int> Koopa() const override
+    pair<bool, int> leave(AstFrame &, const AstResult *) const
     {
         int tag = find_loop[loop_dep];
         // break: 跳转到%while_end
@@ -722,7 +983,7 @@ public:
         {
             string end_name = "%while_end_" + to_string(tag);
             if (!block_handler.is_end())
-                koopa_str += "  jump " + end_name + "\n\n";
+                builder.jump(builder.block(end_name));
 
             block_handler.set_end();
         }
@@ -730,7 +991,7 @@ public:
         {
             string entry_name = "%while_entry_" + to_string(tag);
             if (!block_handler.is_end())
-                koopa_str += "  jump " + entry_name + "\n\n";
+                builder.jump(builder.block(entry_name));
 
             block_handler.set_end();
         }
@@ -741,996 +1002,709 @@ public:
 
 // lv4+
 // Exp 表达式 lv3
-class ExpAST : public BaseAST
+class ExpAST : public AstNode<AstKind::Exp>
 {
 public:
-    unique_ptr<BaseAST> lorexp;
+    Ref<BaseAST> lorexp;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
     {
-        return lorexp->Koopa();
+        return i == 0 ? lorexp : Ref<BaseAST>{0};
     }
-    int calc() const override
+    void analyze_leave()
     {
-        return lorexp->calc();
+        same_as(lorexp);
+    }
+    pair<bool, int> leave(AstFrame &, const AstResult *done) const
+    {
+        return done[0].res;
     }
 };
 
 // lv4+
 // PrimaryExp 基本表达式，(Exp) | Number | LVal lv4
-class PrimaryExpAST : public BaseAST
+class PrimaryExpAST : public AstNode<AstKind::PrimaryExp>
 {
 public:
     int rule;
     int number;
-    unique_ptr<BaseAST> exp;
-    unique_ptr<BaseAST> lval;
+    Ref<BaseAST> exp;
+    Ref<BaseAST> lval;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
     {
-        if (rule == 0)
-        {
-            return exp->Koopa();
-        }
-        else if (rule == 1)
-        {
-            return make_pair(true, number);
-        }
-        else
-        {
-            return lval->Koopa();
-        }
+        if (i > 0 || rule == 1)
+            return Ref<BaseAST>{0};
+        return rule == 0 ? exp : lval;
     }
-    int calc() const override
+    void analyze_leave()
     {
-        if (rule == 0)
+        if (rule == 1)
         {
-            return exp->calc();
-        }
-        else if (rule == 1)
-        {
-            return number;
+            is_const = true;
+            val = number;
         }
         else
         {
-            return lval->calc();
+            same_as(rule == 0 ? exp : lval);
         }
     }
+    pair<bool, int> leave(AstFrame &, const AstResult *done) const
+    {
+        return done[0].res;
+    }
 };
 
 // lv4+
 // UnaryExp ::= PrimaryExp | UnaryOp[!-+] UnaryExp lv3
-class UnaryExpAST : public BaseAST
+class UnaryExpAST : public AstNode<AstKind::UnaryExp>
 {
 public:
     int rule;
-    string op;
-    unique_ptr<BaseAST> primaryexp;
-    unique_ptr<BaseAST> unaryexp;
+    string_view op;
+    Ref<BaseAST> primaryexp;
+    Ref<BaseAST> unaryexp;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
+    {
+        if (i > 0)
+            return Ref<BaseAST>{0};
+        return rule == 0 ? primaryexp : unaryexp;
+    }
+    void analyze_leave()
     {
         if (rule == 0)
         {
-            return primaryexp->Koopa();
+            same_as(primaryexp);
+            return;
+        }
+        is_const = unaryexp->is_const;
+        if (op == "!")
+        {
+            val = !unaryexp->val;
+        }
+        else if (op == "-")
+        {
+            val = -unaryexp->val;
         }
         else
         {
-            pair<bool, int> res = unaryexp->Koopa();
-            if (res.first)
-            {
-                if (op == "!")
-                {
-
-                    if (res.second == 0)
-                        return make_pair(true, 1);
-                    return make_pair(true, 0);
-
-                    koopa_str += "  %" + to_string(reg_cnt) + " = eq " + to_string(res.second) + ", 0\n";
-                    reg_cnt++;
-                }
-                else if (op == "-")
-                {
-                    return make_pair(true, -res.second);
-
-                    koopa_str += "  %" + to_string(reg_cnt) + " = sub 0, " + to_string(res.second) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == "+")
-                {
-                    return res;
-                }
-            }
-            else
-            {
-                if (op == "!")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = eq %" + to_string(reg_cnt - 1) + ", 0\n";
-                    reg_cnt++;
-                }
-                else if (op == "-")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = sub 0, %" + to_string(reg_cnt - 1) + "\n";
-                    reg_cnt++;
-                }
-            }
-            return make_pair(false, -1);
+            val = unaryexp->val;
         }
     }
-    int calc() const override
+    // 能直接求值的情况在语义分析中已经处理
+    pair<bool, int> leave(AstFrame &, const AstResult *done) const
     {
-        if (rule == 0)
+        if (rule == 0 || op == "+")
         {
-            return primaryexp->calc();
+            return done[0].res;
         }
-        else
+        if (op == "!")
         {
-            if (op == "!")
-            {
-                return !unaryexp->calc();
-            }
-            else if (op == "-")
-            {
-                return -unaryexp->calc();
-            }
-            else
-            {
-                return unaryexp->calc();
-            }
+            builder.binary(KOOPA_RBO_EQ, builder.reg(done[0].reg), builder.integer(0));
+            reg_cnt++;
         }
+        else if (op == "-")
+        {
+            builder.binary(KOOPA_RBO_SUB, builder.integer(0), builder.reg(done[0].reg));
+            reg_cnt++;
+        }
+        return make_pair(false, -1);
     }
 };
 
 // LV8
 // UnaryExp -> IDENT "(" [FuncRParams] ")"
-class UnaryExpWithFuncAST : public BaseAST
+class UnaryExpWithFuncAST : public AstNode<AstKind::UnaryExpWithFunc>
 {
 public:
-    string ident;
-    unique_ptr<BaseAST> funcrparams;
+    int ident;
+    Ref<FuncRParamsAST> funcrparams;
+    // 语义分析的结果：被调用的函数
+    Value func;
 
-    pair<bool, int> Koopa() const override
+    // 实参依次求值
+    Ref<BaseAST> child(int i) const
     {
-        Value func = symbol_list.getSymbol(ident);
+        if (funcrparams && i < (int)funcrparams->ParamList.size())
+            return funcrparams->ParamList[i];
+        return Ref<BaseAST>{0};
+    }
+    void analyze_leave()
+    {
+        func = symbol_list.getSymbol(ident);
         if (func.type != TYPE::FUNC)
         {
             // assert(false); //??
         }
-        vector<pair<bool, int>> rparams_now;
-        if (funcrparams)
+    }
+    pair<bool, int> leave(AstFrame &f, const AstResult *done) const
+    {
+        vector<koopa_raw_value_t> args;
+        for (int i = 0; i < f.next; i++)
         {
-            rparams_now = (dynamic_cast<FuncRParamsAST *>(funcrparams.get()))->get_params();
+            args.push_back(get_operand(done[i].res, done[i].reg));
         }
+        builder.call("@" + interner->name(ident), args);
         // int
         if (func.val == 1)
         {
-            koopa_str += "  %" + to_string(reg_cnt) + " = call @" + ident;
             reg_cnt++;
         }
-        // void
-        else
-        {
-            koopa_str += "  call @" + ident;
-        }
-        koopa_str += "(";
-
-        if (funcrparams)
-        {
-            for (int i = 0; i < rparams_now.size(); i++)
-            {
-                if (i != 0)
-                {
-                    koopa_str += ", ";
-                }
-                if (rparams_now[i].first)
-                {
-                    koopa_str += to_string(rparams_now[i].second);
-                }
-                else
-                {
-                    koopa_str += "%" + to_string(rparams_now[i].second);
-                }
-            }
-        }
-
-        koopa_str += ")\n";
 
         return make_pair(false, -1);
     }
 };
 
+// 二元运算的语义分析：两侧都能直接求值，则直接得到结果
+static void analyze_binary(BaseAST *node, string_view op, Ref<BaseAST> lhs, Ref<BaseAST> rhs)
+{
+    int res = 0;
+    bool ok = fold_binary(op, lhs->val, rhs->val, res);
+    node->is_const = ok && lhs->is_const && rhs->is_const;
+    node->val = res;
+}
+
+// 二元运算的 IR，只在不能直接求值时调用
+static pair<bool, int> lower_binary(string_view op, const AstResult *done)
+{
+    builder.binary(get_binary_op(op), get_operand(done[0].res, done[0].reg), get_operand(done[1].res, done[1].reg));
+    reg_cnt++;
+
+    return make_pair(false, -1);
+}
+
 // lv4+
 // MulExp ::= UnaryExp | MulExp [*/%] UnaryExp lv3
-class MulExpAST : public BaseAST
+class MulExpAST : public AstNode<AstKind::MulExp>
 {
 public:
     int rule;
-    string op;
-    unique_ptr<BaseAST> mulexp;
-    unique_ptr<BaseAST> unaryexp;
+    string_view op;
+    Ref<BaseAST> mulexp;
+    Ref<BaseAST> unaryexp;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
+    {
+        if (i == 0)
+            return rule == 0 ? unaryexp : mulexp;
+        if (i == 1 && rule == 1)
+            return unaryexp;
+        return Ref<BaseAST>{0};
+    }
+    void analyze_leave()
     {
         if (rule == 0)
-        {
-            return unaryexp->Koopa();
-        }
+            same_as(unaryexp);
         else
-        {
-            pair<bool, int> res_l = mulexp->Koopa();
-            int leftreg = reg_cnt - 1;
-            pair<bool, int> res_r = unaryexp->Koopa();
-            int rightreg = reg_cnt - 1;
-
-            if (res_l.first && res_r.first)
-            {
-                if (op == "*")
-                {
-                    return make_pair(true, res_l.second * res_r.second);
-                    ///////////////////////////////////////////////////
-                    koopa_str += "  %" + to_string(reg_cnt) + " = mul " + to_string(res_l.second);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == "/")
-                {
-                    return make_pair(true, res_l.second / res_r.second);
-                    /////////////////////////////////////////////////////
-                    koopa_str += "  %" + to_string(reg_cnt) + " = div " + to_string(res_l.second);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == "%")
-                {
-                    return make_pair(true, res_l.second % res_r.second);
-                    //////////////////////////////////////////////////////
-                    koopa_str += "  %" + to_string(reg_cnt) + " = mod " + to_string(res_l.second);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
-            }
-            else if (res_l.first && !res_r.first)
-            {
-                if (op == "*")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = mul " + to_string(res_l.second);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == "/")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = div " + to_string(res_l.second);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == "%")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = mod " + to_string(res_l.second);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
-            }
-            else if (!res_l.first && res_r.first)
-            {
-                if (op == "*")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = mul %" + to_string(leftreg);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == "/")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = div %" + to_string(leftreg);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == "%")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = mod %" + to_string(leftreg);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
-            }
-            else
-            {
-                if (op == "*")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = mul %" + to_string(leftreg);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == "/")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = div %" + to_string(leftreg);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == "%")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = mod %" + to_string(leftreg);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
-            }
-            return make_pair(false, -1);
-        }
+            analyze_binary(this, op, mulexp, unaryexp);
     }
-    int calc() const override
+    pair<bool, int> leave(AstFrame &, const AstResult *done) const
     {
         if (rule == 0)
         {
-            return unaryexp->calc();
-        }
-        else
-        {
-            if (op == "*")
-            {
-                return mulexp->calc() * unaryexp->calc();
-            }
-            else if (op == "/")
-            {
-                return mulexp->calc() / unaryexp->calc();
-            }
-            else
-            {
-                return mulexp->calc() % unaryexp->calc();
-            }
+            return done[0].res;
         }
+        return lower_binary(op, done);
     }
 };
 
 // lv4+
 // AddExp ::= MulExp | AddExp [+-] MulExp lv3
-class AddExpAST : public BaseAST
+class AddExpAST : public AstNode<AstKind::AddExp>
 {
 public:
     int rule;
-    string op;
-    unique_ptr<BaseAST> mulexp;
-    unique_ptr<BaseAST> addexp;
+    string_view op;
+    Ref<BaseAST> mulexp;
+    Ref<BaseAST> addexp;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
+    {
+        if (i == 0)
+            return rule == 0 ? mulexp : addexp;
+        if (i == 1 && rule == 1)
+            return mulexp;
+        return Ref<BaseAST>{0};
+    }
+    void analyze_leave()
     {
         if (rule == 0)
-        {
-            return mulexp->Koopa();
-        }
+            same_as(mulexp);
         else
+            analyze_binary(this, op, addexp, mulexp);
+    }
+    pair<bool, int> leave(AstFrame &, const AstResult *done) const
+    {
+        if (rule == 0)
         {
-            pair<bool, int> res_l = addexp->Koopa();
-            int leftreg = reg_cnt - 1;
-            pair<bool, int> res_r = mulexp->Koopa();
-            int rightreg = reg_cnt - 1;
+            return done[0].res;
+        }
+        return lower_binary(op, done);
+    }
+};
 
-            if (res_l.first && res_r.first)
-            {
-                if (op == "+")
-                {
-                    return make_pair(true, res_l.second + res_r.second);
-                    koopa_str += "  %" + to_string(reg_cnt) + " = add " + to_string(res_l.second);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == "-")
-                {
-                    return make_pair(true, res_l.second - res_r.second);
-                    koopa_str += "  %" + to_string(reg_cnt) + " = sub " + to_string(res_l.second);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
-            }
-            else if (res_l.first && !res_r.first)
-            {
-                if (op == "+")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = add " + to_string(res_l.second);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == "-")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = sub " + to_string(res_l.second);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
-            }
-            else if (!res_l.first && res_r.first)
-            {
-                if (op == "+")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = add %" + to_string(leftreg);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == "-")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = sub %" + to_string(leftreg);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
-            }
-            else
-            {
-                if (op == "+")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = add %" + to_string(leftreg);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == "-")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = sub %" + to_string(leftreg);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
-            }
+// lv4+
+// RelExp ::= AddExp | RelExp [<>LEGE] AddExp lv3
+class RelExpAST : public AstNode<AstKind::RelExp>
+{
+public:
+    int rule;
+    string_view op;
+    Ref<BaseAST> addexp;
+    Ref<BaseAST> relexp;
 
-            return make_pair(false, -1);
-        }
+    Ref<BaseAST> child(int i) const
+    {
+        if (i == 0)
+            return rule == 0 ? addexp : relexp;
+        if (i == 1 && rule == 1)
+            return addexp;
+        return Ref<BaseAST>{0};
     }
-    int calc() const override
+    void analyze_leave()
     {
         if (rule == 0)
-        {
-            return mulexp->calc();
-        }
+            same_as(addexp);
         else
+            analyze_binary(this, op, relexp, addexp);
+    }
+    pair<bool, int> leave(AstFrame &, const AstResult *done) const
+    {
+        if (rule == 0)
         {
-            if (op == "+")
-            {
-                return addexp->calc() + mulexp->calc();
-            }
-            else
-            {
-                return addexp->calc() - mulexp->calc();
-            }
+            return done[0].res;
         }
+        return lower_binary(op, done);
     }
 };
 
 // lv4+
-// RelExp ::= AddExp | RelExp [<>LEGE] AddExp lv3
-class RelExpAST : public BaseAST
+// EqExp ::= RelExp | EqExp EQ/NE RelExp lv3
+class EqExpAST : public AstNode<AstKind::EqExp>
 {
 public:
     int rule;
-    string op;
-    unique_ptr<BaseAST> addexp;
-    unique_ptr<BaseAST> relexp;
+    string_view op;
+    Ref<BaseAST> relexp;
+    Ref<BaseAST> eqexp;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
+    {
+        if (i == 0)
+            return rule == 0 ? relexp : eqexp;
+        if (i == 1 && rule == 1)
+            return relexp;
+        return Ref<BaseAST>{0};
+    }
+    void analyze_leave()
     {
         if (rule == 0)
-        {
-            return addexp->Koopa();
-        }
+            same_as(relexp);
         else
+            analyze_binary(this, op, eqexp, relexp);
+    }
+    pair<bool, int> leave(AstFrame &, const AstResult *done) const
+    {
+        if (rule == 0)
         {
-            pair<bool, int> res_l = relexp->Koopa();
-            int leftreg = reg_cnt - 1;
-            pair<bool, int> res_r = addexp->Koopa();
-            int rightreg = reg_cnt - 1;
-
-            if (res_l.first && res_r.first)
-            {
-                if (op == "<")
-                {
-                    return make_pair(true, res_l.second < res_r.second);
-                    ///////////////////////////////////////////////////
-                    koopa_str += "  %" + to_string(reg_cnt) + " = lt " + to_string(res_l.second);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == ">")
-                {
-                    return make_pair(true, res_l.second > res_r.second);
-                    /////////////////////////////////////////////////////
-                    koopa_str += "  %" + to_string(reg_cnt) + " = gt " + to_string(res_l.second);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == "<=")
-                {
-                    return make_pair(true, res_l.second <= res_r.second);
-                    //////////////////////////////////////////////////////
-                    koopa_str += "  %" + to_string(reg_cnt) + " = le " + to_string(res_l.second);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == ">=")
-                {
-                    return make_pair(true, res_l.second >= res_r.second);
-                    ///////////////////////////////////////////////////////
-                    koopa_str += "  %" + to_string(reg_cnt) + " = ge " + to_string(res_l.second);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
-            }
-            else if (res_l.first && !res_r.first)
-            {
-                if (op == "<")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = lt " + to_string(res_l.second);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == ">")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = gt " + to_string(res_l.second);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == "<=")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = le " + to_string(res_l.second);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == ">=")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = ge " + to_string(res_l.second);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
-            }
-            else if (!res_l.first && res_r.first)
-            {
-                if (op == "<")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = lt %" + to_string(leftreg);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == ">")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = gt %" + to_string(leftreg);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == "<=")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = le %" + to_string(leftreg);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == ">=")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = ge %" + to_string(leftreg);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
-            }
-            else
-            {
-                if (op == "<")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = lt %" + to_string(leftreg);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == ">")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = gt %" + to_string(leftreg);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == "<=")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = le %" + to_string(leftreg);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == ">=")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = ge %" + to_string(leftreg);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
-            }
-            return make_pair(false, -1);
+            return done[0].res;
         }
+        return lower_binary(op, done);
     }
-    int calc() const override
+};
+
+// 短路求值的值：rhs 非零为 1，否则为 0
+static koopa_raw_value_t logical_value(const AstResult &rhs)
+{
+    if (rhs.res.first)
     {
-        if (rule == 0)
-        {
-            return addexp->calc();
-        }
-        else
-        {
-            if (op == ">")
-            {
-                return relexp->calc() > addexp->calc();
-            }
-            else if (op == "<")
-            {
-                return relexp->calc() < addexp->calc();
-            }
-            else if (op == ">=")
-            {
-                return relexp->calc() >= addexp->calc();
-            }
-            else
-            {
-                return relexp->calc() <= addexp->calc();
-            }
-        }
+        return builder.integer(rhs.res.second != 0);
     }
-};
+    koopa_raw_value_t not_zero = builder.binary(KOOPA_RBO_NOT_EQ, builder.reg(rhs.reg), builder.integer(0));
+    reg_cnt++;
+    return not_zero;
+}
 
+// lv6.2短路求值
 // lv4+
-// EqExp ::= RelExp | EqExp EQ/NE RelExp lv3
-class EqExpAST : public BaseAST
+// LAndExp ::= EqExp | LAndExp AND EqExp lv3
+// 作为值时 lhs 为 0 直接带着 0 跳到 %land_end，否则在 %land_rhs 中求 rhs，结果是 %land_end 的参数
+// 作为 if/while 的条件时由 lower_cond 生成跳转，不经过这里
+class LAndExpAST : public AstNode<AstKind::LAndExp>
 {
 public:
     int rule;
-    string op;
-    unique_ptr<BaseAST> relexp;
-    unique_ptr<BaseAST> eqexp;
+    Ref<BaseAST> eqexp;
+    Ref<BaseAST> landexp;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
+    {
+        if (i == 0)
+            return rule == 0 ? eqexp : landexp;
+        if (i == 1 && rule == 1)
+            return eqexp;
+        return Ref<BaseAST>{0};
+    }
+    void analyze_leave()
     {
         if (rule == 0)
         {
-            return relexp->Koopa();
+            same_as(eqexp);
+            return;
         }
-        else
+        // lhs是0时短路，不看rhs
+        is_const = landexp->is_const && (landexp->val == 0 || eqexp->is_const);
+        val = landexp->val && eqexp->val;
+    }
+    bool enter(int i, AstFrame &f, const AstResult *done) const
+    {
+        if (rule == 0)
         {
-            pair<bool, int> res_l = eqexp->Koopa();
-            int leftreg = reg_cnt - 1;
-            pair<bool, int> res_r = relexp->Koopa();
-            int rightreg = reg_cnt - 1;
+            return true;
+        }
+        if (i == 0)
+        {
+            logical++;
+            f.tag = logical;
+        }
+        else if (i == 1)
+        {
+            string rhs_tag = "%land_rhs_" + to_string(f.tag);
+            string end_tag = "%land_end_" + to_string(f.tag);
 
-            // 似乎可以优化
-            if (res_l.first && res_r.first)
-            {
-                if (op == "==")
-                {
-                    return make_pair(true, res_l.second == res_r.second);
-                    ////////////////////////////////////////////////////
-                    koopa_str += "  %" + to_string(reg_cnt) + " = eq " + to_string(res_l.second);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == "!=")
-                {
-                    return make_pair(true, res_l.second != res_r.second);
-                    /////////////////////////////////////////////////////
-                    koopa_str += "  %" + to_string(reg_cnt) + " = ne " + to_string(res_l.second);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
-            }
-            else if (res_l.first && !res_r.first)
-            {
-                if (op == "==")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = eq " + to_string(res_l.second);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == "!=")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = ne " + to_string(res_l.second);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
-            }
-            else if (!res_l.first && res_r.first)
+            // 短路求值：lhs是0？
+            // lhs是数字时一定不是0，否则整个表达式在语义分析中就能求值
+            if (done[0].res.first)
             {
-                if (op == "==")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = eq %" + to_string(leftreg);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == "!=")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = ne %" + to_string(leftreg);
-                    koopa_str += ", " + to_string(res_r.second) + "\n";
-                    reg_cnt++;
-                }
+                builder.jump(builder.block(rhs_tag));
             }
             else
             {
-                if (op == "==")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = eq %" + to_string(leftreg);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
-                else if (op == "!=")
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = ne %" + to_string(leftreg);
-                    koopa_str += ", %" + to_string(rightreg) + "\n";
-                    reg_cnt++;
-                }
+                builder.branch(builder.reg(done[0].reg), builder.block(rhs_tag), {}, builder.block(end_tag), {builder.integer(0)});
             }
-            return make_pair(false, -1);
+            builder.set_block(builder.block(rhs_tag));
         }
+        return true;
     }
-    int calc() const override
+    pair<bool, int> leave(AstFrame &f, const AstResult *done) const
     {
         if (rule == 0)
         {
-            return relexp->calc();
-        }
-        else
-        {
-            if (op == "==")
-            {
-                return eqexp->calc() == relexp->calc();
-            }
-            else
-            {
-                return eqexp->calc() != relexp->calc();
-            }
+            return done[0].res;
         }
+
+        // 这里，lhs非0，结果就是rhs是否非0
+        auto end = builder.block("%land_end_" + to_string(f.tag));
+        builder.jump(end, {logical_value(done[1])});
+        builder.set_block(end);
+        builder.block_param(end, builder.int_type());
+        reg_cnt++;
+
+        return make_pair(false, -1);
     }
 };
 
 // lv6.2短路求值
 // lv4+
-// LAndExp ::= EqExp | LAndExp AND EqExp lv3
-class LAndExpAST : public BaseAST
+// LOrExp ::= LAndExp | LOrExp OR LAndExp lv3
+// 与 LAndExp 对称：lhs 非 0 直接带着 1 跳到 %lor_end
+class LOrExpAST : public AstNode<AstKind::LOrExp>
 {
 public:
     int rule;
-    unique_ptr<BaseAST> eqexp;
-    unique_ptr<BaseAST> landexp;
+    Ref<BaseAST> landexp;
+    Ref<BaseAST> lorexp;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
+    {
+        if (i == 0)
+            return rule == 0 ? landexp : lorexp;
+        if (i == 1 && rule == 1)
+            return landexp;
+        return Ref<BaseAST>{0};
+    }
+    void analyze_leave()
     {
         if (rule == 0)
         {
-            return eqexp->Koopa();
+            same_as(landexp);
+            return;
         }
-        else
+        // lhs非0时短路，不看rhs
+        is_const = lorexp->is_const && (lorexp->val != 0 || landexp->is_const);
+        val = lorexp->val || landexp->val;
+    }
+    bool enter(int i, AstFrame &f, const AstResult *done) const
+    {
+        if (rule == 0)
+        {
+            return true;
+        }
+        if (i == 0)
         {
             logical++;
-            int now_logic = logical;
-
-            string then_tag = "%not_zero_" + to_string(now_logic);
-            string end_tag = "%is_zero_" + to_string(now_logic);
-            string res_tag = "@result_" + to_string(now_logic);
-
-            koopa_str += "  " + res_tag + " = alloc i32\n";
-            koopa_str += "  store 0, " + res_tag + "\n";
+            f.tag = logical;
+        }
+        else if (i == 1)
+        {
+            string rhs_tag = "%lor_rhs_" + to_string(f.tag);
+            string end_tag = "%lor_end_" + to_string(f.tag);
 
-            pair<bool, int> res_l = landexp->Koopa();
-            int leftreg = reg_cnt - 1;
-            // 短路求值：lhs是0？
-            // step1: 判断lhs是否是0
-            // case1：lhs是一个数字
-            if (res_l.first)
+            // lhs是数字时一定是0
+            if (done[0].res.first)
             {
-                if (res_l.second == 0)
-                {
-                    return make_pair(true, 0);
-                }
-                // 如果不是0的话，直接忽略
-                koopa_str += "  jump " + then_tag + "\n\n";
+                builder.jump(builder.block(rhs_tag));
             }
             else
             {
-                koopa_str += "  br %" + to_string(leftreg) + ", " + then_tag + ", " + end_tag + "\n\n";
+                builder.branch(builder.reg(done[0].reg), builder.block(end_tag), {builder.integer(1)}, builder.block(rhs_tag), {});
             }
-            koopa_str += then_tag + ":\n";
-
-            pair<bool, int> res_r = eqexp->Koopa();
-            int rightreg = reg_cnt - 1;
-
-            // 这里，lhs非0
-            if (res_r.first)
-            {
-                // res默认为0，所以如果是0，无需改变，直接jump即可
-                if (res_r.second == 0)
-                {
-                    koopa_str += "  jump " + end_tag + "\n\n";
-                }
-                else
-                { // 已知只有非0的时候会到达这里
-                  // 把res记为1再jump
-                    koopa_str += "  store 1, " + res_tag + "\n";
-                    koopa_str += "  jump " + end_tag + "\n\n";
-                }
-            }
-            else
-            { // 结果在寄存器中
-                // step1: 寄存器中的值是否为0？如果是0返回0，否则返回1
-                koopa_str += "  %" + to_string(reg_cnt) + " = ne %" + to_string(rightreg) + ", 0\n";
-                reg_cnt++;
-                // step2: 把step1返回的结果存入res，然后jump
-                koopa_str += "  store %" + to_string(reg_cnt - 1) + ", " + res_tag + "\n";
-                koopa_str += "  jump " + end_tag + "\n\n";
-            }
-
-            koopa_str += end_tag + ":\n";
-
-            koopa_str += "  %" + to_string(reg_cnt) + " = load " + res_tag + "\n";
-            reg_cnt++;
-
-            return make_pair(false, -1);
+            builder.set_block(builder.block(rhs_tag));
         }
+        return true;
     }
-    int calc() const override
+    pair<bool, int> leave(AstFrame &f, const AstResult *done) const
     {
         if (rule == 0)
         {
-            return eqexp->calc();
-        }
-        else
-        {
-            return landexp->calc() && eqexp->calc();
+            return done[0].res;
         }
+
+        auto end = builder.block("%lor_end_" + to_string(f.tag));
+        builder.jump(end, {logical_value(done[1])});
+        builder.set_block(end);
+        builder.block_param(end, builder.int_type());
+        reg_cnt++;
+
+        return make_pair(false, -1);
     }
 };
 
-// lv6.2短路求值
-// lv4+
-// LOrExp ::= LAndExp | LOrExp OR LAndExp lv3
-class LOrExpAST : public BaseAST
+// 把 && 或 || 连成的链 op[0] op op[1] op ... 展开，左结合的链很长时也不会递归
+template <typename Node>
+static vector<Ref<BaseAST>> logical_chain(Ref<BaseAST> exp)
 {
-public:
-    int rule;
-    unique_ptr<BaseAST> landexp;
-    unique_ptr<BaseAST> lorexp;
-
-    pair<bool, int> Koopa() const override
+    vector<Ref<BaseAST>> ops;
+    while (true)
     {
-        if (rule == 0)
+        Node *n = exp->as<Node>();
+        if (n->rule == 0)
         {
-            return landexp->Koopa();
+            ops.push_back(exp);
+            break;
         }
-        else
+        ops.push_back(n->child(1));
+        exp = n->child(0);
+        if (exp->is_const)
         {
-            logical++;
-            int now_logic = logical;
-
-            string then_tag = "%is_zero_" + to_string(now_logic);
-            string end_tag = "%not_zero_" + to_string(now_logic);
-            string res_tag = "@result_" + to_string(now_logic);
-
-            // 规避错误：Instruction does not dominate all uses!
-            koopa_str += "  " + res_tag + " = alloc i32\n";
-            koopa_str += "  store 1, " + res_tag + "\n";
+            ops.push_back(exp);
+            break;
+        }
+    }
+    reverse(ops.begin(), ops.end());
+    return ops;
+}
 
-            pair<bool, int> res_l = lorexp->Koopa();
-            int leftreg = reg_cnt - 1;
+// lower_cond 的一项工作：从 start（为空时就是当前基本块）开始，按 exp 的值跳转到 true_bb 或 false_bb
+// chain 为 '&' / '|' 时 exp 是 && / || 链中除最后一项之外的一项，它为真 / 为假时跳到新建的
+// %land_rhs / %lor_rhs，链中的下一项就在工作栈中紧挨着它的下面，从这个基本块开始
+struct CondFrame
+{
+    Ref<BaseAST> exp;
+    koopa_raw_basic_block_t true_bb;
+    koopa_raw_basic_block_t false_bb;
+    koopa_raw_basic_block_t start;
+    char chain;
+};
 
-            // 以下过程近似于LAndExp的短路求值，注释略去
+// 用显式的工作栈展开条件，&& 和 || 交替嵌套很深时也不会递归
+static void lower_cond(Ref<BaseAST> cond, koopa_raw_basic_block_t cond_true, koopa_raw_basic_block_t cond_false)
+{
+    vector<CondFrame> work;
+    work.push_back(CondFrame{cond, cond_true, cond_false, nullptr, 0});
+    while (!work.empty())
+    {
+        CondFrame f = work.back();
+        work.pop_back();
+        if (f.start != nullptr)
+            builder.set_block(f.start);
+        if (f.chain != 0)
+        {
+            logical++;
+            if (f.chain == '&')
+                work.back().start = f.true_bb = builder.block("%land_rhs_" + to_string(logical));
+            else
+                work.back().start = f.false_bb = builder.block("%lor_rhs_" + to_string(logical));
+        }
 
-            if (res_l.first)
+        Ref<BaseAST> exp = f.exp;
+        koopa_raw_basic_block_t true_bb = f.true_bb, false_bb = f.false_bb;
+        // 展开成链时各项压入工作栈，这一项不再求值
+        bool expanded = false;
+        while (!exp->is_const)
+        {
+            // 只有一个子节点的表达式直接看子节点，! 交换两个目标
+            Ref<BaseAST> sub{0};
+            switch (exp->kind)
+            {
+            case AstKind::Exp:
+                sub = exp->as<ExpAST>()->lorexp;
+                break;
+            case AstKind::PrimaryExp:
+                if (exp->as<PrimaryExpAST>()->rule == 0)
+                    sub = exp->as<PrimaryExpAST>()->exp;
+                break;
+            case AstKind::UnaryExp:
             {
-                if (res_l.second != 0)
+                UnaryExpAST *n = exp->as<UnaryExpAST>();
+                if (n->rule == 0)
+                    sub = n->primaryexp;
+                else if (n->op == "+")
+                    sub = n->unaryexp;
+                else if (n->op == "!")
                 {
-                    return make_pair(true, 1);
+                    swap(true_bb, false_bb);
+                    sub = n->unaryexp;
                 }
-                koopa_str += "  jump " + then_tag + "\n\n";
-            }
-            else
-            {
-                koopa_str += "  br %" + to_string(leftreg) + ", " + end_tag + ", " + then_tag + "\n\n";
+                break;
             }
-
-            koopa_str += then_tag + ":\n";
-
-            pair<bool, int> res_r = landexp->Koopa();
-            int rightreg = reg_cnt - 1;
-
-            if (res_r.first)
+            case AstKind::MulExp:
+                if (exp->as<MulExpAST>()->rule == 0)
+                    sub = exp->as<MulExpAST>()->unaryexp;
+                break;
+            case AstKind::AddExp:
+                if (exp->as<AddExpAST>()->rule == 0)
+                    sub = exp->as<AddExpAST>()->mulexp;
+                break;
+            case AstKind::RelExp:
+                if (exp->as<RelExpAST>()->rule == 0)
+                    sub = exp->as<RelExpAST>()->addexp;
+                break;
+            case AstKind::EqExp:
+                if (exp->as<EqExpAST>()->rule == 0)
+                    sub = exp->as<EqExpAST>()->relexp;
+                break;
+            case AstKind::LAndExp:
             {
-                if (res_r.second != 0)
+                if (exp->as<LAndExpAST>()->rule == 0)
                 {
-                    koopa_str += "  jump " + end_tag + "\n\n";
+                    sub = exp->as<LAndExpAST>()->eqexp;
+                    break;
                 }
-                else
+                // a && b：a 为假时跳到 false_bb，否则在 %land_rhs 中看 b
+                // 从最后一项开始压栈，第一项最先处理
+                vector<Ref<BaseAST>> ops = logical_chain<LAndExpAST>(exp);
+                work.push_back(CondFrame{ops.back(), true_bb, false_bb, nullptr, 0});
+                for (size_t k = ops.size() - 1; k-- > 0;)
+                    work.push_back(CondFrame{ops[k], nullptr, false_bb, nullptr, '&'});
+                expanded = true;
+                break;
+            }
+            case AstKind::LOrExp:
+            {
+                if (exp->as<LOrExpAST>()->rule == 0)
                 {
-                    koopa_str += "  store 0, " + res_tag + "\n";
-                    koopa_str += "  jump " + end_tag + "\n\n";
+                    sub = exp->as<LOrExpAST>()->landexp;
+                    break;
                 }
+                // a || b：a 为真时跳到 true_bb，否则在 %lor_rhs 中看 b
+                vector<Ref<BaseAST>> ops = logical_chain<LOrExpAST>(exp);
+                work.push_back(CondFrame{ops.back(), true_bb, false_bb, nullptr, 0});
+                for (size_t k = ops.size() - 1; k-- > 0;)
+                    work.push_back(CondFrame{ops[k], true_bb, nullptr, nullptr, '|'});
+                expanded = true;
+                break;
             }
-            else
-            {
-                koopa_str += "  %" + to_string(reg_cnt) + " = ne %" + to_string(rightreg) + ", 0\n";
-                reg_cnt++;
-                koopa_str += "  store %" + to_string(reg_cnt - 1) + ", " + res_tag + "\n";
-                koopa_str += "  jump " + end_tag + "\n\n";
+            default:
+                break;
             }
-
-            koopa_str += end_tag + ":\n";
-
-            koopa_str += "  %" + to_string(reg_cnt) + " = load " + res_tag + "\n";
-            reg_cnt++;
-
-            return make_pair(false, -1);
+            if (!sub)
+                break;
+            exp = sub;
         }
-    }
-    int calc() const override
-    {
-        if (rule == 0)
+        if (expanded)
+            continue;
+
+        // 其他表达式求值后非零即为真，比较的结果直接用于跳转
+        if (exp->is_const)
         {
-            return landexp->calc();
+            builder.jump(exp->val != 0 ? true_bb : false_bb);
+            continue;
         }
+        pair<bool, int> res = exp->Koopa();
+        if (res.first)
+            builder.jump(res.second != 0 ? true_bb : false_bb);
         else
-        {
-            return lorexp->calc() || landexp->calc();
-        }
+            builder.branch(builder.reg(reg_cnt - 1), true_bb, false_bb);
     }
-};
+}
 
 // Decl 声明：常量/变量 ConstDecl | VarDecl lv4
-class DeclAST : public BaseAST
+class DeclAST : public AstNode<AstKind::Decl>
 {
 public:
     int rule;
-    unique_ptr<BaseAST> constdecl;
-    unique_ptr<BaseAST> vardecl;
+    Ref<BaseAST> constdecl;
+    Ref<BaseAST> vardecl;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
     {
-        if (rule == 0)
-        {
-            return constdecl->Koopa();
-        }
-        else
-        {
-            return vardecl->Koopa();
-        }
+        if (i > 0)
+            return Ref<BaseAST>{0};
+        return rule == 0 ? constdecl : vardecl;
     }
 };
 
 // ConstDecl 声明常量，需要列表 CONST BType ConstDef {"," ConstDef} ";"; lv4
 // 示例 const int a = 3,b = 5;
-class ConstDeclAST : public BaseAST
+class ConstDeclAST : public AstNode<AstKind::ConstDecl>
 {
 public:
-    vector<unique_ptr<BaseAST>> constDefList;
+    List constDefList;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
     {
-        for (auto &i : constDefList)
-        {
-            i->Koopa();
-        }
-
-        return make_pair(false, -1);
+        return i < (int)constDefList.size() ? constDefList[i] : Ref<BaseAST>{0};
     }
 };
 
 // ConstDef 常量定义 IDENT "=" ConstInitVal lv4
 // 示例 a = 3+5
-class ConstDefAST : public BaseAST
+// 常量直接存入符号表，不生成 IR
+class ConstDefAST : public AstNode<AstKind::ConstDef>
 {
 public:
-    string ident;
-    unique_ptr<BaseAST> constinitval; // InitValAST
+    int ident;
+    Ref<BaseAST> constinitval; // InitValAST
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
     {
-        int val = constinitval->calc();
-        Value tmp(CONSTANT, val, block_handler.block_now.index);
+        return i == 0 ? constinitval : Ref<BaseAST>{0};
+    }
+    void analyze_leave()
+    {
+        Value tmp(CONSTANT, constinitval->val, scope_handler.block_now.index);
         symbol_list.addSymbol(ident, tmp);
-
-        return make_pair(false, -1);
     }
+    bool enter(int, AstFrame &, const AstResult *) const { return false; }
 };
 
 // lv9 done
-class InitValWithListAST : public BaseAST
+class InitValWithListAST : public AstNode<AstKind::InitValWithList>
 {
 public:
-    vector<unique_ptr<BaseAST>> init_val_list;
+    List init_val_list;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
     {
-        return make_pair(false, -1);
+        return i < (int)init_val_list.size() ? init_val_list[i] : Ref<BaseAST>{0};
     }
-    bool is_list() const override
-    {
-        return true;
-    }
-    void getInitVal(string *ptr, const vector<int> &len)
+
+    // 按初始化列表的结构找到每个元素展开成一维后的下标，依次调用 f(下标, 元素)
+    // base 是这个列表对应的子数组的起始下标
+    template <typename F>
+    void forEachInit(int base, const vector<int> &len, F &&f) const
     {
         int n = len.size();
         vector<int> width(n);
@@ -1744,22 +1718,8 @@ public:
         {
             if (!init_val->is_list())
             {
-                if (is_global)
-                {
-                    ptr[i++] = to_string(init_val->calc());
-                }
-                else
-                {
-                    pair<bool, int> res = init_val->Koopa();
-                    if (res.first)
-                    {
-                        ptr[i++] = to_string(res.second);
-                    }
-                    else
-                    {
-                        ptr[i++] = "%" + to_string(reg_cnt - 1);
-                    }
-                }
+                f(base + i, init_val);
+                i++;
             }
             else
             {
@@ -1778,470 +1738,372 @@ public:
                     }
                     ++j;
                 }
-                dynamic_cast<InitValWithListAST *>(init_val.get())->getInitVal(ptr + i, vector<int>(len.begin() + j, len.end()));
+                init_val->as<InitValWithListAST>()->forEachInit(base + i, vector<int>(len.begin() + j, len.end()), f);
                 i += width[j];
             }
             if (i >= width[0])
                 break;
         }
     }
+
+    // 全局数组的初始值在语义分析中已经求出，局部数组则生成计算初始值的 IR
+    // 非零的元素按下标顺序加入 init
+    void getInitVal(ArrayInit &init, const vector<int> &len, bool global) const
+    {
+        forEachInit(0, len, [&](int i, const Ref<BaseAST> &init_val)
+        {
+            if (global)
+            {
+                if (init_val->val != 0)
+                    init.emplace_back(i, builder.integer(init_val->val));
+            }
+            else
+            {
+                pair<bool, int> res = init_val->Koopa();
+                if (!res.first || res.second != 0)
+                    init.emplace_back(i, get_operand(res, reg_cnt - 1));
+            }
+        });
+    }
 };
 
+// 数组定义的语义分析，子节点为各维长度，然后是初始化列表
+// 各维长度求出后得到数组的类型，在处理初始化列表之前加入符号表
+static void analyze_array_def(int i, int ident, const List &array_size_list, koopa_raw_type_t &ty, int &index)
+{
+    if (i == (int)array_size_list.size())
+    {
+        ty = getArrayType(array_size_list);
+        index = scope_handler.block_now.index;
+        // 数组放入符号表
+        symbol_list.addSymbol(ident, Value(ARRAY, array_size_list.size(), index));
+    }
+}
+
 // lv9 done
 // 示例 const int a[10] = {1, 2, 3, 4, 5};
 // 注意不能够像int常量一样直接存入符号表
 // 必须体现在IR当中
-class ConstDefArrayAST : public BaseAST
+class ConstDefArrayAST : public AstNode<AstKind::ConstDefArray>
 {
 public:
-    string ident;
-    unique_ptr<BaseAST> constinitval; // InitValWithListAST 列表
-    vector<unique_ptr<BaseAST>> array_size_list;
-    pair<bool, int> Koopa() const override
+    int ident;
+    Ref<BaseAST> constinitval; // InitValWithListAST 列表
+    List array_size_list;
+    // 语义分析的结果：数组的类型，所在基本块的编号（0 表示全局）
+    koopa_raw_type_t ty;
+    int index;
+
+    Ref<BaseAST> child(int i) const
     {
-        vector<int> len;
-        for (auto &i : array_size_list)
-        {
-            len.push_back(i->calc());
-        }
-        int array_size = array_size_list.size();
-        Value const_array = Value(ARRAY, array_size, block_handler.block_now.index);
-        // 数组放入符号表
-        symbol_list.addSymbol(ident, const_array);
+        if (i < (int)array_size_list.size())
+            return array_size_list[i];
+        return i == (int)array_size_list.size() ? constinitval : Ref<BaseAST>{0};
+    }
+    bool analyze_enter(int i)
+    {
+        analyze_array_def(i, ident, array_size_list, ty, index);
+        return true;
+    }
+    // 初始值都已求出，保存在符号表中，常量下标的读取可以直接折叠
+    void analyze_leave()
+    {
+        vector<int> len = getArrayLen(ty);
+        vector<pair<int, int>> elems;
+        constinitval->as<InitValWithListAST>()->forEachInit(0, len, [&](int i, const Ref<BaseAST> &init_val)
+        {
+            if (init_val->val != 0)
+                elems.emplace_back(i, init_val->val);
+        });
+        int init = symbol_list.addConstArray(len, elems);
+        symbol_list.addSymbol(ident, Value(ARRAY, array_size_list.size(), index, init));
+    }
+    bool enter(int, AstFrame &, const AstResult *) const { return false; }
+    pair<bool, int> leave(AstFrame &, const AstResult *) const
+    {
+        vector<int> len = getArrayLen(ty);
 
         // 处理初始化列表
         // 先把所有初始值置为0
         // 再根据constinitval的值来修改
-        int tot_len = 1;
-        for (auto i : len)
-        {
-            tot_len *= i;
-        }
-        string *init = new string[tot_len];
-        for (int i = 0; i < tot_len; ++i)
-        {
-            init[i] = "0";
-        }
-        dynamic_cast<InitValWithListAST *>(constinitval.get())->getInitVal(init, len);
-        string init_str = getInitList(init, len);
-
-        // name tag
-        string name_tag = "@" + ident + "_" + to_string(block_handler.block_now.index);
-
-        // type tag
-        string type_tag = "i32";
-        int array_len = array_size_list.size();
-        for (int i = array_len - 1; i >= 0; i--)
-        {
-            type_tag = "[" + type_tag + ", " + to_string(array_size_list[i]->calc()) + "]";
-        }
-
-        if (is_global) // 全局常量
-        {
-            koopa_str += "global " + name_tag + " = alloc ";
-            koopa_str += type_tag + ", " + init_str + "\n";
-        }
-        else // 非全
+        int tot_len = 1;
+        for (auto i : len)
         {
-            koopa_str += "  " + name_tag + " = alloc " + type_tag + "\n";
-            initArray(name_tag, init, len);
+            tot_len *= i;
         }
+        ArrayInit init;
+        constinitval->as<InitValWithListAST>()->getInitVal(init, len, true);
+
+        // 初始值在语义分析中已经求出，局部的常量数组也定义成只读的全局变量，不必每次进入作用域都重新初始化
+        // 名字中有基本块的编号，不会与其他全局变量重复
+        builder.global_alloc(var_name(ident, index), ty, arrayInitializer(ty, len, tot_len, init), true);
         return make_pair(false, -1);
     }
 };
 
 // ConstInitVal 常量赋值 ConstExp lv4
-class ConstInitValAST : public BaseAST
+class ConstInitValAST : public AstNode<AstKind::ConstInitVal>
 {
 public:
-    unique_ptr<BaseAST> constexp;
+    Ref<BaseAST> constexp;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
+    {
+        return i == 0 ? constexp : Ref<BaseAST>{0};
+    }
+    void analyze_leave()
+    {
+        same_as(constexp);
+    }
+    pair<bool, int> leave(AstFrame &, const AstResult *done) const
     {
-        return constexp->Koopa();
+        return done[0].res;
     }
 };
 
 // ConstExp 常量赋值表达式 Exp lv4
-class ConstExpAST : public BaseAST
+class ConstExpAST : public AstNode<AstKind::ConstExp>
 {
 public:
-    unique_ptr<BaseAST> exp;
+    Ref<BaseAST> exp;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
     {
-        return exp->Koopa();
+        return i == 0 ? exp : Ref<BaseAST>{0};
+    }
+    void analyze_leave()
+    {
+        same_as(exp);
+    }
+    pair<bool, int> leave(AstFrame &, const AstResult *done) const
+    {
+        return done[0].res;
     }
 };
 
 // BlockItem Decl | Stmt lv4
-class BlockItemAST : public BaseAST
+class BlockItemAST : public AstNode<AstKind::BlockItem>
 {
 public:
     int rule;
-    unique_ptr<BaseAST> decl;
-    unique_ptr<BaseAST> stmt;
+    Ref<BaseAST> decl;
+    Ref<BaseAST> stmt;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
     {
-        if (rule == 0)
-            return decl->Koopa();
-        else
-            return stmt->Koopa();
+        if (i > 0)
+            return Ref<BaseAST>{0};
+        return rule == 0 ? decl : stmt;
+    }
+    pair<bool, int> leave(AstFrame &, const AstResult *done) const
+    {
+        return done[0].res;
     }
 };
 
 // Lval （右值）变量名 IDENT lv4
-class LValAST : public BaseAST
+class LValAST : public AstNode<AstKind::LVal>
 {
 public:
-    string ident;
+    int ident;
+    // 语义分析的结果：引用的符号
+    Value sym;
 
-    pair<bool, int> Koopa() const override
+    void analyze_leave()
     {
-        Value cur_var = symbol_list.getSymbol(ident);
+        sym = symbol_list.getSymbol(ident);
         // 常量
-        if (cur_var.type == CONSTANT)
-        {
-            return make_pair(true, cur_var.val);
-        }
+        is_const = sym.type == CONSTANT;
+        val = sym.val;
+    }
+    pair<bool, int> leave(AstFrame &, const AstResult *) const
+    {
         // 变量
-        else if (cur_var.type == VAR)
+        if (sym.type == VAR)
         {
-            koopa_str += "  %" + to_string(reg_cnt) + " = load @" + ident + "_" + to_string(cur_var.name_index) + "\n";
+            builder.load(builder.value(var_name(ident, sym.name_index)));
             reg_cnt++;
             // !!!
             return make_pair(false, -1);
         }
-        else if (cur_var.type == ARRAY)
+        else if (sym.type == ARRAY)
         {
-            string array_ident = "@" + ident + "_" + to_string(cur_var.name_index);
-            koopa_str += "  %" + to_string(reg_cnt) + " = getelemptr " + array_ident + ", 0\n";
+            builder.get_elem_ptr(builder.value(var_name(ident, sym.name_index)), builder.integer(0));
             reg_cnt++;
 
             return make_pair(false, -1);
         }
         else
         {
-            // string array_ident = "@" + ident + "_" + to_string(cur_var.name_index);
-            // koopa_str += "  %" + to_string(reg_cnt) + " = getptr " + array_ident + ", 0\n";
-            // reg_cnt++;
-            string array_ident = "@" + ident + "_" + to_string(cur_var.name_index);
-            koopa_str += "  %" + to_string(reg_cnt) + " = load " + array_ident + "\n";
+            builder.load(builder.value(var_name(ident, sym.name_index)));
             reg_cnt++;
             return make_pair(false, -1);
         }
     }
-    int calc() const override
+};
+
+// 数组元素的地址：每个下标求值之后立即计算对应的指针，指针保存在 f.value 中
+// 左值和右值的数组访问共用，在第 i 个下标之前调用
+static bool array_index(int i, int ident, const Value &sym, AstFrame &f, const AstResult *done)
+{
+    if (i == 0)
+    {
+        string array_ident = var_name(ident, sym.name_index);
+        // 数组
+        if (sym.type == ARRAY)
+        {
+            f.value = builder.value(array_ident);
+        }
+        else if (sym.type == POINTER)
+        { // 指针（函数参数）
+            // step1 取出对应参数
+            f.value = builder.load(builder.value(array_ident));
+            reg_cnt++;
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+
+    const AstResult &res = done[i - 1];
+    if (sym.type == POINTER && i == 1)
+    {
+        f.value = builder.get_ptr(f.value, get_operand(res.res, res.reg));
+    }
+    else
     {
-        Value cur_var = symbol_list.getSymbol(ident);
-        return cur_var.val;
+        f.value = builder.get_elem_ptr(f.value, get_operand(res.res, res.reg));
     }
-};
+    reg_cnt++;
+    return true;
+}
 
 // lv9 unfinished
 // （右值）数组变量
 // Lval lv9 IDENT ArraySizeList 示例 c = a[2][5]
-class LValArrayAST : public BaseAST
+class LValArrayAST : public AstNode<AstKind::LValArray>
 {
 public:
-    string ident;
-    vector<unique_ptr<BaseAST>> array_size_list;
+    int ident;
+    List array_size_list;
+    Value sym;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
+    {
+        return i < (int)array_size_list.size() ? array_size_list[i] : Ref<BaseAST>{0};
+    }
+    void analyze_leave()
+    {
+        sym = symbol_list.getSymbol(ident);
+        // 常量数组的元素，下标都是常量时直接取初始值
+        if (sym.init < 0 || (int)array_size_list.size() != sym.val)
+            return;
+        vector<int> index;
+        for (auto &i : array_size_list)
+        {
+            if (!i->is_const)
+                return;
+            index.push_back(i->val);
+        }
+        is_const = symbol_list.getConstElem(sym.init, index, val);
+    }
+    bool enter(int i, AstFrame &f, const AstResult *done) const
+    {
+        return array_index(i, ident, sym, f, done);
+    }
+    pair<bool, int> leave(AstFrame &f, const AstResult *) const
     {
-        Value lval = symbol_list.getSymbol(ident);
         int len = array_size_list.size();
-        string array_ident = "@" + ident + "_" + to_string(lval.name_index);
+        koopa_raw_value_t ptr = f.value;
         // 数组
-        if (lval.type == ARRAY)
+        if (sym.type == ARRAY)
         {
-            if (lval.val == len)
+            if (sym.val == len)
             { // 读取一个数组项
-                for (int i = 0; i < len; i++)
-                {
-                    string array_index;
-                    int last_index = reg_cnt - 1;
-                    pair<bool, int> res = array_size_list[i]->Koopa();
-                    if (res.first)
-                    {
-                        array_index = to_string(res.second);
-                    }
-                    else
-                    {
-                        array_index = "%" + to_string(reg_cnt - 1);
-                    }
-
-                    if (i == 0)
-                    {
-                        koopa_str += "  %" + to_string(reg_cnt) + " = getelemptr ";
-                        koopa_str += array_ident + ", " + array_index + "\n";
-                    }
-                    else
-                    {
-                        koopa_str += "  %" + to_string(reg_cnt) + " = getelemptr ";
-                        koopa_str += "%" + to_string(last_index) + ", " + array_index + "\n";
-                    }
-
-                    reg_cnt++;
-                }
-                koopa_str += "  %" + to_string(reg_cnt) + " = load %" + to_string(reg_cnt - 1) + "\n";
-                reg_cnt++;
-                return make_pair(false, -1);
+                builder.load(ptr);
             }
             else // 读取一个部分解引用
             {
-                for (int i = 0; i < len; i++)
-                {
-                    string array_index;
-                    int last_index = reg_cnt - 1;
-                    pair<bool, int> res = array_size_list[i]->Koopa();
-                    if (res.first)
-                    {
-                        array_index = to_string(res.second);
-                    }
-                    else
-                    {
-                        array_index = "%" + to_string(reg_cnt - 1);
-                    }
-
-                    if (i == 0)
-                    {
-                        koopa_str += "  %" + to_string(reg_cnt) + " = getelemptr ";
-                        koopa_str += array_ident + ", " + array_index + "\n";
-                    }
-                    else
-                    {
-                        koopa_str += "  %" + to_string(reg_cnt) + " = getelemptr ";
-                        koopa_str += "%" + to_string(last_index) + ", " + array_index + "\n";
-                    }
-
-                    reg_cnt++;
-                }
-
-                koopa_str += "  %" + to_string(reg_cnt) + " = getelemptr ";
-                if (array_size_list.size() == 0)
-                    koopa_str += array_ident;
-                else
-                    koopa_str += "%" + to_string(reg_cnt - 1);
-                koopa_str += ", 0\n";
-                reg_cnt++;
-
-                return make_pair(false, -1);
+                builder.get_elem_ptr(ptr, builder.integer(0));
             }
+            reg_cnt++;
+            return make_pair(false, -1);
         }
-        else if (lval.type == POINTER)
-        { // 指针（函数参数）
-            if (lval.val == len)
+        else if (sym.type == POINTER)
+        {
+            if (sym.val == len)
             {
-                // step1 取出对应参数
-                koopa_str += "  %" + to_string(reg_cnt) + " = load " + array_ident + "\n";
-                reg_cnt++;
-
-                for (int i = 0; i < len; i++)
-                {
-                    string array_index;
-                    int last_index = reg_cnt - 1;
-                    pair<bool, int> res = array_size_list[i]->Koopa();
-                    if (res.first)
-                    {
-                        array_index = to_string(res.second);
-                    }
-                    else
-                    {
-                        array_index = "%" + to_string(reg_cnt - 1);
-                    }
-
-                    if (i == 0)
-                    {
-                        koopa_str += "  %" + to_string(reg_cnt) + " = getptr ";
-                        koopa_str += "%" + to_string(last_index) + ", " + array_index + "\n";
-                    }
-                    else
-                    {
-                        koopa_str += "  %" + to_string(reg_cnt) + " = getelemptr ";
-                        koopa_str += "%" + to_string(last_index) + ", " + array_index + "\n";
-                    }
-
-                    reg_cnt++;
-                }
-                koopa_str += "  %" + to_string(reg_cnt) + " = load %" + to_string(reg_cnt - 1) + "\n";
-                reg_cnt++;
-                return make_pair(false, -1);
+                builder.load(ptr);
+            }
+            else if (len == 0)
+            {
+                builder.get_ptr(ptr, builder.integer(0));
             }
             else
             {
-                // step1 取出对应参数
-                koopa_str += "  %" + to_string(reg_cnt) + " = load " + array_ident + "\n";
-                reg_cnt++;
-
-                for (int i = 0; i < len; i++)
-                {
-                    string array_index;
-                    int last_index = reg_cnt - 1;
-                    pair<bool, int> res = array_size_list[i]->Koopa();
-                    if (res.first)
-                    {
-                        array_index = to_string(res.second);
-                    }
-                    else
-                    {
-                        array_index = "%" + to_string(reg_cnt - 1);
-                    }
-
-                    if (i == 0)
-                    {
-                        koopa_str += "  %" + to_string(reg_cnt) + " = getptr ";
-                        koopa_str += "%" + to_string(last_index) + ", " + array_index + "\n";
-                    }
-                    else
-                    {
-                        koopa_str += "  %" + to_string(reg_cnt) + " = getelemptr ";
-                        koopa_str += "%" + to_string(last_index) + ", " + array_index + "\n";
-                    }
-
-                    reg_cnt++;
-                }
-
-                if (array_size_list.size() == 0)
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = getptr ";
-                    koopa_str += "%" + to_string(reg_cnt - 1) + ", 0\n";
-                }
-                else
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = getelemptr ";
-                    koopa_str += "%" + to_string(reg_cnt - 1) + ", 0\n";
-                }
-                reg_cnt++;
-                return make_pair(false, -1);
+                builder.get_elem_ptr(ptr, builder.integer(0));
             }
+            reg_cnt++;
+            return make_pair(false, -1);
         }
         return make_pair(false, -1);
     }
 };
 
 // Leval 左值变量 IDENT lv4
-class LeValAST : public BaseAST
+// 左值的地址通过 f.value 交给赋值语句
+class LeValAST : public AstNode<AstKind::LeVal>
 {
 public:
-    string ident;
+    int ident;
+    Value sym;
 
-    pair<bool, int> Koopa() const override
+    void analyze_leave()
     {
-        // koopa_str += "store %" + to_string(reg_cnt - 1) + ", @" + ident + "\n";
-        return make_pair(false, -1);
+        sym = symbol_list.getSymbol(ident);
     }
-    string name() const override
+    pair<bool, int> leave(AstFrame &f, const AstResult *) const
     {
-        Value var = symbol_list.getSymbol(ident);
-        return "@" + ident + "_" + to_string(var.name_index);
+        f.value = builder.value(var_name(ident, sym.name_index));
+        return make_pair(false, -1);
     }
 };
 
 // lv9 unfinished
 // （左值）数组变量
 // lv9 IDENT ArraySizeList
-class LeValArrayAST : public BaseAST
+class LeValArrayAST : public AstNode<AstKind::LeValArray>
 {
 public:
-    string ident;
-    vector<unique_ptr<BaseAST>> array_size_list;
+    int ident;
+    List array_size_list;
+    Value sym;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
     {
-        return make_pair(false, -1);
+        return i < (int)array_size_list.size() ? array_size_list[i] : Ref<BaseAST>{0};
     }
-    string name() const override
+    void analyze_leave()
     {
-        Value var = symbol_list.getSymbol(ident);
-        string array_ident = "@" + ident + "_" + to_string(var.name_index);
-        if (var.type == ARRAY)
-        {
-            for (int i = 0; i < array_size_list.size(); i++)
-            {
-                int last_index = reg_cnt - 1;
-                string array_index;
-                pair<bool, int> res = array_size_list[i]->Koopa();
-
-                if (res.first)
-                {
-                    array_index = to_string(res.second);
-                }
-                else
-                {
-                    array_index = "%" + to_string(reg_cnt - 1);
-                }
-
-                if (i == 0)
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = getelemptr ";
-                    koopa_str += array_ident + ", " + array_index + "\n";
-                }
-                else
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = getelemptr ";
-                    koopa_str += "%" + to_string(last_index) + ", " + array_index + "\n";
-                }
-                reg_cnt++;
-            }
-            return "%" + to_string(reg_cnt - 1);
-        }
-        else if (var.type == POINTER)
-        {
-            koopa_str += "  %" + to_string(reg_cnt) + " = load " + array_ident + "\n";
-            reg_cnt++;
-
-            for (int i = 0; i < array_size_list.size(); i++)
-            {
-                string array_index;
-                int last_index = reg_cnt - 1;
-                pair<bool, int> res = array_size_list[i]->Koopa();
-                if (res.first)
-                {
-                    array_index = to_string(res.second);
-                }
-                else
-                {
-                    array_index = "%" + to_string(reg_cnt - 1);
-                }
-
-                if (i == 0)
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = getptr ";
-                    koopa_str += "%" + to_string(last_index) + ", " + array_index + "\n";
-                }
-                else
-                {
-                    koopa_str += "  %" + to_string(reg_cnt) + " = getelemptr ";
-                    koopa_str += "%" + to_string(last_index) + ", " + array_index + "\n";
-                }
-
-                reg_cnt++;
-            }
-            return "%" + to_string(reg_cnt - 1);
-        }
-        else
-        { // ???
-            return "%" + to_string(reg_cnt - 1);
-        }
+        sym = symbol_list.getSymbol(ident);
+    }
+    bool enter(int i, AstFrame &f, const AstResult *done) const
+    {
+        return array_index(i, ident, sym, f, done);
     }
 };
 
 // VarDecl 声明变量，需要列表 BType VarDef {"," VarDef} ";" lv4
-class VarDeclAST : public BaseAST
+class VarDeclAST : public AstNode<AstKind::VarDecl>
 {
 public:
-    vector<unique_ptr<BaseAST>> varDefList;
+    List varDefList;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
     {
-        for (auto &i : varDefList)
-        {
-            i->Koopa();
-        }
-
-        return make_pair(false, -1);
+        return i < (int)varDefList.size() ? varDefList[i] : Ref<BaseAST>{0};
     }
 };
 
@@ -2249,82 +2111,64 @@ public:
 // 变量名分配策略：在第index层基本块，变量命名为 ident_index
 // rule = 0 未初始化
 // rule = 1 初始化 = initval
-class VarDefAST : public BaseAST
+class VarDefAST : public AstNode<AstKind::VarDef>
 {
 public:
     int rule;
-    string ident;
-    unique_ptr<BaseAST> initval;
+    int ident;
+    Ref<BaseAST> initval;
+    // 语义分析的结果：所在基本块的编号（0 表示全局）
+    int index;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
+    {
+        return i == 0 && rule == 1 ? initval : Ref<BaseAST>{0};
+    }
+    void analyze_leave()
+    {
+        index = scope_handler.block_now.index;
+        // 全局变量的初值必须能直接求出；局部变量能求出时也记下来
+        int var_init = 0;
+        if (rule == 1 && (index == 0 || initval->is_const))
+        {
+            var_init = initval->val;
+        }
+        Value tmp(VAR, var_init, index);
+        symbol_list.addSymbol(ident, tmp);
+    }
+    bool enter(int i, AstFrame &f, const AstResult *) const
+    {
+        // 全局变量的初值已经求出
+        if (index == 0)
+        {
+            return false;
+        }
+        if (i == 0)
+        {
+            f.value = builder.alloc(var_name(ident, index), builder.int_type());
+        }
+        return true;
+    }
+    pair<bool, int> leave(AstFrame &f, const AstResult *done) const
     {
         // 全局变量koopa
-        if (is_global)
+        if (index == 0)
         {
             // 初始化为0
             if (rule == 0)
             {
-                Value tmp(VAR, 0, block_handler.block_now.index);
-
-                string name = ident + "_" + to_string(block_handler.block_now.index);
-
-                symbol_list.addSymbol(ident, tmp);
-
-                koopa_str += "global @" + name + " = alloc i32, zeroinit\n";
+                builder.global_alloc(var_name(ident, index), builder.int_type(), builder.zero_init(builder.int_type()));
             }
             else
             {
-                int var_init = initval->calc();
-
-                Value tmp(VAR, var_init, block_handler.block_now.index);
-
-                string name = ident + "_" + to_string(block_handler.block_now.index);
-
-                symbol_list.addSymbol(ident, tmp);
-
-                koopa_str += "global @" + name + " = alloc i32, " + to_string(var_init) + "\n";
+                builder.global_alloc(var_name(ident, index), builder.int_type(), builder.integer(initval->val));
             }
-            return make_pair(false, -1);
         }
-        else
+        else if (rule == 1)
         {
-            // 没有初始值
-            if (rule == 0)
-            {
-                // var_type[ident] = VAR;
-                Value tmp(VAR, 0, block_handler.block_now.index);
-
-                string name = ident + "_" + to_string(block_handler.block_now.index);
-
-                symbol_list.addSymbol(ident, tmp);
-
-                koopa_str += "  @" + name + " = alloc i32 " + "\n";
-            }
-            else
-            {
-                // var_type[ident] = VAR;
-                // var_val[ident] = initval->cal_value();
-                // int val = (initval->Koopa()).second;
-
-                string name = ident + "_" + to_string(block_handler.block_now.index);
-
-                koopa_str += "  @" + name + " = alloc i32 " + "\n";
-                pair<bool, int> res = initval->Koopa();
-                if (res.first)
-                {
-                    koopa_str += "  store " + to_string(res.second) + ", @" + name + "\n";
-                    Value tmp(VAR, res.second, block_handler.block_now.index);
-                    symbol_list.addSymbol(ident, tmp);
-                }
-                else
-                {
-                    koopa_str += "  store %" + to_string(reg_cnt - 1) + ", @" + name + "\n";
-                    Value tmp(VAR, 0, block_handler.block_now.index);
-                    symbol_list.addSymbol(ident, tmp);
-                }
-            }
-            return make_pair(false, -1);
+            builder.store(get_operand(done[0].res, done[0].reg), f.value);
         }
+        return make_pair(false, -1);
     }
 };
 
@@ -2332,26 +2176,31 @@ public:
 // unfinished
 // 和ConstDefArray分外相似
 // 但初始化列表有可能是空的
-class VarDefArrayAST : public BaseAST
+class VarDefArrayAST : public AstNode<AstKind::VarDefArray>
 {
 public:
     int rule;
-    string ident;
-    unique_ptr<BaseAST> init_val;
-    vector<unique_ptr<BaseAST>> array_size_list;
+    int ident;
+    Ref<BaseAST> init_val;
+    List array_size_list;
+    koopa_raw_type_t ty;
+    int index;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
     {
-        vector<int> len;
-        for (auto &i : array_size_list)
-        {
-            len.push_back(i->calc());
-        }
-
-        int array_size = array_size_list.size();
-        Value var_array = Value(ARRAY, array_size, block_handler.block_now.index);
-        // 数组放入符号表
-        symbol_list.addSymbol(ident, var_array);
+        if (i < (int)array_size_list.size())
+            return array_size_list[i];
+        return i == (int)array_size_list.size() ? init_val : Ref<BaseAST>{0};
+    }
+    bool analyze_enter(int i)
+    {
+        analyze_array_def(i, ident, array_size_list, ty, index);
+        return true;
+    }
+    bool enter(int, AstFrame &, const AstResult *) const { return false; }
+    pair<bool, int> leave(AstFrame &, const AstResult *) const
+    {
+        vector<int> len = getArrayLen(ty);
 
         // 处理初始化列表
         // 先把所有初始值置为0
@@ -2361,49 +2210,32 @@ public:
         {
             tot_len *= i;
         }
-        string *init = new string[tot_len];
-        for (int i = 0; i < tot_len; ++i)
-        {
-            init[i] = "0";
-        }
+        ArrayInit init;
 
         // name tag
-        string name_tag = "@" + ident + "_" + to_string(block_handler.block_now.index);
-
-        // type tag
-        string type_tag = "i32";
-        int array_len = array_size_list.size();
-        for (int i = array_len - 1; i >= 0; i--)
-        {
-            type_tag = "[" + type_tag + ", " + to_string(array_size_list[i]->calc()) + "]";
-        }
+        string name_tag = var_name(ident, index);
 
-        if (is_global)
+        if (index == 0)
         {
             if (init_val != nullptr) // 全局变量 有初值
             {
-                dynamic_cast<InitValWithListAST *>(init_val.get())->getInitVal(init, len);
-                string init_str = getInitList(init, len);
-                koopa_str += "global " + name_tag + " = alloc ";
-                koopa_str += type_tag + ", " + init_str + "\n";
+                init_val->as<InitValWithListAST>()->getInitVal(init, len, true);
+                builder.global_alloc(name_tag, ty, arrayInitializer(ty, len, tot_len, init));
             }
             else
             {
-                string init_str = getInitList(init, len);
-                koopa_str += "global " + name_tag + " = alloc ";
-                koopa_str += type_tag + ", zeroinit" + "\n";
+                builder.global_alloc(name_tag, ty, builder.zero_init(ty));
             }
         }
         else
         {
-            koopa_str += "  " + name_tag + " = alloc " + type_tag + "\n";
+            koopa_raw_value_t array = builder.alloc(name_tag, ty);
             if (init_val == nullptr) // 局部变量 不用初始化就直接返回
             {
                 return make_pair(false, -1);
             }
-            dynamic_cast<InitValWithListAST *>(init_val.get())->getInitVal(init, len);
-            string init_str = getInitList(init, len);
-            initArray(name_tag, init, len);
+            init_val->as<InitValWithListAST>()->getInitVal(init, len, false);
+            initArray(array, name_tag, len, tot_len, init);
         }
 
         return make_pair(false, -1);
@@ -2412,17 +2244,110 @@ public:
 
 // lv4+
 // InitVal 变量赋值 Exp
-class InitValAST : public BaseAST
+class InitValAST : public AstNode<AstKind::InitVal>
 {
 public:
-    unique_ptr<BaseAST> exp;
+    Ref<BaseAST> exp;
 
-    pair<bool, int> Koopa() const override
+    Ref<BaseAST> child(int i) const
+    {
+        return i == 0 ? exp : Ref<BaseAST>{0};
+    }
+    void analyze_leave()
     {
-        return exp->Koopa();
+        same_as(exp);
     }
-    int calc() const override
+    pair<bool, int> leave(AstFrame &, const AstResult *done) const
     {
-        return exp->calc();
+        return done[0].res;
     }
 };
+
+// 按节点的种类调用 f(具体类型的节点指针)
+template <typename Node, typename F>
+static inline auto visit_ast(Node *node, F &&f)
+{
+    switch (node->kind)
+    {
+#define AST_KIND_CASE(K) \
+    case AstKind::K:     \
+        return f(static_cast<conditional_t<is_const<Node>::value, const K##AST, K##AST> *>(node));
+        AST_KINDS(AST_KIND_CASE)
+#undef AST_KIND_CASE
+    }
+    assert(false);
+    __builtin_unreachable();
+}
+
+inline void BaseAST::analyze()
+{
+    struct Frame
+    {
+        BaseAST *node;
+        int next;
+    };
+    vector<Frame> frames;
+    frames.push_back(Frame{this, 0});
+    while (!frames.empty())
+    {
+        Frame &f = frames.back();
+        Ref<BaseAST> next{0};
+        int i = f.next;
+        if (visit_ast(f.node, [i](auto *n) { return n->analyze_enter(i); }) &&
+            (next = visit_ast(f.node, [i](auto *n) { return n->child(i); })))
+        {
+            f.next++;
+            frames.push_back(Frame{next.get(), 0});
+            continue;
+        }
+        visit_ast(f.node, [](auto *n) { n->analyze_leave(); });
+        frames.pop_back();
+    }
+}
+
+inline pair<bool, int> BaseAST::Koopa() const
+{
+    if (is_const)
+    {
+        return make_pair(true, val);
+    }
+    // 每次调用使用自己的栈：leave() 中可能再调用其他节点的 Koopa()
+    vector<AstFrame> frames;
+    vector<AstResult> results;
+    frames.push_back(AstFrame{this, 0, 0, nullptr, 0});
+    while (true)
+    {
+        AstFrame &f = frames.back();
+        const AstResult *done = results.data() + f.base;
+        int i = f.next;
+        if (visit_ast(f.node, [&](auto *n) { return n->enter(i, f, done); }))
+        {
+            // enter 可以增加 f.next，跳过它自己处理过的子节点
+            i = f.next;
+            Ref<BaseAST> next = visit_ast(f.node, [i](auto *n) { return n->child(i); });
+            if (next)
+            {
+                f.next++;
+                // 能直接求值的子表达式不用访问
+                if (next->is_const)
+                {
+                    results.push_back(AstResult{make_pair(true, next->val), reg_cnt - 1, nullptr});
+                }
+                else
+                {
+                    frames.push_back(AstFrame{next.get(), 0, 0, nullptr, results.size()});
+                }
+                continue;
+            }
+        }
+        pair<bool, int> res = visit_ast(f.node, [&](auto *n) { return n->leave(f, done); });
+        AstResult result{res, reg_cnt - 1, f.value};
+        results.resize(f.base);
+        frames.pop_back();
+        if (frames.empty())
+        {
+            return res;
+        }
+        results.push_back(result);
+    }
+}
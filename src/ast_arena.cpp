@@ -0,0 +1,75 @@
+#include "ast_arena.h"
+#include <cstring>
+
+uint32_t AstArena::alloc(size_t size)
+{
+    uint32_t units = (size + UNIT - 1) / UNIT;
+    if (chunks.empty())
+    {
+        chunks.emplace_back(new char[CHUNK_UNITS * UNIT]);
+        chunk_units.push_back(CHUNK_UNITS);
+        chunk_now = 0;
+        // 编号 0 表示空
+        used = 1;
+    }
+    if (used + units <= CHUNK_UNITS)
+    {
+        uint32_t id = (chunk_now << CHUNK_BITS) | used;
+        used += units;
+        return id;
+    }
+    assert(chunks.size() <= CHUNK_MASK);
+    if (units > CHUNK_UNITS)
+    {
+        // 超过一块的分配单独占一块，插在当前块之后，并视为已用满
+        chunks.emplace(chunks.begin() + chunk_now + 1, new char[(size_t)units * UNIT]);
+        chunk_units.insert(chunk_units.begin() + chunk_now + 1, units);
+        chunk_now++;
+        used = CHUNK_UNITS;
+        return chunk_now << CHUNK_BITS;
+    }
+    // 换到下一块，clear() 之后优先复用已有的块
+    chunk_now++;
+    if (chunk_now == chunks.size())
+    {
+        chunks.emplace_back(new char[CHUNK_UNITS * UNIT]);
+        chunk_units.push_back(CHUNK_UNITS);
+    }
+    used = units;
+    return chunk_now << CHUNK_BITS;
+}
+
+List AstArena::end_list(int start)
+{
+    List list;
+    list.len = list_stack.size() - start;
+    list.first = 0;
+    if (list.len != 0)
+    {
+        list.first = alloc(sizeof(Ref<BaseAST>) * list.len);
+        memcpy(at(list.first), list_stack.data() + start, sizeof(Ref<BaseAST>) * list.len);
+    }
+    list_stack.resize(start);
+    return list;
+}
+
+void AstArena::clear()
+{
+    // 单独分配的大块直接归还，普通的块留给之后复用
+    size_t n = 0;
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        if (chunk_units[i] == CHUNK_UNITS)
+        {
+            chunks[n] = move(chunks[i]);
+            chunk_units[n] = CHUNK_UNITS;
+            n++;
+        }
+    }
+    chunks.resize(n);
+    chunk_units.resize(n);
+    chunk_now = 0;
+    used = 1;
+    // 解析出错时可能还有没构建完的列表
+    list_stack.clear();
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+using namespace std;
+
+class BaseAST;
+class AstArena;
+// 每个线程在自己的区域中建树
+extern thread_local AstArena ast_arena;
+
+/**
+ * AST 节点的引用
+ * 保存的是节点在 AstArena 中的 32 位编号，而不是指针，0 表示空
+ * 没有构造/析构函数，可以直接放进 Bison 的 %union
+ */
+template <typename T>
+struct Ref
+{
+    uint32_t id;
+
+    T *get() const;
+    T *operator->() const { return get(); }
+    T &operator*() const { return *get(); }
+    explicit operator bool() const { return id != 0; }
+    bool operator==(nullptr_t) const { return id == 0; }
+    bool operator!=(nullptr_t) const { return id != 0; }
+
+    // 派生类的引用可以转换为基类的引用
+    template <typename U>
+    operator Ref<U>() const
+    {
+        static_assert(is_base_of<U, T>::value, "invalid AST reference conversion");
+        return Ref<U>{id};
+    }
+};
+
+/**
+ * AST 节点列表：连续存放在 AstArena 中的一段节点引用
+ */
+struct List
+{
+    uint32_t first;
+    uint32_t len;
+
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+    const Ref<BaseAST> *begin() const;
+    const Ref<BaseAST> *end() const { return begin() + len; }
+    const Ref<BaseAST> &operator[](size_t i) const { return begin()[i]; }
+};
+
+/**
+ * AST 的区域分配器
+ * 节点按 8 字节为单位连续分配在大块内存中，用 (块号, 块内偏移) 编成 32 位编号
+ * 节点不单独析构，整棵树用 clear() 一次释放，所以节点必须是平凡析构的
+ */
+class AstArena
+{
+public:
+    AstArena() = default;
+    AstArena(const AstArena &) = delete;
+    AstArena &operator=(const AstArena &) = delete;
+
+    /**
+     * @brief Create a node of type T
+     */
+    template <typename T>
+    Ref<T> make()
+    {
+        static_assert(is_trivially_destructible<T>::value, "AST nodes are never destroyed");
+        uint32_t id = alloc(sizeof(T));
+        new (at(id)) T();
+        return Ref<T>{id};
+    }
+
+    void *at(uint32_t id) const
+    {
+        return chunks[id >> CHUNK_BITS].get() + (size_t)(id & CHUNK_MASK) * UNIT;
+    }
+
+    /**
+     * @brief Start building a list, the returned value identifies it
+     * 列表在解析过程中严格嵌套，所以所有正在构建的列表共用一个栈
+     */
+    int begin_list() const { return list_stack.size(); }
+
+    /**
+     * @brief Append an item to the innermost list being built
+     */
+    void push_list(Ref<BaseAST> item) { list_stack.push_back(item); }
+
+    /**
+     * @brief Finish the innermost list and copy it into the arena
+     * @param start The value returned by begin_list()
+     */
+    List end_list(int start);
+
+    /**
+     * @brief Free all nodes, the memory is kept for reuse
+     */
+    void clear();
+
+private:
+    static constexpr size_t UNIT = 8;
+    static constexpr uint32_t CHUNK_BITS = 16;
+    static constexpr uint32_t CHUNK_MASK = (1u << CHUNK_BITS) - 1;
+    static constexpr uint32_t CHUNK_UNITS = 1u << CHUNK_BITS;
+
+    // 每块 2^16 个单位，即 512 KB；更大的节点或列表单独占一块
+    vector<unique_ptr<char[]>> chunks;
+    vector<uint32_t> chunk_units;
+    // 当前块的块号和已使用的单位数
+    uint32_t chunk_now = 0;
+    uint32_t used = 0;
+
+    vector<Ref<BaseAST>> list_stack;
+
+    uint32_t alloc(size_t size);
+};
+
+template <typename T>
+T *Ref<T>::get() const
+{
+    return id == 0 ? nullptr : static_cast<T *>(ast_arena.at(id));
+}
+
+inline const Ref<BaseAST> *List::begin() const
+{
+    return len == 0 ? nullptr : static_cast<const Ref<BaseAST> *>(ast_arena.at(first));
+}
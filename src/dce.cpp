@@ -0,0 +1,90 @@
+#include "pass.h"
+
+// 没有副作用的指令，结果不被使用时可以删除
+static bool is_pure(const IrValue *inst)
+{
+    switch (inst->op)
+    {
+    case IrOp::Alloc:
+    case IrOp::Load:
+    case IrOp::GetPtr:
+    case IrOp::GetElemPtr:
+    case IrOp::Binary:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// alloc 的每个使用都是 store 的目标时，这些 store 也是无用的
+static bool only_stored(const IrValue *alloc)
+{
+    for (IrUse *use = alloc->uses; use != nullptr; use = use->next)
+    {
+        if (use->user->op != IrOp::Store || use->user->operand(1) != alloc)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * dce：删除结果不被使用的无副作用指令，以及只写不读的局部变量
+ * 删除一条指令后它的操作数可能也不再被使用，用工作表处理
+ */
+class DcePass : public FunctionPass
+{
+public:
+    const char *name() const override { return "dce"; }
+    bool run(IrFunction &func, PassStats &stats) override
+    {
+        work.clear();
+        for (IrBlock *bb = func.entry(); bb != nullptr; bb = bb->next)
+        {
+            for (IrValue *inst = bb->first; inst != nullptr; inst = inst->next)
+                work.push_back(inst);
+        }
+        size_t removed = 0;
+        while (!work.empty())
+        {
+            IrValue *inst = work.back();
+            work.pop_back();
+            // 已经删除的指令不在基本块中
+            if (inst->block == nullptr || !is_pure(inst))
+                continue;
+            if (inst->op == IrOp::Alloc && only_stored(inst))
+            {
+                while (inst->uses != nullptr)
+                {
+                    IrValue *store = inst->uses->user;
+                    add_operands(store);
+                    func.erase(store);
+                    removed++;
+                }
+            }
+            if (inst->has_uses())
+                continue;
+            add_operands(inst);
+            func.erase(inst);
+            removed++;
+        }
+        stats.insts_removed += removed;
+        return removed != 0;
+    }
+
+private:
+    vector<IrValue *> work;
+
+    void add_operands(IrValue *inst)
+    {
+        for (size_t i = 0; i < inst->num_ops; i++)
+        {
+            if (inst->operand(i)->is_inst())
+                work.push_back(inst->operand(i));
+        }
+    }
+};
+
+unique_ptr<Pass> create_dce_pass()
+{
+    return make_unique<DcePass>();
+}
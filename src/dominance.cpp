@@ -0,0 +1,149 @@
+#include "dominance.h"
+#include <algorithm>
+
+DominatorTree::DominatorTree(const IrFunction &func)
+    : order(func.block_count(), -1), idoms(func.block_count(), nullptr), kids(func.block_count()),
+      enter(func.block_count(), -1), leave(func.block_count(), -1)
+{
+    // 深度优先遍历，基本块很多时递归会栈溢出，用显式的栈
+    // 同时得到先序编号和生成树上的父结点（用于求直接支配者）以及后序
+    vector<int> num(func.block_count(), -1);
+    vector<IrBlock *> pre;
+    vector<int> parent;
+    vector<pair<IrBlock *, size_t>> stack;
+    IrBlock *entry = func.entry();
+    stack.emplace_back(entry, 0);
+    num[entry->id] = 0;
+    pre.push_back(entry);
+    parent.push_back(-1);
+    while (!stack.empty())
+    {
+        auto &[bb, i] = stack.back();
+        if (i < bb->succs.size())
+        {
+            IrBlock *succ = bb->succs[i++];
+            if (num[succ->id] < 0)
+            {
+                num[succ->id] = pre.size();
+                pre.push_back(succ);
+                parent.push_back(num[bb->id]);
+                stack.emplace_back(succ, 0);
+            }
+        }
+        else
+        {
+            blocks.push_back(bb);
+            stack.pop_back();
+        }
+    }
+    reverse(blocks.begin(), blocks.end());
+    for (size_t i = 0; i < blocks.size(); i++)
+        order[blocks[i]->id] = i;
+
+    // Lengauer-Tarjan 算法（路径压缩的简单版本），都用先序编号表示基本块
+    // 迭代算法在一长串分支汇合到同一个基本块时（例如很长的 || 链）是平方复杂度的
+    size_t n = pre.size();
+    vector<int> semi(n), label(n), ancestor(n, -1), idom(n, -1);
+    vector<vector<int>> bucket(n);
+    for (size_t v = 0; v < n; v++)
+        semi[v] = label[v] = v;
+    vector<int> path;
+    auto eval = [&](int v)
+    {
+        if (ancestor[v] < 0)
+            return v;
+        // 路径压缩：先找出整条路径，再从靠近根的一端开始更新
+        path.clear();
+        for (int u = v; ancestor[ancestor[u]] >= 0; u = ancestor[u])
+            path.push_back(u);
+        for (auto it = path.rbegin(); it != path.rend(); ++it)
+        {
+            int u = *it, a = ancestor[u];
+            if (semi[label[a]] < semi[label[u]])
+                label[u] = label[a];
+            ancestor[u] = ancestor[a];
+        }
+        return label[v];
+    };
+    for (int w = n - 1; w > 0; w--)
+    {
+        for (IrBlock *pred : pre[w]->preds)
+        {
+            if (num[pred->id] < 0)
+                continue;
+            int u = eval(num[pred->id]);
+            if (semi[u] < semi[w])
+                semi[w] = semi[u];
+        }
+        bucket[semi[w]].push_back(w);
+        int p = parent[w];
+        ancestor[w] = p;
+        for (int v : bucket[p])
+        {
+            int u = eval(v);
+            idom[v] = semi[u] < semi[v] ? u : p;
+        }
+        bucket[p].clear();
+    }
+    for (size_t w = 1; w < n; w++)
+    {
+        if (idom[w] != semi[w])
+            idom[w] = idom[idom[w]];
+        idoms[pre[w]->id] = pre[idom[w]];
+    }
+    idoms[entry->id] = nullptr;
+    for (size_t i = 1; i < blocks.size(); i++)
+        kids[idoms[blocks[i]->id]->id].push_back(blocks[i]);
+
+    // 支配树的先序编号
+    int clock = 0;
+    vector<pair<IrBlock *, size_t>> walk;
+    walk.emplace_back(entry, 0);
+    enter[entry->id] = clock++;
+    while (!walk.empty())
+    {
+        auto &[bb, i] = walk.back();
+        if (i < kids[bb->id].size())
+        {
+            IrBlock *kid = kids[bb->id][i++];
+            enter[kid->id] = clock++;
+            walk.emplace_back(kid, 0);
+        }
+        else
+        {
+            leave[bb->id] = clock++;
+            walk.pop_back();
+        }
+    }
+}
+
+bool DominatorTree::dominates(const IrBlock *a, const IrBlock *b) const
+{
+    if (!reachable(a) || !reachable(b))
+        return false;
+    return enter[a->id] <= enter[b->id] && leave[b->id] <= leave[a->id];
+}
+
+void DominatorTree::compute_frontiers()
+{
+    // 汇合点 bb 在每个前驱到 idom(bb) 路径上（不含 idom(bb)）的基本块的支配边界中
+    frontiers.assign(order.size(), {});
+    for (IrBlock *bb : blocks)
+    {
+        if (bb->preds.size() < 2)
+            continue;
+        for (IrBlock *pred : bb->preds)
+        {
+            if (!reachable(pred))
+                continue;
+            for (IrBlock *runner = pred; runner != nullptr && runner != idoms[bb->id]; runner = idoms[runner->id])
+            {
+                // 已经在支配边界中时，从这里往上的部分之前已经走过
+                auto &df = frontiers[runner->id];
+                if (!df.empty() && df.back() == bb)
+                    break;
+                df.push_back(bb);
+            }
+        }
+    }
+}
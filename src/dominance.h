@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include "ir.h"
+
+using namespace std;
+
+/**
+ * 支配树和支配边界
+ * 直接支配者用 Lengauer-Tarjan 算法求出，支配边界在需要时由直接支配者计算
+ * 从入口不可达的基本块不在支配树中
+ * 建立之后函数的控制流图不能再修改，修改后需要重新建立
+ */
+class DominatorTree
+{
+public:
+    /**
+     * @brief Build the tree, IrFunction::compute_cfg() must be called first
+     */
+    explicit DominatorTree(const IrFunction &func);
+
+    bool reachable(const IrBlock *bb) const { return order[bb->id] >= 0; }
+
+    /**
+     * @brief Immediate dominator, nullptr for the entry and unreachable blocks
+     */
+    IrBlock *idom(const IrBlock *bb) const { return idoms[bb->id]; }
+
+    const vector<IrBlock *> &children(const IrBlock *bb) const { return kids[bb->id]; }
+
+    /**
+     * @brief Reachable blocks in reverse post order, the entry comes first
+     */
+    const vector<IrBlock *> &rpo() const { return blocks; }
+
+    /**
+     * @brief Whether a dominates b (every block dominates itself)
+     */
+    bool dominates(const IrBlock *a, const IrBlock *b) const;
+
+    /**
+     * @brief Compute the dominance frontier of every reachable block
+     */
+    void compute_frontiers();
+
+    const vector<IrBlock *> &frontier(const IrBlock *bb) const { return frontiers[bb->id]; }
+
+private:
+    // 逆后序中的位置，不可达的基本块为 -1
+    vector<int> order;
+    vector<IrBlock *> blocks;
+    vector<IrBlock *> idoms;
+    vector<vector<IrBlock *>> kids;
+    vector<vector<IrBlock *>> frontiers;
+    // 支配树上先序遍历的进入和离开编号，a 支配 b 当且仅当 b 的区间包含在 a 的区间中
+    vector<int> enter;
+    vector<int> leave;
+};
@@ -0,0 +1,464 @@
+#include "frontend.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <sstream>
+#include <thread>
+#include "koopa_parser.h"
+#include "koopa_writer.h"
+#include "riscv.h"
+
+// token 的定义
+#include "sysy.tab.hpp"
+
+// 每个线程的工作状态，见 CompileContext
+thread_local KoopaBuilder builder;
+thread_local int reg_cnt = 0;
+thread_local int if_cnt = 0;
+
+thread_local AstArena ast_arena;
+thread_local Interner *interner = nullptr;
+thread_local SymbolList symbol_list;
+thread_local BlockHandler block_handler = BlockHandler();
+
+extern thread_local void (*def_handler)(Ref<BaseAST> def);
+
+// 重置当前线程的工作状态，释放它占用的内存
+static void reset_thread_state()
+{
+    builder.clear();
+    ast_arena.clear();
+    symbol_list = SymbolList();
+    block_handler.reset(0);
+    scope_handler.reset(0);
+    reg_cnt = 0;
+    if_cnt = 0;
+    logical = 0;
+    loop_cnt = 0;
+    loop_dep = 0;
+    find_loop.clear();
+    if_end = true;
+    function_params.clear();
+}
+
+// 在作用域内让当前线程参与一次编译
+class ThreadScope
+{
+public:
+    explicit ThreadScope(Interner *ctx_interner)
+    {
+        reset_thread_state();
+        interner = ctx_interner;
+    }
+    ~ThreadScope()
+    {
+        reset_thread_state();
+        interner = nullptr;
+    }
+};
+
+// 当前线程输出的目标代码，以及函数经过的优化流水线（为空时直接输出）
+static thread_local Target target_now = Target::RiscV;
+static thread_local PassManager *passes_now = nullptr;
+// 每个线程一个 Koopa IR 输出器，缓冲区在线程内复用
+static thread_local KoopaWriter koopa_writer;
+
+// 把 raw program 输出为当前的目标代码
+static void emit(const koopa_raw_program_t &program)
+{
+    if (passes_now != nullptr)
+        passes_now->run(program);
+    if (target_now == Target::Koopa)
+        koopa_writer.write(program);
+    else
+        Visit(program);
+}
+
+// 在作用域内把当前线程的结果输出到 out
+class OutputScope
+{
+public:
+    OutputScope(Target target, PassPipeline &pipeline, ostream &out) : prev_out(asm_out)
+    {
+        target_now = target;
+        if (pipeline.enabled())
+            passes = make_unique<PassManager>(pipeline);
+        passes_now = passes.get();
+        asm_out = &out;
+        koopa_writer.set_output(&out);
+    }
+    ~OutputScope()
+    {
+        koopa_writer.set_output(nullptr);
+        asm_out = prev_out;
+        passes_now = nullptr;
+    }
+
+private:
+    ostream *prev_out;
+    unique_ptr<PassManager> passes;
+};
+
+void stream_def(Ref<BaseAST> def)
+{
+    CompUnitAST::lower_def(def);
+    emit(builder.build());
+    builder.release_functions();
+    ast_arena.clear();
+}
+
+bool split_defs(Lexer &lexer, vector<TopLevelDef> &defs)
+{
+    YYSTYPE lval;
+    int blocks = 0, ifs = 0, loops = 0, logicals = 0;
+    int token = lexer.next(&lval);
+    while (token != 0)
+    {
+        TopLevelDef def = TopLevelDef();
+        def.begin = lexer.text();
+        def.line = lexer.line();
+        def.blocks = blocks;
+        def.ifs = ifs;
+        def.loops = loops;
+        def.logicals = logicals;
+
+        // 函数定义以 "int/void IDENT (" 开头，到与第一个 '{' 配对的 '}' 结束
+        // 声明到花括号之外的第一个 ';' 结束
+        int first = token;
+        int depth = 0;
+        bool done = false;
+        int last = 0, last_ident = 0;
+        for (int n = 0; !done; n++)
+        {
+            if (token == 0)
+            {
+                return false;
+            }
+            if (n == 1 && token == IDENT)
+            {
+                def.ident = lval.int_val;
+            }
+            if (n == 2 && token == '(' && (first == INT || first == VOID))
+            {
+                def.is_func = true;
+                def.func_val = first == INT ? 1 : 0;
+            }
+            if (token == '(' && last == IDENT && depth > 0)
+            {
+                def.callees.push_back(last_ident);
+            }
+            switch (token)
+            {
+            case '{':
+                depth++;
+                blocks++;
+                break;
+            case '}':
+                if (--depth < 0)
+                {
+                    return false;
+                }
+                done = def.is_func && depth == 0;
+                break;
+            case ';':
+                done = !def.is_func && depth == 0;
+                break;
+            case IF:
+                ifs++;
+                break;
+            case WHILE:
+                loops++;
+                break;
+            case AND:
+            case OR:
+                logicals++;
+                break;
+            }
+            def.end = lexer.text() + lexer.text_len();
+            last = token;
+            last_ident = token == IDENT ? lval.int_val : 0;
+            token = lexer.next(&lval);
+        }
+        defs.push_back(move(def));
+    }
+    return true;
+}
+
+size_t drop_unreachable(vector<TopLevelDef> &defs, int main_ident)
+{
+    unordered_map<int, size_t> funcs;
+    for (size_t i = 0; i < defs.size(); i++)
+    {
+        if (defs[i].is_func)
+            funcs[defs[i].ident] = i;
+    }
+    auto it = funcs.find(main_ident);
+    if (it == funcs.end())
+    {
+        return 0;
+    }
+
+    // 从 main 出发沿调用关系遍历，库函数不在 funcs 中
+    vector<bool> reached(defs.size());
+    vector<size_t> work = {it->second};
+    reached[it->second] = true;
+    while (!work.empty())
+    {
+        size_t i = work.back();
+        work.pop_back();
+        for (int callee : defs[i].callees)
+        {
+            auto found = funcs.find(callee);
+            if (found != funcs.end() && !reached[found->second])
+            {
+                reached[found->second] = true;
+                work.push_back(found->second);
+            }
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < defs.size(); i++)
+    {
+        if (!defs[i].is_func || reached[i])
+            defs[kept++] = move(defs[i]);
+    }
+    size_t dropped = defs.size() - kept;
+    defs.resize(kept);
+    return dropped;
+}
+
+// 在当前线程上解析并编译一个顶层定义，结果写入 out
+bool CompileContext::compile_def(const TopLevelDef &def, ostream &out, string &error)
+{
+    OutputScope scope(target, pipeline, out);
+
+    scope_handler.reset(def.blocks);
+    block_handler.reset(def.blocks);
+    if_cnt = def.ifs;
+    loop_cnt = def.loops;
+    logical = def.logicals;
+
+    Lexer lexer;
+    lexer.open(def.begin, def.end, def.line);
+    def_handler = stream_def;
+    Ref<BaseAST> ast;
+    return yyparse(lexer, ast, error) == 0;
+}
+
+// 一个顶层定义的编译结果
+struct DefResult
+{
+    bool ok;
+    string output;
+    string error;
+};
+
+bool CompileContext::compile_defs(const vector<TopLevelDef> &defs, ostream &os, string &error)
+{
+    bool ok = true;
+    if (jobs <= 1)
+    {
+        for (auto &def : defs)
+        {
+            ok = compile_def(def, os, error) && ok;
+        }
+        return ok;
+    }
+
+    // 全局声明在当前线程上按顺序编译
+    // 函数先只登记名字和返回类型，函数体中可以调用在其他线程上编译的函数
+    // 调用指令只用到被调函数的名字和返回类型，所以这里的登记不带参数
+    // visible 记下每个函数登记之后的符号个数，工作线程中隐藏在它之后定义的全局符号，与 -j1 时一致
+    vector<DefResult> decls(defs.size());
+    vector<size_t> funcs;
+    vector<int> visible;
+    for (size_t i = 0; i < defs.size(); i++)
+    {
+        const TopLevelDef &def = defs[i];
+        if (def.is_func)
+        {
+            symbol_list.addSymbol(def.ident, Value(FUNC, def.func_val, 0));
+            builder.forward_function("@" + interner.name(def.ident), def.func_val ? builder.int_type() : builder.unit_type());
+            funcs.push_back(i);
+            visible.push_back(symbol_list.size());
+        }
+        else
+        {
+            ostringstream out;
+            decls[i].ok = compile_def(def, out, decls[i].error);
+            decls[i].output = out.str();
+        }
+    }
+
+    // 工作线程复制全局符号表，共享全局变量和函数，每次取下一个未编译的函数
+    const SymbolList *global_symbols = &symbol_list;
+    int global_count = symbol_list.size();
+    const KoopaBuilder *global_builder = &builder;
+    vector<promise<DefResult>> results(funcs.size());
+    vector<future<DefResult>> outputs;
+    for (auto &r : results)
+    {
+        outputs.push_back(r.get_future());
+    }
+    atomic<size_t> next(0);
+    auto work = [&]()
+    {
+        ThreadScope thread_scope(&interner);
+        symbol_list = *global_symbols;
+        builder.import_globals(*global_builder);
+        for (size_t k = next++; k < funcs.size(); k = next++)
+        {
+            DefResult res;
+            ostringstream out;
+            symbol_list.hideSymbols(visible[k], global_count);
+            res.ok = compile_def(defs[funcs[k]], out, res.error);
+            res.output = out.str();
+            results[k].set_value(move(res));
+        }
+    };
+    vector<thread> workers;
+    for (int i = 0; i < jobs && i < (int)funcs.size(); i++)
+    {
+        workers.emplace_back(work);
+    }
+
+    // 按源码顺序输出，先完成的函数等待前面的定义
+    size_t k = 0;
+    for (size_t i = 0; i < defs.size(); i++)
+    {
+        DefResult res = defs[i].is_func ? outputs[k++].get() : move(decls[i]);
+        os << res.output;
+        error += res.error;
+        ok = res.ok && ok;
+    }
+    for (auto &t : workers)
+    {
+        t.join();
+    }
+    return ok;
+}
+
+CompileContext::CompileContext(const SysycOptions &options)
+    : target(options.target), jobs(options.jobs), lazy(options.lazy), stats(options.stats)
+{
+    pipeline_ok = pipeline.init(options, pipeline_error);
+    if (jobs <= 0)
+    {
+        jobs = thread::hardware_concurrency();
+    }
+}
+
+bool CompileContext::compile(string_view source, ostream &os, string &error)
+{
+    if (!pipeline_ok)
+    {
+        error += pipeline_error;
+        return false;
+    }
+    ThreadScope thread_scope(&interner);
+    auto start = chrono::steady_clock::now();
+    CompUnitAST::begin_unit();
+
+    // 库函数声明
+    {
+        OutputScope scope(target, pipeline, os);
+        emit(builder.build());
+    }
+
+    Lexer lexer;
+    lexer.open(source.data(), source.data() + source.size(), 1);
+    vector<TopLevelDef> defs;
+    bool ok;
+    if (split_defs(lexer, defs))
+    {
+        if (lazy)
+        {
+            size_t total = defs.size();
+            size_t dropped = drop_unreachable(defs, interner.intern("main"));
+            if (stats != nullptr)
+                *stats << "lazy: skipped " << dropped << " of " << total << " top-level definitions\n";
+        }
+        ok = compile_defs(defs, os, error);
+    }
+    else
+    {
+        TopLevelDef unit = TopLevelDef();
+        unit.begin = source.data();
+        unit.end = source.data() + source.size();
+        unit.line = 1;
+        ok = compile_def(unit, os, error);
+    }
+
+    CompUnitAST::end_unit();
+    ok = pipeline.take_errors(error) && ok;
+    if (stats != nullptr)
+    {
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        double mb = source.size() / 1e6;
+        char line[128];
+        snprintf(line, sizeof(line), "sysy: compiled %.2f MB in %.1f ms (%.1f MB/s)\n", mb, ms, ms > 0 ? mb / (ms / 1e3) : 0.0);
+        *stats << line;
+        pipeline.report(*stats);
+    }
+    return ok;
+}
+
+bool CompileContext::compile_koopa(string_view source, ostream &os, string &error)
+{
+    using clock = chrono::steady_clock;
+    if (!pipeline_ok)
+    {
+        error += pipeline_error;
+        return false;
+    }
+    ThreadScope thread_scope(&interner);
+    OutputScope scope(target, pipeline, os);
+    KoopaParser parser(builder);
+    clock::duration parse_time = clock::duration::zero();
+    clock::duration emit_time = clock::duration::zero();
+
+    auto start = clock::now();
+    parser.open(source.data(), source.data() + source.size());
+    parse_time += clock::now() - start;
+    // 连续的全局变量和函数声明一起输出，每个函数定义解析完立即输出并释放
+    bool ok = true;
+    while (!parser.done())
+    {
+        start = clock::now();
+        if (parser.at_function())
+            emit(builder.build());
+        auto mid = clock::now();
+        bool is_func;
+        ok = parser.parse_item(is_func, error);
+        auto end = clock::now();
+        emit_time += mid - start;
+        parse_time += end - mid;
+        // 解析在第一个错误处停止，出错的函数不输出
+        if (ok && is_func)
+        {
+            emit(builder.build());
+            builder.release_functions();
+            emit_time += clock::now() - end;
+        }
+    }
+    start = clock::now();
+    if (ok)
+        emit(builder.build());
+    emit_time += clock::now() - start;
+    ok = pipeline.take_errors(error) && ok;
+
+    if (stats != nullptr)
+    {
+        double parse_ms = chrono::duration<double, milli>(parse_time).count();
+        double emit_ms = chrono::duration<double, milli>(emit_time).count();
+        double mb = source.size() / 1e6;
+        char line[128];
+        snprintf(line, sizeof(line), "koopa: parsed %.2f MB in %.1f ms (%.1f MB/s), codegen %.1f ms\n",
+                 mb, parse_ms, parse_ms > 0 ? mb / (parse_ms / 1e3) : 0.0, emit_ms);
+        *stats << line;
+        pipeline.report(*stats);
+    }
+    return ok;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <ostream>
+#include <vector>
+#include "AST.h"
+#include "lexer.h"
+#include "pass.h"
+#include "sysyc.h"
+
+using namespace std;
+
+/**
+ * 源文件中的一个顶层定义（Decl 或 FuncDef）
+ * 在切分时记录下来，之后可以在任意线程上单独解析
+ */
+struct TopLevelDef
+{
+    // 定义在源文件中的范围和起始行号
+    const char *begin;
+    const char *end;
+    int line;
+    // 函数定义的名字和返回类型，int->func_val = 1 ; void->func_val = 0
+    bool is_func;
+    int ident;
+    int func_val;
+    // 这个定义之前出现的 '{'、if、while 以及 &&/|| 的个数
+    // 用作这个定义中基本块、if、while 和短路求值编号的起点，各个定义的编号互不重叠
+    int blocks;
+    int ifs;
+    int loops;
+    int logicals;
+    // 函数体中调用的函数（"IDENT (" 中的 IDENT），可能重复
+    vector<int> callees;
+};
+
+/**
+ * @brief Split the source file into top-level definitions by tracking the depth of braces
+ * 同时驻留所有标识符，之后各个线程的 lexer 只会查询驻留表
+ * @return false if the file can not be split, e.g. the braces are unbalanced
+ */
+bool split_defs(Lexer &lexer, vector<TopLevelDef> &defs);
+
+/**
+ * @brief Drop the function definitions that can not be reached from main through calls
+ * 全局声明全部保留；没有 main 时不做任何删除
+ * @return Number of function definitions dropped
+ */
+size_t drop_unreachable(vector<TopLevelDef> &defs, int main_ident);
+
+/**
+ * @brief Handle a parsed top-level definition in streaming mode
+ * 生成 raw program 后立即输出，然后释放 AST 和函数体
+ */
+void stream_def(Ref<BaseAST> def);
+
+/**
+ * 一次编译的上下文
+ * 保存同一次编译的所有线程共用的状态：选项和驻留表
+ * 构建器、AST 区域、符号表、编号计数器和后端状态等线程局部变量是各个线程的工作状态
+ * 线程参与一次编译时先把它们重置并把驻留表指向这个上下文，离开时再释放它们占用的内存
+ * 所以一个线程可以先后进行多次编译，不同线程上的编译互不影响
+ */
+class CompileContext
+{
+public:
+    explicit CompileContext(const SysycOptions &options);
+    CompileContext(const CompileContext &) = delete;
+    CompileContext &operator=(const CompileContext &) = delete;
+
+    /**
+     * @brief Compile the whole source file on the calling thread and the workers
+     * 能按顶层定义切分时，全局声明在当前线程上按顺序处理，函数定义分给 jobs 个工作线程
+     * lazy 时只编译从 main 可达的函数，其余的函数只在切分时扫描过一遍
+     * 否则（例如花括号不配对）整体流式处理，由 parser 报告语法错误
+     * 结果按源码顺序写入 os，与线程数无关
+     * @return false if the source has syntax errors, the messages are appended to error
+     */
+    bool compile(string_view source, ostream &os, string &error);
+
+    /**
+     * @brief Translate Koopa IR text on the calling thread
+     * 每解析完一个函数就生成代码并释放函数体，解析和代码生成的时间分别统计
+     * @return false if the text has syntax errors, the messages are appended to error
+     */
+    bool compile_koopa(string_view source, ostream &os, string &error);
+
+private:
+    Target target;
+    int jobs;
+    bool lazy;
+    ostream *stats;
+    Interner interner;
+    // 优化流水线，选项有误时 pipeline_error 记录错误信息，编译直接失败
+    PassPipeline pipeline;
+    bool pipeline_ok;
+    string pipeline_error;
+
+    bool compile_def(const TopLevelDef &def, ostream &out, string &error);
+    bool compile_defs(const vector<TopLevelDef> &defs, ostream &os, string &error);
+};
@@ -0,0 +1,278 @@
+#include <unordered_map>
+#include "dominance.h"
+#include "pass.h"
+
+/**
+ * gvn：基于支配树的全局值编号，删除重复计算的表达式
+ * 1. 沿支配树先序遍历，用作用域哈希表记录到达当前基本块时可用的表达式，
+ *    binary、getelemptr、getptr 的运算符和操作数相同时结果相同，后出现的换成先出现的
+ *    离开基本块时撤销它加入的表达式，所以表中的值总是支配当前指令
+ * 2. load 按地址记录可用的值（之前 load 的结果或者 store 的值），
+ *    中间可能修改同一内存的 store 或 call 使记录失效：
+ *      每条 load/store 的地址追溯到 alloc、全局变量或者未知（来自参数的指针），
+ *      store 只使同一 alloc 的记录失效，store 到全局变量和未知地址时还使可能别名的记录失效
+ *      call 和有多个前驱的基本块（其他路径上可能有 store）使所有记录失效
+ */
+class GvnPass : public FunctionPass
+{
+public:
+    const char *name() const override { return "gvn"; }
+    bool run(IrFunction &func, PassStats &stats) override;
+
+private:
+    struct Expr
+    {
+        IrOp op;
+        koopa_raw_binary_op_t binary_op;
+        const IrValue *lhs;
+        const IrValue *rhs;
+
+        bool operator==(const Expr &other) const
+        {
+            return op == other.op && binary_op == other.binary_op && lhs == other.lhs && rhs == other.rhs;
+        }
+    };
+    struct ExprHash
+    {
+        size_t operator()(const Expr &expr) const
+        {
+            size_t h = (size_t)expr.op * 31 + expr.binary_op;
+            h = h * 1000003 ^ hash<const void *>()(expr.lhs);
+            return h * 1000003 ^ hash<const void *>()(expr.rhs);
+        }
+    };
+    // load 的地址上可用的值，以及记录时内存的版本
+    struct Available
+    {
+        IrValue *value;
+        uint32_t epoch;
+        uint32_t root_gen;
+        uint32_t escape_gen;
+    };
+
+    unordered_map<Expr, IrValue *, ExprHash> exprs;
+    unordered_map<const IrValue *, Available> loads;
+    // 撤销记录，旧值为空表示原来没有
+    vector<pair<Expr, IrValue *>> expr_undo;
+    vector<pair<const IrValue *, Available>> load_undo;
+    vector<pair<uint32_t *, uint32_t>> gen_undo;
+
+    // 内存的版本：epoch 使所有记录失效；root_gens 按 alloc 或全局变量的编号，unknown_gen 对应未知地址；
+    // escape_gen 由未知地址的 store 增加，使全局变量和未知地址的记录失效
+    uint32_t epoch = 0;
+    vector<uint32_t> root_gens;
+    uint32_t unknown_gen = 0;
+    uint32_t escape_gen = 0;
+    size_t replaced = 0;
+
+    uint32_t &gen_of(const IrValue *root) { return root != nullptr ? root_gens[root->id] : unknown_gen; }
+    void bump(uint32_t &gen);
+    Available snapshot(const IrValue *root);
+    void set_load(const IrValue *ptr, const Available &available);
+    void visit(IrFunction &func, IrBlock *bb);
+};
+
+// 交换操作数不改变结果的运算
+static bool commutative(koopa_raw_binary_op_t op)
+{
+    switch (op)
+    {
+    case KOOPA_RBO_NOT_EQ:
+    case KOOPA_RBO_EQ:
+    case KOOPA_RBO_ADD:
+    case KOOPA_RBO_MUL:
+    case KOOPA_RBO_AND:
+    case KOOPA_RBO_OR:
+    case KOOPA_RBO_XOR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// 地址所在的 alloc 或全局变量，来自参数等的未知地址返回 nullptr
+static const IrValue *root_of(const IrValue *ptr)
+{
+    while (ptr->op == IrOp::GetElemPtr || ptr->op == IrOp::GetPtr)
+        ptr = ptr->operand(0);
+    if (ptr->op == IrOp::Alloc || (ptr->op == IrOp::Const && ptr->data.raw->kind.tag == KOOPA_RVT_GLOBAL_ALLOC))
+        return ptr;
+    return nullptr;
+}
+
+// 未知地址可能指向全局变量（但不会指向当前函数的 alloc）
+static bool may_escape(const IrValue *root)
+{
+    return root == nullptr || root->op == IrOp::Const;
+}
+
+void GvnPass::bump(uint32_t &gen)
+{
+    gen_undo.emplace_back(&gen, gen);
+    gen++;
+}
+
+GvnPass::Available GvnPass::snapshot(const IrValue *root)
+{
+    return {nullptr, epoch, gen_of(root), may_escape(root) ? escape_gen : 0};
+}
+
+void GvnPass::set_load(const IrValue *ptr, const Available &available)
+{
+    auto [it, inserted] = loads.try_emplace(ptr, available);
+    load_undo.emplace_back(ptr, inserted ? Available{} : it->second);
+    it->second = available;
+}
+
+void GvnPass::visit(IrFunction &func, IrBlock *bb)
+{
+    // 只有一个前驱时前驱就是支配树上的父结点，到达这里时内存与离开父结点时相同
+    if (bb->preds.size() != 1)
+        bump(epoch);
+    for (IrValue *inst = bb->first, *next; inst != nullptr; inst = next)
+    {
+        next = inst->next;
+        switch (inst->op)
+        {
+        case IrOp::Binary:
+        case IrOp::GetElemPtr:
+        case IrOp::GetPtr:
+        {
+            Expr expr = {inst->op, KOOPA_RBO_NOT_EQ, inst->operand(0), inst->operand(1)};
+            if (inst->op == IrOp::Binary)
+            {
+                expr.binary_op = inst->data.binary_op;
+                if (commutative(expr.binary_op) && expr.lhs->id > expr.rhs->id)
+                    swap(expr.lhs, expr.rhs);
+            }
+            auto [it, inserted] = exprs.try_emplace(expr, inst);
+            if (inserted)
+            {
+                expr_undo.emplace_back(expr, nullptr);
+                break;
+            }
+            func.replace_all_uses(inst, it->second);
+            func.erase(inst);
+            replaced++;
+            break;
+        }
+        case IrOp::Load:
+        {
+            const IrValue *ptr = inst->operand(0);
+            Available now = snapshot(root_of(ptr));
+            auto it = loads.find(ptr);
+            if (it != loads.end() && it->second.epoch == now.epoch && it->second.root_gen == now.root_gen &&
+                it->second.escape_gen == now.escape_gen)
+            {
+                func.replace_all_uses(inst, it->second.value);
+                func.erase(inst);
+                replaced++;
+                break;
+            }
+            now.value = inst;
+            set_load(ptr, now);
+            break;
+        }
+        case IrOp::Store:
+        {
+            const IrValue *ptr = inst->operand(1);
+            const IrValue *root = root_of(ptr);
+            if (root == nullptr)
+                bump(escape_gen);
+            else
+            {
+                bump(gen_of(root));
+                if (may_escape(root))
+                    bump(unknown_gen);
+            }
+            // store 之后读取同一地址得到写入的值
+            Available now = snapshot(root);
+            now.value = inst->operand(0);
+            set_load(ptr, now);
+            break;
+        }
+        case IrOp::Call:
+            bump(epoch);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+bool GvnPass::run(IrFunction &func, PassStats &stats)
+{
+    func.compute_cfg();
+    DominatorTree dom(func);
+    exprs.clear();
+    loads.clear();
+    expr_undo.clear();
+    load_undo.clear();
+    gen_undo.clear();
+    epoch = unknown_gen = escape_gen = 0;
+    root_gens.assign(func.value_count(), 0);
+    replaced = 0;
+
+    // 离开基本块时按进入时的位置撤销
+    struct Mark
+    {
+        size_t exprs, loads, gens;
+    };
+    auto restore = [&](const Mark &mark)
+    {
+        while (expr_undo.size() > mark.exprs)
+        {
+            auto &[expr, old] = expr_undo.back();
+            if (old == nullptr)
+                exprs.erase(expr);
+            else
+                exprs[expr] = old;
+            expr_undo.pop_back();
+        }
+        while (load_undo.size() > mark.loads)
+        {
+            auto &[ptr, old] = load_undo.back();
+            if (old.value == nullptr)
+                loads.erase(ptr);
+            else
+                loads[ptr] = old;
+            load_undo.pop_back();
+        }
+        while (gen_undo.size() > mark.gens)
+        {
+            *gen_undo.back().first = gen_undo.back().second;
+            gen_undo.pop_back();
+        }
+    };
+    vector<pair<IrBlock *, size_t>> stack;
+    vector<Mark> marks;
+    visit(func, func.entry());
+    stack.emplace_back(func.entry(), 0);
+    marks.push_back({0, 0, 0});
+    while (!stack.empty())
+    {
+        auto &[bb, i] = stack.back();
+        if (i < dom.children(bb).size())
+        {
+            IrBlock *kid = dom.children(bb)[i++];
+            marks.push_back({expr_undo.size(), load_undo.size(), gen_undo.size()});
+            visit(func, kid);
+            stack.emplace_back(kid, 0);
+        }
+        else
+        {
+            restore(marks.back());
+            marks.pop_back();
+            stack.pop_back();
+        }
+    }
+
+    stats.values_replaced += replaced;
+    stats.insts_removed += replaced;
+    return replaced > 0;
+}
+
+unique_ptr<Pass> create_gvn_pass()
+{
+    return make_unique<GvnPass>();
+}
@@ -0,0 +1,792 @@
+#include "ir.h"
+#include <cassert>
+
+extern thread_local KoopaBuilder builder;
+
+static void link_use(IrUse *use, IrValue *value)
+{
+    use->value = value;
+    use->prev = nullptr;
+    use->next = value->uses;
+    if (value->uses != nullptr)
+        value->uses->prev = use;
+    value->uses = use;
+}
+
+static void unlink_use(IrUse *use)
+{
+    if (use->prev != nullptr)
+        use->prev->next = use->next;
+    else
+        use->value->uses = use->next;
+    if (use->next != nullptr)
+        use->next->prev = use->prev;
+    use->value = nullptr;
+}
+
+size_t IrValue::num_succs() const
+{
+    switch (op)
+    {
+    case IrOp::Branch:
+        return 2;
+    case IrOp::Jump:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+IrBlock *IrValue::succ(size_t i) const
+{
+    if (op == IrOp::Jump)
+        return data.target;
+    return i == 0 ? data.branch.true_bb : data.branch.false_bb;
+}
+
+size_t IrValue::args_begin(size_t i) const
+{
+    if (op == IrOp::Jump)
+        return 0;
+    return i == 0 ? 1 : 1 + data.branch.true_args;
+}
+
+size_t IrValue::args_count(size_t i) const
+{
+    if (op == IrOp::Jump)
+        return num_ops;
+    return i == 0 ? data.branch.true_args : num_ops - 1 - data.branch.true_args;
+}
+
+IrFunction::IrFunction(koopa_raw_function_t func) : func(func)
+{
+    for (size_t i = 0; i < func->params.len; i++)
+    {
+        auto param = reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i]);
+        IrValue *arg = new_value(IrOp::FuncArg, param->ty, 0);
+        arg->name = param->name;
+        arg->data.index = i;
+        func_params.push_back(arg);
+    }
+}
+
+IrValue *IrFunction::new_value(IrOp op, koopa_raw_type_t ty, size_t num_ops)
+{
+    IrValue *value = free_values;
+    if (value != nullptr)
+    {
+        free_values = value->next;
+        memset(value, 0, sizeof(IrValue));
+    }
+    else
+    {
+        value = pool.make<IrValue>();
+    }
+    value->op = op;
+    value->id = next_value_id++;
+    value->ty = ty;
+    value->num_ops = num_ops;
+    if (num_ops != 0)
+    {
+        value->ops = static_cast<IrUse *>(pool.alloc(sizeof(IrUse) * num_ops));
+        for (size_t i = 0; i < num_ops; i++)
+            value->ops[i].user = value;
+    }
+    return value;
+}
+
+IrValue *IrFunction::new_inst(IrOp op, koopa_raw_type_t ty, const vector<IrValue *> &ops)
+{
+    assert(insert_bb != nullptr);
+    IrValue *inst = new_value(op, ty, ops.size());
+    for (size_t i = 0; i < ops.size(); i++)
+        link_use(&inst->ops[i], ops[i]);
+    link_inst(inst, insert_bb, insert_before);
+    return inst;
+}
+
+void IrFunction::link_inst(IrValue *inst, IrBlock *bb, IrValue *before)
+{
+    inst->block = bb;
+    inst->next = before;
+    inst->prev = before != nullptr ? before->prev : bb->last;
+    if (inst->prev != nullptr)
+        inst->prev->next = inst;
+    else
+        bb->first = inst;
+    if (before != nullptr)
+        before->prev = inst;
+    else
+        bb->last = inst;
+}
+
+void IrFunction::unlink_inst(IrValue *inst)
+{
+    IrBlock *bb = inst->block;
+    if (inst->prev != nullptr)
+        inst->prev->next = inst->next;
+    else
+        bb->first = inst->next;
+    if (inst->next != nullptr)
+        inst->next->prev = inst->prev;
+    else
+        bb->last = inst->prev;
+    inst->block = nullptr;
+    inst->prev = inst->next = nullptr;
+}
+
+IrValue *IrFunction::integer(int value)
+{
+    auto &ret = integers[value];
+    if (ret == nullptr)
+    {
+        ret = new_value(IrOp::Integer, builder.int_type(), 0);
+        ret->data.integer = value;
+    }
+    return ret;
+}
+
+IrValue *IrFunction::constant(koopa_raw_value_t raw)
+{
+    auto &ret = constants[raw];
+    if (ret == nullptr)
+    {
+        ret = new_value(IrOp::Const, raw->ty, 0);
+        ret->name = raw->name;
+        ret->data.raw = raw;
+    }
+    return ret;
+}
+
+IrBlock *IrFunction::new_block(const string &name, IrBlock *after)
+{
+    auto bb = new IrBlock();
+    blocks.emplace_back(bb);
+    bb->id = next_block_id++;
+    // Koopa IR 中基本块的名字不能重复
+    string unique = name;
+    for (int i = 1; block_names.count(unique); i++)
+        unique = name + "_" + to_string(i);
+    bb->name = pool.dup(unique);
+    block_names.insert(bb->name);
+
+    if (after == nullptr)
+        after = last_block;
+    bb->prev = after;
+    bb->next = after != nullptr ? after->next : nullptr;
+    if (after != nullptr)
+        after->next = bb;
+    else
+        first_block = bb;
+    if (bb->next != nullptr)
+        bb->next->prev = bb;
+    else
+        last_block = bb;
+    return bb;
+}
+
+void IrFunction::erase_block(IrBlock *bb)
+{
+    for (IrValue *inst = bb->first; inst != nullptr; inst = inst->next)
+        drop_operands(inst);
+    while (bb->first != nullptr)
+        erase(bb->first);
+#ifndef NDEBUG
+    for (IrValue *param : bb->params)
+        assert(!param->has_uses());
+#endif
+
+    if (bb->prev != nullptr)
+        bb->prev->next = bb->next;
+    else
+        first_block = bb->next;
+    if (bb->next != nullptr)
+        bb->next->prev = bb->prev;
+    else
+        last_block = bb->prev;
+    bb->prev = bb->next = nullptr;
+    block_names.erase(bb->name);
+}
+
+IrValue *IrFunction::add_param(IrBlock *bb, koopa_raw_type_t ty)
+{
+    IrValue *param = new_value(IrOp::BlockArg, ty, 0);
+    param->block = bb;
+    param->data.index = bb->params.size();
+    bb->params.push_back(param);
+    return param;
+}
+
+void IrFunction::erase_param(IrBlock *bb, size_t index)
+{
+    assert(!bb->params[index]->has_uses());
+    bb->params.erase(bb->params.begin() + index);
+    for (size_t i = index; i < bb->params.size(); i++)
+        bb->params[i]->data.index = i;
+}
+
+void IrFunction::set_insert_point(IrBlock *bb, IrValue *before)
+{
+    insert_bb = bb;
+    insert_before = before;
+}
+
+IrValue *IrFunction::alloc(koopa_raw_type_t ty, const char *name)
+{
+    assert(name != nullptr);
+    IrValue *inst = new_inst(IrOp::Alloc, builder.pointer_type(ty), {});
+    inst->name = name;
+    return inst;
+}
+
+IrValue *IrFunction::load(IrValue *src)
+{
+    return new_inst(IrOp::Load, src->ty->data.pointer.base, {src});
+}
+
+IrValue *IrFunction::store(IrValue *value, IrValue *dest)
+{
+    return new_inst(IrOp::Store, builder.unit_type(), {value, dest});
+}
+
+IrValue *IrFunction::get_ptr(IrValue *src, IrValue *index)
+{
+    return new_inst(IrOp::GetPtr, src->ty, {src, index});
+}
+
+IrValue *IrFunction::get_elem_ptr(IrValue *src, IrValue *index)
+{
+    koopa_raw_type_t ty = builder.pointer_type(src->ty->data.pointer.base->data.array.base);
+    return new_inst(IrOp::GetElemPtr, ty, {src, index});
+}
+
+IrValue *IrFunction::binary(koopa_raw_binary_op_t op, IrValue *lhs, IrValue *rhs)
+{
+    IrValue *inst = new_inst(IrOp::Binary, builder.int_type(), {lhs, rhs});
+    inst->data.binary_op = op;
+    return inst;
+}
+
+IrValue *IrFunction::call(koopa_raw_function_t callee, const vector<IrValue *> &args)
+{
+    IrValue *inst = new_inst(IrOp::Call, callee->ty->data.function.ret, args);
+    inst->data.callee = callee;
+    return inst;
+}
+
+IrValue *IrFunction::branch(IrValue *cond, IrBlock *true_bb, const vector<IrValue *> &true_args,
+                            IrBlock *false_bb, const vector<IrValue *> &false_args)
+{
+    vector<IrValue *> ops;
+    ops.push_back(cond);
+    ops.insert(ops.end(), true_args.begin(), true_args.end());
+    ops.insert(ops.end(), false_args.begin(), false_args.end());
+    IrValue *inst = new_inst(IrOp::Branch, builder.unit_type(), ops);
+    inst->data.branch.true_bb = true_bb;
+    inst->data.branch.false_bb = false_bb;
+    inst->data.branch.true_args = true_args.size();
+    return inst;
+}
+
+IrValue *IrFunction::jump(IrBlock *target, const vector<IrValue *> &args)
+{
+    IrValue *inst = new_inst(IrOp::Jump, builder.unit_type(), args);
+    inst->data.target = target;
+    return inst;
+}
+
+IrValue *IrFunction::ret(IrValue *value)
+{
+    if (value == nullptr)
+        return new_inst(IrOp::Return, builder.unit_type(), {});
+    return new_inst(IrOp::Return, builder.unit_type(), {value});
+}
+
+void IrFunction::set_operand(IrValue *inst, size_t i, IrValue *value)
+{
+    IrUse *use = &inst->ops[i];
+    if (use->value != nullptr)
+        unlink_use(use);
+    if (value != nullptr)
+        link_use(use, value);
+}
+
+void IrFunction::replace_all_uses(IrValue *from, IrValue *to)
+{
+    assert(from != to);
+    while (from->uses != nullptr)
+    {
+        IrUse *use = from->uses;
+        unlink_use(use);
+        link_use(use, to);
+    }
+}
+
+void IrFunction::drop_operands(IrValue *inst)
+{
+    for (size_t i = 0; i < inst->num_ops; i++)
+    {
+        if (inst->ops[i].value != nullptr)
+            unlink_use(&inst->ops[i]);
+    }
+}
+
+void IrFunction::erase(IrValue *inst)
+{
+    assert(inst->is_inst() && !inst->has_uses());
+    drop_operands(inst);
+    unlink_inst(inst);
+    // 操作数数组不回收，只回收值本身
+    inst->next = free_values;
+    free_values = inst;
+}
+
+void IrFunction::move_before(IrValue *inst, IrBlock *bb, IrValue *before)
+{
+    unlink_inst(inst);
+    link_inst(inst, bb, before);
+}
+
+// 把 inst 的操作数 [pos, pos + erase) 换成 insert，其余操作数的使用关系不变
+void IrFunction::resize_operands(IrValue *inst, size_t pos, size_t erase, const vector<IrValue *> &insert)
+{
+    vector<IrValue *> ops;
+    for (size_t i = 0; i < inst->num_ops; i++)
+    {
+        if (i == pos)
+            ops.insert(ops.end(), insert.begin(), insert.end());
+        if (i < pos || i >= pos + erase)
+            ops.push_back(inst->ops[i].value);
+    }
+    if (pos == inst->num_ops)
+        ops.insert(ops.end(), insert.begin(), insert.end());
+
+    drop_operands(inst);
+    if (ops.size() > inst->num_ops)
+        inst->ops = static_cast<IrUse *>(pool.alloc(sizeof(IrUse) * ops.size()));
+    inst->num_ops = ops.size();
+    for (size_t i = 0; i < ops.size(); i++)
+    {
+        inst->ops[i].user = inst;
+        link_use(&inst->ops[i], ops[i]);
+    }
+}
+
+void IrFunction::set_succ(IrValue *term, size_t i, IrBlock *bb, const vector<IrValue *> &args)
+{
+    size_t count = term->args_count(i);
+    resize_operands(term, term->args_begin(i), count, args);
+    if (term->op == IrOp::Jump)
+    {
+        term->data.target = bb;
+    }
+    else if (i == 0)
+    {
+        term->data.branch.true_bb = bb;
+        term->data.branch.true_args = args.size();
+    }
+    else
+    {
+        term->data.branch.false_bb = bb;
+    }
+}
+
+void IrFunction::add_edge_arg(IrValue *term, size_t i, IrValue *arg)
+{
+    resize_operands(term, term->args_begin(i) + term->args_count(i), 0, {arg});
+    if (term->op == IrOp::Branch && i == 0)
+        term->data.branch.true_args++;
+}
+
+void IrFunction::erase_edge_arg(IrValue *term, size_t i, size_t index)
+{
+    assert(index < term->args_count(i));
+    resize_operands(term, term->args_begin(i) + index, 1, {});
+    if (term->op == IrOp::Branch && i == 0)
+        term->data.branch.true_args--;
+}
+
+void IrFunction::compute_cfg()
+{
+    for (IrBlock *bb = first_block; bb != nullptr; bb = bb->next)
+    {
+        bb->preds.clear();
+        bb->succs.clear();
+    }
+    for (IrBlock *bb = first_block; bb != nullptr; bb = bb->next)
+    {
+        IrValue *term = bb->terminator();
+        if (term == nullptr)
+            continue;
+        for (size_t i = 0; i < term->num_succs(); i++)
+        {
+            IrBlock *succ = term->succ(i);
+            bb->succs.push_back(succ);
+            succ->preds.push_back(bb);
+        }
+    }
+}
+
+bool IrFunction::verify(string &error) const
+{
+    auto fail = [&](const IrBlock *bb, const string &msg)
+    {
+        error += "IR error in " + string(func->name) + ", block " + bb->name + ": " + msg + "\n";
+        return false;
+    };
+    // 每个值的使用链表中的使用个数，与所有操作数中的使用个数对比
+    vector<size_t> listed(next_value_id), used(next_value_id);
+    auto count_uses = [&](const IrValue *value)
+    {
+        for (IrUse *use = value->uses; use != nullptr; use = use->next)
+        {
+            if (use->value != value || (use->next != nullptr && use->next->prev != use))
+                return false;
+            listed[value->id]++;
+        }
+        return true;
+    };
+
+    for (const IrBlock *bb = first_block; bb != nullptr; bb = bb->next)
+    {
+        if (bb->next != nullptr && bb->next->prev != bb)
+            return fail(bb, "broken block list");
+        for (const IrValue *param : bb->params)
+        {
+            if (!count_uses(param))
+                return fail(bb, "broken use list");
+        }
+        if (bb->terminator() == nullptr)
+            return fail(bb, "missing terminator");
+        for (const IrValue *inst = bb->first; inst != nullptr; inst = inst->next)
+        {
+            if (inst->block != bb || (inst->next != nullptr && inst->next->prev != inst))
+                return fail(bb, "broken instruction list");
+            if (inst->is_terminator() && inst != bb->last)
+                return fail(bb, "terminator in the middle of block");
+            if (!count_uses(inst))
+                return fail(bb, "broken use list");
+            for (size_t i = 0; i < inst->num_ops; i++)
+            {
+                const IrUse &use = inst->ops[i];
+                if (use.value == nullptr || use.user != inst)
+                    return fail(bb, "broken operand");
+                used[use.value->id]++;
+                if (use.value->is_inst() && use.value->block == nullptr)
+                    return fail(bb, "use of erased instruction");
+            }
+            for (size_t i = 0; i < inst->num_succs(); i++)
+            {
+                if (inst->args_count(i) != inst->succ(i)->params.size())
+                    return fail(bb, string("wrong number of arguments to ") + inst->succ(i)->name);
+            }
+        }
+    }
+    for (auto &param : func_params)
+    {
+        if (!count_uses(param))
+            return fail(first_block, "broken use list");
+    }
+    for (auto &it : integers)
+    {
+        if (!count_uses(it.second))
+            return fail(first_block, "broken use list");
+    }
+    for (auto &it : constants)
+    {
+        if (!count_uses(it.second))
+            return fail(first_block, "broken use list");
+    }
+    for (uint32_t id = 0; id < next_value_id; id++)
+    {
+        if (listed[id] != used[id])
+            return fail(first_block, "use list does not match operands");
+    }
+    return true;
+}
+
+// raw 指令的操作数，顺序与 IrValue 相同
+static void raw_operands(koopa_raw_value_t inst, vector<koopa_raw_value_t> &ops)
+{
+    ops.clear();
+    auto add_slice = [&](const koopa_raw_slice_t &slice)
+    {
+        for (size_t i = 0; i < slice.len; i++)
+            ops.push_back(reinterpret_cast<koopa_raw_value_t>(slice.buffer[i]));
+    };
+    const auto &kind = inst->kind;
+    switch (kind.tag)
+    {
+    case KOOPA_RVT_LOAD:
+        ops.push_back(kind.data.load.src);
+        break;
+    case KOOPA_RVT_STORE:
+        ops.push_back(kind.data.store.value);
+        ops.push_back(kind.data.store.dest);
+        break;
+    case KOOPA_RVT_GET_PTR:
+        ops.push_back(kind.data.get_ptr.src);
+        ops.push_back(kind.data.get_ptr.index);
+        break;
+    case KOOPA_RVT_GET_ELEM_PTR:
+        ops.push_back(kind.data.get_elem_ptr.src);
+        ops.push_back(kind.data.get_elem_ptr.index);
+        break;
+    case KOOPA_RVT_BINARY:
+        ops.push_back(kind.data.binary.lhs);
+        ops.push_back(kind.data.binary.rhs);
+        break;
+    case KOOPA_RVT_CALL:
+        add_slice(kind.data.call.args);
+        break;
+    case KOOPA_RVT_BRANCH:
+        ops.push_back(kind.data.branch.cond);
+        add_slice(kind.data.branch.true_args);
+        add_slice(kind.data.branch.false_args);
+        break;
+    case KOOPA_RVT_JUMP:
+        add_slice(kind.data.jump.args);
+        break;
+    case KOOPA_RVT_RETURN:
+        if (kind.data.ret.value != nullptr)
+            ops.push_back(kind.data.ret.value);
+        break;
+    default:
+        break;
+    }
+}
+
+static IrOp raw_op(koopa_raw_value_tag_t tag)
+{
+    switch (tag)
+    {
+    case KOOPA_RVT_ALLOC:
+        return IrOp::Alloc;
+    case KOOPA_RVT_LOAD:
+        return IrOp::Load;
+    case KOOPA_RVT_STORE:
+        return IrOp::Store;
+    case KOOPA_RVT_GET_PTR:
+        return IrOp::GetPtr;
+    case KOOPA_RVT_GET_ELEM_PTR:
+        return IrOp::GetElemPtr;
+    case KOOPA_RVT_BINARY:
+        return IrOp::Binary;
+    case KOOPA_RVT_CALL:
+        return IrOp::Call;
+    case KOOPA_RVT_BRANCH:
+        return IrOp::Branch;
+    case KOOPA_RVT_JUMP:
+        return IrOp::Jump;
+    case KOOPA_RVT_RETURN:
+        return IrOp::Return;
+    default:
+        // 函数体中不会出现其他指令
+        assert(false);
+        return IrOp::Return;
+    }
+}
+
+unique_ptr<IrFunction> IrFunction::from_raw(koopa_raw_function_t func)
+{
+    auto ir = make_unique<IrFunction>(func);
+    size_t num_insts = 0;
+    for (size_t i = 0; i < func->bbs.len; i++)
+        num_insts += reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i])->insts.len;
+    unordered_map<koopa_raw_value_t, IrValue *> values;
+    values.reserve(num_insts + func->params.len);
+    unordered_map<koopa_raw_basic_block_t, IrBlock *> bbs;
+    // 按出现顺序排列的指令
+    vector<IrValue *> insts;
+    insts.reserve(num_insts);
+    for (size_t i = 0; i < func->params.len; i++)
+        values[reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i])] = ir->func_params[i];
+
+    // 先建立所有基本块、参数和指令，再填写操作数，操作数可以引用后面才定义的值
+    for (size_t i = 0; i < func->bbs.len; i++)
+    {
+        auto raw_bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        IrBlock *bb = ir->new_block(raw_bb->name);
+        bbs[raw_bb] = bb;
+        for (size_t j = 0; j < raw_bb->params.len; j++)
+        {
+            auto raw_param = reinterpret_cast<koopa_raw_value_t>(raw_bb->params.buffer[j]);
+            IrValue *param = ir->add_param(bb, raw_param->ty);
+            param->name = raw_param->name;
+            values[raw_param] = param;
+        }
+    }
+    vector<koopa_raw_value_t> ops;
+    for (size_t i = 0; i < func->bbs.len; i++)
+    {
+        auto raw_bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        IrBlock *bb = bbs[raw_bb];
+        for (size_t j = 0; j < raw_bb->insts.len; j++)
+        {
+            auto raw = reinterpret_cast<koopa_raw_value_t>(raw_bb->insts.buffer[j]);
+            const auto &kind = raw->kind;
+            raw_operands(raw, ops);
+            IrValue *inst = ir->new_value(raw_op(kind.tag), raw->ty, ops.size());
+            inst->name = raw->name;
+            switch (kind.tag)
+            {
+            case KOOPA_RVT_BINARY:
+                inst->data.binary_op = kind.data.binary.op;
+                break;
+            case KOOPA_RVT_CALL:
+                inst->data.callee = kind.data.call.callee;
+                break;
+            case KOOPA_RVT_BRANCH:
+                inst->data.branch.true_bb = bbs.at(kind.data.branch.true_bb);
+                inst->data.branch.false_bb = bbs.at(kind.data.branch.false_bb);
+                inst->data.branch.true_args = kind.data.branch.true_args.len;
+                break;
+            case KOOPA_RVT_JUMP:
+                inst->data.target = bbs.at(kind.data.jump.target);
+                break;
+            default:
+                break;
+            }
+            ir->link_inst(inst, bb, nullptr);
+            insts.push_back(inst);
+            // 只有有返回值的指令可能被引用
+            if (raw->ty->tag != KOOPA_RTT_UNIT)
+                values[raw] = inst;
+        }
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < func->bbs.len; i++)
+    {
+        auto raw_bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        for (size_t j = 0; j < raw_bb->insts.len; j++)
+        {
+            auto raw = reinterpret_cast<koopa_raw_value_t>(raw_bb->insts.buffer[j]);
+            IrValue *inst = insts[n++];
+            raw_operands(raw, ops);
+            for (size_t k = 0; k < ops.size(); k++)
+            {
+                IrValue *op;
+                auto it = values.find(ops[k]);
+                if (it != values.end())
+                    op = it->second;
+                else if (ops[k]->kind.tag == KOOPA_RVT_INTEGER)
+                    op = ir->integer(ops[k]->kind.data.integer.value);
+                else
+                    op = ir->constant(ops[k]);
+                link_use(&inst->ops[k], op);
+            }
+        }
+    }
+    return ir;
+}
+
+void IrFunction::to_raw() const
+{
+    builder.rewrite_function(func);
+    vector<koopa_raw_value_t> raw(next_value_id, nullptr);
+    vector<koopa_raw_basic_block_t> raw_bbs(next_block_id, nullptr);
+    for (size_t i = 0; i < func_params.size(); i++)
+        raw[func_params[i]->id] = reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i]);
+    for (const IrBlock *bb = first_block; bb != nullptr; bb = bb->next)
+    {
+        raw_bbs[bb->id] = builder.block(bb->name);
+    }
+
+    // 还没有生成的指令用同类型的 undef 占位
+    unordered_map<koopa_raw_value_t, koopa_raw_value_t> placeholders;
+    auto get = [&](const IrValue *value)
+    {
+        koopa_raw_value_t &ret = raw[value->id];
+        if (ret == nullptr)
+        {
+            switch (value->op)
+            {
+            case IrOp::Integer:
+                ret = builder.integer(value->data.integer);
+                break;
+            case IrOp::Const:
+                ret = value->data.raw;
+                break;
+            default:
+                ret = builder.undef(value->ty);
+                placeholders[ret] = nullptr;
+                break;
+            }
+        }
+        return ret;
+    };
+    auto get_ops = [&](const IrValue *inst, size_t begin, size_t count)
+    {
+        vector<koopa_raw_value_t> ops;
+        for (size_t i = begin; i < begin + count; i++)
+            ops.push_back(get(inst->operand(i)));
+        return ops;
+    };
+
+    for (const IrBlock *bb = first_block; bb != nullptr; bb = bb->next)
+    {
+        koopa_raw_basic_block_t raw_bb = raw_bbs[bb->id];
+        builder.set_block(raw_bb);
+        for (const IrValue *param : bb->params)
+        {
+            koopa_raw_value_t &ret = raw[param->id];
+            koopa_raw_value_t real = builder.block_param(raw_bb, param->ty);
+            if (ret != nullptr)
+                placeholders[ret] = real;
+            ret = real;
+        }
+        for (const IrValue *inst = bb->first; inst != nullptr; inst = inst->next)
+        {
+            koopa_raw_value_t value = nullptr;
+            switch (inst->op)
+            {
+            case IrOp::Alloc:
+                value = builder.alloc(inst->name, inst->ty->data.pointer.base);
+                break;
+            case IrOp::Load:
+                value = builder.load(get(inst->operand(0)));
+                break;
+            case IrOp::Store:
+                builder.store(get(inst->operand(0)), get(inst->operand(1)));
+                break;
+            case IrOp::GetPtr:
+                value = builder.get_ptr(get(inst->operand(0)), get(inst->operand(1)));
+                break;
+            case IrOp::GetElemPtr:
+                value = builder.get_elem_ptr(get(inst->operand(0)), get(inst->operand(1)));
+                break;
+            case IrOp::Binary:
+                value = builder.binary(inst->data.binary_op, get(inst->operand(0)), get(inst->operand(1)));
+                break;
+            case IrOp::Call:
+                value = builder.call(inst->data.callee->name, get_ops(inst, 0, inst->num_ops));
+                break;
+            case IrOp::Branch:
+                builder.branch(get(inst->operand(0)), raw_bbs[inst->data.branch.true_bb->id], get_ops(inst, 1, inst->args_count(0)),
+                               raw_bbs[inst->data.branch.false_bb->id], get_ops(inst, inst->args_begin(1), inst->args_count(1)));
+                break;
+            case IrOp::Jump:
+                builder.jump(raw_bbs[inst->data.target->id], get_ops(inst, 0, inst->num_ops));
+                break;
+            case IrOp::Return:
+                builder.ret(inst->num_ops != 0 ? get(inst->operand(0)) : nullptr);
+                break;
+            default:
+                assert(false);
+            }
+            // 没有返回值的指令不会被引用，不需要记录
+            if (value != nullptr)
+            {
+                koopa_raw_value_t &ret = raw[inst->id];
+                if (ret != nullptr)
+                    placeholders[ret] = value;
+                ret = value;
+            }
+        }
+    }
+    builder.end_function();
+
+    // 用到占位值的情况很少（只在基本块的顺序与支配关系不一致时出现），这时逐条检查新的函数体
+    if (!placeholders.empty())
+        KoopaBuilder::patch_function(func, placeholders);
+}
@@ -0,0 +1,295 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "koopa.h"
+#include "koopa_builder.h"
+
+using namespace std;
+
+struct IrValue;
+struct IrBlock;
+
+/**
+ * 优化器使用的 SSA 形式中间表示
+ * raw program 是只读的，也没有使用关系，不能在上面做变换，IrFunction 把一个函数转换成可以修改的形式：
+ *   值和指令从函数的内存池中分配，删除的指令回收复用；每个值和基本块都有函数内稠密的编号，可以直接作为数组下标
+ *   指令用侵入式双向链表串在基本块中，基本块也串成链表
+ *   每个值记录所有使用它的位置（def-use 链），替换所有使用、删除指令的代价只与使用次数有关
+ *   基本块可以有参数，跳转时传入实参，代替 phi
+ * 与 raw 函数可以无损地互相转换：from_raw() 读入，to_raw() 通过 KoopaBuilder 重新生成原来那个函数的函数体
+ * 类型直接使用 raw 类型，全局变量、被调函数和聚合常量引用原来的 raw 值
+ * 以函数为单位，流式处理时每生成一个函数就可以立即转换和变换
+ */
+
+// 值的种类
+enum class IrOp : uint8_t
+{
+    // 不在基本块中的值
+    Integer,
+    // 全局变量以及 zeroinit、undef、aggregate 常量，保留原来的 raw 值
+    Const,
+    FuncArg,
+    BlockArg,
+    // 指令
+    Alloc,
+    Load,
+    Store,
+    GetPtr,
+    GetElemPtr,
+    Binary,
+    Call,
+    // 基本块的最后一条指令
+    Branch,
+    Jump,
+    Return
+};
+
+/**
+ * 一次使用：user 的一个操作数是 value
+ * 同一个值的所有使用串成双向链表，IrValue::uses 是表头
+ */
+struct IrUse
+{
+    IrValue *value;
+    IrValue *user;
+    IrUse *prev;
+    IrUse *next;
+};
+
+/**
+ * 值：常量、参数或指令
+ * 没有构造/析构函数，从 IrFunction 的内存池中分配
+ * 操作数的排列：
+ *   load src | store value, dest | getptr / getelemptr src, index | binary lhs, rhs
+ *   call 的各个实参 | ret [value] | jump 的各个实参 | br cond, 真分支的实参..., 假分支的实参...
+ */
+struct IrValue
+{
+    IrOp op;
+    // 函数内的编号，小于 IrFunction::value_count()
+    uint32_t id;
+    koopa_raw_type_t ty;
+    // 可能为空，alloc 一定有名字
+    const char *name;
+    // 使用这个值的位置
+    IrUse *uses;
+
+    // 指令所在的基本块和前后的指令
+    IrBlock *block;
+    IrValue *prev;
+    IrValue *next;
+
+    IrUse *ops;
+    uint32_t num_ops;
+
+    union
+    {
+        // Integer
+        int integer;
+        // Const
+        koopa_raw_value_t raw;
+        // FuncArg, BlockArg：第几个参数
+        uint32_t index;
+        // Binary
+        koopa_raw_binary_op_t binary_op;
+        // Call
+        koopa_raw_function_t callee;
+        // Jump
+        IrBlock *target;
+        // Branch
+        struct
+        {
+            IrBlock *true_bb;
+            IrBlock *false_bb;
+            // 真分支的实参个数
+            uint32_t true_args;
+        } branch;
+    } data;
+
+    bool is_inst() const { return op >= IrOp::Alloc; }
+    bool is_terminator() const { return op >= IrOp::Branch; }
+    IrValue *operand(size_t i) const { return ops[i].value; }
+    bool has_uses() const { return uses != nullptr; }
+    bool has_one_use() const { return uses != nullptr && uses->next == nullptr; }
+
+    // 跳转指令的后继，以及跳转到第 i 个后继时传入的实参：ops[args_begin(i), args_begin(i) + args_count(i))
+    size_t num_succs() const;
+    IrBlock *succ(size_t i) const;
+    size_t args_begin(size_t i) const;
+    size_t args_count(size_t i) const;
+};
+
+/**
+ * 基本块
+ * preds 和 succs 由 IrFunction::compute_cfg() 计算，一条边对应一项，修改跳转后需要重新计算
+ */
+struct IrBlock
+{
+    uint32_t id;
+    const char *name;
+    vector<IrValue *> params;
+    IrValue *first = nullptr;
+    IrValue *last = nullptr;
+    IrBlock *prev = nullptr;
+    IrBlock *next = nullptr;
+    vector<IrBlock *> preds;
+    vector<IrBlock *> succs;
+
+    bool empty() const { return first == nullptr; }
+    IrValue *terminator() const { return last != nullptr && last->is_terminator() ? last : nullptr; }
+};
+
+/**
+ * 一个函数的 IR
+ */
+class IrFunction
+{
+public:
+    explicit IrFunction(koopa_raw_function_t func);
+    IrFunction(const IrFunction &) = delete;
+    IrFunction &operator=(const IrFunction &) = delete;
+
+    /**
+     * @brief Convert the body of a raw function into IR
+     */
+    static unique_ptr<IrFunction> from_raw(koopa_raw_function_t func);
+
+    /**
+     * @brief Write the IR back as the new body of the raw function, using the thread's KoopaBuilder
+     * 基本块按链表中的顺序输出，在后面定义的值先用占位的值代替，最后再回填
+     */
+    void to_raw() const;
+
+    koopa_raw_function_t raw() const { return func; }
+    const vector<IrValue *> &params() const { return func_params; }
+    IrBlock *entry() const { return first_block; }
+    IrBlock *last() const { return last_block; }
+
+    // 编号的上界，包括已经删除的值和基本块
+    uint32_t value_count() const { return next_value_id; }
+    uint32_t block_count() const { return next_block_id; }
+
+    // 常量，同一个整数只有一个值
+    IrValue *integer(int value);
+    IrValue *constant(koopa_raw_value_t raw);
+
+    /**
+     * @brief Create a basic block after the given one (at the end if after is null)
+     * 名字与已有的基本块重复时自动加上后缀
+     */
+    IrBlock *new_block(const string &name, IrBlock *after = nullptr);
+
+    /**
+     * @brief Remove an empty basic block, or a block whose values are not used by other blocks
+     * 跳转到它的指令由调用者处理
+     */
+    void erase_block(IrBlock *bb);
+
+    IrValue *add_param(IrBlock *bb, koopa_raw_type_t ty);
+
+    /**
+     * @brief Remove an unused parameter, the arguments on incoming edges must be removed by the caller
+     */
+    void erase_param(IrBlock *bb, size_t index);
+
+    /**
+     * @brief Following instructions are inserted into bb before the given instruction (at the end if before is null)
+     */
+    void set_insert_point(IrBlock *bb, IrValue *before = nullptr);
+
+    // 指令
+    IrValue *alloc(koopa_raw_type_t ty, const char *name);
+    IrValue *load(IrValue *src);
+    IrValue *store(IrValue *value, IrValue *dest);
+    IrValue *get_ptr(IrValue *src, IrValue *index);
+    IrValue *get_elem_ptr(IrValue *src, IrValue *index);
+    IrValue *binary(koopa_raw_binary_op_t op, IrValue *lhs, IrValue *rhs);
+    IrValue *call(koopa_raw_function_t callee, const vector<IrValue *> &args);
+    IrValue *branch(IrValue *cond, IrBlock *true_bb, const vector<IrValue *> &true_args,
+                    IrBlock *false_bb, const vector<IrValue *> &false_args);
+    IrValue *jump(IrBlock *target, const vector<IrValue *> &args = {});
+    IrValue *ret(IrValue *value = nullptr);
+
+    /**
+     * @brief Let the i-th operand of inst use value
+     */
+    void set_operand(IrValue *inst, size_t i, IrValue *value);
+
+    /**
+     * @brief Replace all uses of from with to
+     */
+    void replace_all_uses(IrValue *from, IrValue *to);
+
+    /**
+     * @brief Stop using the operands of inst, e.g. before erasing instructions that use each other
+     */
+    void drop_operands(IrValue *inst);
+
+    /**
+     * @brief Remove an unused instruction, its memory is reused by later instructions
+     */
+    void erase(IrValue *inst);
+
+    /**
+     * @brief Move an instruction into bb before the given instruction (at the end if before is null)
+     */
+    void move_before(IrValue *inst, IrBlock *bb, IrValue *before);
+
+    /**
+     * @brief Redirect the i-th successor edge of a terminator to bb with new arguments
+     */
+    void set_succ(IrValue *term, size_t i, IrBlock *bb, const vector<IrValue *> &args);
+
+    /**
+     * @brief Append an argument to the i-th successor edge of a terminator
+     */
+    void add_edge_arg(IrValue *term, size_t i, IrValue *arg);
+
+    /**
+     * @brief Remove the index-th argument of the i-th successor edge of a terminator
+     */
+    void erase_edge_arg(IrValue *term, size_t i, size_t index);
+
+    /**
+     * @brief Compute preds and succs of all basic blocks
+     */
+    void compute_cfg();
+
+    /**
+     * @brief Check the structure of the IR: instruction lists, use lists, terminators and block arguments
+     * @return false if the IR is broken, the reason is appended to error
+     */
+    bool verify(string &error) const;
+
+private:
+    koopa_raw_function_t func;
+    vector<IrValue *> func_params;
+    IrBlock *first_block = nullptr;
+    IrBlock *last_block = nullptr;
+
+    // 值和操作数的内存池，删除的值串在 free_values 中复用
+    Arena pool;
+    IrValue *free_values = nullptr;
+    vector<unique_ptr<IrBlock>> blocks;
+    unordered_set<string_view> block_names;
+    uint32_t next_value_id = 0;
+    uint32_t next_block_id = 0;
+
+    unordered_map<int, IrValue *> integers;
+    unordered_map<koopa_raw_value_t, IrValue *> constants;
+
+    IrBlock *insert_bb = nullptr;
+    IrValue *insert_before = nullptr;
+
+    IrValue *new_value(IrOp op, koopa_raw_type_t ty, size_t num_ops);
+    IrValue *new_inst(IrOp op, koopa_raw_type_t ty, const vector<IrValue *> &ops);
+    void link_inst(IrValue *inst, IrBlock *bb, IrValue *before);
+    void unlink_inst(IrValue *inst);
+    void resize_operands(IrValue *inst, size_t pos, size_t erase, const vector<IrValue *> &insert);
+};
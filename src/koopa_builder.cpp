@@ -0,0 +1,543 @@
+#include "koopa_builder.h"
+#include <cassert>
+
+void *Arena::alloc(size_t size)
+{
+    size = (size + 7) & ~size_t(7);
+    if (size > left)
+    {
+        size_t chunk = size > CHUNK_SIZE ? size : CHUNK_SIZE;
+        chunks.emplace_back(new char[chunk]);
+        cur = chunks.back().get();
+        left = chunk;
+    }
+    void *ret = cur;
+    memset(ret, 0, size);
+    cur += size;
+    left -= size;
+    return ret;
+}
+
+const char *Arena::dup(const string &str)
+{
+    char *ret = static_cast<char *>(alloc(str.size() + 1));
+    memcpy(ret, str.c_str(), str.size() + 1);
+    return ret;
+}
+
+void Arena::clear()
+{
+    chunks.clear();
+    cur = nullptr;
+    left = 0;
+}
+
+koopa_raw_slice_t KoopaBuilder::make_slice(const vector<const void *> &items, koopa_raw_slice_item_kind_t kind)
+{
+    koopa_raw_slice_t slice;
+    slice.len = items.size();
+    slice.kind = kind;
+    slice.buffer = nullptr;
+    if (!items.empty())
+    {
+        auto buffer = static_cast<const void **>(mem().alloc(sizeof(const void *) * items.size()));
+        memcpy(buffer, items.data(), sizeof(const void *) * items.size());
+        slice.buffer = buffer;
+    }
+    return slice;
+}
+
+// 常量、全局变量等不在基本块中的值
+koopa_raw_value_data_t *KoopaBuilder::new_value(koopa_raw_type_t ty, koopa_raw_value_tag_t tag)
+{
+    auto value = mem().make<koopa_raw_value_data_t>();
+    value->ty = ty;
+    value->name = nullptr;
+    value->used_by = make_slice({}, KOOPA_RSIK_VALUE);
+    value->kind.tag = tag;
+    return value;
+}
+
+// 指令：插入当前基本块末尾，有返回值的匿名指令记为 %n
+koopa_raw_value_data_t *KoopaBuilder::new_inst(koopa_raw_type_t ty, koopa_raw_value_tag_t tag)
+{
+    assert(block_now != nullptr);
+    auto inst = new_value(ty, tag);
+    block_now->insts.push_back(inst);
+    if (ty->tag != KOOPA_RTT_UNIT && tag != KOOPA_RVT_ALLOC)
+    {
+        regs.push_back(inst);
+    }
+    return inst;
+}
+
+koopa_raw_type_t KoopaBuilder::int_type()
+{
+    if (i32_ty == nullptr)
+    {
+        auto ty = arena.make<koopa_raw_type_kind_t>();
+        ty->tag = KOOPA_RTT_INT32;
+        i32_ty = ty;
+    }
+    return i32_ty;
+}
+
+koopa_raw_type_t KoopaBuilder::unit_type()
+{
+    if (unit_ty == nullptr)
+    {
+        auto ty = arena.make<koopa_raw_type_kind_t>();
+        ty->tag = KOOPA_RTT_UNIT;
+        unit_ty = ty;
+    }
+    return unit_ty;
+}
+
+koopa_raw_type_t KoopaBuilder::pointer_type(koopa_raw_type_t base)
+{
+    auto &ty = pointer_types[base];
+    if (ty == nullptr)
+    {
+        auto new_ty = arena.make<koopa_raw_type_kind_t>();
+        new_ty->tag = KOOPA_RTT_POINTER;
+        new_ty->data.pointer.base = base;
+        ty = new_ty;
+    }
+    return ty;
+}
+
+koopa_raw_type_t KoopaBuilder::array_type(koopa_raw_type_t base, size_t len)
+{
+    auto &ty = array_types[make_pair(base, len)];
+    if (ty == nullptr)
+    {
+        auto new_ty = arena.make<koopa_raw_type_kind_t>();
+        new_ty->tag = KOOPA_RTT_ARRAY;
+        new_ty->data.array.base = base;
+        new_ty->data.array.len = len;
+        ty = new_ty;
+    }
+    return ty;
+}
+
+koopa_raw_type_t KoopaBuilder::array_type(const vector<int> &len, size_t skip)
+{
+    koopa_raw_type_t ty = int_type();
+    for (size_t i = len.size(); i > skip; i--)
+    {
+        ty = array_type(ty, len[i - 1]);
+    }
+    return ty;
+}
+
+koopa_raw_type_t KoopaBuilder::function_type(const vector<koopa_raw_type_t> &params, koopa_raw_type_t ret)
+{
+    auto ty = arena.make<koopa_raw_type_kind_t>();
+    ty->tag = KOOPA_RTT_FUNCTION;
+    ty->data.function.params = make_slice(vector<const void *>(params.begin(), params.end()), KOOPA_RSIK_TYPE);
+    ty->data.function.ret = ret;
+    return ty;
+}
+
+koopa_raw_value_t KoopaBuilder::integer(int value)
+{
+    auto ret = new_value(int_type(), KOOPA_RVT_INTEGER);
+    ret->kind.data.integer.value = value;
+    return ret;
+}
+
+koopa_raw_value_t KoopaBuilder::zero_init(koopa_raw_type_t ty)
+{
+    return new_value(ty, KOOPA_RVT_ZERO_INIT);
+}
+
+koopa_raw_value_t KoopaBuilder::undef(koopa_raw_type_t ty)
+{
+    return new_value(ty, KOOPA_RVT_UNDEF);
+}
+
+koopa_raw_value_t KoopaBuilder::aggregate(const koopa_raw_value_t *init, const vector<int> &len)
+{
+    if (len.empty())
+    {
+        return init[0];
+    }
+    int width = 1;
+    for (size_t i = 1; i < len.size(); i++)
+    {
+        width *= len[i];
+    }
+    vector<int> sublen(len.begin() + 1, len.end());
+    vector<const void *> elems;
+    for (int i = 0; i < len[0]; i++)
+    {
+        elems.push_back(aggregate(init + i * width, sublen));
+    }
+    auto ret = new_value(array_type(len), KOOPA_RVT_AGGREGATE);
+    ret->kind.data.aggregate.elems = make_slice(elems, KOOPA_RSIK_VALUE);
+    return ret;
+}
+
+koopa_raw_value_t KoopaBuilder::global_alloc(const string &name, koopa_raw_type_t ty, koopa_raw_value_t init, bool read_only)
+{
+    auto ret = new_value(pointer_type(ty), KOOPA_RVT_GLOBAL_ALLOC);
+    ret->name = mem().dup(name);
+    ret->kind.data.global_alloc.init = init;
+    global_values.push_back(ret);
+    if (func_now != nullptr)
+        locals[name] = ret;
+    else
+        globals[name] = ret;
+    if (read_only)
+        read_only_globals.insert(ret);
+    return ret;
+}
+
+void KoopaBuilder::declare_function(const string &name, const vector<koopa_raw_type_t> &params, koopa_raw_type_t ret)
+{
+    auto func = arena.make<koopa_raw_function_data_t>();
+    func->ty = function_type(params, ret);
+    func->name = arena.dup(name);
+    func->params = make_slice({}, KOOPA_RSIK_VALUE);
+    func->bbs = make_slice({}, KOOPA_RSIK_BASIC_BLOCK);
+    functions.push_back(func);
+    function_table[name] = func;
+}
+
+void KoopaBuilder::forward_function(const string &name, koopa_raw_type_t ret)
+{
+    auto func = arena.make<koopa_raw_function_data_t>();
+    func->ty = function_type({}, ret);
+    func->name = arena.dup(name);
+    func->params = make_slice({}, KOOPA_RSIK_VALUE);
+    func->bbs = make_slice({}, KOOPA_RSIK_BASIC_BLOCK);
+    function_table[name] = func;
+}
+
+void KoopaBuilder::begin_function(const string &name, const vector<pair<string, koopa_raw_type_t>> &params, koopa_raw_type_t ret)
+{
+    auto func = arena.make<koopa_raw_function_data_t>();
+    vector<koopa_raw_type_t> param_types;
+    vector<const void *> param_values;
+    for (size_t i = 0; i < params.size(); i++)
+    {
+        auto param = new_value(params[i].second, KOOPA_RVT_FUNC_ARG_REF);
+        param->name = arena.dup(params[i].first);
+        param->kind.data.func_arg_ref.index = i;
+        param_types.push_back(params[i].second);
+        param_values.push_back(param);
+        locals[params[i].first] = param;
+    }
+    func->ty = function_type(param_types, ret);
+    func->name = arena.dup(name);
+    func->params = make_slice(param_values, KOOPA_RSIK_VALUE);
+    functions.push_back(func);
+    defined.push_back(func);
+    // 先登记函数，以支持递归调用
+    function_table[name] = func;
+    func_now = func;
+}
+
+void KoopaBuilder::rewrite_function(koopa_raw_function_t func)
+{
+    assert(func_now == nullptr);
+    func_now = const_cast<koopa_raw_function_data_t *>(func);
+    for (size_t i = 0; i < func->params.len; i++)
+    {
+        auto param = reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i]);
+        if (param->name != nullptr)
+            locals[param->name] = param;
+    }
+}
+
+koopa_raw_function_t KoopaBuilder::end_function()
+{
+    // 只保留真正插入到函数中的基本块，按插入的先后排列
+    vector<const void *> bbs;
+    for (auto info : block_order)
+    {
+        info->bb->insts = make_slice(info->insts, KOOPA_RSIK_VALUE);
+        info->bb->params = make_slice(info->params, KOOPA_RSIK_VALUE);
+        bbs.push_back(info->bb);
+    }
+    func_now->bbs = make_slice(bbs, KOOPA_RSIK_BASIC_BLOCK);
+    koopa_raw_function_t func = func_now;
+    func_now = nullptr;
+    locals.clear();
+    block_table.clear();
+    blocks.clear();
+    block_order.clear();
+    block_now = nullptr;
+    regs.clear();
+    return func;
+}
+
+// 把 raw 指令中的占位值换成真正的值
+static void patch_operands(koopa_raw_value_t inst, const unordered_map<koopa_raw_value_t, koopa_raw_value_t> &real)
+{
+    auto patch = [&](koopa_raw_value_t &value)
+    {
+        auto it = real.find(value);
+        if (it != real.end())
+            value = it->second;
+    };
+    auto patch_slice = [&](const koopa_raw_slice_t &slice)
+    {
+        auto buffer = const_cast<const void **>(slice.buffer);
+        for (size_t i = 0; i < slice.len; i++)
+        {
+            auto value = reinterpret_cast<koopa_raw_value_t>(buffer[i]);
+            patch(value);
+            buffer[i] = value;
+        }
+    };
+    auto &kind = const_cast<koopa_raw_value_kind_t &>(inst->kind);
+    switch (kind.tag)
+    {
+    case KOOPA_RVT_LOAD:
+        patch(kind.data.load.src);
+        break;
+    case KOOPA_RVT_STORE:
+        patch(kind.data.store.value);
+        patch(kind.data.store.dest);
+        break;
+    case KOOPA_RVT_GET_PTR:
+        patch(kind.data.get_ptr.src);
+        patch(kind.data.get_ptr.index);
+        break;
+    case KOOPA_RVT_GET_ELEM_PTR:
+        patch(kind.data.get_elem_ptr.src);
+        patch(kind.data.get_elem_ptr.index);
+        break;
+    case KOOPA_RVT_BINARY:
+        patch(kind.data.binary.lhs);
+        patch(kind.data.binary.rhs);
+        break;
+    case KOOPA_RVT_CALL:
+        patch_slice(kind.data.call.args);
+        break;
+    case KOOPA_RVT_BRANCH:
+        patch(kind.data.branch.cond);
+        patch_slice(kind.data.branch.true_args);
+        patch_slice(kind.data.branch.false_args);
+        break;
+    case KOOPA_RVT_JUMP:
+        patch_slice(kind.data.jump.args);
+        break;
+    case KOOPA_RVT_RETURN:
+        if (kind.data.ret.value != nullptr)
+            patch(kind.data.ret.value);
+        break;
+    default:
+        break;
+    }
+}
+
+void KoopaBuilder::patch_function(koopa_raw_function_t func, const unordered_map<koopa_raw_value_t, koopa_raw_value_t> &real)
+{
+    for (size_t i = 0; i < func->bbs.len; i++)
+    {
+        auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        for (size_t j = 0; j < bb->insts.len; j++)
+            patch_operands(reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]), real);
+    }
+}
+
+koopa_raw_basic_block_t KoopaBuilder::block(const string &name)
+{
+    auto &info = block_table[name];
+    if (info == nullptr)
+    {
+        auto bb = func_arena.make<koopa_raw_basic_block_data_t>();
+        bb->name = func_arena.dup(name);
+        bb->used_by = make_slice({}, KOOPA_RSIK_VALUE);
+        bb->params = make_slice({}, KOOPA_RSIK_VALUE);
+        blocks.emplace_back(new BlockInfo{bb, {}});
+        info = blocks.back().get();
+    }
+    return info->bb;
+}
+
+void KoopaBuilder::set_block(koopa_raw_basic_block_t bb)
+{
+    auto info = block_table.at(bb->name);
+    // 与文本形式中标号出现的顺序一致
+    block_order.push_back(info);
+    block_now = info;
+}
+
+koopa_raw_value_t KoopaBuilder::block_param(koopa_raw_basic_block_t bb, koopa_raw_type_t ty)
+{
+    auto info = block_table.at(bb->name);
+    auto param = new_value(ty, KOOPA_RVT_BLOCK_ARG_REF);
+    param->kind.data.block_arg_ref.index = info->params.size();
+    info->params.push_back(param);
+    // 与匿名的指令结果一样可以通过 reg(n) 取到
+    regs.push_back(param);
+    return param;
+}
+
+koopa_raw_value_t KoopaBuilder::alloc(const string &name, koopa_raw_type_t ty)
+{
+    auto ret = new_inst(pointer_type(ty), KOOPA_RVT_ALLOC);
+    ret->name = func_arena.dup(name);
+    locals[name] = ret;
+    return ret;
+}
+
+koopa_raw_value_t KoopaBuilder::load(koopa_raw_value_t src)
+{
+    auto ret = new_inst(src->ty->data.pointer.base, KOOPA_RVT_LOAD);
+    ret->kind.data.load.src = src;
+    return ret;
+}
+
+void KoopaBuilder::store(koopa_raw_value_t value, koopa_raw_value_t dest)
+{
+    auto ret = new_inst(unit_type(), KOOPA_RVT_STORE);
+    ret->kind.data.store.value = value;
+    ret->kind.data.store.dest = dest;
+}
+
+koopa_raw_value_t KoopaBuilder::get_ptr(koopa_raw_value_t src, koopa_raw_value_t index)
+{
+    auto ret = new_inst(src->ty, KOOPA_RVT_GET_PTR);
+    ret->kind.data.get_ptr.src = src;
+    ret->kind.data.get_ptr.index = index;
+    return ret;
+}
+
+koopa_raw_value_t KoopaBuilder::get_elem_ptr(koopa_raw_value_t src, koopa_raw_value_t index)
+{
+    auto ret = new_inst(pointer_type(src->ty->data.pointer.base->data.array.base), KOOPA_RVT_GET_ELEM_PTR);
+    ret->kind.data.get_elem_ptr.src = src;
+    ret->kind.data.get_elem_ptr.index = index;
+    return ret;
+}
+
+koopa_raw_value_t KoopaBuilder::binary(koopa_raw_binary_op_t op, koopa_raw_value_t lhs, koopa_raw_value_t rhs)
+{
+    auto ret = new_inst(int_type(), KOOPA_RVT_BINARY);
+    ret->kind.data.binary.op = op;
+    ret->kind.data.binary.lhs = lhs;
+    ret->kind.data.binary.rhs = rhs;
+    return ret;
+}
+
+void KoopaBuilder::branch(koopa_raw_value_t cond, koopa_raw_basic_block_t true_bb, koopa_raw_basic_block_t false_bb)
+{
+    auto ret = new_inst(unit_type(), KOOPA_RVT_BRANCH);
+    ret->kind.data.branch.cond = cond;
+    ret->kind.data.branch.true_bb = true_bb;
+    ret->kind.data.branch.false_bb = false_bb;
+    ret->kind.data.branch.true_args = make_slice({}, KOOPA_RSIK_VALUE);
+    ret->kind.data.branch.false_args = make_slice({}, KOOPA_RSIK_VALUE);
+}
+
+void KoopaBuilder::jump(koopa_raw_basic_block_t target)
+{
+    auto ret = new_inst(unit_type(), KOOPA_RVT_JUMP);
+    ret->kind.data.jump.target = target;
+    ret->kind.data.jump.args = make_slice({}, KOOPA_RSIK_VALUE);
+}
+
+void KoopaBuilder::branch(koopa_raw_value_t cond, koopa_raw_basic_block_t true_bb, const vector<koopa_raw_value_t> &true_args,
+                          koopa_raw_basic_block_t false_bb, const vector<koopa_raw_value_t> &false_args)
+{
+    auto ret = new_inst(unit_type(), KOOPA_RVT_BRANCH);
+    ret->kind.data.branch.cond = cond;
+    ret->kind.data.branch.true_bb = true_bb;
+    ret->kind.data.branch.false_bb = false_bb;
+    ret->kind.data.branch.true_args = make_slice(vector<const void *>(true_args.begin(), true_args.end()), KOOPA_RSIK_VALUE);
+    ret->kind.data.branch.false_args = make_slice(vector<const void *>(false_args.begin(), false_args.end()), KOOPA_RSIK_VALUE);
+}
+
+void KoopaBuilder::jump(koopa_raw_basic_block_t target, const vector<koopa_raw_value_t> &args)
+{
+    auto ret = new_inst(unit_type(), KOOPA_RVT_JUMP);
+    ret->kind.data.jump.target = target;
+    ret->kind.data.jump.args = make_slice(vector<const void *>(args.begin(), args.end()), KOOPA_RSIK_VALUE);
+}
+
+koopa_raw_value_t KoopaBuilder::call(const string &callee, const vector<koopa_raw_value_t> &args)
+{
+    auto func = function_table.at(callee);
+    auto ret = new_inst(func->ty->data.function.ret, KOOPA_RVT_CALL);
+    ret->kind.data.call.callee = func;
+    ret->kind.data.call.args = make_slice(vector<const void *>(args.begin(), args.end()), KOOPA_RSIK_VALUE);
+    return ret;
+}
+
+void KoopaBuilder::ret(koopa_raw_value_t value)
+{
+    auto ret = new_inst(unit_type(), KOOPA_RVT_RETURN);
+    ret->kind.data.ret.value = value;
+}
+
+void KoopaBuilder::import_globals(const KoopaBuilder &other)
+{
+    globals.insert(other.globals.begin(), other.globals.end());
+    function_table.insert(other.function_table.begin(), other.function_table.end());
+}
+
+koopa_raw_value_t KoopaBuilder::value(const string &name)
+{
+    auto it = locals.find(name);
+    if (it != locals.end())
+    {
+        return it->second;
+    }
+    return globals.at(name);
+}
+
+koopa_raw_value_t KoopaBuilder::reg(int n)
+{
+    return regs.at(n);
+}
+
+koopa_raw_program_t KoopaBuilder::build()
+{
+    koopa_raw_program_t program;
+    program.values = make_slice(global_values, KOOPA_RSIK_VALUE);
+    program.funcs = make_slice(functions, KOOPA_RSIK_FUNCTION);
+    global_values.clear();
+    functions.clear();
+    return program;
+}
+
+void KoopaBuilder::clear()
+{
+    func_now = nullptr;
+    locals.clear();
+    block_table.clear();
+    blocks.clear();
+    block_order.clear();
+    block_now = nullptr;
+    regs.clear();
+
+    i32_ty = nullptr;
+    unit_ty = nullptr;
+    pointer_types.clear();
+    array_types.clear();
+    global_values.clear();
+    functions.clear();
+    globals.clear();
+    function_table.clear();
+    read_only_globals.clear();
+    defined.clear();
+    func_arena.clear();
+    arena.clear();
+}
+
+void KoopaBuilder::release_functions()
+{
+    assert(func_now == nullptr);
+    for (auto func : defined)
+    {
+        func->bbs = make_slice({}, KOOPA_RSIK_BASIC_BLOCK);
+    }
+    defined.clear();
+    // 函数中定义的全局变量也在 func_arena 中，此时都已经输出
+    read_only_globals.clear();
+    func_arena.clear();
+}
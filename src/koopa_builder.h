@@ -0,0 +1,256 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "koopa.h"
+
+using namespace std;
+
+/**
+ * 简单的区域分配器
+ * raw program 中的所有结构体、名字和 slice 缓冲区都从这里分配
+ * 只申请不释放，随 Arena 析构一次性归还
+ */
+class Arena
+{
+public:
+    Arena() = default;
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    /**
+     * @brief Allocate zero-filled memory
+     * @param size Number of bytes
+     * @return 8-byte aligned memory owned by the arena
+     */
+    void *alloc(size_t size);
+
+    /**
+     * @brief Allocate a zero-filled object of type T (T must be a C struct)
+     */
+    template <typename T>
+    T *make()
+    {
+        return static_cast<T *>(alloc(sizeof(T)));
+    }
+
+    /**
+     * @brief Copy a string into the arena
+     */
+    const char *dup(const string &str);
+
+    /**
+     * @brief Free all memory owned by the arena
+     */
+    void clear();
+
+private:
+    static const size_t CHUNK_SIZE = 1 << 16;
+    vector<unique_ptr<char[]>> chunks;
+    char *cur = nullptr;
+    size_t left = 0;
+};
+
+/**
+ * Koopa IR 构建器
+ * AST 通过它直接在内存中构建 raw program，省去 "生成文本 -> 重新解析" 的过程
+ * 构建方式与文本形式一一对应：
+ *   begin_function / end_function  <->  fun @f(...) { ... }
+ *   set_block(block("%name"))     <->  %name:
+ *   其余指令方法                   <->  一条指令
+ * 没有名字的指令结果按出现顺序记录，reg(n) 即文本中的 %n
+ * 注意：raw 值的 used_by 不维护，后端和 koopa_generate_raw_to_koopa 都不依赖它，需要使用关系时转换成 IrFunction
+ * 类型、全局变量和函数声明在整个编译过程中有效
+ * 函数体（基本块、指令及其中的常量）单独分配，可以在代码生成后用 release_functions() 释放
+ */
+class KoopaBuilder
+{
+public:
+    KoopaBuilder() = default;
+    KoopaBuilder(const KoopaBuilder &) = delete;
+    KoopaBuilder &operator=(const KoopaBuilder &) = delete;
+
+    // 类型
+    koopa_raw_type_t int_type();
+    koopa_raw_type_t unit_type();
+    koopa_raw_type_t pointer_type(koopa_raw_type_t base);
+    koopa_raw_type_t array_type(koopa_raw_type_t base, size_t len);
+    /**
+     * @brief Build the type of an array such as int a[len[0]][len[1]]...
+     * @param len The length of each dimension, from outermost to innermost
+     * @param skip Number of outer dimensions to skip
+     */
+    koopa_raw_type_t array_type(const vector<int> &len, size_t skip = 0);
+
+    // 常量
+    koopa_raw_value_t integer(int value);
+    koopa_raw_value_t zero_init(koopa_raw_type_t ty);
+    koopa_raw_value_t undef(koopa_raw_type_t ty);
+    /**
+     * @brief Build an aggregate initializer for an array
+     * @param init Flattened elements of the array, len[0] * len[1] * ... in total
+     * @param len The length of each dimension
+     */
+    koopa_raw_value_t aggregate(const koopa_raw_value_t *init, const vector<int> &len);
+
+    /**
+     * @brief Define a global variable: global @name = alloc ty, init
+     * 在函数定义中调用时（例如局部的常量数组），只能在这个函数中按名字找到，和函数体一起释放
+     * @param read_only The variable is never written, the backend may place it in read-only data
+     */
+    koopa_raw_value_t global_alloc(const string &name, koopa_raw_type_t ty, koopa_raw_value_t init, bool read_only = false);
+
+    /**
+     * @brief Whether a global variable was defined with read_only
+     * 文本形式的 Koopa IR 中没有这个信息，解析得到的全局变量都不是只读的
+     */
+    bool is_read_only(koopa_raw_value_t global) const { return read_only_globals.count(global) != 0; }
+
+    /**
+     * @brief Declare a library function: decl @name(params): ret
+     */
+    void declare_function(const string &name, const vector<koopa_raw_type_t> &params, koopa_raw_type_t ret);
+
+    /**
+     * @brief Register a function defined elsewhere (e.g. on another thread) so that it can be called
+     * 只登记名字和返回类型，不会出现在 build() 的结果中
+     */
+    void forward_function(const string &name, koopa_raw_type_t ret);
+
+    /**
+     * @brief Start a function definition, the parameters can be found by value(name)
+     * @param params Name and type of each parameter
+     */
+    void begin_function(const string &name, const vector<pair<string, koopa_raw_type_t>> &params, koopa_raw_type_t ret);
+
+    /**
+     * @brief Start building a new body for a function defined before, e.g. after optimizing it
+     * 参数沿用原来的值，原来的函数体在 end_function() 时被替换
+     */
+    void rewrite_function(koopa_raw_function_t func);
+
+    /**
+     * @brief Finish the current function definition
+     * @return The finished function
+     */
+    koopa_raw_function_t end_function();
+
+    /**
+     * @brief Replace placeholder operands in the body of a function by the real values
+     * 在定义之前使用的值先用占位值代替，函数结束后再回填
+     */
+    static void patch_function(koopa_raw_function_t func, const unordered_map<koopa_raw_value_t, koopa_raw_value_t> &real);
+
+    /**
+     * @brief Get the basic block with given name in current function, create it if not exist
+     */
+    koopa_raw_basic_block_t block(const string &name);
+
+    /**
+     * @brief Append a basic block to current function, following instructions are inserted into it
+     */
+    void set_block(koopa_raw_basic_block_t bb);
+
+    /**
+     * @brief Add a parameter to a basic block of current function: %bb(..., %p: ty)
+     * 参数和匿名的指令结果一起编号，也可以通过 reg(n) 取到
+     */
+    koopa_raw_value_t block_param(koopa_raw_basic_block_t bb, koopa_raw_type_t ty);
+
+    // 指令
+    koopa_raw_value_t alloc(const string &name, koopa_raw_type_t ty);
+    koopa_raw_value_t load(koopa_raw_value_t src);
+    void store(koopa_raw_value_t value, koopa_raw_value_t dest);
+    koopa_raw_value_t get_ptr(koopa_raw_value_t src, koopa_raw_value_t index);
+    koopa_raw_value_t get_elem_ptr(koopa_raw_value_t src, koopa_raw_value_t index);
+    koopa_raw_value_t binary(koopa_raw_binary_op_t op, koopa_raw_value_t lhs, koopa_raw_value_t rhs);
+    void branch(koopa_raw_value_t cond, koopa_raw_basic_block_t true_bb, koopa_raw_basic_block_t false_bb);
+    void jump(koopa_raw_basic_block_t target);
+    // 带基本块参数的跳转
+    void branch(koopa_raw_value_t cond, koopa_raw_basic_block_t true_bb, const vector<koopa_raw_value_t> &true_args,
+                koopa_raw_basic_block_t false_bb, const vector<koopa_raw_value_t> &false_args);
+    void jump(koopa_raw_basic_block_t target, const vector<koopa_raw_value_t> &args);
+    koopa_raw_value_t call(const string &callee, const vector<koopa_raw_value_t> &args);
+    void ret(koopa_raw_value_t value = nullptr);
+
+    /**
+     * @brief Make the globals and functions of another builder visible to this one
+     * 它们仍然属于原来的构建器，不会出现在这个构建器 build() 的结果中
+     */
+    void import_globals(const KoopaBuilder &other);
+
+    /**
+     * @brief Find a named value (@name), local ones first
+     */
+    koopa_raw_value_t value(const string &name);
+
+    /**
+     * @brief The n-th unnamed value (instruction result or block parameter) of current function, i.e. %n
+     */
+    koopa_raw_value_t reg(int n);
+
+    /**
+     * @brief Collect globals and functions added since the last call into a raw program
+     * @return The program, function bodies in it are valid until release_functions()
+     */
+    koopa_raw_program_t build();
+
+    /**
+     * @brief Free the bodies of all functions defined so far, they become declarations
+     */
+    void release_functions();
+
+    /**
+     * @brief Discard everything built so far, including types, globals and functions
+     */
+    void clear();
+
+private:
+    // 正在构建的基本块：指令先放在 vector 里，函数结束时再写入 slice
+    struct BlockInfo
+    {
+        koopa_raw_basic_block_data_t *bb;
+        vector<const void *> insts;
+        vector<const void *> params;
+    };
+
+    Arena arena;
+    // 函数体使用的内存
+    Arena func_arena;
+
+    koopa_raw_type_t i32_ty = nullptr;
+    koopa_raw_type_t unit_ty = nullptr;
+    map<koopa_raw_type_t, koopa_raw_type_t> pointer_types;
+    map<pair<koopa_raw_type_t, size_t>, koopa_raw_type_t> array_types;
+
+    vector<const void *> global_values;
+    vector<const void *> functions;
+    unordered_map<string, koopa_raw_value_t> globals;
+    unordered_map<string, koopa_raw_function_t> function_table;
+    unordered_set<koopa_raw_value_t> read_only_globals;
+    // 函数体尚未释放的函数
+    vector<koopa_raw_function_data_t *> defined;
+
+    // 当前函数
+    koopa_raw_function_data_t *func_now = nullptr;
+    unordered_map<string, koopa_raw_value_t> locals;
+    unordered_map<string, BlockInfo *> block_table;
+    vector<unique_ptr<BlockInfo>> blocks;
+    vector<BlockInfo *> block_order;
+    BlockInfo *block_now = nullptr;
+    vector<koopa_raw_value_t> regs;
+
+    // 在函数内分配的内存随函数体一起释放
+    Arena &mem() { return func_now != nullptr ? func_arena : arena; }
+    koopa_raw_slice_t make_slice(const vector<const void *> &items, koopa_raw_slice_item_kind_t kind);
+    koopa_raw_value_data_t *new_value(koopa_raw_type_t ty, koopa_raw_value_tag_t tag);
+    koopa_raw_value_data_t *new_inst(koopa_raw_type_t ty, koopa_raw_value_tag_t tag);
+    koopa_raw_type_t function_type(const vector<koopa_raw_type_t> &params, koopa_raw_type_t ret);
+};
@@ -0,0 +1,978 @@
+#include "koopa_parser.h"
+#include <array>
+#include <cassert>
+#include <climits>
+
+static inline bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static inline bool is_alpha(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static inline bool is_name(char c)
+{
+    return is_alpha(c) || is_digit(c) || c == '_';
+}
+
+// 跳过 [p, end) 开头的空白符和注释，同时统计途经的换行数
+static const char *skip(const char *p, const char *end, int &lines)
+{
+    while (p < end)
+    {
+        char c = *p;
+        if (c == '\n')
+        {
+            lines++;
+            p++;
+        }
+        else if (c == ' ' || c == '\t' || c == '\r')
+        {
+            p++;
+        }
+        else if (c == '/' && end - p >= 2 && p[1] == '/')
+        {
+            while (p < end && *p != '\n')
+                p++;
+        }
+        else if (c == '/' && end - p >= 2 && p[1] == '*')
+        {
+            for (p += 2; p < end && !(*p == '*' && end - p >= 2 && p[1] == '/'); p++)
+            {
+                if (*p == '\n')
+                    lines++;
+            }
+            p = p < end ? p + 2 : end;
+        }
+        else
+        {
+            break;
+        }
+    }
+    return p;
+}
+
+// 关键字的完美哈希，由长度、首字符、第二个字符和最后一个字符决定
+static inline unsigned keyword_hash(string_view word)
+{
+    return (word.size() * 7 + (unsigned char)word[0] * 4 + (unsigned char)word[1] * 5 +
+            (unsigned char)word.back() * 9) &
+           63;
+}
+
+// 形如 %n 的名字的编号，n 没有前导 0，不是这种形式时返回 -1
+static inline long long reg_number(string_view name)
+{
+    if (name[0] != '%' || name.size() > 10 || (name[1] == '0' && name.size() > 2))
+        return -1;
+    long long n = 0;
+    for (size_t i = 1; i < name.size(); i++)
+    {
+        if (!is_digit(name[i]))
+            return -1;
+        n = n * 10 + (name[i] - '0');
+    }
+    return n;
+}
+
+void KoopaParser::open(const char *begin, const char *end_)
+{
+    cur = begin;
+    end = end_;
+    lineno = 1;
+    message.clear();
+    globals.clear();
+    locals.clear();
+    numbered.clear();
+    functions.clear();
+    later_functions.clear();
+    scanned = false;
+    blocks.clear();
+    forward.clear();
+    placeholders.clear();
+    next();
+}
+
+void KoopaParser::skip_blank()
+{
+    cur = skip(cur, end, lineno);
+}
+
+KoopaParser::Keyword KoopaParser::find_keyword(string_view word) const
+{
+    struct Entry
+    {
+        string_view name;
+        Keyword kw;
+    };
+    // 按 Keyword 的顺序排列
+    static const char *names[KW_NONE] = {"ne", "eq", "gt", "lt", "ge", "le", "add", "sub", "mul",
+                                         "div", "mod", "and", "or", "xor", "shl", "shr", "sar",
+                                         "i32", "global", "decl", "fun", "alloc", "load", "store",
+                                         "getptr", "getelemptr", "br", "jump", "call", "ret",
+                                         "zeroinit", "undef"};
+    static const auto table = []()
+    {
+        array<Entry, 64> t{};
+        for (int i = 0; i < KW_NONE; i++)
+        {
+            Entry &e = t[keyword_hash(names[i])];
+            assert(e.name.empty());
+            e = Entry{names[i], Keyword(i)};
+        }
+        return t;
+    }();
+    if (word.size() < 2)
+    {
+        return KW_NONE;
+    }
+    const Entry &e = table[keyword_hash(word)];
+    return e.name == word ? e.kw : KW_NONE;
+}
+
+void KoopaParser::next()
+{
+    skip_blank();
+    const char *begin = cur;
+    if (cur == end)
+    {
+        kind = END;
+    }
+    else if (*cur == '@' || *cur == '%')
+    {
+        for (cur++; cur < end && is_name(*cur); cur++)
+            ;
+        kind = cur - begin > 1 ? SYMBOL : BAD;
+    }
+    else if (is_digit(*cur) || (*cur == '-' && end - cur >= 2 && is_digit(cur[1])))
+    {
+        bool neg = *cur == '-';
+        if (neg)
+            cur++;
+        // i32 的字面量，超过 32 位无符号数的范围时报错
+        long long val = 0;
+        for (; cur < end && is_digit(*cur); cur++)
+        {
+            if (val <= UINT_MAX)
+                val = val * 10 + (*cur - '0');
+        }
+        kind = val <= UINT_MAX && (cur == end || !is_name(*cur)) ? INT : BAD;
+        int_value = (int)(unsigned)(neg ? -val : val);
+    }
+    else if (is_alpha(*cur))
+    {
+        for (cur++; cur < end && is_name(*cur); cur++)
+            ;
+        keyword = find_keyword(string_view(begin, cur - begin));
+        kind = keyword != KW_NONE ? KEYWORD : BAD;
+    }
+    else
+    {
+        cur++;
+        kind = PUNCT;
+    }
+    tok = string_view(begin, cur - begin);
+}
+
+// 当前的符号是否是基本块的标号，即后面紧跟 ':' 或者基本块参数的 '('
+bool KoopaParser::symbol_is_label() const
+{
+    int lines = 0;
+    const char *p = skip(cur, end, lines);
+    return p < end && (*p == ':' || *p == '(');
+}
+
+// 按名字查找值，局部的优先，找不到时返回空
+koopa_raw_value_t KoopaParser::find_value(string_view name) const
+{
+    long long n = reg_number(name);
+    if (n >= 0 && n < (long long)numbered.size() && numbered[n] != nullptr)
+        return numbered[n];
+    auto it = locals.find(name);
+    if (it != locals.end())
+        return it->second;
+    it = globals.find(name);
+    return it != globals.end() ? it->second : nullptr;
+}
+
+// 局部名字对应的位置，空表示还没有定义
+// 编号远大于已有编号的名字（只会出现在手写的 IR 中）仍然放在哈希表里
+koopa_raw_value_t &KoopaParser::local_slot(string_view name)
+{
+    long long n = reg_number(name);
+    if (n < 0 || n > (long long)numbered.size() + 65536)
+        return locals[name];
+    if (n >= (long long)numbered.size())
+        numbered.resize(max<size_t>(n + 1, numbered.size() * 2));
+    return numbered[n];
+}
+
+// 定义局部的值，之前用过它时记下占位值对应的真正的值
+void KoopaParser::define(koopa_raw_value_t &slot, string_view name, koopa_raw_value_t value)
+{
+    slot = value;
+    if (forward.empty())
+        return;
+    auto it = forward.find(name);
+    if (it != forward.end())
+    {
+        placeholders[it->second.placeholder] = value;
+        forward.erase(it);
+    }
+}
+
+// 按名字查找函数的参数类型，找不到时返回空
+// 调用在后面才声明或定义的函数时，先用 forward_function 登记它的返回类型
+const vector<koopa_raw_type_t> *KoopaParser::find_function(string_view name)
+{
+    auto it = functions.find(name);
+    if (it != functions.end())
+        return &it->second;
+    if (!scanned)
+        scan_signatures();
+    auto later = later_functions.find(name);
+    if (later == later_functions.end())
+        return nullptr;
+    if (!later->second.forwarded)
+    {
+        builder.forward_function(string(name), later->second.ret);
+        later->second.forwarded = true;
+    }
+    return &later->second.params;
+}
+
+// 从当前位置向后扫描一遍，记下所有 decl / fun 的签名，之后回到原来的位置继续解析
+// 只在调用了还不知道的函数时扫描一次，签名有语法错误的跳过，等到真正解析它时再报错
+void KoopaParser::scan_signatures()
+{
+    scanned = true;
+    const char *saved_cur = cur;
+    int saved_lineno = lineno;
+    TokenKind saved_kind = kind;
+    string_view saved_tok = tok;
+    Keyword saved_keyword = keyword;
+    int saved_int = int_value;
+    string saved_message = message;
+
+    while (kind != END)
+    {
+        if (!is(KW_DECL) && !is(KW_FUN))
+        {
+            next();
+            continue;
+        }
+        next();
+        if (kind != SYMBOL)
+            continue;
+        string_view name = tok;
+        next();
+        // decl 的参数只有类型，fun 的参数是 SYMBOL ":" Type
+        Signature sig{{}, builder.unit_type(), false};
+        bool ok = expect('(');
+        while (ok && !is(')'))
+        {
+            if (!sig.params.empty() && !expect(','))
+                break;
+            if (kind == SYMBOL)
+            {
+                next();
+                if (!expect(':'))
+                    break;
+            }
+            koopa_raw_type_t ty;
+            ok = parse_type(ty);
+            if (ok)
+                sig.params.push_back(ty);
+        }
+        if (!ok || !is(')'))
+            continue;
+        next();
+        if (is(':'))
+        {
+            next();
+            if (!parse_type(sig.ret))
+                continue;
+        }
+        if (!functions.count(name))
+            later_functions.emplace(name, sig);
+    }
+
+    cur = saved_cur;
+    lineno = saved_lineno;
+    kind = saved_kind;
+    tok = saved_tok;
+    keyword = saved_keyword;
+    int_value = saved_int;
+    message = saved_message;
+}
+
+bool KoopaParser::fail(const char *msg)
+{
+    if (message.empty())
+    {
+        message = "ERROR: " + string(msg) + " at symbol '" + string(tok) + "' on line " + to_string(lineno) + "\n";
+    }
+    return false;
+}
+
+bool KoopaParser::expect(char c)
+{
+    if (!is(c))
+    {
+        return fail((string("expected '") + c + "'").c_str());
+    }
+    next();
+    return true;
+}
+
+bool KoopaParser::expect(Keyword kw)
+{
+    if (!is(kw))
+    {
+        return fail("syntax error");
+    }
+    next();
+    return true;
+}
+
+// Type ::= "i32" | "[" Type "," INT "]" | "*" Type
+bool KoopaParser::parse_type(koopa_raw_type_t &ty)
+{
+    if (is(KW_I32))
+    {
+        next();
+        ty = builder.int_type();
+        return true;
+    }
+    if (is('*'))
+    {
+        next();
+        koopa_raw_type_t base;
+        if (!parse_type(base))
+            return false;
+        ty = builder.pointer_type(base);
+        return true;
+    }
+    if (is('['))
+    {
+        next();
+        koopa_raw_type_t base;
+        if (!parse_type(base) || !expect(','))
+            return false;
+        if (kind != INT || int_value <= 0)
+            return fail("expected array length");
+        int len = int_value;
+        next();
+        if (!expect(']'))
+            return false;
+        ty = builder.array_type(base, len);
+        return true;
+    }
+    if (is('('))
+    {
+        return fail("function types are not supported");
+    }
+    return fail("expected type");
+}
+
+// Initializer ::= INT | "zeroinit" | "{" Initializer {"," Initializer} "}"
+// 把类型为 ty 的初始值展开成整数，按顺序追加到 flat 中
+bool KoopaParser::parse_init(koopa_raw_type_t ty, vector<koopa_raw_value_t> &flat)
+{
+    // 全局变量初始值中的 undef 当作 0
+    if (is(KW_ZEROINIT) || is(KW_UNDEF))
+    {
+        next();
+        size_t n = 1;
+        for (; ty->tag == KOOPA_RTT_ARRAY; ty = ty->data.array.base)
+            n *= ty->data.array.len;
+        for (size_t i = 0; i < n; i++)
+            flat.push_back(builder.integer(0));
+        return true;
+    }
+    if (ty->tag == KOOPA_RTT_INT32)
+    {
+        if (kind != INT)
+            return fail("expected integer");
+        flat.push_back(builder.integer(int_value));
+        next();
+        return true;
+    }
+    if (ty->tag != KOOPA_RTT_ARRAY)
+    {
+        return fail("invalid initializer type");
+    }
+    if (!expect('{'))
+        return false;
+    for (size_t i = 0; i < ty->data.array.len; i++)
+    {
+        if (i != 0 && !expect(','))
+            return false;
+        if (!parse_init(ty->data.array.base, flat))
+            return false;
+    }
+    return expect('}');
+}
+
+// Value ::= SYMBOL | INT | "undef"
+// ty 是这个位置上值的类型，用于 undef，为空表示由上下文还不能确定
+// 还没有定义的局部值先用占位值代替，占位值的类型没有意义，回填之前只被当作操作数引用
+bool KoopaParser::parse_value(koopa_raw_value_t &value, koopa_raw_type_t ty)
+{
+    if (kind == INT)
+    {
+        value = builder.integer(int_value);
+        next();
+        return true;
+    }
+    if (kind == SYMBOL)
+    {
+        value = find_value(tok);
+        if (value == nullptr)
+        {
+            auto it = forward.find(tok);
+            if (it == forward.end())
+                it = forward.emplace(tok, Forward{builder.undef(builder.unit_type()), lineno}).first;
+            value = it->second.placeholder;
+        }
+        next();
+        return true;
+    }
+    if (is(KW_UNDEF))
+    {
+        if (ty == nullptr)
+            return fail("cannot infer the type of undef");
+        value = builder.undef(ty);
+        next();
+        return true;
+    }
+    return fail("expected value");
+}
+
+// 作为 load / store / getptr / getelemptr 地址的值，它的类型决定了指令结果的类型，必须已经定义
+bool KoopaParser::parse_address(koopa_raw_value_t &ptr)
+{
+    if (kind == SYMBOL && find_value(tok) == nullptr)
+        return fail("address used before its definition");
+    return parse_value(ptr, nullptr);
+}
+
+// SYMBOL ["(" [Value {"," Value}] ")"]
+bool KoopaParser::parse_block_ref(koopa_raw_basic_block_t &bb, vector<koopa_raw_value_t> &args)
+{
+    if (kind != SYMBOL)
+        return fail("expected basic block");
+    string_view name = tok;
+    bb = builder.block(string(name));
+    auto &state = blocks.emplace(name, BlockState{false, -1, {}, {}}).first->second;
+    next();
+    if (is('('))
+    {
+        next();
+        while (!is(')'))
+        {
+            if (!args.empty() && !expect(','))
+                return false;
+            koopa_raw_value_t arg;
+            if (state.defined)
+            {
+                if (!parse_value(arg, args.size() < state.types.size() ? state.types[args.size()] : nullptr))
+                    return false;
+            }
+            else if (is(KW_UNDEF))
+            {
+                arg = builder.undef(builder.int_type());
+                state.untyped.emplace_back(args.size(), arg);
+                next();
+            }
+            else if (!parse_value(arg, nullptr))
+            {
+                return false;
+            }
+            args.push_back(arg);
+        }
+        next();
+    }
+    return check_block_params(state, name, args.size());
+}
+
+// 同一个基本块的参数个数和每次跳转的实参个数必须相同
+bool KoopaParser::check_block_params(BlockState &state, string_view name, size_t count)
+{
+    if (state.params < 0)
+    {
+        state.params = count;
+        return true;
+    }
+    if (state.params == (int)count)
+        return true;
+    tok = name;
+    return fail("wrong number of basic block arguments");
+}
+
+// "(" [Value {"," Value}] ")"，types 是函数参数的类型
+bool KoopaParser::parse_args(vector<koopa_raw_value_t> &args, const vector<koopa_raw_type_t> &types)
+{
+    if (!expect('('))
+        return false;
+    while (!is(')'))
+    {
+        if (!args.empty() && !expect(','))
+            return false;
+        koopa_raw_value_t arg;
+        if (!parse_value(arg, args.size() < types.size() ? types[args.size()] : nullptr))
+            return false;
+        args.push_back(arg);
+    }
+    next();
+    return true;
+}
+
+bool KoopaParser::parse_item(bool &is_func, string &error)
+{
+    is_func = false;
+    bool ok;
+    if (is(KW_GLOBAL))
+    {
+        ok = parse_global();
+    }
+    else if (is(KW_DECL))
+    {
+        ok = parse_decl();
+    }
+    else if (is(KW_FUN))
+    {
+        is_func = true;
+        ok = parse_function();
+    }
+    else
+    {
+        ok = fail("syntax error");
+    }
+    if (!ok)
+    {
+        error += message;
+        // 出错后不再继续解析
+        kind = END;
+    }
+    return ok;
+}
+
+// "global" SYMBOL "=" "alloc" Type "," Initializer
+bool KoopaParser::parse_global()
+{
+    next();
+    if (kind != SYMBOL)
+        return fail("expected symbol");
+    string_view name = tok;
+    if (globals.count(name) || functions.count(name))
+        return fail("redefinition");
+    next();
+    koopa_raw_type_t ty;
+    if (!expect('=') || !expect(KW_ALLOC) || !parse_type(ty) || !expect(','))
+        return false;
+
+    koopa_raw_value_t init;
+    if (is(KW_ZEROINIT))
+    {
+        next();
+        init = builder.zero_init(ty);
+    }
+    else
+    {
+        vector<koopa_raw_value_t> flat;
+        if (!parse_init(ty, flat))
+            return false;
+        vector<int> len;
+        for (auto t = ty; t->tag == KOOPA_RTT_ARRAY; t = t->data.array.base)
+            len.push_back(t->data.array.len);
+        init = builder.aggregate(flat.data(), len);
+    }
+    globals[name] = builder.global_alloc(string(name), ty, init);
+    return true;
+}
+
+// "decl" SYMBOL "(" [Type {"," Type}] ")" [":" Type]
+bool KoopaParser::parse_decl()
+{
+    next();
+    if (kind != SYMBOL)
+        return fail("expected symbol");
+    string_view name = tok;
+    if (globals.count(name) || functions.count(name))
+        return fail("redefinition");
+    next();
+    vector<koopa_raw_type_t> params;
+    if (!expect('('))
+        return false;
+    while (!is(')'))
+    {
+        if (!params.empty() && !expect(','))
+            return false;
+        koopa_raw_type_t ty;
+        if (!parse_type(ty))
+            return false;
+        params.push_back(ty);
+    }
+    next();
+    koopa_raw_type_t ret = builder.unit_type();
+    if (is(':'))
+    {
+        next();
+        if (!parse_type(ret))
+            return false;
+    }
+    builder.declare_function(string(name), params, ret);
+    functions.emplace(name, params);
+    return true;
+}
+
+// "fun" SYMBOL "(" [SYMBOL ":" Type {"," SYMBOL ":" Type}] ")" [":" Type] "{" Block {Block} "}"
+bool KoopaParser::parse_function()
+{
+    next();
+    if (kind != SYMBOL)
+        return fail("expected symbol");
+    string_view name = tok;
+    if (globals.count(name) || functions.count(name))
+        return fail("redefinition");
+    next();
+    vector<pair<string, koopa_raw_type_t>> params;
+    vector<string_view> param_names;
+    if (!expect('('))
+        return false;
+    while (!is(')'))
+    {
+        if (!params.empty() && !expect(','))
+            return false;
+        if (kind != SYMBOL)
+            return fail("expected symbol");
+        string_view param = tok;
+        next();
+        koopa_raw_type_t ty;
+        if (!expect(':') || !parse_type(ty))
+            return false;
+        params.emplace_back(string(param), ty);
+        param_names.push_back(param);
+    }
+    next();
+    koopa_raw_type_t ret = builder.unit_type();
+    if (is(':'))
+    {
+        next();
+        if (!parse_type(ret))
+            return false;
+    }
+    if (!expect('{'))
+        return false;
+
+    // 先登记函数，以支持递归调用
+    bool ok = true;
+    builder.begin_function(string(name), params, ret);
+    auto &param_types = functions[name];
+    for (auto &param : params)
+        param_types.push_back(param.second);
+    ret_type = ret;
+    locals.clear();
+    numbered.clear();
+    blocks.clear();
+    for (size_t i = 0; i < params.size(); i++)
+    {
+        auto &slot = local_slot(param_names[i]);
+        if (slot != nullptr)
+        {
+            tok = param_names[i];
+            ok = fail("redefinition");
+            break;
+        }
+        slot = builder.value(params[i].first);
+    }
+
+    if (ok && is('}'))
+        ok = fail("function has no basic block");
+    while (ok && !is('}'))
+    {
+        ok = parse_block();
+    }
+    if (ok)
+    {
+        for (auto &bb : blocks)
+        {
+            if (!bb.second.defined)
+            {
+                tok = bb.first;
+                ok = fail("undefined basic block");
+                break;
+            }
+        }
+    }
+    if (ok && !forward.empty())
+    {
+        // 报告最先使用的未定义的值
+        auto first = forward.begin();
+        for (auto it = forward.begin(); it != forward.end(); ++it)
+        {
+            if (it->second.line < first->second.line)
+                first = it;
+        }
+        tok = first->first;
+        lineno = first->second.line;
+        ok = fail("undefined value");
+    }
+    // 出错时也要结束函数，让构建器回到函数之外的状态
+    koopa_raw_function_t func = builder.end_function();
+    if (ok && !placeholders.empty())
+        KoopaBuilder::patch_function(func, placeholders);
+    locals.clear();
+    numbered.clear();
+    blocks.clear();
+    forward.clear();
+    placeholders.clear();
+    if (!ok)
+        return false;
+    next();
+    return true;
+}
+
+// SYMBOL ["(" [SYMBOL ":" Type {"," SYMBOL ":" Type}] ")"] ":" {Statement} EndStatement
+bool KoopaParser::parse_block()
+{
+    if (kind != SYMBOL)
+        return fail("expected basic block");
+    string_view name = tok;
+    auto &state = blocks.emplace(name, BlockState{false, -1, {}, {}}).first->second;
+    if (state.defined)
+        return fail("redefinition of basic block");
+    state.defined = true;
+    koopa_raw_basic_block_t bb = builder.block(string(name));
+    builder.set_block(bb);
+    next();
+    size_t count = 0;
+    if (is('('))
+    {
+        next();
+        while (!is(')'))
+        {
+            if (count != 0 && !expect(','))
+                return false;
+            if (kind != SYMBOL)
+                return fail("expected symbol");
+            string_view param = tok;
+            next();
+            koopa_raw_type_t ty;
+            if (!expect(':') || !parse_type(ty))
+                return false;
+            auto &slot = local_slot(param);
+            if (slot != nullptr)
+            {
+                tok = param;
+                return fail("redefinition");
+            }
+            define(slot, param, builder.block_param(bb, ty));
+            state.types.push_back(ty);
+            count++;
+        }
+        next();
+    }
+    if (!check_block_params(state, name, count))
+        return false;
+    for (auto &[index, undef] : state.untyped)
+        const_cast<koopa_raw_value_data_t *>(undef)->ty = state.types[index];
+    state.untyped.clear();
+    if (!expect(':'))
+        return false;
+    bool is_end = false;
+    while (!is_end)
+    {
+        if (!parse_statement(is_end))
+            return false;
+    }
+    return true;
+}
+
+// 解析一条指令，is_end 表示它是不是基本块的最后一条指令
+bool KoopaParser::parse_statement(bool &is_end)
+{
+    is_end = false;
+    if (kind == SYMBOL)
+    {
+        if (symbol_is_label())
+            return fail("basic block does not end with br, jump or ret");
+        return parse_symbol_def();
+    }
+    if (kind != KEYWORD)
+    {
+        return fail(is('}') ? "basic block does not end with br, jump or ret" : "syntax error");
+    }
+
+    switch (keyword)
+    {
+    case KW_STORE:
+    {
+        next();
+        koopa_raw_value_t value = nullptr, dest;
+        if (is('{'))
+            return fail("aggregate store is not supported");
+        // undef 的类型由地址决定
+        bool undef = is(KW_UNDEF);
+        if (undef)
+            next();
+        else if (!parse_value(value, nullptr))
+            return false;
+        if (!expect(',') || !parse_address(dest))
+            return false;
+        if (dest->ty->tag != KOOPA_RTT_POINTER)
+            return fail("store to a non-pointer value");
+        if (undef)
+            value = builder.undef(dest->ty->data.pointer.base);
+        builder.store(value, dest);
+        return true;
+    }
+    case KW_CALL:
+        return parse_call(nullptr);
+    case KW_BR:
+    {
+        next();
+        koopa_raw_value_t cond;
+        koopa_raw_basic_block_t true_bb, false_bb;
+        vector<koopa_raw_value_t> true_args, false_args;
+        if (!parse_value(cond, builder.int_type()) || !expect(',') || !parse_block_ref(true_bb, true_args) || !expect(',') ||
+            !parse_block_ref(false_bb, false_args))
+            return false;
+        builder.branch(cond, true_bb, true_args, false_bb, false_args);
+        is_end = true;
+        return true;
+    }
+    case KW_JUMP:
+    {
+        next();
+        koopa_raw_basic_block_t target;
+        vector<koopa_raw_value_t> args;
+        if (!parse_block_ref(target, args))
+            return false;
+        builder.jump(target, args);
+        is_end = true;
+        return true;
+    }
+    case KW_RET:
+    {
+        next();
+        // ret 之后在同一行的值是返回值，下一个基本块的标号或 '}' 不是
+        koopa_raw_value_t value = nullptr;
+        if (kind == INT || is(KW_UNDEF) || (kind == SYMBOL && !symbol_is_label()))
+        {
+            if (!parse_value(value, ret_type))
+                return false;
+        }
+        builder.ret(value);
+        is_end = true;
+        return true;
+    }
+    default:
+        return fail("syntax error");
+    }
+}
+
+// SYMBOL "=" (alloc | load | getptr | getelemptr | binary | call)
+bool KoopaParser::parse_symbol_def()
+{
+    string_view name = tok;
+    if (name[0] == '@' && globals.count(name))
+        return fail("redefinition");
+    if (local_slot(name) != nullptr)
+        return fail("redefinition");
+    next();
+    if (!expect('='))
+        return false;
+    if (kind != KEYWORD)
+        return fail("syntax error");
+
+    koopa_raw_value_t result;
+    Keyword op = keyword;
+    if (op <= KW_SAR)
+    {
+        next();
+        koopa_raw_value_t lhs, rhs;
+        if (!parse_value(lhs, builder.int_type()) || !expect(',') || !parse_value(rhs, builder.int_type()))
+            return false;
+        result = builder.binary(koopa_raw_binary_op_t(op), lhs, rhs);
+    }
+    else if (op == KW_ALLOC)
+    {
+        next();
+        koopa_raw_type_t ty;
+        if (!parse_type(ty))
+            return false;
+        result = builder.alloc(string(name), ty);
+    }
+    else if (op == KW_LOAD)
+    {
+        next();
+        koopa_raw_value_t src;
+        if (!parse_address(src))
+            return false;
+        if (src->ty->tag != KOOPA_RTT_POINTER)
+            return fail("load from a non-pointer value");
+        result = builder.load(src);
+    }
+    else if (op == KW_GETPTR || op == KW_GETELEMPTR)
+    {
+        next();
+        koopa_raw_value_t src, index;
+        if (!parse_address(src) || !expect(',') || !parse_value(index, builder.int_type()))
+            return false;
+        if (src->ty->tag != KOOPA_RTT_POINTER)
+            return fail("expected a pointer");
+        if (op == KW_GETPTR)
+        {
+            result = builder.get_ptr(src, index);
+        }
+        else
+        {
+            if (src->ty->data.pointer.base->tag != KOOPA_RTT_ARRAY)
+                return fail("expected a pointer to array");
+            result = builder.get_elem_ptr(src, index);
+        }
+    }
+    else if (op == KW_CALL)
+    {
+        if (!parse_call(&result))
+            return false;
+    }
+    else
+    {
+        return fail("syntax error");
+    }
+    define(local_slot(name), name, result);
+    return true;
+}
+
+// "call" SYMBOL "(" [Value {"," Value}] ")"，result 不为空时调用的结果要作为值使用
+bool KoopaParser::parse_call(koopa_raw_value_t *result)
+{
+    next();
+    if (kind != SYMBOL)
+        return fail("expected symbol");
+    auto params = find_function(tok);
+    if (params == nullptr)
+        return fail("undefined function");
+    string_view callee = tok;
+    next();
+    vector<koopa_raw_value_t> args;
+    if (!parse_args(args, *params))
+        return false;
+    koopa_raw_value_t value = builder.call(string(callee), args);
+    if (result != nullptr)
+    {
+        if (value->ty->tag == KOOPA_RTT_UNIT)
+        {
+            tok = callee;
+            return fail("function returns nothing");
+        }
+        *result = value;
+    }
+    return true;
+}
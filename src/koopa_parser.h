@@ -0,0 +1,187 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "koopa_builder.h"
+
+using namespace std;
+
+/**
+ * 文本形式 Koopa IR 的解析器
+ * 代替 koopa_parse_from_string + koopa_build_raw_program，一遍扫描直接通过 KoopaBuilder 构建 raw program
+ * 直接在调用者提供的缓冲区（通常是 mmap 的文件）上扫描，名字在解析期间都指向这块缓冲区
+ * 支持编译器自己生成的全部内容：global / decl / fun，以及后端能处理的所有指令和基本块参数
+ * 其他来源的 IR 中常见的写法也可以解析：
+ *   调用在后面才声明或定义的函数
+ *   基本块的顺序与支配关系不一致，局部的值在定义之前使用（先用占位值代替，函数结束时回填）
+ *   指令操作数中的 undef（类型由所在的位置决定），全局变量初始值中的 undef 当作 0
+ * 以下内容会报错：函数类型、聚合类型的 store，以及在定义之前作为 load / store / getptr / getelemptr 地址的值
+ * （指令结果的类型由地址的类型决定）
+ */
+class KoopaParser
+{
+public:
+    explicit KoopaParser(KoopaBuilder &builder) : builder(builder) {}
+    KoopaParser(const KoopaParser &) = delete;
+    KoopaParser &operator=(const KoopaParser &) = delete;
+
+    /**
+     * @brief Start parsing the text in [begin, end), which must stay valid while parsing
+     */
+    void open(const char *begin, const char *end);
+
+    /**
+     * @brief Whether all top-level items have been parsed
+     */
+    bool done() const { return kind == END; }
+
+    /**
+     * @brief Whether the next top-level item is a function definition
+     */
+    bool at_function() const { return is(KW_FUN); }
+
+    /**
+     * @brief Parse the next top-level item (global, decl or fun) into the builder
+     * @param is_func Set to true if the item is a function definition
+     * @return false on syntax errors, the message is appended to error
+     */
+    bool parse_item(bool &is_func, string &error);
+
+private:
+    enum TokenKind
+    {
+        END,
+        SYMBOL,
+        INT,
+        KEYWORD,
+        PUNCT,
+        BAD
+    };
+
+    // 关键字，二元运算的顺序与 koopa_raw_binary_op_t 一致
+    enum Keyword
+    {
+        KW_NE,
+        KW_EQ,
+        KW_GT,
+        KW_LT,
+        KW_GE,
+        KW_LE,
+        KW_ADD,
+        KW_SUB,
+        KW_MUL,
+        KW_DIV,
+        KW_MOD,
+        KW_AND,
+        KW_OR,
+        KW_XOR,
+        KW_SHL,
+        KW_SHR,
+        KW_SAR,
+        KW_I32,
+        KW_GLOBAL,
+        KW_DECL,
+        KW_FUN,
+        KW_ALLOC,
+        KW_LOAD,
+        KW_STORE,
+        KW_GETPTR,
+        KW_GETELEMPTR,
+        KW_BR,
+        KW_JUMP,
+        KW_CALL,
+        KW_RET,
+        KW_ZEROINIT,
+        KW_UNDEF,
+        KW_NONE
+    };
+
+    KoopaBuilder &builder;
+
+    // 扫描位置
+    const char *cur = nullptr;
+    const char *end = nullptr;
+    int lineno = 1;
+
+    // 当前 token
+    TokenKind kind = END;
+    string_view tok;
+    Keyword keyword = KW_NONE;
+    int int_value = 0;
+
+    // 第一条错误信息，解析在第一个错误处停止
+    string message;
+
+    // 名字到值的映射，全局的在整个解析过程中有效，局部的在函数结束时清空
+    unordered_map<string_view, koopa_raw_value_t> globals;
+    unordered_map<string_view, koopa_raw_value_t> locals;
+    // %0, %1, ... 这样的编号名字占了局部名字的绝大多数，直接按编号存放，不经过哈希表
+    vector<koopa_raw_value_t> numbered;
+    // 已声明或定义的函数及其参数类型
+    unordered_map<string_view, vector<koopa_raw_type_t>> functions;
+    // 在后面才声明或定义的函数，第一次调用还不知道的函数时向后扫描一遍签名
+    struct Signature
+    {
+        vector<koopa_raw_type_t> params;
+        koopa_raw_type_t ret;
+        // 是否已经通过 forward_function 登记到构建器
+        bool forwarded;
+    };
+    unordered_map<string_view, Signature> later_functions;
+    bool scanned = false;
+    // 当前函数的返回类型
+    koopa_raw_type_t ret_type = nullptr;
+    // 当前函数中出现过的基本块：是否已经定义，以及参数个数（-1 表示还不知道）
+    // 定义之前跳转到它时实参中的 undef 先记为 i32，定义时改成参数的类型
+    struct BlockState
+    {
+        bool defined;
+        int params;
+        vector<koopa_raw_type_t> types;
+        vector<pair<size_t, koopa_raw_value_t>> untyped;
+    };
+    unordered_map<string_view, BlockState> blocks;
+    // 在定义之前使用的局部值：占位值和第一次使用所在的行
+    struct Forward
+    {
+        koopa_raw_value_t placeholder;
+        int line;
+    };
+    unordered_map<string_view, Forward> forward;
+    // 占位值到真正的值，函数结束时回填
+    unordered_map<koopa_raw_value_t, koopa_raw_value_t> placeholders;
+
+    void next();
+    void skip_blank();
+    Keyword find_keyword(string_view word) const;
+    bool symbol_is_label() const;
+    koopa_raw_value_t find_value(string_view name) const;
+    koopa_raw_value_t &local_slot(string_view name);
+    void define(koopa_raw_value_t &slot, string_view name, koopa_raw_value_t value);
+    const vector<koopa_raw_type_t> *find_function(string_view name);
+    void scan_signatures();
+
+    bool fail(const char *msg);
+    bool expect(char c);
+    bool expect(Keyword kw);
+    bool is(char c) const { return kind == PUNCT && tok[0] == c; }
+    bool is(Keyword kw) const { return kind == KEYWORD && keyword == kw; }
+
+    bool parse_type(koopa_raw_type_t &ty);
+    bool parse_init(koopa_raw_type_t ty, vector<koopa_raw_value_t> &flat);
+    bool parse_value(koopa_raw_value_t &value, koopa_raw_type_t ty);
+    bool parse_address(koopa_raw_value_t &ptr);
+    bool parse_block_ref(koopa_raw_basic_block_t &bb, vector<koopa_raw_value_t> &args);
+    bool check_block_params(BlockState &state, string_view name, size_t count);
+    bool parse_args(vector<koopa_raw_value_t> &args, const vector<koopa_raw_type_t> &types);
+
+    bool parse_global();
+    bool parse_decl();
+    bool parse_function();
+    bool parse_block();
+    bool parse_statement(bool &is_end);
+    bool parse_symbol_def();
+    bool parse_call(koopa_raw_value_t *result);
+};
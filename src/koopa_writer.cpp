@@ -0,0 +1,335 @@
+#include "koopa_writer.h"
+#include <cassert>
+
+static const char *binary_op_name(koopa_raw_binary_op_t op)
+{
+    static const char *names[] = {"ne", "eq", "gt", "lt", "ge", "le", "add", "sub", "mul",
+                                  "div", "mod", "and", "or", "xor", "shl", "shr", "sar"};
+    return names[op];
+}
+
+void KoopaWriter::flush()
+{
+    if (len != 0)
+    {
+        os->write(buf.get(), len);
+        len = 0;
+    }
+}
+
+void KoopaWriter::put(const char *str, size_t n)
+{
+    if (len + n > BUF_SIZE)
+    {
+        flush();
+        // 比缓冲区还长的内容直接输出
+        if (n > BUF_SIZE)
+        {
+            os->write(str, n);
+            return;
+        }
+    }
+    memcpy(buf.get() + len, str, n);
+    len += n;
+}
+
+void KoopaWriter::put_int(long long value)
+{
+    char tmp[24];
+    char *p = tmp + sizeof(tmp);
+    bool neg = value < 0;
+    unsigned long long v = neg ? -(unsigned long long)value : value;
+    do
+    {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while (v != 0);
+    if (neg)
+        *--p = '-';
+    put(p, tmp + sizeof(tmp) - p);
+}
+
+void KoopaWriter::write(const koopa_raw_program_t &program)
+{
+    for (size_t i = 0; i < program.values.len; i++)
+    {
+        write_global(reinterpret_cast<koopa_raw_value_t>(program.values.buffer[i]));
+    }
+    if (program.values.len != 0)
+        put('\n');
+
+    bool has_decl = false;
+    for (size_t i = 0; i < program.funcs.len; i++)
+    {
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        if (func->bbs.len == 0)
+        {
+            write_function(func);
+            has_decl = true;
+        }
+    }
+    if (has_decl)
+        put('\n');
+
+    for (size_t i = 0; i < program.funcs.len; i++)
+    {
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        if (func->bbs.len != 0)
+            write_function(func);
+    }
+}
+
+void KoopaWriter::write_type(koopa_raw_type_t ty)
+{
+    switch (ty->tag)
+    {
+    case KOOPA_RTT_INT32:
+        put("i32", 3);
+        break;
+    case KOOPA_RTT_UNIT:
+        put("unit", 4);
+        break;
+    case KOOPA_RTT_ARRAY:
+        put('[');
+        write_type(ty->data.array.base);
+        put(", ", 2);
+        put_int(ty->data.array.len);
+        put(']');
+        break;
+    case KOOPA_RTT_POINTER:
+        put('*');
+        write_type(ty->data.pointer.base);
+        break;
+    case KOOPA_RTT_FUNCTION:
+    {
+        auto &params = ty->data.function.params;
+        put('(');
+        for (size_t i = 0; i < params.len; i++)
+        {
+            if (i != 0)
+                put(", ", 2);
+            write_type(reinterpret_cast<koopa_raw_type_t>(params.buffer[i]));
+        }
+        put(')');
+        if (ty->data.function.ret->tag != KOOPA_RTT_UNIT)
+        {
+            put(": ", 2);
+            write_type(ty->data.function.ret);
+        }
+        break;
+    }
+    }
+}
+
+// 作为操作数或初始值的值
+void KoopaWriter::write_value(koopa_raw_value_t value)
+{
+    const auto &kind = value->kind;
+    switch (kind.tag)
+    {
+    case KOOPA_RVT_INTEGER:
+        put_int(kind.data.integer.value);
+        return;
+    case KOOPA_RVT_ZERO_INIT:
+        put("zeroinit", 8);
+        return;
+    case KOOPA_RVT_UNDEF:
+        put("undef", 5);
+        return;
+    case KOOPA_RVT_AGGREGATE:
+    {
+        auto &elems = kind.data.aggregate.elems;
+        put('{');
+        for (size_t i = 0; i < elems.len; i++)
+        {
+            if (i != 0)
+                put(", ", 2);
+            write_value(reinterpret_cast<koopa_raw_value_t>(elems.buffer[i]));
+        }
+        put('}');
+        return;
+    }
+    default:
+        break;
+    }
+    if (value->name != nullptr)
+    {
+        put(value->name);
+        return;
+    }
+    // 匿名值按在函数中出现的顺序编号
+    auto it = ids.emplace(value, (int)ids.size()).first;
+    put('%');
+    put_int(it->second);
+}
+
+void KoopaWriter::write_args(const koopa_raw_slice_t &args)
+{
+    put('(');
+    for (size_t i = 0; i < args.len; i++)
+    {
+        if (i != 0)
+            put(", ", 2);
+        write_value(reinterpret_cast<koopa_raw_value_t>(args.buffer[i]));
+    }
+    put(')');
+}
+
+void KoopaWriter::write_global(koopa_raw_value_t value)
+{
+    put("global ", 7);
+    put(value->name);
+    put(" = alloc ", 9);
+    write_type(value->ty->data.pointer.base);
+    put(", ", 2);
+    write_value(value->kind.data.global_alloc.init);
+    put('\n');
+}
+
+void KoopaWriter::write_function(koopa_raw_function_t func)
+{
+    koopa_raw_type_t ret = func->ty->data.function.ret;
+    // 函数声明：decl @f(i32, *i32): i32
+    if (func->bbs.len == 0)
+    {
+        put("decl ", 5);
+        put(func->name);
+        write_type(func->ty);
+        put('\n');
+        return;
+    }
+
+    // 函数定义：fun @f(@x: i32): i32 { ... }
+    ids.clear();
+    put("fun ", 4);
+    put(func->name);
+    put('(');
+    for (size_t i = 0; i < func->params.len; i++)
+    {
+        auto param = reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i]);
+        if (i != 0)
+            put(", ", 2);
+        write_value(param);
+        put(": ", 2);
+        write_type(param->ty);
+    }
+    put(')');
+    if (ret->tag != KOOPA_RTT_UNIT)
+    {
+        put(": ", 2);
+        write_type(ret);
+    }
+    put(" {\n", 3);
+
+    for (size_t i = 0; i < func->bbs.len; i++)
+    {
+        auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        if (i != 0)
+            put('\n');
+        put(bb->name);
+        // 基本块参数：%bb(%p: i32):
+        if (bb->params.len != 0)
+        {
+            put('(');
+            for (size_t j = 0; j < bb->params.len; j++)
+            {
+                auto param = reinterpret_cast<koopa_raw_value_t>(bb->params.buffer[j]);
+                if (j != 0)
+                    put(", ", 2);
+                write_value(param);
+                put(": ", 2);
+                write_type(param->ty);
+            }
+            put(')');
+        }
+        put(":\n", 2);
+        for (size_t j = 0; j < bb->insts.len; j++)
+        {
+            write_inst(reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]));
+        }
+    }
+    put("}\n\n", 3);
+}
+
+void KoopaWriter::write_inst(koopa_raw_value_t inst)
+{
+    const auto &kind = inst->kind;
+    put("  ", 2);
+    // 有返回值的指令：%n = ... 或 @name = alloc ...
+    if (inst->ty->tag != KOOPA_RTT_UNIT)
+    {
+        write_value(inst);
+        put(" = ", 3);
+    }
+    switch (kind.tag)
+    {
+    case KOOPA_RVT_ALLOC:
+        put("alloc ", 6);
+        write_type(inst->ty->data.pointer.base);
+        break;
+    case KOOPA_RVT_LOAD:
+        put("load ", 5);
+        write_value(kind.data.load.src);
+        break;
+    case KOOPA_RVT_STORE:
+        put("store ", 6);
+        write_value(kind.data.store.value);
+        put(", ", 2);
+        write_value(kind.data.store.dest);
+        break;
+    case KOOPA_RVT_GET_PTR:
+        put("getptr ", 7);
+        write_value(kind.data.get_ptr.src);
+        put(", ", 2);
+        write_value(kind.data.get_ptr.index);
+        break;
+    case KOOPA_RVT_GET_ELEM_PTR:
+        put("getelemptr ", 11);
+        write_value(kind.data.get_elem_ptr.src);
+        put(", ", 2);
+        write_value(kind.data.get_elem_ptr.index);
+        break;
+    case KOOPA_RVT_BINARY:
+        put(binary_op_name(kind.data.binary.op));
+        put(' ');
+        write_value(kind.data.binary.lhs);
+        put(", ", 2);
+        write_value(kind.data.binary.rhs);
+        break;
+    case KOOPA_RVT_BRANCH:
+        put("br ", 3);
+        write_value(kind.data.branch.cond);
+        put(", ", 2);
+        put(kind.data.branch.true_bb->name);
+        if (kind.data.branch.true_args.len != 0)
+            write_args(kind.data.branch.true_args);
+        put(", ", 2);
+        put(kind.data.branch.false_bb->name);
+        if (kind.data.branch.false_args.len != 0)
+            write_args(kind.data.branch.false_args);
+        break;
+    case KOOPA_RVT_JUMP:
+        put("jump ", 5);
+        put(kind.data.jump.target->name);
+        if (kind.data.jump.args.len != 0)
+            write_args(kind.data.jump.args);
+        break;
+    case KOOPA_RVT_CALL:
+        put("call ", 5);
+        put(kind.data.call.callee->name);
+        write_args(kind.data.call.args);
+        break;
+    case KOOPA_RVT_RETURN:
+        put("ret", 3);
+        if (kind.data.ret.value != nullptr)
+        {
+            put(' ');
+            write_value(kind.data.ret.value);
+        }
+        break;
+    default:
+        // 构建器不会生成其他指令
+        assert(false);
+    }
+    put('\n');
+}
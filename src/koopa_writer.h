@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <unordered_map>
+#include "koopa.h"
+
+using namespace std;
+
+/**
+ * Koopa IR 文本输出器
+ * 把 raw program 直接格式化成文本形式的 Koopa IR，代替 koopa_generate_raw_to_koopa + koopa_dump_to_file
+ * 整数和名字直接写入一块固定大小的缓冲区，写满后整块输出，缓冲区可以换一个输出流继续使用
+ * 流式处理时每个全局定义生成后立即输出，任何时候都不会在内存中保存整个程序的文本
+ */
+class KoopaWriter
+{
+public:
+    KoopaWriter() : buf(new char[BUF_SIZE]) {}
+    KoopaWriter(const KoopaWriter &) = delete;
+    KoopaWriter &operator=(const KoopaWriter &) = delete;
+    ~KoopaWriter() { flush(); }
+
+    /**
+     * @brief Set the output stream, the buffered text is written to the previous one first
+     */
+    void set_output(ostream *os_)
+    {
+        flush();
+        os = os_;
+    }
+
+    /**
+     * @brief Write the global variables and functions of a raw program
+     */
+    void write(const koopa_raw_program_t &program);
+
+    /**
+     * @brief Write the buffered text to the output stream
+     */
+    void flush();
+
+private:
+    static constexpr size_t BUF_SIZE = 1 << 20;
+
+    ostream *os = nullptr;
+    unique_ptr<char[]> buf;
+    size_t len = 0;
+
+    // 当前函数中匿名值的编号，即文本中的 %n
+    unordered_map<koopa_raw_value_t, int> ids;
+
+    void put(char c)
+    {
+        if (len == BUF_SIZE)
+            flush();
+        buf[len++] = c;
+    }
+    void put(const char *str, size_t n);
+    void put(const char *str) { put(str, strlen(str)); }
+    void put_int(long long value);
+
+    void write_type(koopa_raw_type_t ty);
+    void write_value(koopa_raw_value_t value);
+    void write_args(const koopa_raw_slice_t &args);
+    void write_global(koopa_raw_value_t value);
+    void write_function(koopa_raw_function_t func);
+    void write_inst(koopa_raw_value_t inst);
+};
@@ -0,0 +1,328 @@
+#include "lexer.h"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// 因为要用到 Bison 中关于 token 和 yylval 的定义
+// 所以需要 include Bison 生成的头文件
+#include "sysy.tab.hpp"
+
+extern thread_local Interner *interner;
+
+// 供 Bison 生成的 parser 调用
+int yylex(YYSTYPE *lval, Lexer &lexer)
+{
+    return lexer.next(lval);
+}
+
+static inline bool is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static inline bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static inline bool is_hex(char c)
+{
+    return is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static inline bool is_ident_start(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static inline bool is_ident(char c)
+{
+    return is_ident_start(c) || is_digit(c);
+}
+
+// 找到 [p, end) 中第一个字符 c，同时统计途经的换行数
+static const char *find_char(const char *p, const char *end, char c, int &lines)
+{
+#if defined(__SSE2__)
+    const __m128i target = _mm_set1_epi8(c);
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (end - p >= 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        unsigned hit = _mm_movemask_epi8(_mm_cmpeq_epi8(v, target));
+        unsigned nl = _mm_movemask_epi8(_mm_cmpeq_epi8(v, newline));
+        if (hit != 0)
+        {
+            int n = __builtin_ctz(hit);
+            lines += __builtin_popcount(nl & ((1u << n) - 1));
+            return p + n;
+        }
+        lines += __builtin_popcount(nl);
+        p += 16;
+    }
+#endif
+    for (; p < end; p++)
+    {
+        if (*p == c)
+            return p;
+        if (*p == '\n')
+            lines++;
+    }
+    return end;
+}
+
+Lexer::~Lexer()
+{
+    if (size != 0)
+    {
+        munmap(const_cast<char *>(buf), size);
+    }
+}
+
+bool Lexer::open(const char *path)
+{
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    size = st.st_size;
+    if (size == 0)
+    {
+        // 空文件无法映射
+        buf = "";
+    }
+    else
+    {
+        void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED)
+        {
+            size = 0;
+            ::close(fd);
+            return false;
+        }
+        madvise(addr, size, MADV_SEQUENTIAL);
+        buf = static_cast<const char *>(addr);
+    }
+    ::close(fd);
+    cur = buf;
+    end = buf + size;
+    lineno = 1;
+    return true;
+}
+
+void Lexer::open(const char *begin, const char *end_, int line)
+{
+    cur = begin;
+    end = end_;
+    lineno = line;
+}
+
+// 跳过空白符和注释
+void Lexer::skip_blank()
+{
+    while (true)
+    {
+        // 空白符：每次比较 16 字节，找到第一个非空白字符
+#if defined(__SSE2__)
+        while (end - cur >= 16)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(cur));
+            __m128i nl = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+            __m128i blank = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                                      _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                                         _mm_or_si128(nl, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+            unsigned mask = _mm_movemask_epi8(blank);
+            unsigned nl_mask = _mm_movemask_epi8(nl);
+            if (mask != 0xffff)
+            {
+                int n = __builtin_ctz(~mask);
+                lineno += __builtin_popcount(nl_mask & ((1u << n) - 1));
+                cur += n;
+                break;
+            }
+            lineno += __builtin_popcount(nl_mask);
+            cur += 16;
+        }
+#endif
+        while (cur < end && is_blank(*cur))
+        {
+            if (*cur == '\n')
+                lineno++;
+            cur++;
+        }
+
+        if (end - cur < 2 || cur[0] != '/')
+        {
+            return;
+        }
+        if (cur[1] == '/')
+        {
+            // 行注释：换行符留给下一轮的空白符处理
+            int lines = 0;
+            cur = find_char(cur + 2, end, '\n', lines);
+        }
+        else if (cur[1] == '*')
+        {
+            // 块注释：逐个检查 '*' 后面是否是 '/'
+            int lines = 0;
+            const char *p = cur + 2;
+            while (true)
+            {
+                p = find_char(p, end, '*', lines);
+                if (end - p < 2)
+                {
+                    // 没有结束的块注释不是注释，'/' 作为普通字符返回
+                    return;
+                }
+                if (p[1] == '/')
+                    break;
+                p++;
+            }
+            lineno += lines;
+            cur = p + 2;
+        }
+        else
+        {
+            return;
+        }
+    }
+}
+
+// 关键字的完美哈希：(长度 * 2 + 首字符 + 第二个字符 * 4) % 16 互不相同
+int Lexer::keyword(const char *str, size_t len) const
+{
+    struct Keyword
+    {
+        const char *name;
+        size_t len;
+        int token;
+    };
+    static const Keyword table[16] = {
+        {nullptr, 0, 0},
+        {"while", 5, WHILE},
+        {"return", 6, RETURN},
+        {nullptr, 0, 0},
+        {"break", 5, BREAK},
+        {"if", 2, IF},
+        {nullptr, 0, 0},
+        {"int", 3, INT},
+        {nullptr, 0, 0},
+        {"const", 5, CONST},
+        {"void", 4, VOID},
+        {nullptr, 0, 0},
+        {nullptr, 0, 0},
+        {"else", 4, ELSE},
+        {nullptr, 0, 0},
+        {"continue", 8, CONTINUE},
+    };
+    if (len < 2 || len > 8)
+    {
+        return 0;
+    }
+    unsigned h = (len * 2 + (unsigned char)str[0] + ((unsigned char)str[1] << 2)) & 15;
+    const Keyword &kw = table[h];
+    if (kw.len == len && memcmp(kw.name, str, len) == 0)
+    {
+        return kw.token;
+    }
+    return 0;
+}
+
+int Lexer::next(YYSTYPE *lval)
+{
+    skip_blank();
+    tok = cur;
+    if (cur >= end)
+    {
+        tok_len = 0;
+        return 0;
+    }
+
+    char c = *cur;
+    int token;
+    if (is_ident_start(c))
+    {
+        const char *p = cur + 1;
+        while (p < end && is_ident(*p))
+            p++;
+        cur = p;
+        token = keyword(tok, cur - tok);
+        if (token == 0)
+        {
+            lval->int_val = interner->intern(tok, cur - tok);
+            token = IDENT;
+        }
+    }
+    else if (is_digit(c))
+    {
+        // 与 strtol(..., 0) 相同：超出 int 范围时截断
+        unsigned long long val = 0;
+        const char *p = cur + 1;
+        if (c != '0')
+        {
+            val = c - '0';
+            while (p < end && is_digit(*p))
+                val = val * 10 + (*p++ - '0');
+        }
+        else if (end - p >= 2 && (*p == 'x' || *p == 'X') && is_hex(p[1]))
+        {
+            for (p++; p < end && is_hex(*p); p++)
+            {
+                int d = is_digit(*p) ? *p - '0' : (*p | 0x20) - 'a' + 10;
+                val = val * 16 + d;
+            }
+        }
+        else
+        {
+            while (p < end && *p >= '0' && *p <= '7')
+                val = val * 8 + (*p++ - '0');
+        }
+        cur = p;
+        lval->int_val = (int)val;
+        token = INT_CONST;
+    }
+    else
+    {
+        // 双字符运算符
+        token = 0;
+        if (end - cur >= 2)
+        {
+            char d = cur[1];
+            if (c == '<' && d == '=')
+                token = LE;
+            else if (c == '>' && d == '=')
+                token = GE;
+            else if (c == '=' && d == '=')
+                token = EQ;
+            else if (c == '!' && d == '=')
+                token = NE;
+            else if (c == '&' && d == '&')
+                token = AND;
+            else if (c == '|' && d == '|')
+                token = OR;
+        }
+        if (token != 0)
+        {
+            cur += 2;
+        }
+        else
+        {
+            cur++;
+            token = (unsigned char)c;
+        }
+    }
+    tok_len = cur - tok;
+    return token;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+union YYSTYPE;
+
+/**
+ * 词法分析器
+ * 用 mmap 把整个源文件映射到内存中，直接在映射的缓冲区上扫描，不做任何拷贝
+ * 空白符和注释用 SIMD 一次跳过 16 字节，关键字用完美哈希识别
+ * 产生的 token 与原来的 Flex 版本完全一致
+ * 除了驻留标识符之外不访问全局状态，不同线程可以各用一个 Lexer 扫描同一个文件的不同部分
+ */
+class Lexer
+{
+public:
+    Lexer() = default;
+    Lexer(const Lexer &) = delete;
+    Lexer &operator=(const Lexer &) = delete;
+    ~Lexer();
+
+    /**
+     * @brief Map the source file into memory
+     * @return false if the file can not be opened
+     */
+    bool open(const char *path);
+
+    /**
+     * @brief Scan a buffer owned by someone else, e.g. part of a file mapped by another lexer
+     * @param line Line number of the first character
+     */
+    void open(const char *begin, const char *end, int line);
+
+    /**
+     * @brief The whole mapped file
+     */
+    string_view source() const { return string_view(buf, size); }
+
+    /**
+     * @brief Scan the next token
+     * @param lval Semantic value of the token (IDENT / INT_CONST)
+     * @return The token kind, 0 at the end of file
+     */
+    int next(YYSTYPE *lval);
+
+    /**
+     * @brief Line number of the current token, starting from 1
+     */
+    int line() const { return lineno; }
+
+    /**
+     * @brief Text of the current token, points into the mapped buffer
+     */
+    const char *text() const { return tok; }
+    size_t text_len() const { return tok_len; }
+
+private:
+    const char *buf = nullptr;
+    size_t size = 0;
+    // 当前位置和文件末尾
+    const char *cur = nullptr;
+    const char *end = nullptr;
+    int lineno = 1;
+
+    const char *tok = nullptr;
+    size_t tok_len = 0;
+
+    void skip_blank();
+    int keyword(const char *str, size_t len) const;
+};
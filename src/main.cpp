@@ -1,56 +1,83 @@
 #include <cassert>
 #include <cstdio>
+#include <fstream>
 #include <iostream>
-#include <memory>
 #include <string>
 #include <cstring>
-#include <unordered_set>
 
-#include "AST.h"
-#include "utils.h"
-#include "riscv.h"
+#include "lexer.h"
+#include "sysyc.h"
 
 using namespace std;
-string koopa_str;
-int reg_cnt = 0;
-int if_cnt = 0;
-
-SymbolList symbol_list;
-BlockHandler block_handler = BlockHandler();
-
-// 声明 lexer 的输入, 以及 parser 函数
-// 为什么不引用 sysy.tab.hpp 呢? 因为首先里面没有 yyin 的定义
-// 其次, 因为这个文件不是我们自己写的, 而是被 Bison 生成出来的
-// 你的代码编辑器/IDE 很可能找不到这个文件, 然后会给你报错 (虽然编译不会出错)
-// 看起来会很烦人, 于是干脆采用这种看起来 dirty 但实际很有效的手段
-extern FILE *yyin;
-extern int yyparse(unique_ptr<BaseAST> &ast);
 
+// 编译器本身在 libsysyc 中，这里只处理命令行参数和文件
 int main(int argc, const char *argv[])
 {
   // 解析命令行参数. 测试脚本/评测平台要求你的编译器能接收如下参数:
-  // compiler 模式 输入文件 -o 输出文件
-  assert(argc == 5);
+  // compiler 模式 输入文件 -o 输出文件 [选项...]
+  // -jN 指定编译函数的线程数，默认使用全部 CPU
+  // -ir 让每个函数经过一次 SSA IR 的转换
+  // -O0/-O1/-O2 选择优化级别，-passes=a,b,... 显式指定变换的列表（见 pass.h）
+  // -print-after=a,b,... 或 -print-after=all 在这些变换之后把 Koopa IR 输出到标准错误
+  // -stats 在标准错误输出统计信息，包括编译的总耗时、每个变换的耗时和修改次数
+  assert(argc >= 5);
   auto mode = argv[1];
   auto input = argv[2];
   auto output = argv[4];
 
-  // 打开输入文件, 并且指定 lexer 在解析的时候读取这个文件
-  yyin = fopen(input, "r");
-  assert(yyin);
-
-  // 调用 parser 函数, parser 函数会进一步调用 lexer 解析输入文件的
-  unique_ptr<BaseAST> ast;
-  auto ret = yyparse(ast);
-  assert(!ret);
-
-  freopen(output, "w", stdout);
+  // -koopa 输出文本形式的 Koopa IR, -riscv 输出汇编
+  // -riscv-from-koopa 把文本形式的 Koopa IR 翻译成汇编，并报告解析速度（能解析的输入见 koopa_parser.h）
+  SysycOptions options;
+  options.target = !strcmp(mode, "-koopa") ? Target::Koopa : Target::RiscV;
+  if (!strcmp(mode, "-riscv-from-koopa"))
+  {
+    options.input = Language::Koopa;
+    options.stats = &cerr;
+  }
+  options.jobs = 0;
+  for (int i = 5; i < argc; i++)
+  {
+    if (!strncmp(argv[i], "-j", 2))
+      options.jobs = atoi(argv[i] + 2);
+    else if (!strcmp(argv[i], "-ir"))
+      options.use_ir = true;
+    else if (!strcmp(argv[i], "-lazy"))
+      options.lazy = true;
+    else if (!strncmp(argv[i], "-O", 2) && argv[i][2] >= '0' && argv[i][2] <= '2' && argv[i][3] == 0)
+      options.opt_level = argv[i][2] - '0';
+    else if (!strncmp(argv[i], "-passes=", 8))
+      options.passes = argv[i] + 8;
+    else if (!strncmp(argv[i], "-print-after=", 13))
+    {
+      options.print_after = argv[i] + 13;
+      options.stats = &cerr;
+    }
+    else if (!strcmp(argv[i], "-stats"))
+      options.stats = &cerr;
+    else
+    {
+      cerr << "unknown option " << argv[i] << "\n";
+      return 1;
+    }
+  }
 
-  ast->Koopa();
+  // 把输入文件映射到内存, 编译器直接在上面扫描
+  Lexer file;
+  if (!file.open(input))
+  {
+    cerr << "cannot open input file " << input << "\n";
+    return 1;
+  }
 
-  if (!strcmp(mode, "-koopa"))
-    cout << koopa_str << endl;
-  else
-    parse_raw_program(koopa_str.c_str());
-  return 0;
+  // 每个定义生成后立即写入输出文件，内存占用只取决于最大的函数
+  ofstream out(output);
+  if (!out)
+  {
+    cerr << "cannot open output file " << output << "\n";
+    return 1;
+  }
+  string error;
+  bool ok = sysyc_compile(file.source(), options, out, error);
+  cerr << error;
+  return ok ? 0 : 1;
 }
\ No newline at end of file
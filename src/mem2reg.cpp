@@ -0,0 +1,277 @@
+#include "dominance.h"
+#include "pass.h"
+
+extern thread_local KoopaBuilder builder;
+
+/**
+ * mem2reg：把只通过 load/store 访问的标量局部变量（包括参数的副本）提升为 SSA 值
+ * 1. 地址没有被 getelemptr/getptr、call 等使用的 i32 或指针类型的 alloc 可以提升
+ * 2. 在写入变量的基本块的迭代支配边界上放置基本块参数（代替 phi），
+ *    只放在变量在入口处活跃的基本块上，避免产生无用的参数
+ * 3. 沿支配树先序遍历，记录每个变量的当前值：load 换成当前值，store 更新当前值，
+ *    跳转时把当前值作为新参数的实参
+ * 没有写入就读取的变量取 0（指针取 undef）
+ */
+class Mem2RegPass : public FunctionPass
+{
+public:
+    const char *name() const override { return "mem2reg"; }
+    bool run(IrFunction &func, PassStats &stats) override;
+
+private:
+    // 可以提升的 alloc，以及每个值对应的变量编号（-1 表示不是这样的 alloc）
+    vector<IrValue *> vars;
+    vector<int> var_index;
+    // 每个基本块新增的参数对应的变量，参数排在原有参数之后
+    vector<vector<int>> block_vars;
+    vector<size_t> block_params_begin;
+    // 变量的当前值，以及修改当前值的记录，离开基本块时撤销
+    vector<IrValue *> current;
+    vector<pair<int, IrValue *>> undo;
+    size_t removed = 0;
+
+    bool promotable(const IrValue *alloc) const;
+    int var_of(const IrValue *ptr) const;
+    void set(int var, IrValue *value);
+    void rename(IrFunction &func, IrBlock *bb);
+};
+
+bool Mem2RegPass::promotable(const IrValue *alloc) const
+{
+    if (alloc->ty->data.pointer.base->tag == KOOPA_RTT_ARRAY)
+        return false;
+    for (IrUse *use = alloc->uses; use != nullptr; use = use->next)
+    {
+        const IrValue *user = use->user;
+        if (user->op == IrOp::Load)
+            continue;
+        // 作为 store 的值使用时地址被保存了下来
+        if (user->op == IrOp::Store && use == &user->ops[1] && user->operand(0) != alloc)
+            continue;
+        return false;
+    }
+    return true;
+}
+
+int Mem2RegPass::var_of(const IrValue *ptr) const
+{
+    return ptr->id < var_index.size() ? var_index[ptr->id] : -1;
+}
+
+void Mem2RegPass::set(int var, IrValue *value)
+{
+    undo.emplace_back(var, current[var]);
+    current[var] = value;
+}
+
+// 重写一个基本块中对变量的访问，并给跳转加上实参
+void Mem2RegPass::rename(IrFunction &func, IrBlock *bb)
+{
+    const auto &new_vars = block_vars[bb->id];
+    for (size_t k = 0; k < new_vars.size(); k++)
+        set(new_vars[k], bb->params[block_params_begin[bb->id] + k]);
+    for (IrValue *inst = bb->first, *next; inst != nullptr; inst = next)
+    {
+        next = inst->next;
+        if (inst->op == IrOp::Load)
+        {
+            int var = var_of(inst->operand(0));
+            if (var < 0)
+                continue;
+            func.replace_all_uses(inst, current[var]);
+            func.erase(inst);
+            removed++;
+        }
+        else if (inst->op == IrOp::Store)
+        {
+            int var = var_of(inst->operand(1));
+            if (var < 0)
+                continue;
+            set(var, inst->operand(0));
+            func.erase(inst);
+            removed++;
+        }
+        else if (inst->is_terminator())
+        {
+            for (size_t i = 0; i < inst->num_succs(); i++)
+            {
+                for (int var : block_vars[inst->succ(i)->id])
+                    func.add_edge_arg(inst, i, current[var]);
+            }
+        }
+    }
+}
+
+bool Mem2RegPass::run(IrFunction &func, PassStats &stats)
+{
+    func.compute_cfg();
+    // 入口有前驱时无法在入口放置参数，这样的函数不处理（前端不会生成）
+    if (!func.entry()->preds.empty())
+        return false;
+
+    vars.clear();
+    var_index.assign(func.value_count(), -1);
+    for (IrBlock *bb = func.entry(); bb != nullptr; bb = bb->next)
+    {
+        for (IrValue *inst = bb->first; inst != nullptr; inst = inst->next)
+        {
+            if (inst->op == IrOp::Alloc && promotable(inst))
+            {
+                var_index[inst->id] = vars.size();
+                vars.push_back(inst);
+            }
+        }
+    }
+    if (vars.empty())
+        return false;
+
+    // 每个变量被写入的基本块，以及在写入之前读取的基本块（变量在入口处活跃）
+    size_t num_blocks = func.block_count();
+    vector<vector<IrBlock *>> def_blocks(vars.size()), use_blocks(vars.size());
+    vector<int> def_seen(vars.size(), -1), use_seen(vars.size(), -1);
+    for (IrBlock *bb = func.entry(); bb != nullptr; bb = bb->next)
+    {
+        int id = bb->id;
+        for (IrValue *inst = bb->first; inst != nullptr; inst = inst->next)
+        {
+            if (inst->op == IrOp::Load)
+            {
+                int var = var_of(inst->operand(0));
+                if (var >= 0 && def_seen[var] != id && use_seen[var] != id)
+                {
+                    use_seen[var] = id;
+                    use_blocks[var].push_back(bb);
+                }
+            }
+            else if (inst->op == IrOp::Store)
+            {
+                int var = var_of(inst->operand(1));
+                if (var >= 0 && def_seen[var] != id)
+                {
+                    def_seen[var] = id;
+                    def_blocks[var].push_back(bb);
+                }
+            }
+        }
+    }
+
+    DominatorTree dom(func);
+    dom.compute_frontiers();
+    block_vars.assign(num_blocks, {});
+    block_params_begin.assign(num_blocks, 0);
+    for (IrBlock *bb = func.entry(); bb != nullptr; bb = bb->next)
+        block_params_begin[bb->id] = bb->params.size();
+
+    // 各个数组用变量编号作标记，不需要为每个变量清空
+    vector<int> defines(num_blocks, -1), live(num_blocks, -1), queued(num_blocks, -1), placed(num_blocks, -1);
+    vector<IrBlock *> work;
+    for (size_t var = 0; var < vars.size(); var++)
+    {
+        for (IrBlock *bb : def_blocks[var])
+            defines[bb->id] = var;
+
+        // 活跃的基本块：从读取处沿前驱向上，直到写入变量的基本块
+        work = use_blocks[var];
+        for (IrBlock *bb : work)
+            live[bb->id] = var;
+        while (!work.empty())
+        {
+            IrBlock *bb = work.back();
+            work.pop_back();
+            for (IrBlock *pred : bb->preds)
+            {
+                if (live[pred->id] != (int)var && defines[pred->id] != (int)var)
+                {
+                    live[pred->id] = var;
+                    work.push_back(pred);
+                }
+            }
+        }
+
+        // 迭代支配边界
+        work = def_blocks[var];
+        for (IrBlock *bb : work)
+            queued[bb->id] = var;
+        while (!work.empty())
+        {
+            IrBlock *bb = work.back();
+            work.pop_back();
+            if (!dom.reachable(bb))
+                continue;
+            for (IrBlock *df : dom.frontier(bb))
+            {
+                if (placed[df->id] == (int)var)
+                    continue;
+                placed[df->id] = var;
+                if (live[df->id] == (int)var)
+                {
+                    func.add_param(df, vars[var]->ty->data.pointer.base);
+                    block_vars[df->id].push_back(var);
+                }
+                if (queued[df->id] != (int)var)
+                {
+                    queued[df->id] = var;
+                    work.push_back(df);
+                }
+            }
+        }
+    }
+
+    // 沿支配树先序遍历，离开基本块时撤销它对当前值的修改
+    current.resize(vars.size());
+    for (size_t var = 0; var < vars.size(); var++)
+    {
+        koopa_raw_type_t ty = vars[var]->ty->data.pointer.base;
+        current[var] = ty->tag == KOOPA_RTT_INT32 ? func.integer(0) : func.constant(builder.undef(ty));
+    }
+    undo.clear();
+    removed = 0;
+    vector<pair<IrBlock *, size_t>> stack;
+    auto restore = [&](size_t mark)
+    {
+        while (undo.size() > mark)
+        {
+            current[undo.back().first] = undo.back().second;
+            undo.pop_back();
+        }
+    };
+    rename(func, func.entry());
+    stack.emplace_back(func.entry(), 0);
+    vector<size_t> marks = {0};
+    while (!stack.empty())
+    {
+        auto &[bb, i] = stack.back();
+        if (i < dom.children(bb).size())
+        {
+            IrBlock *kid = dom.children(bb)[i++];
+            marks.push_back(undo.size());
+            rename(func, kid);
+            stack.emplace_back(kid, 0);
+        }
+        else
+        {
+            restore(marks.back());
+            marks.pop_back();
+            stack.pop_back();
+        }
+    }
+    // 不可达的基本块也可能读写变量或者跳转到放置了参数的基本块，各自从初始值开始处理
+    for (IrBlock *bb = func.entry(); bb != nullptr; bb = bb->next)
+    {
+        if (dom.reachable(bb))
+            continue;
+        rename(func, bb);
+        restore(0);
+    }
+
+    for (IrValue *var : vars)
+        func.erase(var);
+    removed += vars.size();
+    stats.insts_removed += removed;
+    return true;
+}
+
+unique_ptr<Pass> create_mem2reg_pass()
+{
+    return make_unique<Mem2RegPass>();
+}
@@ -0,0 +1,298 @@
+#include "pass.h"
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include "koopa_writer.h"
+
+// 各个优化级别的流水线
+static const vector<string> level_passes[] = {
+    {},
+    {"mem2reg", "simplifycfg"},
+    {"mem2reg", "sccp", "gvn", "simplifycfg"},
+};
+
+struct PassInfo
+{
+    const char *name;
+    unique_ptr<Pass> (*create)();
+};
+
+static const PassInfo pass_table[] = {
+    {"verify", create_verify_pass},
+    {"dce", create_dce_pass},
+    {"mem2reg", create_mem2reg_pass},
+    {"sccp", create_sccp_pass},
+    {"gvn", create_gvn_pass},
+    {"simplifycfg", create_simplifycfg_pass},
+};
+
+static const PassInfo *find_pass(string_view name)
+{
+    for (const auto &info : pass_table)
+    {
+        if (name == info.name)
+            return &info;
+    }
+    return nullptr;
+}
+
+unique_ptr<Pass> create_pass(string_view name)
+{
+    const PassInfo *info = find_pass(name);
+    return info == nullptr ? nullptr : info->create();
+}
+
+void PassStats::merge(const PassStats &other)
+{
+    runs += other.runs;
+    changed += other.changed;
+    time += other.time;
+    insts_removed += other.insts_removed;
+    values_replaced += other.values_replaced;
+    blocks_removed += other.blocks_removed;
+    blocks_merged += other.blocks_merged;
+    branches_folded += other.branches_folded;
+}
+
+// 按逗号切分，忽略空项
+static vector<string> split_list(string_view list)
+{
+    vector<string> items;
+    while (!list.empty())
+    {
+        size_t pos = list.find(',');
+        string_view item = list.substr(0, pos);
+        if (!item.empty())
+            items.emplace_back(item);
+        list = pos == string_view::npos ? string_view() : list.substr(pos + 1);
+    }
+    return items;
+}
+
+bool PassPipeline::init(const SysycOptions &options, string &error)
+{
+    use_ir = options.use_ir;
+    out = options.stats;
+    if (options.passes)
+    {
+        // 显式给出的列表即使为空也经过 IrFunction
+        names = split_list(*options.passes);
+        use_ir = true;
+    }
+    else
+    {
+        int level = options.opt_level;
+        if (level < 0)
+            level = 0;
+        if (level > 2)
+            level = 2;
+        names = level_passes[level];
+    }
+    bool ok = true;
+    for (const auto &name : names)
+    {
+        if (find_pass(name) == nullptr)
+        {
+            error += "ERROR: unknown pass '" + name + "'\n";
+            ok = false;
+        }
+    }
+    print_names = split_list(options.print_after);
+    for (const auto &name : print_names)
+    {
+        if (name == "all")
+            print_all = true;
+        else if (find_pass(name) == nullptr)
+        {
+            error += "ERROR: unknown pass '" + name + "' in -print-after\n";
+            ok = false;
+        }
+    }
+    totals.assign(names.size(), PassStats());
+    return ok;
+}
+
+bool PassPipeline::print_after(const string &pass) const
+{
+    if (out == nullptr)
+        return false;
+    return print_all || find(print_names.begin(), print_names.end(), pass) != print_names.end();
+}
+
+void PassPipeline::print(const string &text)
+{
+    lock_guard<mutex> guard(lock);
+    *out << text;
+}
+
+void PassPipeline::merge(const vector<PassStats> &stats, const PassStats &convert)
+{
+    lock_guard<mutex> guard(lock);
+    for (size_t i = 0; i < stats.size(); i++)
+        totals[i].merge(stats[i]);
+    convert_total.merge(convert);
+}
+
+void PassPipeline::fail(const string &message)
+{
+    lock_guard<mutex> guard(lock);
+    errors += message;
+}
+
+bool PassPipeline::take_errors(string &error)
+{
+    lock_guard<mutex> guard(lock);
+    if (errors.empty())
+        return true;
+    error += errors;
+    errors.clear();
+    return false;
+}
+
+void PassPipeline::report(ostream &os) const
+{
+    if (!enabled())
+        return;
+    auto ms = [](chrono::steady_clock::duration time)
+    { return chrono::duration<double, milli>(time).count(); };
+    char line[256];
+    snprintf(line, sizeof(line), "passes: %zu functions, IR conversion %.1f ms\n",
+             convert_total.runs, ms(convert_total.time));
+    os << line;
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        const PassStats &s = totals[i];
+        int n = snprintf(line, sizeof(line), "  %-12s %8.1f ms  %zu of %zu changed", names[i].c_str(),
+                         ms(s.time), s.changed, s.runs);
+        // 只列出不为 0 的计数器
+        auto counter = [&](size_t value, const char *what)
+        {
+            if (value != 0 && n < (int)sizeof(line))
+                n += snprintf(line + n, sizeof(line) - n, ", %zu %s", value, what);
+        };
+        counter(s.insts_removed, "insts removed");
+        counter(s.values_replaced, "values replaced");
+        counter(s.blocks_removed, "blocks removed");
+        counter(s.blocks_merged, "blocks merged");
+        counter(s.branches_folded, "branches folded");
+        os << line << "\n";
+    }
+}
+
+PassManager::PassManager(PassPipeline &pipeline) : pipeline(pipeline)
+{
+    for (const auto &name : pipeline.passes())
+        passes.push_back(create_pass(name));
+    stats.resize(passes.size());
+}
+
+// 把函数的当前状态写回 raw program，输出成文本
+void PassManager::print(const char *pass, const vector<unique_ptr<IrFunction>> &funcs)
+{
+    ostringstream text;
+    {
+        KoopaWriter writer;
+        writer.set_output(&text);
+        for (const auto &func : funcs)
+        {
+            func->to_raw();
+            text << "// IR after " << pass << " on " << func->raw()->name << "\n";
+            const void *buffer[] = {func->raw()};
+            koopa_raw_program_t program = {};
+            program.values.kind = KOOPA_RSIK_VALUE;
+            program.funcs.buffer = buffer;
+            program.funcs.len = 1;
+            program.funcs.kind = KOOPA_RSIK_FUNCTION;
+            writer.write(program);
+            writer.flush();
+        }
+    }
+    pipeline.print(text.str());
+}
+
+void PassManager::run(const koopa_raw_program_t &program)
+{
+    using clock = chrono::steady_clock;
+    auto start = clock::now();
+    vector<unique_ptr<IrFunction>> funcs;
+    for (size_t i = 0; i < program.funcs.len; i++)
+    {
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        if (func->bbs.len != 0)
+            funcs.push_back(IrFunction::from_raw(func));
+    }
+    if (funcs.empty())
+        return;
+    vector<IrFunction *> module;
+    for (const auto &func : funcs)
+        module.push_back(func.get());
+    convert.time += clock::now() - start;
+
+    // 逐个变换处理所有函数，模块变换因此能看到前面的变换在所有函数上的结果
+    for (size_t i = 0; i < passes.size(); i++)
+    {
+        PassStats &s = stats[i];
+        start = clock::now();
+        if (passes[i]->is_function_pass())
+        {
+            auto pass = static_cast<FunctionPass *>(passes[i].get());
+            for (IrFunction *func : module)
+            {
+                s.runs++;
+                if (pass->run(*func, s))
+                    s.changed++;
+            }
+        }
+        else
+        {
+            s.runs += module.size();
+            if (static_cast<ModulePass *>(passes[i].get())->run(module, s))
+                s.changed += module.size();
+        }
+        s.time += clock::now() - start;
+        if (!passes[i]->error().empty())
+        {
+            // 之后的变换和写回都不再进行，raw program 保持原样
+            pipeline.fail(passes[i]->error());
+            pipeline.merge(stats, convert);
+            stats.assign(passes.size(), PassStats());
+            convert = PassStats();
+            return;
+        }
+        if (pipeline.print_after(passes[i]->name()))
+            print(passes[i]->name(), funcs);
+    }
+
+    start = clock::now();
+    for (const auto &func : funcs)
+        func->to_raw();
+    convert.runs += funcs.size();
+    convert.time += clock::now() - start;
+
+    pipeline.merge(stats, convert);
+    stats.assign(passes.size(), PassStats());
+    convert = PassStats();
+}
+
+// verify：检查 IR 的结构，用于调试其他变换
+class VerifyPass : public ModulePass
+{
+public:
+    const char *name() const override { return "verify"; }
+    bool run(const vector<IrFunction *> &funcs, PassStats &stats) override
+    {
+        failure.clear();
+        for (IrFunction *func : funcs)
+        {
+            string error;
+            if (!func->verify(error))
+                failure += "ERROR: verify failed\n" + error;
+        }
+        return false;
+    }
+};
+
+unique_ptr<Pass> create_verify_pass()
+{
+    return make_unique<VerifyPass>();
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "ir.h"
+#include "sysyc.h"
+
+using namespace std;
+
+/**
+ * 优化流水线
+ * 生成的每个函数转换成 IrFunction（见 ir.h），依次经过流水线中的变换后再写回 raw program
+ * 变换分两种：函数变换每次处理一个函数；模块变换一次处理一起生成的所有函数
+ * 流式处理和并行编译时一次生成的通常只有一个函数，模块变换看到的也就只有这些函数
+ * 流水线由 -O0/-O1/-O2 选择，或者用 -passes= 显式列出
+ */
+
+/**
+ * 一个变换的统计
+ * 各个变换共用同一组计数器，只填写与自己有关的
+ */
+struct PassStats
+{
+    // 处理的函数个数，以及其中被修改的个数
+    size_t runs = 0;
+    size_t changed = 0;
+    chrono::steady_clock::duration time = chrono::steady_clock::duration::zero();
+    // 删除的指令（包括被替换掉的指令）
+    size_t insts_removed = 0;
+    // 被替换成其他值（常量或等价的值）的指令
+    size_t values_replaced = 0;
+    // 删除的基本块，以及合并到前驱中的基本块
+    size_t blocks_removed = 0;
+    size_t blocks_merged = 0;
+    // 变成 jump 的条件跳转
+    size_t branches_folded = 0;
+
+    void merge(const PassStats &other);
+};
+
+class Pass
+{
+public:
+    virtual ~Pass() = default;
+    virtual const char *name() const = 0;
+
+    /**
+     * @brief Whether the pass is a FunctionPass, otherwise it is a ModulePass
+     */
+    virtual bool is_function_pass() const = 0;
+
+    /**
+     * @brief Errors found by the last run (e.g. broken IR found by verify), empty if none
+     * 出错后流水线停止，这次编译失败
+     */
+    const string &error() const { return failure; }
+
+protected:
+    string failure;
+};
+
+class FunctionPass : public Pass
+{
+public:
+    bool is_function_pass() const final { return true; }
+
+    /**
+     * @return Whether the function is changed
+     */
+    virtual bool run(IrFunction &func, PassStats &stats) = 0;
+};
+
+class ModulePass : public Pass
+{
+public:
+    bool is_function_pass() const final { return false; }
+
+    /**
+     * @param funcs The functions generated together
+     * @return Whether any function is changed
+     */
+    virtual bool run(const vector<IrFunction *> &funcs, PassStats &stats) = 0;
+};
+
+/**
+ * @brief Create a pass by its name in -passes=
+ * @return nullptr if there is no such pass
+ */
+unique_ptr<Pass> create_pass(string_view name);
+
+// 各个变换，名字见 create_pass()
+unique_ptr<Pass> create_verify_pass();
+unique_ptr<Pass> create_dce_pass();
+unique_ptr<Pass> create_mem2reg_pass();
+unique_ptr<Pass> create_sccp_pass();
+unique_ptr<Pass> create_gvn_pass();
+unique_ptr<Pass> create_simplifycfg_pass();
+
+/**
+ * 一次编译中所有线程共用的流水线配置，同时汇总各个线程的统计
+ */
+class PassPipeline
+{
+public:
+    /**
+     * @brief Set up the pipeline from the options
+     * @return false if a pass name is unknown, the message is appended to error
+     */
+    bool init(const SysycOptions &options, string &error);
+
+    /**
+     * @brief Whether the functions go through IrFunction at all (a pipeline or -ir)
+     */
+    bool enabled() const { return use_ir || !names.empty(); }
+
+    const vector<string> &passes() const { return names; }
+    bool print_after(const string &pass) const;
+
+    /**
+     * @brief Write IR dumped by a thread, the dumps of different threads do not interleave
+     */
+    void print(const string &text);
+
+    /**
+     * @brief Add the statistics collected by a thread, in the order of passes()
+     * @param convert Time spent on converting between raw functions and IrFunction
+     */
+    void merge(const vector<PassStats> &stats, const PassStats &convert);
+
+    /**
+     * @brief Record an error reported by a pass on some thread
+     */
+    void fail(const string &message);
+
+    /**
+     * @brief Move the recorded errors into error
+     * @return false if any pass has failed
+     */
+    bool take_errors(string &error);
+
+    /**
+     * @brief Write the time and counters of each pass
+     */
+    void report(ostream &os) const;
+
+private:
+    bool use_ir = false;
+    vector<string> names;
+    vector<string> print_names;
+    bool print_all = false;
+    ostream *out = nullptr;
+
+    mutex lock;
+    vector<PassStats> totals;
+    string errors;
+    // 转换成 IrFunction 和写回 raw program
+    PassStats convert_total;
+};
+
+/**
+ * 一个线程上的流水线实例，变换对象属于这个线程，可以保存可复用的缓冲区
+ * 每次运行后把统计汇总到 PassPipeline
+ */
+class PassManager
+{
+public:
+    explicit PassManager(PassPipeline &pipeline);
+    PassManager(const PassManager &) = delete;
+    PassManager &operator=(const PassManager &) = delete;
+
+    /**
+     * @brief Run the pipeline on every function defined in the raw program and write the results back
+     */
+    void run(const koopa_raw_program_t &program);
+
+private:
+    PassPipeline &pipeline;
+    vector<unique_ptr<Pass>> passes;
+    vector<PassStats> stats;
+    PassStats convert;
+
+    void print(const char *pass, const vector<unique_ptr<IrFunction>> &funcs);
+};
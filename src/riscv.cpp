@@ -1,20 +1,47 @@
 #include "riscv.h"
+#include "koopa_builder.h"
 using namespace std;
+
+// 前端的构建器，用来查询全局变量是否只读
+extern thread_local KoopaBuilder builder;
 // 函数声明略
 // ...
 
 // 记录一条指令对应的寄存器
 // lv4：目前暂时全部用于记录变量在栈帧中的位置，即offset(sp)
 // 因为目前所有变量/指令都存放在栈帧里
-unordered_map<koopa_raw_value_t, int> regs;
-static int stack_offset = 0;
+// 并行前端中每个线程各自生成一部分函数的汇编，所以这些状态都是线程局部的
+thread_local unordered_map<koopa_raw_value_t, int> regs;
+static thread_local int stack_offset = 0;
 
 static int align_t = 16;
-static int sp_size;
+static thread_local int sp_size;
 
 // lv8
-bool has_call;
-int max_stack_arg;
+thread_local bool has_call;
+thread_local int max_stack_arg;
+
+// 基本块参数：跳转时传入的实参个数的最大值，以及复制实参时使用的临时区域在栈上的位置
+static thread_local int max_block_args;
+static thread_local int block_args_pos;
+// 当前函数和基本块，条件跳转用它们的名字生成临时标号
+static thread_local koopa_raw_function_t func_now;
+static thread_local koopa_raw_basic_block_t bb_now;
+// 紧接在当前基本块之后输出的基本块，跳转到它时不需要 j
+static thread_local koopa_raw_basic_block_t bb_next;
+// getelemptr/getptr 被使用的情况
+// 只作为 load/store/getelemptr/getptr 的地址使用的指针可以不单独计算，
+// 在每个使用它的地方与整条地址链合并成一次偏移量计算，见 is_folded_ptr()
+struct PtrUses
+{
+    int count = 0;
+    bool only_address = true;
+    // 是否合并，-1 表示还没有决定
+    int folded = -1;
+};
+static thread_local unordered_map<koopa_raw_value_t, PtrUses> ptr_uses;
+
+thread_local std::ostream *asm_out = &cout;
 
 // 返回变量在栈上的偏移量
 int get_stack_pos(const koopa_raw_value_t &value)
@@ -28,21 +55,256 @@ int get_stack_pos(const koopa_raw_value_t &value)
     return regs[value];
 }
 
+string load_to_reg(const koopa_raw_value_t &value, const string &reg);
+
+// disp(base) 与寄存器之间的读写，偏移量超出立即数范围时借用 t3
+static void memory_access(const char *op, const string &reg, const string &base, int disp)
+{
+    if (disp >= 2048 || disp < -2048)
+    {
+        *asm_out << "  li t3, " << disp << "\n";
+        *asm_out << "  add t3, t3, " << base << "\n";
+        *asm_out << "  " << op << " " << reg << ", 0(t3)\n";
+    }
+    else
+    {
+        *asm_out << "  " << op << " " << reg << ", " << disp << "(" << base << ")\n";
+    }
+}
+
+// 栈上 pos(sp) 与寄存器之间的读写
+static void stack_access(const char *op, const string &reg, int pos)
+{
+    memory_access(op, reg, "sp", pos);
+}
+
+// 记录 value 的一次使用，as_address 表示作为访存或取地址指令的地址
+static void count_ptr_use(koopa_raw_value_t value, bool as_address)
+{
+    if (value->kind.tag == KOOPA_RVT_GET_ELEM_PTR || value->kind.tag == KOOPA_RVT_GET_PTR)
+    {
+        auto &uses = ptr_uses[value];
+        uses.count++;
+        uses.only_address &= as_address;
+    }
+}
+
+static void count_ptr_uses(const koopa_raw_slice_t &values)
+{
+    for (size_t i = 0; i < values.len; ++i)
+        count_ptr_use(reinterpret_cast<koopa_raw_value_t>(values.buffer[i]), false);
+}
+
+// 统计一条指令对 getelemptr/getptr 的使用
+static void count_ptr_uses(const koopa_raw_value_t &inst)
+{
+    const auto &kind = inst->kind;
+    switch (kind.tag)
+    {
+    case KOOPA_RVT_LOAD:
+        count_ptr_use(kind.data.load.src, true);
+        break;
+    case KOOPA_RVT_STORE:
+        count_ptr_use(kind.data.store.value, false);
+        count_ptr_use(kind.data.store.dest, true);
+        break;
+    case KOOPA_RVT_GET_ELEM_PTR:
+        count_ptr_use(kind.data.get_elem_ptr.src, true);
+        count_ptr_use(kind.data.get_elem_ptr.index, false);
+        break;
+    case KOOPA_RVT_GET_PTR:
+        count_ptr_use(kind.data.get_ptr.src, true);
+        count_ptr_use(kind.data.get_ptr.index, false);
+        break;
+    case KOOPA_RVT_BINARY:
+        count_ptr_use(kind.data.binary.lhs, false);
+        count_ptr_use(kind.data.binary.rhs, false);
+        break;
+    case KOOPA_RVT_BRANCH:
+        count_ptr_use(kind.data.branch.cond, false);
+        count_ptr_uses(kind.data.branch.true_args);
+        count_ptr_uses(kind.data.branch.false_args);
+        break;
+    case KOOPA_RVT_JUMP:
+        count_ptr_uses(kind.data.jump.args);
+        break;
+    case KOOPA_RVT_CALL:
+        count_ptr_uses(kind.data.call.args);
+        break;
+    case KOOPA_RVT_RETURN:
+        if (kind.data.ret.value != nullptr)
+            count_ptr_use(kind.data.ret.value, false);
+        break;
+    default:
+        break;
+    }
+}
+
+// 是否合并到使用处计算
+// 只有一处使用时总是合并；多处使用时（例如 gvn 合并了相同的地址）每处都要重新计算，
+// 比较重新计算与单独计算一次再从栈上读出的指令数：
+// 每个变量下标约 3 条（读出、移位、相加），起点不是局部数组时 1 条，保存和每次读出各 1 条
+static bool is_folded_ptr(const koopa_raw_value_t &value)
+{
+    auto it = ptr_uses.find(value);
+    if (it == ptr_uses.end())
+        return false;
+    PtrUses &uses = it->second;
+    if (uses.folded < 0)
+    {
+        if (!uses.only_address)
+            uses.folded = false;
+        else if (uses.count == 1)
+            uses.folded = true;
+        else
+        {
+            int cost = 0;
+            koopa_raw_value_t ptr = value;
+            do
+            {
+                bool elem = ptr->kind.tag == KOOPA_RVT_GET_ELEM_PTR;
+                koopa_raw_value_t index = elem ? ptr->kind.data.get_elem_ptr.index : ptr->kind.data.get_ptr.index;
+                if (index->kind.tag != KOOPA_RVT_INTEGER)
+                    cost += 3;
+                ptr = elem ? ptr->kind.data.get_elem_ptr.src : ptr->kind.data.get_ptr.src;
+            } while ((ptr->kind.tag == KOOPA_RVT_GET_ELEM_PTR || ptr->kind.tag == KOOPA_RVT_GET_PTR) &&
+                     is_folded_ptr(ptr));
+            if (ptr->kind.tag != KOOPA_RVT_ALLOC)
+                cost++;
+            uses.folded = (uses.count - 1) * cost <= uses.count + 1;
+        }
+    }
+    return uses.folded;
+}
+
+// lv9 数组地址的线性化
+// 计算指针 ptr 指向的地址，结果为 base + disp：
+//   沿着合并的 getelemptr/getptr 链向上找到起点，每一层的步长（元素大小）在编译期已知，
+//   常数下标直接累加到 disp 中，变量下标乘以步长（2 的幂时用移位）后加到 reg 上
+//   起点是局部数组时 base 为 sp，是全局数组时用 la 取地址，其他指针（计算好的指针、参数等）从保存的位置读出
+// compute 为 true 时计算 ptr 这条指令本身，否则 ptr 没有合并时直接使用它保存的值
+// 可能使用 t2、t3，base 是 reg、sp 或参数寄存器
+static pair<string, int> address_of(koopa_raw_value_t ptr, const string &reg, bool compute = false)
+{
+    int disp = 0;
+    vector<pair<koopa_raw_value_t, int>> scaled;
+    while ((compute || is_folded_ptr(ptr)) &&
+           (ptr->kind.tag == KOOPA_RVT_GET_ELEM_PTR || ptr->kind.tag == KOOPA_RVT_GET_PTR))
+    {
+        compute = false;
+        koopa_raw_value_t src, index;
+        int stride;
+        if (ptr->kind.tag == KOOPA_RVT_GET_ELEM_PTR)
+        {
+            src = ptr->kind.data.get_elem_ptr.src;
+            index = ptr->kind.data.get_elem_ptr.index;
+            stride = cal_type_size(src->ty->data.pointer.base->data.array.base);
+        }
+        else
+        {
+            src = ptr->kind.data.get_ptr.src;
+            index = ptr->kind.data.get_ptr.index;
+            stride = cal_type_size(src->ty->data.pointer.base);
+        }
+        if (index->kind.tag == KOOPA_RVT_INTEGER)
+            disp += index->kind.data.integer.value * stride;
+        else
+            scaled.emplace_back(index, stride);
+        ptr = src;
+    }
+
+    string base;
+    if (ptr->kind.tag == KOOPA_RVT_ALLOC)
+    {
+        base = "sp";
+        disp += get_stack_pos(ptr);
+    }
+    else if (ptr->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
+    {
+        *asm_out << "  la " << reg << ", " << ptr->name + 1 << "\n";
+        base = reg;
+    }
+    else
+    {
+        base = load_to_reg(ptr, reg);
+    }
+
+    for (const auto &[index, stride] : scaled)
+    {
+        string reg_index = load_to_reg(index, "t2");
+        if ((stride & (stride - 1)) == 0)
+        {
+            if (stride != 1)
+            {
+                *asm_out << "  slli t2, " << reg_index << ", " << __builtin_ctz(stride) << "\n";
+                reg_index = "t2";
+            }
+        }
+        else
+        {
+            *asm_out << "  li t3, " << stride << "\n";
+            *asm_out << "  mul t2, " << reg_index << ", t3\n";
+            reg_index = "t2";
+        }
+        *asm_out << "  add " << reg << ", " << base << ", " << reg_index << "\n";
+        base = reg;
+    }
+    return {base, disp};
+}
+
+// 计算 getelemptr/getptr 得到的地址并保存到它在栈上的位置
+static void save_address(const koopa_raw_value_t &value)
+{
+    auto [base, disp] = address_of(value, "t0", true);
+    if (disp >= 2048 || disp < -2048)
+    {
+        *asm_out << "  li t3, " << disp << "\n";
+        *asm_out << "  add t0, " << base << ", t3\n";
+    }
+    else if (disp != 0 || base != "t0")
+    {
+        *asm_out << "  addi t0, " << base << ", " << disp << "\n";
+    }
+    stack_access("sw", "t0", get_stack_pos(value));
+}
+
 // lv8
 // 访问 raw program
 void Visit(const koopa_raw_program_t &program)
 {
     // 执行一些其他的必要操作
     // ...
-    // 访问所有全局变量
-    if (program.values.len != 0)
+    // 访问所有全局变量，只读的（常量数组）放在 .rodata 中
+    vector<koopa_raw_value_t> data, rodata;
+    for (size_t i = 0; i < program.values.len; ++i)
     {
-        cout << "  .data";
-        Visit(program.values);
+        auto value = reinterpret_cast<koopa_raw_value_t>(program.values.buffer[i]);
+        (builder.is_read_only(value) ? rodata : data).push_back(value);
+    }
+    if (!data.empty())
+    {
+        *asm_out << "  .data";
+        for (auto value : data)
+            Visit(value);
+    }
+    if (!rodata.empty())
+    {
+        *asm_out << (data.empty() ? "" : "\n") << "  .section .rodata";
+        for (auto value : rodata)
+            Visit(value);
+    }
+    // 访问所有函数，只有库函数声明时不输出 .text
+    bool has_body = false;
+    for (size_t i = 0; i < program.funcs.len; ++i)
+    {
+        if (reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i])->bbs.len != 0)
+            has_body = true;
+    }
+    if (has_body)
+    {
+        *asm_out << "\n  .text";
+        Visit(program.funcs);
     }
-    // 访问所有函数
-    cout << "\n  .text";
-    Visit(program.funcs);
 }
 
 // 访问 raw slice
@@ -82,14 +344,19 @@ void Visit(const koopa_raw_function_t &func)
     // ...
     has_call = false;
     max_stack_arg = 0;
+    max_block_args = 0;
     stack_offset = 0;
+    func_now = func;
+    // 栈上位置只在函数内有效，流式处理时函数体的内存还会被复用
+    regs.clear();
+    ptr_uses.clear();
     // 跳过库函数
     if (func->bbs.len == 0)
     {
         return;
     }
-    cout << "\n  .globl " << func->name + 1 << "\n";
-    cout << func->name + 1 << ":\n";
+    *asm_out << "\n  .globl " << func->name + 1 << "\n";
+    *asm_out << func->name + 1 << ":\n";
 
     // 开辟栈帧
     sp_size = cal_func_size(func);
@@ -98,27 +365,45 @@ void Visit(const koopa_raw_function_t &func)
     // 函数的prologue
     if (sp_size >= 2048)
     {
-        cout << "  li t0, -" << sp_size << "\n";
-        cout << "  add sp, sp, t0\n";
+        *asm_out << "  li t0, -" << sp_size << "\n";
+        *asm_out << "  add sp, sp, t0\n";
     }
     else
     {
-        cout << "  addi sp, sp, -" << sp_size << "\n";
+        *asm_out << "  addi sp, sp, -" << sp_size << "\n";
     }
     if (has_call)
     {
         if (sp_size - 4 >= 2048)
         {
-            cout << "  li t0, " << sp_size - 4 << "\n";
-            cout << "  add t0, t0, sp\n";
-            cout << "  sw ra, 0(t0)\n";
+            *asm_out << "  li t0, " << sp_size - 4 << "\n";
+            *asm_out << "  add t0, t0, sp\n";
+            *asm_out << "  sw ra, 0(t0)\n";
         }
         else
         {
-            cout << "  sw ra, " << to_string(sp_size - 4) << "(sp)\n";
+            *asm_out << "  sw ra, " << to_string(sp_size - 4) << "(sp)\n";
         }
     }
-    Visit(func->bbs);
+    // 寄存器中的参数先保存到栈上：参数在函数中任何位置都可能被使用（例如经过 mem2reg 之后），
+    // 而调用其他函数和准备实参都会覆盖 a0 ~ a7
+    for (size_t i = 0; i < func->params.len && i < 8; i++)
+    {
+        auto param = reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i]);
+        stack_access("sw", "a" + to_string(i), get_stack_pos(param));
+    }
+    for (size_t i = 0; i < func->bbs.len; ++i)
+    {
+        bb_next = i + 1 < func->bbs.len ? reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i + 1]) : nullptr;
+        Visit(reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]));
+    }
+}
+
+// 基本块的标号：不同函数中的基本块可以同名（外部输入的 Koopa IR 中常见），加上函数名作前缀
+// Koopa IR 的符号名中不会出现 '.'，用它分隔不会与其他标号重复
+static string block_label(koopa_raw_basic_block_t bb)
+{
+    return string(func_now->name + 1) + "." + (bb->name + 1);
 }
 
 // lv4完成
@@ -128,10 +413,8 @@ void Visit(const koopa_raw_basic_block_t &bb)
     // 执行一些其他的必要操作
     // ...
     // 访问所有指令
-    if (strcmp(bb->name + 1, "entry"))
-    {
-        cout << bb->name + 1 << ":\n";
-    }
+    bb_now = bb;
+    *asm_out << block_label(bb) << ":\n";
     Visit(bb->insts);
 }
 
@@ -212,40 +495,38 @@ string load_to_reg(const koopa_raw_value_t &value, const string &reg)
     if (value->kind.tag == KOOPA_RVT_INTEGER)
     {
         // step1: 加载变量到名为reg的寄存器
-        cout << "  li " << reg << ", ";
+        *asm_out << "  li " << reg << ", ";
         Visit(value->kind.data.integer);
-        cout << "\n";
+        *asm_out << "\n";
+
+        return reg;
+    }
 
+    // 未定义的值（例如没有初始化就读取的变量）取 0
+    else if (value->kind.tag == KOOPA_RVT_UNDEF)
+    {
+        *asm_out << "  li " << reg << ", 0\n";
         return reg;
     }
 
-    // 参数
-    else if (value->kind.tag == KOOPA_RVT_FUNC_ARG_REF)
+    // 栈上的参数，寄存器里的参数在函数开头已经保存到栈上，与其他值一样处理
+    else if (value->kind.tag == KOOPA_RVT_FUNC_ARG_REF && value->kind.data.func_arg_ref.index >= 8)
     {
         int idx = value->kind.data.func_arg_ref.index;
-        // 寄存器里的参数
-        if (idx < 8)
+        int stack_o = sp_size + 4 * (idx - 8);
+        if (stack_o >= 2048 || stack_o < -2048)
         {
-            return "a" + to_string(idx);
+            *asm_out << "  li t3, " << stack_o << "\n";
+            *asm_out << "  add t3, t3, sp\n";
+            *asm_out << "  lw " << reg << ", 0(t3)\n";
         }
-        // 栈上的参数
         else
         {
-            int stack_o = sp_size + 4 * (idx - 8);
-            if (stack_o >= 2048 || stack_o < -2048)
-            {
-                cout << "  li t3, " << stack_o << "\n";
-                cout << "  add t3, t3, sp\n";
-                cout << "  lw " << reg << ", 0(t3)\n";
-            }
-            else
-            {
-                cout << "  lw " << reg << ", ";
-                cout << stack_o << "(sp)\n";
-            }
-            // cout << "  lw " << reg << ", " << to_string(sp_size + 4 * (idx - 8)) << "(sp)\n";
-            return reg;
+            *asm_out << "  lw " << reg << ", ";
+            *asm_out << stack_o << "(sp)\n";
         }
+        // *asm_out << "  lw " << reg << ", " << to_string(sp_size + 4 * (idx - 8)) << "(sp)\n";
+        return reg;
     }
 
     // 全局变量
@@ -253,8 +534,8 @@ string load_to_reg(const koopa_raw_value_t &value, const string &reg)
     // 然后把地址中的变量加载到寄存器
     else if (value->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
     {
-        cout << "  la " << reg << ", " << value->name + 1 << "\n";
-        cout << "  lw " << reg << ", 0(" << reg << ")\n";
+        *asm_out << "  la " << reg << ", " << value->name + 1 << "\n";
+        *asm_out << "  lw " << reg << ", 0(" << reg << ")\n";
         return reg;
     }
 
@@ -264,14 +545,14 @@ string load_to_reg(const koopa_raw_value_t &value, const string &reg)
         int stack_pos = get_stack_pos(value);
         if (stack_pos >= 2048 || stack_pos < -2048)
         {
-            cout << "  li t3, " << stack_pos << "\n";
-            cout << "  add t3, t3, sp\n";
-            cout << "  lw " << reg << ", 0(t3)\n";
+            *asm_out << "  li t3, " << stack_pos << "\n";
+            *asm_out << "  add t3, t3, sp\n";
+            *asm_out << "  lw " << reg << ", 0(t3)\n";
         }
         else
         {
-            cout << "  lw " << reg << ", ";
-            cout << stack_pos << "(sp)\n";
+            *asm_out << "  lw " << reg << ", ";
+            *asm_out << stack_pos << "(sp)\n";
         }
         return reg;
     }
@@ -291,8 +572,8 @@ void Visit(const koopa_raw_binary_t &binary, const koopa_raw_value_t &value)
     {
         // 默认使用t0,t1
 
-        cout << "  xor " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
-        cout << "  snez " << reg_l << ", " << reg_l << "\n";
+        *asm_out << "  xor " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
+        *asm_out << "  snez " << reg_l << ", " << reg_l << "\n";
 
         break;
     }
@@ -300,8 +581,8 @@ void Visit(const koopa_raw_binary_t &binary, const koopa_raw_value_t &value)
     {
         // 默认使用t0,t1
 
-        cout << "  xor " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
-        cout << "  seqz " << reg_l << ", " << reg_l << "\n";
+        *asm_out << "  xor " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
+        *asm_out << "  seqz " << reg_l << ", " << reg_l << "\n";
 
         break;
     }
@@ -309,7 +590,7 @@ void Visit(const koopa_raw_binary_t &binary, const koopa_raw_value_t &value)
     {
         // 默认使用t0,t1
 
-        cout << "  sgt " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
+        *asm_out << "  sgt " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
 
         break;
     }
@@ -317,7 +598,7 @@ void Visit(const koopa_raw_binary_t &binary, const koopa_raw_value_t &value)
     {
         // 默认使用t0,t1
 
-        cout << "  slt " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
+        *asm_out << "  slt " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
 
         break;
     }
@@ -325,8 +606,8 @@ void Visit(const koopa_raw_binary_t &binary, const koopa_raw_value_t &value)
     {
         // 默认使用t0,t1
 
-        cout << "  slt " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
-        cout << "  seqz " << reg_l << ", " << reg_l << "\n";
+        *asm_out << "  slt " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
+        *asm_out << "  seqz " << reg_l << ", " << reg_l << "\n";
 
         break;
     }
@@ -334,8 +615,8 @@ void Visit(const koopa_raw_binary_t &binary, const koopa_raw_value_t &value)
     {
         // 默认使用t0,t1
 
-        cout << "  sgt " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
-        cout << "  seqz " << reg_l << ", " << reg_l << "\n";
+        *asm_out << "  sgt " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
+        *asm_out << "  seqz " << reg_l << ", " << reg_l << "\n";
 
         break;
     }
@@ -343,14 +624,14 @@ void Visit(const koopa_raw_binary_t &binary, const koopa_raw_value_t &value)
     {
         // 默认使用t0,t1
 
-        cout << "  add " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
+        *asm_out << "  add " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
 
         break;
     }
     case KOOPA_RBO_SUB:
     {
         // 默认使用t0,t1
-        cout << "  sub " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
+        *asm_out << "  sub " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
 
         break;
     }
@@ -358,7 +639,7 @@ void Visit(const koopa_raw_binary_t &binary, const koopa_raw_value_t &value)
     {
         // 默认使用t0,t1
 
-        cout << "  mul " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
+        *asm_out << "  mul " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
 
         break;
     }
@@ -366,14 +647,14 @@ void Visit(const koopa_raw_binary_t &binary, const koopa_raw_value_t &value)
     {
         // 默认使用t0,t1
 
-        cout << "  div " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
+        *asm_out << "  div " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
 
         break;
     }
     case KOOPA_RBO_MOD:
     {
         // 默认使用t0,t1
-        cout << "  rem " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
+        *asm_out << "  rem " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
 
         break;
     }
@@ -381,7 +662,7 @@ void Visit(const koopa_raw_binary_t &binary, const koopa_raw_value_t &value)
     {
         // 默认使用t0,t1
 
-        cout << "  and " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
+        *asm_out << "  and " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
 
         break;
     }
@@ -389,7 +670,7 @@ void Visit(const koopa_raw_binary_t &binary, const koopa_raw_value_t &value)
     {
         // 默认使用t0,t1
 
-        cout << "  or " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
+        *asm_out << "  or " << reg_l << ", " << reg_l << ", " << reg_r << "\n";
 
         break;
     }
@@ -398,13 +679,13 @@ void Visit(const koopa_raw_binary_t &binary, const koopa_raw_value_t &value)
     int stack_pos = get_stack_pos(value);
     if (stack_pos >= 2048 || stack_pos < -2048)
     {
-        cout << "  li t4, " << stack_pos << "\n";
-        cout << "  add t4, t4, sp\n";
-        cout << "  sw t0, 0(t4)\n";
+        *asm_out << "  li t4, " << stack_pos << "\n";
+        *asm_out << "  add t4, t4, sp\n";
+        *asm_out << "  sw t0, 0(t4)\n";
     }
     else
     {
-        cout << "  sw t0, " << stack_pos << "(sp)\n";
+        *asm_out << "  sw t0, " << stack_pos << "(sp)\n";
     }
 }
 
@@ -414,53 +695,57 @@ void Visit(const koopa_raw_store_t &store)
 {
     if (store.dest->kind.tag == KOOPA_RVT_GLOBAL_ALLOC) // destination:全局变量
     {
-        cout << "  la t1, " << store.dest->name + 1 << "\n";
-        load_to_reg(store.value, "t0");
-        cout << "  sw t0, 0(t1)\n";
-    }
-    else if (store.dest->kind.tag == KOOPA_RVT_GET_ELEM_PTR || store.dest->kind.tag == KOOPA_RVT_GET_PTR)
-    {
-        load_to_reg(store.dest, "t1");
+        *asm_out << "  la t1, " << store.dest->name + 1 << "\n";
         load_to_reg(store.value, "t0");
-        cout << "  sw t0, 0(t1)\n";
+        *asm_out << "  sw t0, 0(t1)\n";
     }
-    else // destination: 栈
+    else if (store.dest->kind.tag == KOOPA_RVT_ALLOC) // destination: 栈
     {
         string reg = load_to_reg(store.value, "t0");
         int stack_pos = get_stack_pos(store.dest);
         if (stack_pos >= 2048 || stack_pos < -2048)
         {
-            cout << "  li t4, " << stack_pos << "\n";
-            cout << "  add t4, t4, sp\n";
-            cout << "  sw " << reg << ", 0(t4)\n";
+            *asm_out << "  li t4, " << stack_pos << "\n";
+            *asm_out << "  add t4, t4, sp\n";
+            *asm_out << "  sw " << reg << ", 0(t4)\n";
         }
         else
         {
-            cout << "  sw " << reg << ", " << stack_pos << "(sp)\n";
+            *asm_out << "  sw " << reg << ", " << stack_pos << "(sp)\n";
         }
     }
+    else // destination: 数组元素等指针指向的位置
+    {
+        auto [base, disp] = address_of(store.dest, "t1");
+        string reg = load_to_reg(store.value, "t0");
+        memory_access("sw", reg, base, disp);
+    }
 }
 
 // load指令
 void Visit(const koopa_raw_load_t &load, const koopa_raw_value_t &value)
 {
-    string reg = load_to_reg(load.src, "t0");
-
-    if (load.src->kind.tag == KOOPA_RVT_GET_ELEM_PTR || load.src->kind.tag == KOOPA_RVT_GET_PTR)
+    string reg = "t0";
+    if (load.src->kind.tag == KOOPA_RVT_ALLOC || load.src->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
     {
-        cout << "  lw " << reg << ", 0(" << reg << ")\n";
+        reg = load_to_reg(load.src, "t0");
+    }
+    else
+    {
+        auto [base, disp] = address_of(load.src, "t0");
+        memory_access("lw", "t0", base, disp);
     }
 
     int stack_pos = get_stack_pos(value);
     if (stack_pos >= 2048 || stack_pos < -2048)
     {
-        cout << "  li t3, " << stack_pos << "\n";
-        cout << "  add t3, t3, sp\n";
-        cout << "  sw " << reg << ", 0(t3)\n";
+        *asm_out << "  li t3, " << stack_pos << "\n";
+        *asm_out << "  add t3, t3, sp\n";
+        *asm_out << "  sw " << reg << ", 0(t3)\n";
     }
     else
     {
-        cout << "  sw " << reg << ", " << stack_pos << "(sp)\n";
+        *asm_out << "  sw " << reg << ", " << stack_pos << "(sp)\n";
     }
 }
 
@@ -470,26 +755,7 @@ void Visit(const koopa_raw_return_t &ret)
     // 将返回值放入a0
     if (ret.value != nullptr)
     {
-        if (ret.value->kind.tag == KOOPA_RVT_INTEGER)
-        {
-            cout << "  li a0, ";
-            Visit(ret.value->kind.data.integer);
-            cout << "\n";
-        }
-        else
-        {
-            int stack_pos = regs[ret.value];
-            if (stack_pos >= 2048 || stack_pos < -2048)
-            {
-                cout << "  li t0, " << stack_pos << "\n";
-                cout << "  add t0, t0, sp\n";
-                cout << "  lw a0, 0(t0)\n";
-            }
-            else
-            {
-                cout << "  lw a0, " << stack_pos << "(sp)\n";
-            }
-        }
+        load_to_reg(ret.value, "a0");
     }
     // 函数的epilogue
 
@@ -498,50 +764,98 @@ void Visit(const koopa_raw_return_t &ret)
     {
         if (sp_size - 4 >= 2048)
         {
-            cout << "  li t0, " << sp_size - 4 << "\n";
-            cout << "  add t0, t0, sp\n";
-            cout << "  lw ra, 0(t0)\n";
+            *asm_out << "  li t0, " << sp_size - 4 << "\n";
+            *asm_out << "  add t0, t0, sp\n";
+            *asm_out << "  lw ra, 0(t0)\n";
         }
         else
         {
-            cout << "  lw ra, " << to_string(sp_size - 4) << "(sp)\n";
+            *asm_out << "  lw ra, " << to_string(sp_size - 4) << "(sp)\n";
         }
     }
 
     if (sp_size >= 2048)
     {
-        cout << "  li t0, " << sp_size << "\n";
-        cout << "  add sp, sp, t0\n";
+        *asm_out << "  li t0, " << sp_size << "\n";
+        *asm_out << "  add sp, sp, t0\n";
     }
     else
     {
-        cout << "  addi sp, sp, " << sp_size << "\n";
+        *asm_out << "  addi sp, sp, " << sp_size << "\n";
     }
     // 返回
-    cout << "  ret\n";
+    *asm_out << "  ret\n";
 }
 
 void Visit(const koopa_raw_integer_t &integer)
 {
-    cout << integer.value;
+    *asm_out << integer.value;
+}
+
+// 跳转到 target 之前把实参写入它的参数
+// 实参可能是 target 自己的参数（例如循环中交换两个值），按顺序写会先覆盖后面还要读的参数，这时经过临时区域复制
+static void copy_block_args(const koopa_raw_slice_t &args, koopa_raw_basic_block_t target)
+{
+    bool overlap = false;
+    for (size_t i = 0; i < args.len; ++i)
+    {
+        auto arg = reinterpret_cast<koopa_raw_value_t>(args.buffer[i]);
+        if (arg->kind.tag == KOOPA_RVT_BLOCK_ARG_REF && arg->kind.data.block_arg_ref.index < i &&
+            target->params.buffer[arg->kind.data.block_arg_ref.index] == arg)
+            overlap = true;
+    }
+    for (size_t i = 0; i < args.len; ++i)
+    {
+        string reg = load_to_reg(reinterpret_cast<koopa_raw_value_t>(args.buffer[i]), "t1");
+        if (overlap)
+            stack_access("sw", reg, block_args_pos + 4 * i);
+        else
+            stack_access("sw", reg, get_stack_pos(reinterpret_cast<koopa_raw_value_t>(target->params.buffer[i])));
+    }
+    if (overlap)
+    {
+        for (size_t i = 0; i < args.len; ++i)
+        {
+            stack_access("lw", "t1", block_args_pos + 4 * i);
+            stack_access("sw", "t1", get_stack_pos(reinterpret_cast<koopa_raw_value_t>(target->params.buffer[i])));
+        }
+    }
+}
+
+// 跳转到下一个基本块时直接往下执行
+static void jump_to(koopa_raw_basic_block_t target)
+{
+    if (target != bb_next)
+        *asm_out << "  j " << block_label(target) << "\n";
 }
 
 // lv9 条件跳转范围问题
 // simple solution: bnez只跳转到相邻的两个jump指令，统一用jump指令
 // lv6 branch指令
+// 临时标号由当前基本块的标号加上后缀组成，不会重复；两侧的实参分别在各自的跳转之前写入
+// 假分支是下一个基本块时反过来用 beqz，放在临时标号之后的一侧是下一个基本块时直接往下执行
 void Visit(const koopa_raw_branch_t &branch)
 {
     string reg_branch = load_to_reg(branch.cond, "t0");
-    cout << "  bnez " << reg_branch << ", " << (branch.true_bb->name + 1) << "_tmp\n";
-    cout << "  j " << branch.false_bb->name + 1 << "\n";
-    cout << branch.true_bb->name + 1 << "_tmp:\n";
-    cout << "  j " << branch.true_bb->name + 1 << "\n";
+    bool swapped = branch.false_bb == bb_next && branch.true_bb != bb_next;
+    koopa_raw_basic_block_t jump_bb = swapped ? branch.true_bb : branch.false_bb;
+    koopa_raw_basic_block_t label_bb = swapped ? branch.false_bb : branch.true_bb;
+    const koopa_raw_slice_t &jump_args = swapped ? branch.true_args : branch.false_args;
+    const koopa_raw_slice_t &label_args = swapped ? branch.false_args : branch.true_args;
+    string tmp_label = block_label(bb_now) + (swapped ? ".false" : ".true");
+    *asm_out << (swapped ? "  beqz " : "  bnez ") << reg_branch << ", " << tmp_label << "\n";
+    copy_block_args(jump_args, jump_bb);
+    *asm_out << "  j " << block_label(jump_bb) << "\n";
+    *asm_out << tmp_label << ":\n";
+    copy_block_args(label_args, label_bb);
+    jump_to(label_bb);
 }
 
 // lv6 jump指令
 void Visit(const koopa_raw_jump_t &jump)
 {
-    cout << "  j " << jump.target->name + 1 << "\n";
+    copy_block_args(jump.args, jump.target);
+    jump_to(jump.target);
 }
 
 // lv8 call
@@ -562,24 +876,24 @@ void Visit(const koopa_raw_call_t &call, const koopa_raw_value_t &value)
         {
             const koopa_raw_value_t arg = reinterpret_cast<koopa_raw_value_t>(call.args.buffer[i]);
             load_to_reg(arg, "t0");
-            cout << "  sw t0, " << to_string((i - 8) * 4) + "(sp)\n";
+            *asm_out << "  sw t0, " << to_string((i - 8) * 4) + "(sp)\n";
         }
     }
 
-    cout << "  call " << call.callee->name + 1 << "\n";
+    *asm_out << "  call " << call.callee->name + 1 << "\n";
 
     if (value->ty->tag != KOOPA_RTT_UNIT)
     {
         int stack_pos = get_stack_pos(value);
         if (stack_pos >= 2048 || stack_pos < -2048)
         {
-            cout << "  li t4, " << stack_pos << "\n";
-            cout << "  add t4, t4, sp\n";
-            cout << "  sw " << "a0" << ", 0(t4)\n";
+            *asm_out << "  li t4, " << stack_pos << "\n";
+            *asm_out << "  add t4, t4, sp\n";
+            *asm_out << "  sw " << "a0" << ", 0(t4)\n";
         }
         else
         {
-            cout << "  sw a0, " << stack_pos << "(sp)\n";
+            *asm_out << "  sw a0, " << stack_pos << "(sp)\n";
         }
     }
 }
@@ -588,15 +902,15 @@ void Visit(const koopa_raw_call_t &call, const koopa_raw_value_t &value)
 // lv8 global variable
 void Visit(const koopa_raw_global_alloc_t &global, const koopa_raw_value_t &value)
 {
-    cout << "\n  .globl " << value->name + 1 << "\n";
-    cout << value->name + 1 << ":\n";
+    *asm_out << "\n  .globl " << value->name + 1 << "\n";
+    *asm_out << value->name + 1 << ":\n";
     if (global.init->kind.tag == KOOPA_RVT_ZERO_INIT)
     {
-        cout << "  .zero " << cal_type_size(value->ty->data.pointer.base) << "\n";
+        *asm_out << "  .zero " << cal_type_size(value->ty->data.pointer.base) << "\n";
     }
     else if (global.init->kind.tag == KOOPA_RVT_INTEGER)
     {
-        cout << "  .word " << global.init->kind.data.integer.value << "\n";
+        *asm_out << "  .word " << global.init->kind.data.integer.value << "\n";
     }
     else
     { // aggregate
@@ -613,7 +927,7 @@ void Visit(const koopa_raw_aggregate_t &aggregate)
         koopa_raw_value_t value = reinterpret_cast<koopa_raw_value_t>(ptr);
         if (value->kind.tag == KOOPA_RVT_INTEGER)
         {
-            cout << "  .word " << value->kind.data.integer.value << "\n";
+            *asm_out << "  .word " << value->kind.data.integer.value << "\n";
         }
         else if (value->kind.tag == KOOPA_RVT_AGGREGATE)
         {
@@ -624,82 +938,18 @@ void Visit(const koopa_raw_aggregate_t &aggregate)
     }
 }
 // lv9 get_elem_ptr
+// 合并到使用处的指针不在这里计算
 void Visit(const koopa_raw_get_elem_ptr_t &get_elem_ptr, const koopa_raw_value_t &value)
 {
-    if (get_elem_ptr.src->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
-    {
-        cout << "  la t0, " << get_elem_ptr.src->name + 1 << "\n";
-    }
-    else
-    {
-        int src_stack_pos = get_stack_pos(get_elem_ptr.src);
-
-        // t0存放src的地址 sp + src_stack_pos
-        if (src_stack_pos < 2048 && src_stack_pos >= -2048)
-            cout << "  addi t0, sp, " << src_stack_pos << "\n";
-        else
-        {
-            cout << "  li t3, " << src_stack_pos << "\n";
-            cout << "  add t0, sp, t3\n";
-        }
-
-        // 指针操作 进一步把值load到t0
-        if (get_elem_ptr.src->kind.tag == KOOPA_RVT_GET_ELEM_PTR ||
-            get_elem_ptr.src->kind.tag == KOOPA_RVT_GET_PTR)
-        {
-            cout << "  lw t0, 0(t0)\n";
-        }
-    }
-    string reg = load_to_reg(get_elem_ptr.index, "t1");
-    int size = cal_type_size(get_elem_ptr.src->ty->data.pointer.base->data.array.base);
-    cout << "  li t2, " << size << "\n";
-    cout << "  mul t1, t1, t2\n";
-    cout << "  add t0, t0, t1\n";
-
-    int stack_pos = get_stack_pos(value);
-    if (stack_pos >= 2048 || stack_pos < -2048)
-    {
-        cout << "  li t4, " << stack_pos << "\n";
-        cout << "  add t4, t4, sp\n";
-        cout << "  sw " << "t0" << ", 0(t4)\n";
-    }
-    else
-    {
-        cout << "  sw " << "t0" << ", " << stack_pos << "(sp)\n";
-    }
+    if (!is_folded_ptr(value))
+        save_address(value);
 }
 
 // lv9 get_ptr
 void Visit(const koopa_raw_get_ptr_t &get_ptr, const koopa_raw_value_t &value)
 {
-    int src_stack_pos = get_stack_pos(get_ptr.src);
-
-    // t0存放src的地址 sp + src_stack_pos
-    if (src_stack_pos < 2048 && src_stack_pos >= -2048)
-        cout << "  addi t0, sp, " << src_stack_pos << "\n";
-    else
-    {
-        cout << "  li t3, " << src_stack_pos << "\n";
-        cout << "  add t0, sp, t3\n";
-    }
-
-    cout << "  lw t0, 0(t0)\n";
-    load_to_reg(get_ptr.index, "t1");
-    int size = cal_type_size(get_ptr.src->ty->data.pointer.base);
-    cout << "  li t2, " << size << "\n";
-    cout << "  mul t1, t1, t2\n";
-    cout << "  add t0, t0, t1\n";
-    int stack_pos = get_stack_pos(value);
-    if (stack_pos >= 2048 || stack_pos < -2048)
-    {
-        cout << "  li t4, " << stack_pos << "\n";
-        cout << "  add t4, t4, sp\n";
-        cout << "  sw " << "t0" << ", 0(t4)\n";
-    }
-    else
-    {
-        cout << "  sw " << "t0" << ", " << stack_pos << "(sp)\n";
-    }
+    if (!is_folded_ptr(value))
+        save_address(value);
 }
 
 // ...
@@ -741,10 +991,17 @@ int cal_func_size(const koopa_raw_function_t &func)
     {
         func_size += 4;
     }
+    // 保存寄存器中的参数
+    func_size += min((int)func->params.len, 8) * 4;
     // caller参数栈
     func_size += max_stack_arg * 4;
 
     stack_offset += max_stack_arg * 4;
+
+    // 复制基本块实参的临时区域
+    block_args_pos = stack_offset;
+    func_size += max_block_args * 4;
+    stack_offset += max_block_args * 4;
     // 需要吗？
     //  func_size += func->params.len;
 
@@ -756,6 +1013,11 @@ int cal_func_size(const koopa_raw_function_t &func)
 int cal_basic_block_size(const koopa_raw_basic_block_t &bb)
 {
     int bb_size = 0;
+    // 基本块参数和指令结果一样放在栈上
+    for (uint32_t i = 0; i < bb->params.len; i++)
+    {
+        bb_size += cal_inst_size(reinterpret_cast<koopa_raw_value_t>(bb->params.buffer[i]));
+    }
     for (uint32_t i = 0; i < bb->insts.len; i++)
     {
         const koopa_raw_value_t inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[i]);
@@ -764,6 +1026,15 @@ int cal_basic_block_size(const koopa_raw_basic_block_t &bb)
             has_call = true;
             max_stack_arg = max(max_stack_arg, (int)(inst->kind.data.call.args.len - 8));
         }
+        else if (inst->kind.tag == KOOPA_RVT_BRANCH)
+        {
+            max_block_args = max(max_block_args, (int)max(inst->kind.data.branch.true_args.len, inst->kind.data.branch.false_args.len));
+        }
+        else if (inst->kind.tag == KOOPA_RVT_JUMP)
+        {
+            max_block_args = max(max_block_args, (int)inst->kind.data.jump.args.len);
+        }
+        count_ptr_uses(inst);
         bb_size += cal_inst_size(inst);
     }
     return bb_size;
@@ -9,6 +9,9 @@
 #include <algorithm>
 #include "math.h"
 
+// 汇编的输出位置，默认为标准输出，每个线程可以各自设置
+extern thread_local std::ostream *asm_out;
+
 void Visit(const koopa_raw_program_t &program);
 void Visit(const koopa_raw_slice_t &slice);
 void Visit(const koopa_raw_function_t &func);
@@ -0,0 +1,387 @@
+#include <climits>
+#include "pass.h"
+
+extern thread_local KoopaBuilder builder;
+
+/**
+ * sccp：稀疏条件常量传播（Wegman-Zadeck）
+ * 每个值的格：未定（还没有到达的定义）-> 常量 -> 不是常量，只会往下走
+ * 同时从入口开始只沿可能执行的边前进：条件已知的 br 只有一条边可能执行，
+ * 基本块参数只汇合来自可能执行的边上的实参
+ * 到达不动点后：
+ *   常量的指令和基本块参数换成常量并删除
+ *   条件已知的 br 换成 jump
+ *   不可能执行的基本块删除
+ */
+class SccpPass : public FunctionPass
+{
+public:
+    const char *name() const override { return "sccp"; }
+    bool run(IrFunction &func, PassStats &stats) override;
+
+private:
+    enum Lattice : uint8_t
+    {
+        UNKNOWN,
+        CONSTANT,
+        OVERDEFINED
+    };
+
+    vector<Lattice> state;
+    vector<int> constant;
+    vector<char> block_exec;
+    // 第 i 条出边（br 的 0 是真分支）是否可能执行，按跳转指令的编号 * 2 + i 存放
+    vector<char> edge_exec;
+    vector<pair<IrValue *, size_t>> edge_work;
+    vector<IrValue *> value_work;
+
+    Lattice get(const IrValue *value, int &c) const;
+    void lower(IrValue *value, Lattice lattice, int c = 0);
+    void meet(IrValue *param, const IrValue *arg);
+    void mark_edge(IrValue *term, size_t i);
+    void visit(IrValue *inst);
+    void visit_block(IrBlock *bb);
+    void propagate();
+};
+
+// 与 RISC-V 指令相同的语义计算二元运算，结果不确定（除以 0、溢出的除法）时返回 false
+static bool fold_binary(koopa_raw_binary_op_t op, int lhs, int rhs, int &result)
+{
+    uint32_t l = lhs, r = rhs;
+    switch (op)
+    {
+    case KOOPA_RBO_NOT_EQ:
+        result = lhs != rhs;
+        break;
+    case KOOPA_RBO_EQ:
+        result = lhs == rhs;
+        break;
+    case KOOPA_RBO_GT:
+        result = lhs > rhs;
+        break;
+    case KOOPA_RBO_LT:
+        result = lhs < rhs;
+        break;
+    case KOOPA_RBO_GE:
+        result = lhs >= rhs;
+        break;
+    case KOOPA_RBO_LE:
+        result = lhs <= rhs;
+        break;
+    case KOOPA_RBO_ADD:
+        result = l + r;
+        break;
+    case KOOPA_RBO_SUB:
+        result = l - r;
+        break;
+    case KOOPA_RBO_MUL:
+        result = l * r;
+        break;
+    case KOOPA_RBO_DIV:
+        if (rhs == 0 || (lhs == INT_MIN && rhs == -1))
+            return false;
+        result = lhs / rhs;
+        break;
+    case KOOPA_RBO_MOD:
+        if (rhs == 0 || (lhs == INT_MIN && rhs == -1))
+            return false;
+        result = lhs % rhs;
+        break;
+    case KOOPA_RBO_AND:
+        result = lhs & rhs;
+        break;
+    case KOOPA_RBO_OR:
+        result = lhs | rhs;
+        break;
+    case KOOPA_RBO_XOR:
+        result = lhs ^ rhs;
+        break;
+    case KOOPA_RBO_SHL:
+        result = l << (r & 31);
+        break;
+    case KOOPA_RBO_SHR:
+        result = l >> (r & 31);
+        break;
+    case KOOPA_RBO_SAR:
+        result = lhs >> (r & 31);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+SccpPass::Lattice SccpPass::get(const IrValue *value, int &c) const
+{
+    if (value->op == IrOp::Integer)
+    {
+        c = value->data.integer;
+        return CONSTANT;
+    }
+    // 全局变量、undef 和函数参数都不是常量
+    c = 0;
+    if (value->op == IrOp::Const || value->op == IrOp::FuncArg)
+        return OVERDEFINED;
+    c = constant[value->id];
+    return state[value->id];
+}
+
+void SccpPass::lower(IrValue *value, Lattice lattice, int c)
+{
+    Lattice &old = state[value->id];
+    if (lattice == CONSTANT && old == CONSTANT)
+    {
+        // 同一个值的两个不同常量汇合成不是常量
+        if (c == constant[value->id])
+            return;
+        lattice = OVERDEFINED;
+    }
+    else if (lattice <= old)
+    {
+        return;
+    }
+    old = lattice;
+    constant[value->id] = c;
+    value_work.push_back(value);
+}
+
+// 格只会往下走，所以参数的新值就是旧值与新实参的交
+void SccpPass::meet(IrValue *param, const IrValue *arg)
+{
+    int c;
+    Lattice lattice = get(arg, c);
+    if (lattice != UNKNOWN)
+        lower(param, lattice, c);
+}
+
+void SccpPass::mark_edge(IrValue *term, size_t i)
+{
+    char &exec = edge_exec[term->id * 2 + i];
+    if (!exec)
+    {
+        exec = true;
+        edge_work.emplace_back(term, i);
+    }
+}
+
+void SccpPass::visit(IrValue *inst)
+{
+    switch (inst->op)
+    {
+    case IrOp::Binary:
+    {
+        int l, r, result;
+        Lattice lhs = get(inst->operand(0), l), rhs = get(inst->operand(1), r);
+        if (lhs == OVERDEFINED || rhs == OVERDEFINED)
+            lower(inst, OVERDEFINED);
+        else if (lhs == CONSTANT && rhs == CONSTANT)
+        {
+            if (fold_binary(inst->data.binary_op, l, r, result))
+                lower(inst, CONSTANT, result);
+            else
+                lower(inst, OVERDEFINED);
+        }
+        break;
+    }
+    case IrOp::Branch:
+    {
+        int c;
+        Lattice cond = get(inst->operand(0), c);
+        if (cond == OVERDEFINED || (cond == CONSTANT && c != 0))
+            mark_edge(inst, 0);
+        if (cond == OVERDEFINED || (cond == CONSTANT && c == 0))
+            mark_edge(inst, 1);
+        break;
+    }
+    case IrOp::Jump:
+        mark_edge(inst, 0);
+        break;
+    case IrOp::Return:
+    case IrOp::Store:
+        break;
+    default:
+        // load、call 等的结果
+        lower(inst, OVERDEFINED);
+        break;
+    }
+    // 已经可能执行的出边上的实参可能变了
+    for (size_t i = 0; i < inst->num_succs(); i++)
+    {
+        if (!edge_exec[inst->id * 2 + i])
+            continue;
+        IrBlock *succ = inst->succ(i);
+        size_t begin = inst->args_begin(i);
+        for (size_t k = 0; k < succ->params.size(); k++)
+            meet(succ->params[k], inst->operand(begin + k));
+    }
+}
+
+void SccpPass::visit_block(IrBlock *bb)
+{
+    block_exec[bb->id] = true;
+    for (IrValue *inst = bb->first; inst != nullptr; inst = inst->next)
+        visit(inst);
+}
+
+// 处理工作表直到不动点
+void SccpPass::propagate()
+{
+    while (!edge_work.empty() || !value_work.empty())
+    {
+        if (!edge_work.empty())
+        {
+            auto [term, i] = edge_work.back();
+            edge_work.pop_back();
+            IrBlock *succ = term->succ(i);
+            size_t begin = term->args_begin(i);
+            for (size_t k = 0; k < succ->params.size(); k++)
+                meet(succ->params[k], term->operand(begin + k));
+            if (!block_exec[succ->id])
+                visit_block(succ);
+            continue;
+        }
+        IrValue *value = value_work.back();
+        value_work.pop_back();
+        for (IrUse *use = value->uses; use != nullptr; use = use->next)
+        {
+            if (block_exec[use->user->block->id])
+                visit(use->user);
+        }
+    }
+}
+
+bool SccpPass::run(IrFunction &func, PassStats &stats)
+{
+    state.assign(func.value_count(), UNKNOWN);
+    constant.assign(func.value_count(), 0);
+    block_exec.assign(func.block_count(), false);
+    edge_exec.assign(func.value_count() * 2, false);
+    edge_work.clear();
+    value_work.clear();
+    for (IrValue *param : func.params())
+        state[param->id] = OVERDEFINED;
+
+    visit_block(func.entry());
+    for (;;)
+    {
+        propagate();
+        // 条件到最后仍然未定（只依赖于不会执行的定义）的 br 没有可能执行的出边，
+        // 任选真分支继续传播，否则它的两个后继都会被删除
+        IrValue *undecided = nullptr;
+        for (IrBlock *bb = func.entry(); bb != nullptr && undecided == nullptr; bb = bb->next)
+        {
+            IrValue *term = bb->terminator();
+            if (block_exec[bb->id] && term->op == IrOp::Branch && !edge_exec[term->id * 2] && !edge_exec[term->id * 2 + 1])
+                undecided = term;
+        }
+        if (undecided == nullptr)
+            break;
+        mark_edge(undecided, 0);
+    }
+
+    // 不可能执行的基本块之间可能互相使用，先断开它们之间的使用再删除
+    bool changed = false;
+    vector<IrBlock *> dead;
+    for (IrBlock *bb = func.entry(); bb != nullptr; bb = bb->next)
+    {
+        if (!block_exec[bb->id])
+            dead.push_back(bb);
+    }
+    for (IrBlock *bb : dead)
+    {
+        for (IrValue *inst = bb->first; inst != nullptr; inst = inst->next)
+            func.drop_operands(inst);
+    }
+    // 定义不支配使用的 IR（例如外部输入的）中，可能执行的指令也会用到它们，换成 undef
+    for (IrBlock *bb : dead)
+    {
+        for (IrValue *param : bb->params)
+        {
+            if (param->has_uses())
+                func.replace_all_uses(param, func.constant(builder.undef(param->ty)));
+        }
+        for (IrValue *inst = bb->first; inst != nullptr; inst = inst->next)
+        {
+            if (inst->has_uses())
+                func.replace_all_uses(inst, func.constant(builder.undef(inst->ty)));
+        }
+    }
+    for (IrBlock *bb : dead)
+    {
+        for (IrValue *inst = bb->first; inst != nullptr; inst = inst->next)
+            stats.insts_removed++;
+        func.erase_block(bb);
+        stats.blocks_removed++;
+        changed = true;
+    }
+
+    for (IrBlock *bb = func.entry(); bb != nullptr; bb = bb->next)
+    {
+        // 只有一条出边可能执行的 br 换成 jump
+        IrValue *term = bb->terminator();
+        if (term->op == IrOp::Branch && edge_exec[term->id * 2] != edge_exec[term->id * 2 + 1])
+        {
+            size_t i = edge_exec[term->id * 2] ? 0 : 1;
+            vector<IrValue *> args;
+            for (size_t k = 0; k < term->args_count(i); k++)
+                args.push_back(term->operand(term->args_begin(i) + k));
+            func.set_insert_point(bb, term);
+            func.jump(term->succ(i), args);
+            func.erase(term);
+            stats.branches_folded++;
+            changed = true;
+        }
+        // 常量指令
+        for (IrValue *inst = bb->first, *next; inst != nullptr; inst = next)
+        {
+            next = inst->next;
+            if (inst->op == IrOp::Binary && state[inst->id] == CONSTANT)
+            {
+                func.replace_all_uses(inst, func.integer(constant[inst->id]));
+                func.erase(inst);
+                stats.values_replaced++;
+                stats.insts_removed++;
+                changed = true;
+            }
+        }
+    }
+
+    // 常量参数：替换所有使用，再从每条入边上删除对应的实参，从后往前删除下标不会变
+    vector<vector<size_t>> const_params(func.block_count());
+    for (IrBlock *bb = func.entry(); bb != nullptr; bb = bb->next)
+    {
+        for (size_t k = bb->params.size(); k-- > 0;)
+        {
+            IrValue *param = bb->params[k];
+            if (state[param->id] != CONSTANT)
+                continue;
+            if (param->has_uses())
+                func.replace_all_uses(param, func.integer(constant[param->id]));
+            const_params[bb->id].push_back(k);
+        }
+    }
+    for (IrBlock *bb = func.entry(); bb != nullptr; bb = bb->next)
+    {
+        IrValue *term = bb->terminator();
+        for (size_t i = 0; i < term->num_succs(); i++)
+        {
+            for (size_t k : const_params[term->succ(i)->id])
+                func.erase_edge_arg(term, i, k);
+        }
+    }
+    for (IrBlock *bb = func.entry(); bb != nullptr; bb = bb->next)
+    {
+        for (size_t k : const_params[bb->id])
+        {
+            func.erase_param(bb, k);
+            stats.values_replaced++;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+unique_ptr<Pass> create_sccp_pass()
+{
+    return make_unique<SccpPass>();
+}
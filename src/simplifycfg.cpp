@@ -0,0 +1,288 @@
+#include "pass.h"
+
+extern thread_local KoopaBuilder builder;
+
+/**
+ * simplifycfg：化简控制流图，反复进行直到没有变化
+ * 1. 删除从入口不可达的基本块（return、break 之后的代码等）
+ * 2. 条件为常量或两条边完全相同的 br 换成 jump
+ * 3. 删除没有用到的基本块参数（包括只在循环中传递自己的参数）
+ * 4. 只有一条 jump 的基本块（例如 %end_N）：前驱直接跳转到它的目标，它随后变得不可达
+ * 5. 基本块以 jump 结束、目标只有这一个前驱时，把目标合并到它的末尾
+ * 6. 删除结果不被使用的指令（见 dce）
+ */
+class SimplifyCfgPass : public FunctionPass
+{
+public:
+    const char *name() const override { return "simplifycfg"; }
+    bool run(IrFunction &func, PassStats &stats) override;
+
+private:
+    unique_ptr<Pass> dce = create_dce_pass();
+    vector<char> reachable;
+    vector<IrBlock *> work;
+    vector<char> live;
+    vector<IrValue *> live_work;
+
+    bool remove_unreachable(IrFunction &func, PassStats &stats);
+    bool fold_branches(IrFunction &func, PassStats &stats);
+    void mark_live(IrValue *value);
+    bool remove_dead_params(IrFunction &func);
+    bool thread_jumps(IrFunction &func);
+    bool merge_blocks(IrFunction &func, PassStats &stats);
+};
+
+// 跳转指令的第 i 条出边上传入的实参
+static vector<IrValue *> edge_args(const IrValue *term, size_t i)
+{
+    vector<IrValue *> args;
+    for (size_t k = 0; k < term->args_count(i); k++)
+        args.push_back(term->operand(term->args_begin(i) + k));
+    return args;
+}
+
+bool SimplifyCfgPass::remove_unreachable(IrFunction &func, PassStats &stats)
+{
+    reachable.assign(func.block_count(), false);
+    reachable[func.entry()->id] = true;
+    work.assign(1, func.entry());
+    while (!work.empty())
+    {
+        IrBlock *bb = work.back();
+        work.pop_back();
+        IrValue *term = bb->terminator();
+        for (size_t i = 0; i < term->num_succs(); i++)
+        {
+            IrBlock *succ = term->succ(i);
+            if (!reachable[succ->id])
+            {
+                reachable[succ->id] = true;
+                work.push_back(succ);
+            }
+        }
+    }
+
+    // 不可达的基本块之间可能互相使用，先全部断开再删除
+    work.clear();
+    for (IrBlock *bb = func.entry(); bb != nullptr; bb = bb->next)
+    {
+        if (!reachable[bb->id])
+            work.push_back(bb);
+    }
+    for (IrBlock *bb : work)
+    {
+        for (IrValue *inst = bb->first; inst != nullptr; inst = inst->next)
+            func.drop_operands(inst);
+    }
+    for (IrBlock *bb : work)
+    {
+        for (IrValue *inst = bb->first; inst != nullptr; inst = inst->next)
+            stats.insts_removed++;
+        func.erase_block(bb);
+        stats.blocks_removed++;
+    }
+    return !work.empty();
+}
+
+bool SimplifyCfgPass::fold_branches(IrFunction &func, PassStats &stats)
+{
+    bool changed = false;
+    for (IrBlock *bb = func.entry(); bb != nullptr; bb = bb->next)
+    {
+        IrValue *term = bb->terminator();
+        if (term->op != IrOp::Branch)
+            continue;
+        IrValue *cond = term->operand(0);
+        size_t i;
+        if (cond->op == IrOp::Integer)
+            i = cond->data.integer != 0 ? 0 : 1;
+        else if (term->succ(0) == term->succ(1) && edge_args(term, 0) == edge_args(term, 1))
+            i = 0;
+        else
+            continue;
+        func.set_insert_point(bb, term);
+        func.jump(term->succ(i), edge_args(term, i));
+        func.erase(term);
+        stats.branches_folded++;
+        changed = true;
+    }
+    return changed;
+}
+
+// 从有副作用的指令出发标记用到的值：跳转的实参只有在对应的参数用到时才用到，
+// 这样只在循环中传递、最终没有被使用的参数（以及计算它的指令）也会被删除
+void SimplifyCfgPass::mark_live(IrValue *value)
+{
+    if (!live[value->id] && (value->is_inst() || value->op == IrOp::BlockArg))
+    {
+        live[value->id] = true;
+        live_work.push_back(value);
+    }
+}
+
+bool SimplifyCfgPass::remove_dead_params(IrFunction &func)
+{
+    live.assign(func.value_count(), false);
+    live_work.clear();
+    for (IrBlock *bb = func.entry(); bb != nullptr; bb = bb->next)
+    {
+        for (IrValue *inst = bb->first; inst != nullptr; inst = inst->next)
+        {
+            if (inst->op == IrOp::Store || inst->op == IrOp::Call || inst->op == IrOp::Return)
+                mark_live(inst);
+            else if (inst->op == IrOp::Branch)
+                mark_live(inst->operand(0));
+        }
+    }
+    while (!live_work.empty())
+    {
+        IrValue *value = live_work.back();
+        live_work.pop_back();
+        if (value->op != IrOp::BlockArg)
+        {
+            for (size_t i = 0; i < value->num_ops; i++)
+                mark_live(value->operand(i));
+            continue;
+        }
+        IrBlock *bb = value->block;
+        for (IrBlock *pred : bb->preds)
+        {
+            IrValue *term = pred->terminator();
+            for (size_t i = 0; i < term->num_succs(); i++)
+            {
+                if (term->succ(i) == bb)
+                    mark_live(term->operand(term->args_begin(i) + value->data.index));
+            }
+        }
+    }
+
+    bool changed = false;
+    for (IrBlock *bb = func.entry(); bb != nullptr; bb = bb->next)
+    {
+        for (size_t k = bb->params.size(); k-- > 0;)
+        {
+            IrValue *param = bb->params[k];
+            if (live[param->id])
+                continue;
+            // 一个前驱可能有多条边到这里，在 preds 中出现多次，第一次就处理它的所有出边，
+            // 之后再遇到时这些边上的实参已经少了一个
+            for (IrBlock *pred : bb->preds)
+            {
+                IrValue *term = pred->terminator();
+                for (size_t i = 0; i < term->num_succs(); i++)
+                {
+                    if (term->succ(i) == bb && term->args_count(i) == bb->params.size())
+                        func.erase_edge_arg(term, i, k);
+                }
+            }
+            // 用到它的只有没有用到的指令，它们随后被删除
+            func.replace_all_uses(param, func.constant(builder.undef(param->ty)));
+            func.erase_param(bb, k);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+bool SimplifyCfgPass::thread_jumps(IrFunction &func)
+{
+    bool changed = false;
+    for (IrBlock *bb = func.entry()->next; bb != nullptr; bb = bb->next)
+    {
+        IrValue *jump = bb->first;
+        if (jump->op != IrOp::Jump || jump->data.target == bb)
+            continue;
+        // 参数只能用在这条 jump 中，否则目标中还有对它们的使用
+        bool local = true;
+        for (IrValue *param : bb->params)
+        {
+            for (IrUse *use = param->uses; use != nullptr && local; use = use->next)
+                local = use->user == jump;
+        }
+        if (!local)
+            continue;
+
+        IrBlock *target = jump->data.target;
+        for (IrBlock *pred : bb->preds)
+        {
+            IrValue *term = pred->terminator();
+            for (size_t i = 0; i < term->num_succs(); i++)
+            {
+                if (term->succ(i) != bb)
+                    continue;
+                // 参数换成这条边上的实参，其他值支配 bb，也就支配前驱
+                vector<IrValue *> args = edge_args(jump, 0);
+                for (IrValue *&arg : args)
+                {
+                    if (arg->op == IrOp::BlockArg && arg->block == bb)
+                        arg = term->operand(term->args_begin(i) + arg->data.index);
+                }
+                func.set_succ(term, i, target, args);
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+bool SimplifyCfgPass::merge_blocks(IrFunction &func, PassStats &stats)
+{
+    bool changed = false;
+    for (IrBlock *bb = func.entry(); bb != nullptr; bb = bb->next)
+    {
+        // 合并后 bb 以后继的 jump 结束，可以继续合并；其他基本块的 preds 个数不受影响
+        for (;;)
+        {
+            IrValue *jump = bb->terminator();
+            if (jump->op != IrOp::Jump)
+                break;
+            IrBlock *succ = jump->data.target;
+            if (succ == bb || succ == func.entry() || succ->preds.size() != 1)
+                break;
+            vector<IrValue *> args = edge_args(jump, 0);
+            func.erase(jump);
+            for (size_t k = 0; k < args.size(); k++)
+            {
+                func.replace_all_uses(succ->params[k], args[k]);
+                stats.values_replaced++;
+            }
+            for (size_t k = args.size(); k-- > 0;)
+                func.erase_param(succ, k);
+            while (!succ->empty())
+                func.move_before(succ->first, bb, nullptr);
+            func.erase_block(succ);
+            stats.blocks_merged++;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+bool SimplifyCfgPass::run(IrFunction &func, PassStats &stats)
+{
+    bool changed = false;
+    for (;;)
+    {
+        bool round = remove_unreachable(func, stats);
+        round |= fold_branches(func, stats);
+        func.compute_cfg();
+        round |= remove_dead_params(func);
+        if (thread_jumps(func))
+        {
+            round = true;
+            // 被绕过的基本块在下一轮删除
+            func.compute_cfg();
+        }
+        round |= merge_blocks(func, stats);
+        round |= static_cast<FunctionPass &>(*dce).run(func, stats);
+        if (!round)
+            break;
+        changed = true;
+    }
+    return changed;
+}
+
+unique_ptr<Pass> create_simplifycfg_pass()
+{
+    return make_unique<SimplifyCfgPass>();
+}
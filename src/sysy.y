@@ -2,6 +2,7 @@
   #include <memory>
   #include <string>
   #include "AST.h"
+  #include "lexer.h"
 }
 
 %{
@@ -11,165 +12,164 @@
 #include <string>
 #include <cstring>
 #include <vector>
-#include <deque>
 #include "AST.h"
+#include "lexer.h"
 
 // 声明 lexer 函数和错误处理函数
-int yylex();
-void yyerror(std::unique_ptr<BaseAST> &ast, const char *s);
+int yylex(YYSTYPE *lval, Lexer &lexer);
+void yyerror(Lexer &lexer, Ref<BaseAST> &ast, string &error, const char *s);
 
-int funcnum = 0;
 
 using namespace std;
 
+// 括号、一元运算符和语句的嵌套每一层都要占用分析栈，Bison 默认最多 10000 层
+// 分析栈在堆上按需倍增，这里的上限只用来防止失控
+#define YYMAXDEPTH 100000000
+
+// 非空时为流式处理：每解析完一个全局定义就交给它处理，不再收集到 CompUnit 中
+// 并行前端的每个线程各自解析源文件的一段，所以每个线程有自己的处理函数
+thread_local void (*def_handler)(Ref<BaseAST> def) = nullptr;
+
+static int add_def(int def_list, Ref<BaseAST> def)
+{
+  if (def_handler != nullptr)
+    def_handler(def);
+  else
+    ast_arena.push_list(def);
+  return def_list;
+}
+
 %}
 
+// 可重入的 parser：yylval 和分析栈都是 yyparse 的局部变量，token 从参数给出的 lexer 中读取
+// 这样多个线程可以同时解析源文件的不同部分
+%define api.pure full
+%lex-param { Lexer &lexer }
+
 // 定义 parser 函数和错误处理函数的附加参数
 // 我们需要返回一个字符串作为 AST, 所以我们把附加参数定义成字符串的智能指针
 // 解析完成后, 我们要手动修改这个参数, 把它设置成解析得到的字符串
-%parse-param { std::unique_ptr<BaseAST> &ast }
+%parse-param { Lexer &lexer } { Ref<BaseAST> &ast } { string &error }
 
 // yylval 的定义, 我们把它定义成了一个联合体 (union)
-// 因为 token 的值有的是字符串指针, 有的是整数
-// 之前我们在 lexer 中用到的 str_val 和 int_val 就是在这里被定义的
-// 至于为什么要用字符串指针而不直接用 string 或者 unique_ptr<string>?
-// 请自行 STFW 在 union 里写一个带析构函数的类会出现什么情况
+// 标识符在 lexer 中就被驻留为整数编号, 所以 token 的值都是整数
+// 之前我们在 lexer 中用到的 int_val 就是在这里被定义的
 %union {
-  std::string *str_val;
   int int_val;
-  BaseAST *ast_val;
-  deque<unique_ptr<BaseAST>> *ast_deq;
-  vector<unique_ptr<BaseAST>> *ast_vec;
+  Ref<BaseAST> ast_val;
+  // 正在构建的列表，见 AstArena::begin_list
+  int ast_list;
 }
 
 // lexer 返回的所有 token 种类的声明
-// 注意 IDENT 和 INT_CONST 会返回 token 的值, 分别对应 str_val 和 int_val
+// 注意 IDENT 和 INT_CONST 会返回 token 的值, 都对应 int_val (IDENT 的值是驻留后的编号)
 %token INT RETURN CONST IF ELSE LE GE EQ NE AND OR WHILE BREAK CONTINUE
-%token <str_val> IDENT
+%token <int_val> IDENT
 %token <int_val> INT_CONST
 %token VOID
 
 // 非终结符的类型定义
 %type <ast_val> FuncDef Block Stmt If
 %type <ast_val> Exp PrimaryExp UnaryExp AddExp MulExp LOrExp LAndExp EqExp RelExp
-%type <ast_val> Decl ConstDecl ConstDef ConstDefList BlockItem LVal LeVal BlockItemList VarDecl VarDef InitVal VarDefList
+%type <ast_val> Decl ConstDecl ConstDef BlockItem LVal LeVal VarDecl VarDef InitVal
 %type <int_val> Number
-%type <ast_deq> DefList
-%type <ast_val> FuncFParams FuncFParam FuncRParams
-%type <ast_vec> ArraySizeList InitValList
+%type <ast_val> FuncFParam
+%type <ast_list> ArraySizeList InitValList DefList FuncFParams FuncRParams BlockItemList ConstDefList VarDefList
 %%
 
 
 CompUnit
   : DefList {
-    auto comp_unit = make_unique<CompUnitAST>();
-    comp_unit->DefList = unique_ptr<deque<unique_ptr<BaseAST>>>($1);
-    comp_unit->func_num = funcnum;
-    ast = move(comp_unit);
+    auto comp_unit = ast_arena.make<CompUnitAST>();
+    comp_unit->DefList = ast_arena.end_list($1);
+    ast = comp_unit;
   }
   ;
 
 
+// 左递归，按源码顺序线性地收集全局定义
 DefList
-  : FuncDef DefList {
-    auto deq = (deque<unique_ptr<BaseAST>>*)($2);
-    auto func = unique_ptr<BaseAST>($1);
-    deq->push_back(move(func));
-    funcnum++;
-    $$ = deq;
-  }
-  | Decl DefList {
-    auto deq = (deque<unique_ptr<BaseAST>>*)($2);
-    auto decl = unique_ptr<BaseAST>($1);
-    deq->push_front(move(decl));
-    $$ = deq;
+  : DefList FuncDef {
+    $$ = add_def($1, $2);
+  }
+  | DefList Decl {
+    $$ = add_def($1, $2);
   }
   | FuncDef {
-    auto deq = new deque<unique_ptr<BaseAST>>();
-    auto func = unique_ptr<BaseAST>($1);
-    deq->push_back(move(func));
-    funcnum++;
-    $$ = deq;
+    $$ = add_def(ast_arena.begin_list(), $1);
   }
   | Decl {
-    auto deq = new deque<unique_ptr<BaseAST>>();
-    auto decl = unique_ptr<BaseAST>($1);
-    deq->push_front(move(decl));
-    $$ = deq;
+    $$ = add_def(ast_arena.begin_list(), $1);
   }
   ;
 
 FuncDef
   : INT IDENT '(' ')' Block {
-    auto ast = new FuncDefAST();
+    auto ast = ast_arena.make<FuncDefAST>();
     ast->type = "int";
-    ast->ident = *unique_ptr<string>($2);
-    ast->block = unique_ptr<BaseAST>($5);
+    ast->ident = $2;
+    ast->block = $5;
     $$ = ast;
   }
   | VOID IDENT '(' ')' Block {
-    auto ast = new FuncDefAST();
+    auto ast = ast_arena.make<FuncDefAST>();
     ast->type = "void";
-    ast->ident = *unique_ptr<string>($2);
-    ast->block = unique_ptr<BaseAST>($5);
+    ast->ident = $2;
+    ast->block = $5;
     $$ = ast;
   }
   | INT IDENT '(' FuncFParams ')' Block {
-    auto ast = new FuncDefWithParamsAST();
+    auto ast = ast_arena.make<FuncDefWithParamsAST>();
     ast->type = "int";
-    ast->ident = *unique_ptr<string>($2);
-    ast->funcfparams = unique_ptr<BaseAST>($4);
-    ast->block = unique_ptr<BaseAST>($6);
+    ast->ident = $2;
+    auto params = ast_arena.make<FuncFParamsAST>();
+    params->ParamList = ast_arena.end_list($4);
+    ast->funcfparams = params;
+    ast->block = $6;
     $$ = ast;
   }
   | VOID IDENT '(' FuncFParams ')' Block {
-    auto ast = new FuncDefWithParamsAST();
+    auto ast = ast_arena.make<FuncDefWithParamsAST>();
     ast->type = "void";
-    ast->ident = *unique_ptr<string>($2);
-    ast->funcfparams = unique_ptr<BaseAST>($4);
-    ast->block = unique_ptr<BaseAST>($6);
+    ast->ident = $2;
+    auto params = ast_arena.make<FuncFParamsAST>();
+    params->ParamList = ast_arena.end_list($4);
+    ast->funcfparams = params;
+    ast->block = $6;
     $$ = ast;
   }
   ;
 
 FuncFParams
-  : FuncFParam ',' FuncFParams {
-    auto ast = new FuncFParamsAST();
-    auto ast_params = unique_ptr<FuncFParamsAST>((FuncFParamsAST*)$3);
-    ast->ParamList.emplace_back($1); 
-    for(auto &i : ast_params->ParamList) {
-      ast->ParamList.emplace_back(i.release());
-    }
-    $$ = ast;
+  : FuncFParams ',' FuncFParam {
+    ast_arena.push_list($3);
+    $$ = $1;
   }
   | FuncFParam {
-    auto ast = new FuncFParamsAST();
-    ast->ParamList.emplace_back($1);
-    $$ = ast;
+    $$ = ast_arena.begin_list();
+    ast_arena.push_list($1);
   }
   ;
 
 // lv9 done
 FuncFParam
   : INT IDENT {
-    auto ast = new FuncFParamAST();
+    auto ast = ast_arena.make<FuncFParamAST>();
     ast->type = "int";
-    ast->name_ = *unique_ptr<string>($2);
+    ast->name_ = $2;
     $$ = ast;
   } 
   | INT IDENT '[' ']' {
-    auto ast = new FuncFParamAST();
+    auto ast = ast_arena.make<FuncFParamAST>();
     ast->type = "array";
-    ast->name_ = *unique_ptr<string>($2);
+    ast->name_ = $2;
     $$ = ast;
   } 
   | INT IDENT '[' ']' ArraySizeList {
-    auto ast = new FuncFParamAST();
+    auto ast = ast_arena.make<FuncFParamAST>();
     ast->type = "array";
-    ast->name_ = *unique_ptr<string>($2);
-    vector<unique_ptr<BaseAST>> *v_ptr = ($5);
-    for (auto it = v_ptr->begin(); it != v_ptr->end(); it++)
-      ast->array_size_list.push_back(move(*it));
+    ast->name_ = $2;
+    ast->array_size_list = ast_arena.end_list($5);
     $$ = ast;
   }
   ;
@@ -177,43 +177,35 @@ FuncFParam
 // lv9 done
 ArraySizeList
   : '[' Exp ']' {
-    vector<unique_ptr<BaseAST>> *v = new vector<unique_ptr<BaseAST>>;
-    v->push_back(unique_ptr<BaseAST>($2));
-    $$ = v;
+    $$ = ast_arena.begin_list();
+    ast_arena.push_list($2);
   } 
   | ArraySizeList '[' Exp ']' {
-    vector<unique_ptr<BaseAST>> *v = ($1);
-    v->push_back(unique_ptr<BaseAST>($3));
-    $$ = v;
+    ast_arena.push_list($3);
+    $$ = $1;
   }
   ;
 
 FuncRParams
-  : Exp ',' FuncRParams {
-    auto ast = new FuncRParamsAST();
-    auto ast_params = unique_ptr<FuncRParamsAST>((FuncRParamsAST*)$3);
-    ast->ParamList.emplace_back($1);
-    for (auto &i : ast_params->ParamList){
-      ast->ParamList.emplace_back(i.release());
-    }
-    $$ = ast;
+  : FuncRParams ',' Exp {
+    ast_arena.push_list($3);
+    $$ = $1;
   }
   | Exp {
-    auto ast = new FuncRParamsAST();
-    ast->ParamList.emplace_back($1);
-    $$ = ast;
+    $$ = ast_arena.begin_list();
+    ast_arena.push_list($1);
   }
   ;
 
 /* // 同上, 不再解释
 FuncType
   : INT {
-    auto ast = new FuncTypeAST();
+    auto ast = ast_arena.make<FuncTypeAST>();
     ast->type = "int";
     $$ = ast;
   }
   | VOID {
-    auto ast = new FuncTypeAST();
+    auto ast = ast_arena.make<FuncTypeAST>();
     ast->type = "void";
     $$ = ast;
   }
@@ -221,37 +213,33 @@ FuncType
 
 Block
   : '{' BlockItemList '}' {
-    $$ = $2;
+    auto ast = ast_arena.make<BlockAST>();
+    ast->blockItemList = ast_arena.end_list($2);
+    $$ = ast;
   }
   ;
 
 BlockItemList
   : {
-    auto ast = new BlockAST();
-    $$ = ast;
+    $$ = ast_arena.begin_list();
   }
-  | BlockItem BlockItemList {
-    auto ast = new BlockAST();
-    auto ast_item_list = (BlockAST*)$2;
-    ast->blockItemList.emplace_back($1);
-    int n = ast_item_list->blockItemList.size();
-    for(int i=0; i < n; i++) {
-      ast->blockItemList.emplace_back(ast_item_list->blockItemList[i].release());
-    }
-    $$ = ast;
+  | BlockItemList BlockItem {
+    // 左递归：直接追加到正在构建的列表，避免每次归约都复制整个列表
+    ast_arena.push_list($2);
+    $$ = $1;
   }
   ;
 
 BlockItem
   : Decl {
-    auto ast = new BlockItemAST();
-    ast->decl = unique_ptr<BaseAST>($1);
+    auto ast = ast_arena.make<BlockItemAST>();
+    ast->decl = $1;
     ast->rule = 0;
     $$ = ast;
   }
   | Stmt {
-    auto ast = new BlockItemAST();
-    ast->stmt = unique_ptr<BaseAST>($1);
+    auto ast = ast_arena.make<BlockItemAST>();
+    ast->stmt = $1;
     ast->rule = 1;
     $$ = ast;
   }
@@ -259,64 +247,64 @@ BlockItem
 
 Stmt
   : LeVal '=' Exp ';'{
-    auto ast = new StmtAST();
-    ast->leval = unique_ptr<BaseAST>($1);
-    ast->exp = unique_ptr<BaseAST>($3);
+    auto ast = ast_arena.make<StmtAST>();
+    ast->leval = $1;
+    ast->exp = $3;
     ast->rule = 0;
     $$ = ast;
   }
   | RETURN Exp ';' {
-    auto ast = new StmtAST();
-    ast->exp = unique_ptr<BaseAST>($2);
+    auto ast = ast_arena.make<StmtAST>();
+    ast->exp = $2;
     ast->rule = 1;
     $$ = ast;
   }
   | RETURN ';' {
-    auto ast = new StmtAST();
+    auto ast = ast_arena.make<StmtAST>();
     ast->rule = 1;
     $$ = ast;
   }
   | Exp ';' {
-    auto ast = new StmtAST();
-    ast->exp = unique_ptr<BaseAST>($1);
+    auto ast = ast_arena.make<StmtAST>();
+    ast->exp = $1;
     ast->rule = 2;
     $$ = ast;
   }
   | ';' {
-    auto ast = new StmtAST();
+    auto ast = ast_arena.make<StmtAST>();
     ast->rule = 2;
     $$ = ast;
   }
   | Block {
-    auto ast = new StmtAST();
-    ast->block = unique_ptr<BaseAST>($1);
+    auto ast = ast_arena.make<StmtAST>();
+    ast->block = $1;
     ast->rule = 3;
     $$ = ast;
   }
   | If ELSE Stmt{
-    auto ast = new IfStmtAST();
-    ast->if_stmt = unique_ptr<BaseAST>($1);
-    ast->else_stmt = unique_ptr<BaseAST>($3);
+    auto ast = ast_arena.make<IfStmtAST>();
+    ast->if_stmt = $1;
+    ast->else_stmt = $3;
     $$ = ast;
   }
   | If {
-    auto ast = new IfStmtAST();
-    ast->if_stmt = unique_ptr<BaseAST>($1);
+    auto ast = ast_arena.make<IfStmtAST>();
+    ast->if_stmt = $1;
     $$ = ast;
   }
   | WHILE '(' Exp ')' Stmt {
-    auto ast = new WhileAST();
-    ast->exp = unique_ptr<BaseAST>($3);
-    ast->stmt = unique_ptr<BaseAST>($5);
+    auto ast = ast_arena.make<WhileAST>();
+    ast->exp = $3;
+    ast->stmt = $5;
     $$ = ast;
   }
   | CONTINUE ';' {
-    auto ast = new LoopJumpAST();
+    auto ast = ast_arena.make<LoopJumpAST>();
     ast->rule = 1;
     $$ = ast;
   }
   | BREAK ';' {
-    auto ast = new LoopJumpAST();
+    auto ast = ast_arena.make<LoopJumpAST>();
     ast->rule = 0;
     $$ = ast;
   }
@@ -324,9 +312,9 @@ Stmt
 
 If
   : IF '(' Exp ')' Stmt {
-    auto ast = new IfAST();
-    ast->exp = unique_ptr<BaseAST>($3);
-    ast->stmt = unique_ptr<BaseAST>($5);
+    auto ast = ast_arena.make<IfAST>();
+    ast->exp = $3;
+    ast->stmt = $5;
     $$ = ast;
   }
   ;
@@ -340,29 +328,29 @@ Number
 
 Exp
   : LOrExp {
-    auto ast = new ExpAST();
-    ast->lorexp = unique_ptr<BaseAST>($1);
+    auto ast = ast_arena.make<ExpAST>();
+    ast->lorexp = $1;
     $$ = ast;
   }
   ;
 
 PrimaryExp
   : '(' Exp ')' {
-    auto ast = new PrimaryExpAST();
+    auto ast = ast_arena.make<PrimaryExpAST>();
     ast -> rule = 0;
-    ast -> exp = unique_ptr<BaseAST>($2);
+    ast -> exp = $2;
     $$ = ast;
   }
   | Number {
-    auto ast = new PrimaryExpAST();
+    auto ast = ast_arena.make<PrimaryExpAST>();
     ast -> rule = 1;
     ast ->number = ($1);
     $$ = ast;
   }
   | LVal {
-    auto ast = new PrimaryExpAST();
+    auto ast = ast_arena.make<PrimaryExpAST>();
     ast->rule = 2;
-    ast->lval = unique_ptr<BaseAST>($1);
+    ast->lval = $1;
     $$ = ast;
   }
   ;
@@ -370,256 +358,250 @@ PrimaryExp
 
 UnaryExp
   : PrimaryExp {
-    auto ast = new UnaryExpAST();
+    auto ast = ast_arena.make<UnaryExpAST>();
     ast -> rule = 0;
-    ast -> primaryexp = unique_ptr<BaseAST>($1);
+    ast -> primaryexp = $1;
     $$ = ast;
   }
   | '+' UnaryExp {
-    auto ast = new UnaryExpAST();
+    auto ast = ast_arena.make<UnaryExpAST>();
     ast -> rule = 1;
     ast -> op = "+";
-    ast -> unaryexp = unique_ptr<BaseAST>($2);
+    ast -> unaryexp = $2;
     $$ = ast;
   }
   | '-' UnaryExp {
-    auto ast = new UnaryExpAST();
+    auto ast = ast_arena.make<UnaryExpAST>();
     ast -> rule = 1;
     ast -> op = "-";
-    ast -> unaryexp = unique_ptr<BaseAST>($2);
+    ast -> unaryexp = $2;
     $$ = ast;
   }
   | '!' UnaryExp {
-    auto ast = new UnaryExpAST();
+    auto ast = ast_arena.make<UnaryExpAST>();
     ast -> rule = 1;
     ast -> op = "!";
-    ast -> unaryexp = unique_ptr<BaseAST>($2);
+    ast -> unaryexp = $2;
     $$ = ast;
   }
   | IDENT '(' ')' {
-    auto ast = new UnaryExpWithFuncAST();
-    ast->ident = *unique_ptr<string>($1);
+    auto ast = ast_arena.make<UnaryExpWithFuncAST>();
+    ast->ident = $1;
     $$ = ast;
   }
   | IDENT '(' FuncRParams ')' {
-    auto ast = new UnaryExpWithFuncAST();
-    ast->ident = *unique_ptr<string>($1);
-    ast->funcrparams = unique_ptr<BaseAST>($3);
+    auto ast = ast_arena.make<UnaryExpWithFuncAST>();
+    ast->ident = $1;
+    auto params = ast_arena.make<FuncRParamsAST>();
+    params->ParamList = ast_arena.end_list($3);
+    ast->funcrparams = params;
     $$ = ast;
   }
   ;
 
 MulExp
   : UnaryExp {
-    auto ast = new MulExpAST();
+    auto ast = ast_arena.make<MulExpAST>();
     ast -> rule = 0;
-    ast -> unaryexp = unique_ptr<BaseAST>($1);
+    ast -> unaryexp = $1;
     $$ = ast;
   }
   | MulExp '*' UnaryExp {
-    auto ast = new MulExpAST();
+    auto ast = ast_arena.make<MulExpAST>();
     ast -> rule = 1;
-    ast -> mulexp = unique_ptr<BaseAST>($1);
+    ast -> mulexp = $1;
     ast -> op = "*";
-    ast -> unaryexp = unique_ptr<BaseAST>($3);
+    ast -> unaryexp = $3;
     $$ = ast;
   }
   | MulExp '/' UnaryExp {
-    auto ast = new MulExpAST();
+    auto ast = ast_arena.make<MulExpAST>();
     ast -> rule = 1;
-    ast -> mulexp = unique_ptr<BaseAST>($1);
+    ast -> mulexp = $1;
     ast -> op = "/";
-    ast -> unaryexp = unique_ptr<BaseAST>($3);
+    ast -> unaryexp = $3;
     $$ = ast;
   }
   | MulExp '%' UnaryExp {
-    auto ast = new MulExpAST();
+    auto ast = ast_arena.make<MulExpAST>();
     ast -> rule = 1;
-    ast -> mulexp = unique_ptr<BaseAST>($1);
+    ast -> mulexp = $1;
     ast -> op = "%";
-    ast -> unaryexp = unique_ptr<BaseAST>($3);
+    ast -> unaryexp = $3;
     $$ = ast;
   }
   ;
 
 AddExp
   : MulExp {
-    auto ast = new AddExpAST();
+    auto ast = ast_arena.make<AddExpAST>();
     ast -> rule = 0;
-    ast -> mulexp = unique_ptr<BaseAST>($1);
+    ast -> mulexp = $1;
     $$ = ast;
   }
   | AddExp '+' MulExp {
-    auto ast = new AddExpAST();
+    auto ast = ast_arena.make<AddExpAST>();
     ast -> rule = 1;
-    ast -> addexp = unique_ptr<BaseAST>($1);
+    ast -> addexp = $1;
     ast -> op = "+";
-    ast -> mulexp = unique_ptr<BaseAST>($3);
+    ast -> mulexp = $3;
     $$ = ast;
   }
   | AddExp '-' MulExp {
-    auto ast = new AddExpAST();
+    auto ast = ast_arena.make<AddExpAST>();
     ast -> rule = 1;
-    ast -> addexp = unique_ptr<BaseAST>($1);
+    ast -> addexp = $1;
     ast -> op = "-";
-    ast -> mulexp = unique_ptr<BaseAST>($3);
+    ast -> mulexp = $3;
     $$ = ast;
   }
   ;
 
 RelExp
   : AddExp {
-    auto ast = new RelExpAST();
+    auto ast = ast_arena.make<RelExpAST>();
     ast -> rule = 0;
-    ast -> addexp = unique_ptr<BaseAST>($1);
+    ast -> addexp = $1;
     $$ = ast;
   }
   | RelExp '<' AddExp {
-    auto ast = new RelExpAST();
+    auto ast = ast_arena.make<RelExpAST>();
     ast -> rule = 1;
-    ast -> relexp = unique_ptr<BaseAST>($1);
+    ast -> relexp = $1;
     ast -> op = "<";
-    ast -> addexp = unique_ptr<BaseAST>($3);
+    ast -> addexp = $3;
     $$ = ast;
   }
   | RelExp '>' AddExp {
-    auto ast = new RelExpAST();
+    auto ast = ast_arena.make<RelExpAST>();
     ast -> rule = 1;
-    ast -> relexp = unique_ptr<BaseAST>($1);
+    ast -> relexp = $1;
     ast -> op = ">";
-    ast -> addexp = unique_ptr<BaseAST>($3);
+    ast -> addexp = $3;
     $$ = ast;
   }
   | RelExp LE AddExp {
-    auto ast = new RelExpAST();
+    auto ast = ast_arena.make<RelExpAST>();
     ast -> rule = 1;
-    ast -> relexp = unique_ptr<BaseAST>($1);
+    ast -> relexp = $1;
     ast -> op = "<=";
-    ast -> addexp = unique_ptr<BaseAST>($3);
+    ast -> addexp = $3;
     $$ = ast;
   }
   | RelExp GE AddExp {
-    auto ast = new RelExpAST();
+    auto ast = ast_arena.make<RelExpAST>();
     ast -> rule = 1;
-    ast -> relexp = unique_ptr<BaseAST>($1);
+    ast -> relexp = $1;
     ast -> op = ">=";
-    ast -> addexp = unique_ptr<BaseAST>($3);
+    ast -> addexp = $3;
     $$ = ast;
   }
   ;
 
 EqExp
   : RelExp {
-    auto ast = new EqExpAST();
+    auto ast = ast_arena.make<EqExpAST>();
     ast -> rule = 0;
-    ast -> relexp = unique_ptr<BaseAST>($1);
+    ast -> relexp = $1;
     $$ = ast;
   }
   | EqExp EQ RelExp {
-    auto ast = new EqExpAST();
+    auto ast = ast_arena.make<EqExpAST>();
     ast -> rule = 1;
-    ast -> eqexp = unique_ptr<BaseAST>($1);
+    ast -> eqexp = $1;
     ast -> op = "==";
-    ast -> relexp = unique_ptr<BaseAST>($3);
+    ast -> relexp = $3;
     $$ = ast;
   }
   | EqExp NE RelExp {
-    auto ast = new EqExpAST();
+    auto ast = ast_arena.make<EqExpAST>();
     ast -> rule = 1;
-    ast -> eqexp = unique_ptr<BaseAST>($1);
+    ast -> eqexp = $1;
     ast -> op = "!=";
-    ast -> relexp = unique_ptr<BaseAST>($3);
+    ast -> relexp = $3;
     $$ = ast;   
   }
   ;
 
 LAndExp
   : EqExp {
-    auto ast = new LAndExpAST();
+    auto ast = ast_arena.make<LAndExpAST>();
     ast -> rule = 0;
-    ast -> eqexp = unique_ptr<BaseAST>($1);
+    ast -> eqexp = $1;
     $$ = ast;
   }
   | LAndExp AND EqExp {
-    auto ast = new LAndExpAST();
+    auto ast = ast_arena.make<LAndExpAST>();
     ast -> rule = 1;
-    ast -> landexp = unique_ptr<BaseAST>($1);
-    ast -> eqexp = unique_ptr<BaseAST>($3);
+    ast -> landexp = $1;
+    ast -> eqexp = $3;
     $$ = ast; 
   }
   ;
 
 LOrExp
   : LAndExp {
-    auto ast = new LOrExpAST();
+    auto ast = ast_arena.make<LOrExpAST>();
     ast -> rule = 0;
-    ast -> landexp = unique_ptr<BaseAST>($1);
+    ast -> landexp = $1;
     $$ = ast;
   }
   | LOrExp OR LAndExp {
-    auto ast = new LOrExpAST();
+    auto ast = ast_arena.make<LOrExpAST>();
     ast -> rule = 1;
-    ast -> lorexp = unique_ptr<BaseAST>($1);
-    ast -> landexp = unique_ptr<BaseAST>($3);
+    ast -> lorexp = $1;
+    ast -> landexp = $3;
     $$ = ast; 
   }
   ;
 
 Decl
   : ConstDecl {
-    auto ast = new DeclAST();
+    auto ast = ast_arena.make<DeclAST>();
     ast->rule = 0;
-    ast->constdecl = unique_ptr<BaseAST>($1);
+    ast->constdecl = $1;
     $$ = ast;
   }
   | VarDecl{
-    auto ast = new DeclAST();
+    auto ast = ast_arena.make<DeclAST>();
     ast->rule = 1;
-    ast->vardecl = unique_ptr<BaseAST>($1);
+    ast->vardecl = $1;
     $$ = ast;
   }
   ;
 
 ConstDecl
   : CONST INT ConstDefList ';' {
-    auto ast = $3;
+    auto ast = ast_arena.make<ConstDeclAST>();
+    ast->constDefList = ast_arena.end_list($3);
     $$ = ast;
   }
   ;
 
 ConstDefList
-  : ConstDef ',' ConstDefList {
-    auto ast = new ConstDeclAST();
-    auto ast_def = (ConstDeclAST* )$3;
-    ast->constDefList.emplace_back($1); 
-    int n = ast_def->constDefList.size();
-    for(int i = 0; i < n; i++) {
-      ast->constDefList.emplace_back(ast_def->constDefList[i].release());
-    }
-    $$ = ast;
+  : ConstDefList ',' ConstDef {
+    ast_arena.push_list($3);
+    $$ = $1;
   }
   | ConstDef {
-    auto ast = new ConstDeclAST();
-    ast->constDefList.emplace_back($1);
-    $$ = ast;
+    $$ = ast_arena.begin_list();
+    ast_arena.push_list($1);
   }
   ;
 
 // lv9 done
 ConstDef
   : IDENT '=' InitVal {
-    auto ast = new ConstDefAST();
-    ast->ident = *unique_ptr<string>($1);
-    ast->constinitval = unique_ptr<BaseAST>($3);
+    auto ast = ast_arena.make<ConstDefAST>();
+    ast->ident = $1;
+    ast->constinitval = $3;
     $$ = ast;
   } 
   | IDENT ArraySizeList '=' InitVal {
-    auto ast = new ConstDefArrayAST();
-    ast->ident = *unique_ptr<string>($1);
-    ast->constinitval = unique_ptr<BaseAST>($4);
-    vector<unique_ptr<BaseAST>> *v_ptr = ($2);
-    for (auto it = v_ptr->begin(); it != v_ptr->end(); it++)
-      ast->array_size_list.push_back(move(*it));
+    auto ast = ast_arena.make<ConstDefArrayAST>();
+    ast->ident = $1;
+    ast->constinitval = $4;
+    ast->array_size_list = ast_arena.end_list($2);
     $$ = ast;
   }
   ;
@@ -629,92 +611,79 @@ ConstDef
 
 LVal 
   : IDENT {
-    auto ast = new LValAST();
-    ast->ident = *unique_ptr<string>($1);
+    auto ast = ast_arena.make<LValAST>();
+    ast->ident = $1;
     $$ = ast;
   }
   | IDENT ArraySizeList {
-    auto ast = new LValArrayAST();
-    ast->ident = *unique_ptr<string>($1);
-    vector<unique_ptr<BaseAST>> *v_ptr = ($2);
-    for(auto it = v_ptr->begin(); it != v_ptr->end(); it++)
-      ast->array_size_list.push_back(move(*it));
+    auto ast = ast_arena.make<LValArrayAST>();
+    ast->ident = $1;
+    ast->array_size_list = ast_arena.end_list($2);
     $$ = ast;
   }
   ;
 
 LeVal
   : IDENT{
-    auto ast = new LeValAST();
-    ast->ident = *unique_ptr<string>($1);
+    auto ast = ast_arena.make<LeValAST>();
+    ast->ident = $1;
     $$ = ast;
   }
   | IDENT ArraySizeList {
-    auto ast = new LeValArrayAST();
-    ast->ident = *unique_ptr<string>($1);
-    vector<unique_ptr<BaseAST>> *v_ptr = ($2);
-    for(auto it = v_ptr->begin(); it != v_ptr->end(); it++)
-      ast->array_size_list.push_back(move(*it));
+    auto ast = ast_arena.make<LeValArrayAST>();
+    ast->ident = $1;
+    ast->array_size_list = ast_arena.end_list($2);
     $$ = ast;
   }
   ;
 
 VarDecl
   : INT VarDefList ';' {
-    $$ = $2;
+    auto ast = ast_arena.make<VarDeclAST>();
+    ast->varDefList = ast_arena.end_list($2);
+    $$ = ast;
   }
   ;
 
 VarDefList
-  : VarDef ',' VarDefList {
-    auto ast = new VarDeclAST();
-    auto ast_def = (VarDeclAST* )$3;
-    ast->varDefList.emplace_back($1); 
-    int n = ast_def->varDefList.size();
-    for(int i = 0; i < n; i++) {
-      ast->varDefList.emplace_back(ast_def->varDefList[i].release());
-    }
-    $$ = ast;
+  : VarDefList ',' VarDef {
+    ast_arena.push_list($3);
+    $$ = $1;
   }
   | VarDef {
-    auto ast = new VarDeclAST();
-    ast->varDefList.emplace_back($1);
-    $$ = ast;
+    $$ = ast_arena.begin_list();
+    ast_arena.push_list($1);
   }
   ;
 
 // lv9 done
 VarDef
   : IDENT {
-    auto ast = new VarDefAST();
+    auto ast = ast_arena.make<VarDefAST>();
     ast->rule = 0;
-    ast->ident = *unique_ptr<string>($1);
+    ast->ident = $1;
     $$ = ast;
   }
   | IDENT '=' InitVal {
-    auto ast = new VarDefAST();
+    auto ast = ast_arena.make<VarDefAST>();
     ast->rule = 1;
-    ast->ident = *unique_ptr<string>($1);
-    ast->initval = unique_ptr<BaseAST>($3);
+    ast->ident = $1;
+    ast->initval = $3;
     $$ = ast;
   }
   | IDENT ArraySizeList {
-    auto ast = new VarDefArrayAST();
+    auto ast = ast_arena.make<VarDefArrayAST>();
     ast->rule = 0;
-    ast->ident = *unique_ptr<string>($1);
-    vector<unique_ptr<BaseAST>> *v_ptr = ($2);
-    for (auto it = v_ptr->begin(); it != v_ptr->end(); it++)
-      ast->array_size_list.push_back(move(*it));
+    ast->ident = $1;
+    ast->array_size_list = ast_arena.end_list($2);
     $$ = ast;
   }
   | IDENT ArraySizeList '=' InitVal {
-    auto ast = new VarDefArrayAST();
+    auto ast = ast_arena.make<VarDefArrayAST>();
     ast->rule = 1;
-    ast->ident = *unique_ptr<string>($1);
-    ast->init_val = unique_ptr<BaseAST>($4);
-    vector<unique_ptr<BaseAST>> *v_ptr = ($2);
-    for (auto it = v_ptr->begin(); it != v_ptr->end(); it++)
-      ast->array_size_list.push_back(move(*it));
+    ast->ident = $1;
+    ast->init_val = $4;
+    ast->array_size_list = ast_arena.end_list($2);
     $$ = ast;
   }
   ;
@@ -722,19 +691,17 @@ VarDef
 // lv9 done
 InitVal
   : Exp {
-    auto ast = new InitValAST();
-    ast->exp = unique_ptr<BaseAST>($1);
+    auto ast = ast_arena.make<InitValAST>();
+    ast->exp = $1;
     $$ = ast;
   }
   | '{' '}' {
-    auto ast = new InitValWithListAST();
+    auto ast = ast_arena.make<InitValWithListAST>();
     $$ = ast;
   }
   | '{' InitValList '}' {
-    auto ast = new InitValWithListAST();
-    vector<unique_ptr<BaseAST>> *v_ptr = ($2);
-    for (auto it = v_ptr->begin(); it != v_ptr->end(); it++)
-      ast->init_val_list.push_back(move(*it));
+    auto ast = ast_arena.make<InitValWithListAST>();
+    ast->init_val_list = ast_arena.end_list($2);
     $$ = ast;  
   }
   ;
@@ -743,31 +710,22 @@ InitVal
 // lv9 done
 InitValList
   : InitVal {
-    vector<unique_ptr<BaseAST>> *v = new vector<unique_ptr<BaseAST>>;
-    v->push_back(unique_ptr<BaseAST>($1));
-    $$ = v;
+    $$ = ast_arena.begin_list();
+    ast_arena.push_list($1);
   }
   | InitValList ',' InitVal {
-    vector<unique_ptr<BaseAST>> *v = ($1);
-    v->push_back(unique_ptr<BaseAST>($3));
-    $$ = v;
+    ast_arena.push_list($3);
+    $$ = $1;
   }
   ;
 
 
 %%
 
-// 定义错误处理函数, 其中第二个参数是错误信息
+// 定义错误处理函数, 其中最后一个参数是错误信息
 // parser 如果发生错误 (例如输入的程序出现了语法错误), 就会调用这个函数
-void yyerror(unique_ptr<BaseAST> &ast, const char *s) {
-    extern int yylineno;    
-    extern char *yytext; 
-    int len=strlen(yytext);
-    int i;
-    char buf[512]={0};
-    for (i=0;i<len;++i)
-    {
-        sprintf(buf,"%s%d ",buf,yytext[i]);
-    }
-    fprintf(stderr, "ERROR: %s at symbol '%s' on line %d\n", s, buf, yylineno);
+// 错误信息追加到 error 中，由调用者决定如何报告
+void yyerror(Lexer &lexer, Ref<BaseAST> &ast, string &error, const char *s) {
+    string text(lexer.text(), lexer.text_len());
+    error += "ERROR: " + string(s) + " at symbol '" + text + "' on line " + to_string(lexer.line()) + "\n";
 }
\ No newline at end of file
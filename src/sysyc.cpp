@@ -0,0 +1,22 @@
+#include "sysyc.h"
+#include <sstream>
+#include "frontend.h"
+
+bool sysyc_compile(string_view source, const SysycOptions &options, ostream &os, string &error)
+{
+    CompileContext ctx(options);
+    if (options.input == Language::Koopa)
+    {
+        return ctx.compile_koopa(source, os, error);
+    }
+    return ctx.compile(source, os, error);
+}
+
+SysycResult sysyc_compile(string_view source, const SysycOptions &options)
+{
+    SysycResult result;
+    ostringstream out;
+    result.ok = sysyc_compile(source, options, out, result.error);
+    result.output = out.str();
+    return result;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+/**
+ * libsysyc：SysY 编译器库
+ * 每次编译有自己的上下文，所有状态都属于某一次编译，同一进程中可以在不同线程上同时编译任意多次
+ * compiler 可执行文件只是它的一层包装
+ */
+
+// 输出的目标代码
+enum class Target
+{
+    Koopa,
+    RiscV
+};
+
+// 输入的源代码
+enum class Language
+{
+    SysY,
+    // 文本形式的 Koopa IR，只经过后端
+    Koopa
+};
+
+// 编译选项
+struct SysycOptions
+{
+    Language input = Language::SysY;
+    Target target = Target::RiscV;
+    // 编译函数的线程数，0 表示使用全部 CPU
+    int jobs = 1;
+    // 函数生成后先转换成 SSA IR（见 ir.h）再转换回来，不做任何变换，用于检查转换是否无损
+    bool use_ir = false;
+    // 优化级别 0 ~ 2，选择经过 SSA IR 的变换流水线（见 pass.h），0 表示不做变换
+    int opt_level = 0;
+    // 显式给出的变换列表（逗号分隔），设置时代替 opt_level 对应的流水线，为空时只做 use_ir 的转换
+    optional<string> passes;
+    // 在这些变换（逗号分隔，all 表示所有变换）之后把函数的 Koopa IR 输出到 stats
+    string print_after;
+    // 只解析和生成从 main 经过调用可达的函数，其余函数只按花括号扫描一遍，其中的语义错误不会报告
+    bool lazy = false;
+    // 统计信息（例如 Koopa IR 的解析速度、每个变换的耗时和修改次数）的输出位置，为空时不输出
+    ostream *stats = nullptr;
+};
+
+// 编译结果
+struct SysycResult
+{
+    bool ok;
+    // Koopa IR 或 RISC-V 汇编，出错时可能不完整
+    string output;
+    // 错误信息，每条一行
+    string error;
+};
+
+/**
+ * @brief Compile a SysY program (or Koopa IR text) into Koopa IR text or RISC-V assembly
+ * @param source The whole source file, it is not copied and must stay valid during the call
+ */
+SysycResult sysyc_compile(string_view source, const SysycOptions &options);
+
+/**
+ * @brief Compile a SysY program (or Koopa IR text), the output is written into os while compiling
+ * @param error Receives the error messages
+ * @return false if the program has syntax errors
+ */
+bool sysyc_compile(string_view source, const SysycOptions &options, ostream &os, string &error);
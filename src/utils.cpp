@@ -1,29 +1,105 @@
 
 #include "utils.h"
 
+int Interner::intern(const char *str, size_t len)
+{
+    auto it = ids.find(string_view(str, len));
+    if (it != ids.end())
+    {
+        return it->second;
+    }
+    int id = names.size();
+    names.emplace_back(str, len);
+    ids.emplace(string_view(names.back()), id);
+    return id;
+}
+
 void SymbolList::newMap()
 {
-    symbol_list_array.push_back(unordered_map<string, Value>());
+    scope_start.push_back(entries.size());
+    const_start.push_back(const_arrays.size());
 }
 
 void SymbolList::deleteMap()
 {
-    symbol_list_array.pop_back();
+    const_arrays.resize(const_start.back());
+    const_start.pop_back();
+    int start = scope_start.back();
+    scope_start.pop_back();
+    while ((int)entries.size() > start)
+    {
+        const Entry &e = entries.back();
+        head[e.name] = e.prev;
+        entries.pop_back();
+    }
 }
 
-void SymbolList::addSymbol(string name, Value value)
+void SymbolList::addSymbol(int name, Value value)
 {
-    symbol_list_array.back()[name] = value;
+    if (name >= (int)head.size())
+    {
+        head.resize(name + 1, -1);
+    }
+    int cur = head[name];
+    // 同一作用域内重复定义，直接覆盖
+    if (cur >= scope_start.back())
+    {
+        entries[cur].value = value;
+        return;
+    }
+    head[name] = entries.size();
+    entries.push_back(Entry{value, name, cur});
 }
 
-Value SymbolList::getSymbol(string name)
+Value SymbolList::getSymbol(int name)
 {
-    for (auto i = symbol_list_array.rbegin(); i != symbol_list_array.rend(); i++)
+    if (name < (int)head.size() && head[name] >= 0 && (head[name] < hidden_begin || head[name] >= hidden_end))
     {
-        if (i->find(name) != i->end())
-        {
-            return i->at(name);
-        }
+        return entries[head[name]].value;
     }
     return Value();
 }
+
+void SymbolList::hideSymbols(int begin, int end)
+{
+    hidden_begin = begin;
+    hidden_end = end;
+}
+
+int SymbolList::addConstArray(const vector<int> &len, const vector<pair<int, int>> &elems)
+{
+    int init = const_arrays.size();
+    int tot_len = 1;
+    const_arrays.push_back(len.size());
+    for (int l : len)
+    {
+        const_arrays.push_back(l);
+        tot_len *= l;
+    }
+    int start = const_arrays.size();
+    const_arrays.resize(start + tot_len, 0);
+    for (auto &elem : elems)
+    {
+        const_arrays[start + elem.first] = elem.second;
+    }
+    return init;
+}
+
+bool SymbolList::getConstElem(int init, const vector<int> &index, int &value) const
+{
+    int n = const_arrays[init];
+    const int *len = &const_arrays[init + 1];
+    if ((int)index.size() != n)
+    {
+        return false;
+    }
+    int pos = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (index[i] < 0 || index[i] >= len[i])
+            return false;
+        pos = pos * len[i] + index[i];
+    }
+    value = const_arrays[init + 1 + n + pos];
+    return true;
+}
@@ -5,6 +5,8 @@
 #include <vector>
 #include <string>
 #include <unordered_set>
+#include <deque>
+#include <string_view>
 
 using namespace std;
 
@@ -30,23 +32,52 @@ struct Value
     int val;
     // @name_index: 符号的命名序号，这里用的是符号所在的基本块号
     int name_index;
+    // @init: 常量数组折叠后的初始值的位置（见 SymbolList::addConstArray），其他符号为 -1
+    int init = -1;
     Value() = default;
-    Value(TYPE type_, int val_, int name_index_) : type(type_), val(val_), name_index(name_index_) {}
+    Value(TYPE type_, int val_, int name_index_, int init_ = -1) : type(type_), val(val_), name_index(name_index_), init(init_) {}
+};
+
+/**
+ * 标识符驻留表
+ * 每个不同的标识符只保存一份，用从0开始的连续整数编号表示
+ * 之后的各个阶段都只传递和比较编号
+ * 多个线程同时调用 intern 时只允许查询已有的标识符，并行前端在切分源文件时已经驻留了全部标识符
+ */
+class Interner
+{
+public:
+    Interner() = default;
+
+    /**
+     * @brief Get the id of an identifier, assign a new one if it is seen for the first time
+     * @param str The identifier, need not be null-terminated
+     * @param len Length of the identifier
+     */
+    int intern(const char *str, size_t len);
+    int intern(const string &str) { return intern(str.data(), str.size()); }
+
+    /**
+     * @brief The identifier with given id
+     */
+    const string &name(int id) const { return names[id]; }
+
+private:
+    // deque 保证已有的字符串不会移动，ids 的键直接指向它们
+    deque<string> names;
+    unordered_map<string_view, int> ids;
 };
 
 /**
  * 符号表
  * 需要实现功能：
- * 1.支持嵌套 --STL容器
- * 2.跨作用域查询 --随机访问
- * 综合考虑使用vector实现
+ * 1.支持嵌套 --每个名字一条遮蔽链，内层定义指向被它遮蔽的外层定义
+ * 2.跨作用域查询 --按标识符编号直接索引链头，与嵌套深度无关
+ * 所有作用域共用一张表，进入/离开作用域只记录和回退 entries 的长度，不分配内存
  */
 class SymbolList
 {
 public:
-    // @symbol_list_array: 符号表构成的vector 前后符号表有着嵌套关系
-    vector<unordered_map<string, Value>> symbol_list_array;
-
     SymbolList() = default;
 
     /**
@@ -61,24 +92,73 @@ public:
 
     /**
      * @brief Add a symbol to the current symbol list
-     * @param name The original name of the symbol
+     * @param name The interned id of the symbol
      * @param value Related information of the symbol
      */
-    void addSymbol(string name, Value value);
+    void addSymbol(int name, Value value);
 
     /**
      * @brief Finds the corresponding symbol by name
-     * @param name The original name of the symbol
+     * @param name The interned id of the symbol
      * @return The value of the symbol
      */
-    Value getSymbol(string name);
+    Value getSymbol(int name);
+
+    /**
+     * @brief Number of symbols defined so far in all open scopes, i.e. the position of the next symbol
+     */
+    int size() const { return entries.size(); }
+
+    /**
+     * @brief Hide the symbols at positions [begin, end), e.g. globals defined after the function being compiled
+     * 隐藏的符号由 getSymbol 当作未定义，再次调用时替换原来的范围
+     */
+    void hideSymbols(int begin, int end);
+
+    /**
+     * @brief Keep the folded initializer of a const array until the current scope is deleted
+     * @param len The length of each dimension
+     * @param elems The non-zero elements: flattened index and value
+     * @return Position of the initializer, saved in Value::init
+     */
+    int addConstArray(const vector<int> &len, const vector<pair<int, int>> &elems);
+
+    /**
+     * @brief Read an element of a const array
+     * @param init Position returned by addConstArray
+     * @param index The index of each dimension
+     * @return false if an index is out of range
+     */
+    bool getConstElem(int init, const vector<int> &index, int &value) const;
+
+private:
+    struct Entry
+    {
+        Value value;
+        int name;
+        // @prev: 被遮蔽的同名符号在 entries 中的位置，-1 表示没有
+        int prev;
+    };
+    // @entries: 所有可见的符号，按定义顺序排列，兼作离开作用域时的撤销日志
+    vector<Entry> entries;
+    // @head: 每个标识符最内层定义在 entries 中的位置，-1 表示未定义
+    vector<int> head;
+    // @scope_start: 每个作用域的第一个符号在 entries 中的位置
+    vector<int> scope_start;
+    // @hidden_begin, @hidden_end: 隐藏的符号在 entries 中的范围
+    int hidden_begin = 0;
+    int hidden_end = 0;
+    // @const_arrays: 常量数组的初始值，每个依次存放维数、各维长度和展开成一维的全部元素
+    // @const_start: 每个作用域的第一个常量数组在 const_arrays 中的位置
+    vector<int> const_arrays;
+    vector<int> const_start;
 };
 
 struct Block_Unit
 {
     // @index: 块编号，从0开始计数
     int index;
-    // @parent_index: 母块编号，体现块之间的嵌套关系
+    // @parent_index: 母块在 block_list 中的位置，体现块之间的嵌套关系
     int parent_index;
     // @end: 记录块是否终止
     bool end;
@@ -132,7 +212,8 @@ public:
     void addBlock()
     {
         block_cnt++;
-        Block_Unit new_block = Block_Unit(block_cnt, block_now.index);
+        Block_Unit new_block = Block_Unit(block_cnt, pos_now);
+        pos_now = block_list.size();
         block_list.push_back(new_block);
         block_now = new_block;
     }
@@ -140,7 +221,24 @@ public:
     void leaveBlock()
     {
         bool end_info = block_now.end;
-        block_now = block_list[block_now.parent_index];
+        pos_now = block_now.parent_index;
+        block_now = block_list[pos_now];
         block_now.end = end_info;
     }
+
+    /**
+     * @brief Return to the global block, new blocks are numbered from base + 1
+     * 并行前端中每个顶层定义的块编号从切分时预留的位置开始，与其他定义互不重叠
+     */
+    void reset(int base)
+    {
+        block_cnt = base;
+        block_list.assign(1, Block_Unit());
+        block_now = block_list[0];
+        pos_now = 0;
+    }
+
+private:
+    // @pos_now: 当前块在 block_list 中的位置
+    int pos_now = 0;
 };
\ No newline at end of file
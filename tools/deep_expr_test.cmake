@@ -0,0 +1,33 @@
+# 压力测试：生成很深的语法树，递归地生成 IR 或者折叠常量会栈溢出
+# expr：1M 项的表达式，常量 c 折叠成 1000000，x+x+...+x 逐项相加
+# if / block：嵌套 100000 层的 if 和语句块
+# cond：if / while 的条件中 && 和 || 交替嵌套 200000 层，由 lower_cond 生成跳转
+# 每个程序在 -O2 之后 main 都应当只剩下 ret 0
+# cmake -DCOMPILER=... -DGEN_SYSY=... -DWORK_DIR=... -P deep_expr_test.cmake
+file(MAKE_DIRECTORY ${WORK_DIR})
+
+function(deep_case mode n)
+  set(input ${WORK_DIR}/deep_${mode}.sy)
+  set(output ${WORK_DIR}/deep_${mode}.koopa)
+
+  execute_process(COMMAND ${GEN_SYSY} ${mode} ${n} ${input} RESULT_VARIABLE rc)
+  if(NOT rc EQUAL 0)
+    message(FATAL_ERROR "gen_sysy ${mode} failed: ${rc}")
+  endif()
+
+  execute_process(COMMAND ${COMPILER} -koopa ${input} -o ${output} -O2
+                  RESULT_VARIABLE rc ERROR_VARIABLE err)
+  if(NOT rc EQUAL 0)
+    message(FATAL_ERROR "compiler failed on ${mode}: ${rc}\n${err}")
+  endif()
+
+  file(READ ${output} ir)
+  if(NOT ir MATCHES "fun @main\\(\\): i32 {\n%entry:\n  ret 0\n}")
+    message(FATAL_ERROR "unexpected output for ${mode}:\n${ir}")
+  endif()
+endfunction()
+
+deep_case(expr 1000000)
+deep_case(if 100000)
+deep_case(block 100000)
+deep_case(cond 200000)
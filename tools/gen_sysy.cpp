@@ -0,0 +1,120 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using namespace std;
+
+/**
+ * 生成基准测试和压力测试用的 SysY 程序，输入太大，不放在仓库里
+ * gen_sysy stmts N [输出文件]  main 的函数体中有 N 条语句，声明（每条定义两个变量）、赋值和 if 轮流出现
+ * gen_sysy expr N [输出文件]   N 项的常量表达式 1+1+...+1 和同样长的 x+x+...+x（x 为 1），main 返回两者之差 0
+ * gen_sysy if N [输出文件]     嵌套 N 层的 if，每层把 r 减 1，main 返回 0
+ * gen_sysy block N [输出文件]  嵌套 N 层的语句块，每层定义一个同名的变量并加到 r 上，main 返回 0
+ * gen_sysy cond N [输出文件]   if 和 while 的条件中 && 和 || 交替嵌套 N 层：((x && x) || x) && ...，main 返回 0
+ * 不指定输出文件时输出到标准输出
+ */
+
+// 函数体中的语句：第 i 条与 i % 3 有关
+static void gen_stmts(string &out, long n)
+{
+    out += "int main() {\n  int x = 0;\n";
+    for (long i = 0; i < n; i++)
+    {
+        string id = to_string(i - i % 3);
+        switch (i % 3)
+        {
+        case 0:
+            out += "  int v" + id + " = " + to_string(i % 100) + ", w" + id + " = v" + id + " + 1;\n";
+            break;
+        case 1:
+            out += "  x = x + v" + id + ";\n";
+            break;
+        default:
+            out += "  if (x > 1000) x = x - w" + id + ";\n";
+            break;
+        }
+    }
+    out += "  return x;\n}\n";
+}
+
+// 两个 n 项的表达式，左结合的加法在语法树上形成 n 层深的左链
+static void gen_expr(string &out, long n)
+{
+    out += "int main() {\n  const int c = 1";
+    for (long i = 1; i < n; i++)
+        out += "+1";
+    out += ";\n  int x = 1;\n  return c - (x";
+    for (long i = 1; i < n; i++)
+        out += "+x";
+    out += ");\n}\n";
+}
+
+static void gen_if(string &out, long n)
+{
+    out += "int main() {\n  int x = 1;\n  int r = " + to_string(n) + ";\n";
+    for (long i = 0; i < n; i++)
+        out += "if (x) {\nr = r - 1;\n";
+    out.append(n, '}');
+    out += "\n  return r;\n}\n";
+}
+
+static void gen_block(string &out, long n)
+{
+    out += "int main() {\n  int r = 0;\n";
+    for (long i = 0; i < n; i++)
+        out += "{\nint v = 1;\nr = r + v;\n";
+    out.append(n, '}');
+    out += "\n  return r - " + to_string(n) + ";\n}\n";
+}
+
+// && 和 || 交替、用括号嵌套 n 层的条件，x 为 1 时条件为真
+static void gen_cond_exp(string &out, long n)
+{
+    out.append(n, '(');
+    out += "x";
+    for (long i = 0; i < n; i++)
+        out += i % 2 == 0 ? " && x)" : " || x)";
+}
+
+static void gen_cond(string &out, long n)
+{
+    out += "int main() {\n  int x = 1;\n  int r = 2;\n  if (";
+    gen_cond_exp(out, n);
+    out += ") r = r - 1;\n  while (";
+    gen_cond_exp(out, n);
+    out += ") {\n    r = r - 1;\n    break;\n  }\n  return r;\n}\n";
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc < 3 || atol(argv[2]) <= 0 || (strcmp(argv[1], "stmts") && strcmp(argv[1], "expr") && strcmp(argv[1], "if") &&
+                                             strcmp(argv[1], "block") && strcmp(argv[1], "cond")))
+    {
+        fprintf(stderr, "usage: %s stmts|expr|if|block|cond N [output]\n", argv[0]);
+        return 1;
+    }
+    long n = atol(argv[2]);
+    string out;
+    if (!strcmp(argv[1], "stmts"))
+        gen_stmts(out, n);
+    else if (!strcmp(argv[1], "expr"))
+        gen_expr(out, n);
+    else if (!strcmp(argv[1], "if"))
+        gen_if(out, n);
+    else if (!strcmp(argv[1], "block"))
+        gen_block(out, n);
+    else
+        gen_cond(out, n);
+
+    FILE *file = argc > 3 ? fopen(argv[3], "w") : stdout;
+    if (file == nullptr)
+    {
+        perror(argv[3]);
+        return 1;
+    }
+    bool ok = fwrite(out.data(), 1, out.size(), file) == out.size();
+    if (file != stdout)
+        ok = fclose(file) == 0 && ok;
+    return ok ? 0 : 1;
+}